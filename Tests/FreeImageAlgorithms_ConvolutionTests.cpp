@@ -13,7 +13,10 @@
 #include "FreeImageAlgorithms_Statistics.h"
 #include "FreeImageAlgorithms_Convolution.h"
 
+#include <math.h>
+#include <vector>
 #include <iostream>
+#include <algorithm>
 
 static const double kernel[] = {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,
 			 			  1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0,
@@ -1874,6 +1877,891 @@ TestFIA_BinningTest(CuTest* tc)
 	FreeImage_Unload(dib1);
 }
 
+static void
+TestFIA_ConvolveToTypeTest(CuTest* tc)
+{
+    static const double kernel_values[] = {1.0, 2.0, 1.0,
+                                           2.0, 4.0, 2.0,
+                                           1.0, 2.0, 1.0};
+
+    FIBITMAP *src = FreeImage_AllocateT(FIT_UINT16, 64, 48, 16, 0, 0, 0);
+
+	CuAssertTrue(tc, src != NULL);
+
+    for(int y = 0; y < 48; y++) {
+
+        unsigned short *bits = (unsigned short *) FreeImage_GetScanLine(src, y);
+
+        for(int x = 0; x < 64; x++)
+            bits[x] = (unsigned short) ((x * 977 + y * 131) % 4096);
+    }
+
+    FIABITMAP *border = FIA_SetZeroBorder(src, 1, 1);
+    FilterKernel convolve_kernel = FIA_NewKernel(1, 1, kernel_values, 16.0);
+
+    PROFILE_START("FIA_ConvolveToType");
+
+    FIBITMAP *reference = FIA_ConvolveToType(border, convolve_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_DOUBLE);
+    FIBITMAP *native = FIA_ConvolveToType(border, convolve_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_INT32);
+    FIBITMAP *native16 = FIA_ConvolveToType(border, convolve_kernel, FIT_UINT16, FIA_ACCUMULATOR_AUTO);
+
+    PROFILE_STOP("FIA_ConvolveToType");
+
+	CuAssertTrue(tc, reference != NULL);
+	CuAssertTrue(tc, native != NULL);
+	CuAssertTrue(tc, native16 != NULL);
+    CuAssertTrue(tc, FreeImage_GetImageType(native16) == FIT_UINT16);
+
+    for(int y = 0; y < 48; y++) {
+
+        double *ref_bits = (double *) FreeImage_GetScanLine(reference, y);
+        double *native_bits = (double *) FreeImage_GetScanLine(native, y);
+        unsigned short *native16_bits = (unsigned short *) FreeImage_GetScanLine(native16, y);
+
+        for(int x = 0; x < 64; x++) {
+            CuAssertDblEquals(tc, ref_bits[x], native_bits[x], 0.0);
+            CuAssertDblEquals(tc, floor(ref_bits[x] + 0.5), native16_bits[x], 0.0);
+        }
+    }
+
+    // A fractional kernel can not be summed in an int.
+    static const double fractional_values[] = {0.5, 0.5, 0.5,
+                                               0.5, 0.5, 0.5,
+                                               0.5, 0.5, 0.5};
+
+    FilterKernel fractional_kernel = FIA_NewKernel(1, 1, fractional_values, 1.0);
+
+    CuAssertTrue(tc, FIA_ConvolveToType(border, fractional_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_INT32) == NULL);
+
+    FreeImage_Unload(src);
+    FIA_Unload(border);
+    FreeImage_Unload(reference);
+    FreeImage_Unload(native);
+    FreeImage_Unload(native16);
+}
+
+static void
+TestFIA_ConvolveThreadedTest(CuTest* tc)
+{
+    FIBITMAP *src = FreeImage_AllocateT(FIT_FLOAT, 301, 203, 32, 0, 0, 0);
+
+	CuAssertTrue(tc, src != NULL);
+
+    for(int y = 0; y < 203; y++) {
+
+        float *bits = (float *) FreeImage_GetScanLine(src, y);
+
+        for(int x = 0; x < 301; x++)
+            bits[x] = (float) sin(x * 0.1) * cos(y * 0.07) * 100.0f;
+    }
+
+    FIABITMAP *border = FIA_SetZeroBorder(src, 10, 10);
+    FilterKernel convolve_kernel = FIA_NewKernel(10, 10, kernel, 48.0);
+
+    int number_of_threads = FIA_GetNumberOfThreads();
+
+    FIA_SetNumberOfThreads(1);
+    FIBITMAP *serial = FIA_Convolve(border, convolve_kernel);
+
+    FIA_SetNumberOfThreads(7);
+
+    PROFILE_START("FIA_Convolve Threaded");
+    FIBITMAP *threaded = FIA_Convolve(border, convolve_kernel);
+    PROFILE_STOP("FIA_Convolve Threaded");
+
+    FIA_SetNumberOfThreads(number_of_threads);
+
+	CuAssertTrue(tc, serial != NULL);
+	CuAssertTrue(tc, threaded != NULL);
+
+    for(int y = 0; y < 203; y++) {
+
+        double *serial_bits = (double *) FreeImage_GetScanLine(serial, y);
+        double *threaded_bits = (double *) FreeImage_GetScanLine(threaded, y);
+
+        for(int x = 0; x < 301; x++)
+            CuAssertTrue(tc, serial_bits[x] == threaded_bits[x]);
+    }
+
+    FreeImage_Unload(src);
+    FIA_Unload(border);
+    FreeImage_Unload(serial);
+    FreeImage_Unload(threaded);
+}
+
+
+static void
+TestFIA_ConvolveVectorISATest(CuTest* tc)
+{
+    static const double kernel_values[] = {1.0, -2.0, 3.0, -2.0, 1.0,
+                                           2.0, 4.0, 5.0, 4.0, 2.0,
+                                           3.0, 5.0, 9.0, 5.0, 3.0};
+
+    FIBITMAP *short_src = FreeImage_AllocateT(FIT_INT16, 157, 61, 16, 0, 0, 0);
+    FIBITMAP *float_src = FreeImage_AllocateT(FIT_FLOAT, 157, 61, 32, 0, 0, 0);
+
+    for(int y = 0; y < 61; y++) {
+
+        short *short_bits = (short *) FreeImage_GetScanLine(short_src, y);
+        float *float_bits = (float *) FreeImage_GetScanLine(float_src, y);
+
+        for(int x = 0; x < 157; x++) {
+            short_bits[x] = (short) ((x * 1237 + y * 3119) % 20000 - 10000);
+            float_bits[x] = (float) short_bits[x] / 7.0f;
+        }
+    }
+
+    FIABITMAP *short_border = FIA_SetZeroBorder(short_src, 2, 1);
+    FIABITMAP *float_border = FIA_SetZeroBorder(float_src, 2, 1);
+    FilterKernel convolve_kernel = FIA_NewKernel(2, 1, kernel_values, 1.0);
+
+    FIA_ISA_LEVEL active = FIA_GetISALevel();
+    FIA_ISA_LEVEL supported = FIA_GetSupportedISALevel();
+
+    FIA_SetISALevel(FIA_ISA_SCALAR);
+    CuAssertTrue(tc, FIA_GetISALevel() == FIA_ISA_SCALAR);
+
+    FIBITMAP *short_scalar = FIA_ConvolveToType(short_border, convolve_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_INT32);
+    FIBITMAP *float_scalar = FIA_ConvolveToType(float_border, convolve_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_FLOAT);
+
+    for(int level = FIA_ISA_SSE2; level <= supported; level++) {
+
+        CuAssertTrue(tc, FIA_SetISALevel((FIA_ISA_LEVEL) level) == level);
+
+        FIBITMAP *short_vector = FIA_ConvolveToType(short_border, convolve_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_INT32);
+        FIBITMAP *float_vector = FIA_ConvolveToType(float_border, convolve_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_FLOAT);
+
+        for(int y = 0; y < 61; y++) {
+
+            double *short_scalar_bits = (double *) FreeImage_GetScanLine(short_scalar, y);
+            double *short_vector_bits = (double *) FreeImage_GetScanLine(short_vector, y);
+            double *float_scalar_bits = (double *) FreeImage_GetScanLine(float_scalar, y);
+            double *float_vector_bits = (double *) FreeImage_GetScanLine(float_vector, y);
+
+            for(int x = 0; x < 157; x++) {
+                // Integer sums are exact, float sums may be added in another order.
+                CuAssertDblEquals(tc, short_scalar_bits[x], short_vector_bits[x], 0.0);
+                CuAssertDblEquals(tc, float_scalar_bits[x], float_vector_bits[x],
+                    fabs(float_scalar_bits[x]) * 1e-5 + 1e-2);
+            }
+        }
+
+        FreeImage_Unload(short_vector);
+        FreeImage_Unload(float_vector);
+    }
+
+    FIA_SetISALevel(active);
+
+    FreeImage_Unload(short_src);
+    FreeImage_Unload(float_src);
+    FIA_Unload(short_border);
+    FIA_Unload(float_border);
+    FreeImage_Unload(short_scalar);
+    FreeImage_Unload(float_scalar);
+}
+
+// Sums the kernel over the bordered 8bit image one pixel at a time.
+static double
+DirectConvolvePixel(FIABITMAP *src, const double *values, int x_radius, int y_radius,
+                    double divider, int x, int y)
+{
+    int kernel_width = x_radius * 2 + 1;
+    double sum = 0.0;
+
+    for(int r = 0; r < y_radius * 2 + 1; r++) {
+
+        BYTE *bits = FreeImage_GetScanLine(src->fib, y + src->yborder - y_radius + r);
+
+        for(int c = 0; c < kernel_width; c++)
+            sum += values[r * kernel_width + c] * bits[x + src->xborder - x_radius + c];
+    }
+
+    return sum / divider;
+}
+
+static void
+TestFIA_ConvolveSeparableKernelTest(CuTest* tc)
+{
+    const int radius = 6, size = radius * 2 + 1;
+    double gaussian[size * size], whole[size * size], rank_two[size * size];
+
+    for(int y = 0; y < size; y++) {
+        for(int x = 0; x < size; x++) {
+            double dsq = (x - radius) * (x - radius) + (y - radius) * (y - radius);
+
+            gaussian[y * size + x] = exp(-dsq / 9.0);
+            whole[y * size + x] = (1 + abs(x - radius)) * (2 + abs(y - radius));
+            rank_two[y * size + x] = gaussian[y * size + x] - 0.5 * exp(-dsq / 2.0);
+        }
+    }
+
+    FIBITMAP *src = FreeImage_Allocate(131, 77, 8, 0, 0, 0);
+
+	CuAssertTrue(tc, src != NULL);
+
+    for(int y = 0; y < 77; y++) {
+
+        BYTE *bits = FreeImage_GetScanLine(src, y);
+
+        for(int x = 0; x < 131; x++)
+            bits[x] = (BYTE) ((x * 37 + y * y * 11) % 256);
+    }
+
+    // A copied border gives different rows above and below the image,
+    // so a separable pass that lost them would show up at the edges.
+    FIABITMAP *border = FIA_SetBorder(src, radius, radius, BorderType_Copy, 0.0);
+
+    PROFILE_START("FIA_Convolve Separable");
+    FIBITMAP *separable = FIA_Convolve(border, FIA_NewKernel(radius, radius, gaussian, 10.0));
+    PROFILE_STOP("FIA_Convolve Separable");
+
+    FIBITMAP *exact = FIA_ConvolveToType(border, FIA_NewKernel(radius, radius, whole, 1.0),
+                                         FIT_INT32, FIA_ACCUMULATOR_INT32);
+
+    FIBITMAP *approximated = FIA_ConvolveSeparableApproximation(border,
+                                FIA_NewKernel(radius, radius, rank_two, 1.0), 2, 1e-9);
+
+	CuAssertTrue(tc, separable != NULL);
+	CuAssertTrue(tc, exact != NULL);
+	CuAssertTrue(tc, approximated != NULL);
+
+    for(int y = 0; y < 77; y++) {
+
+        double *separable_bits = (double *) FreeImage_GetScanLine(separable, y);
+        int *exact_bits = (int *) FreeImage_GetScanLine(exact, y);
+        double *approximated_bits = (double *) FreeImage_GetScanLine(approximated, y);
+
+        for(int x = 0; x < 131; x++) {
+            CuAssertDblEquals(tc, DirectConvolvePixel(border, gaussian, radius, radius, 10.0, x, y),
+                              separable_bits[x], 1e-9);
+            CuAssertDblEquals(tc, DirectConvolvePixel(border, whole, radius, radius, 1.0, x, y),
+                              exact_bits[x], 0.0);
+            CuAssertDblEquals(tc, DirectConvolvePixel(border, rank_two, radius, radius, 1.0, x, y),
+                              approximated_bits[x], 1e-6);
+        }
+    }
+
+    FreeImage_Unload(src);
+    FIA_Unload(border);
+    FreeImage_Unload(separable);
+    FreeImage_Unload(exact);
+    FreeImage_Unload(approximated);
+}
+
+static void
+TestFIA_ConvolveMethodTest(CuTest* tc)
+{
+    const int radius = 12, size = radius * 2 + 1;
+    double circle[size * size];
+
+    for(int y = 0; y < size; y++)
+        for(int x = 0; x < size; x++)
+            circle[y * size + x] = ((x - radius) * (x - radius) + (y - radius) * (y - radius)
+                                    <= radius * radius) ? 1.0 + (x + y) % 3 : 0.0;
+
+    FIBITMAP *src = FreeImage_Allocate(211, 157, 8, 0, 0, 0);
+
+	CuAssertTrue(tc, src != NULL);
+
+    for(int y = 0; y < 157; y++) {
+
+        BYTE *bits = FreeImage_GetScanLine(src, y);
+
+        for(int x = 0; x < 211; x++)
+            bits[x] = (BYTE) ((x * 37 + y * y * 11) % 256);
+    }
+
+    FIBITMAP *float_src = FreeImage_ConvertToType(src, FIT_FLOAT, 1);
+    FIABITMAP *border = FIA_SetBorder(src, radius, radius, BorderType_Copy, 0.0);
+    FIABITMAP *float_border = FIA_SetBorder(float_src, radius, radius, BorderType_Copy, 0.0);
+    FilterKernel convolve_kernel = FIA_NewKernel(radius, radius, circle, 3.0);
+
+    FIA_CONVOLUTION_METHOD method = FIA_GetConvolutionMethod();
+
+    FIA_SetConvolutionMethod(FIA_CONVOLUTION_DIRECT);
+    FIBITMAP *direct = FIA_ConvolveToType(border, convolve_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_AUTO);
+    FIBITMAP *float_direct = FIA_ConvolveToType(float_border, convolve_kernel, FIT_FLOAT, FIA_ACCUMULATOR_AUTO);
+    FIBITMAP *legacy_direct = FIA_Convolve(float_border, convolve_kernel);
+
+    // Not separable, so the same as direct.
+    FIA_SetConvolutionMethod(FIA_CONVOLUTION_SEPARABLE);
+    FIBITMAP *separable = FIA_ConvolveToType(border, convolve_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_AUTO);
+
+    // Whole number sums are rounded so are exact.
+    FIA_SetConvolutionMethod(FIA_CONVOLUTION_FFT);
+    PROFILE_START("FIA_Convolve FFT");
+    FIBITMAP *fft = FIA_ConvolveToType(border, convolve_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_AUTO);
+    PROFILE_STOP("FIA_Convolve FFT");
+
+    FIA_SetConvolutionMethod(FIA_CONVOLUTION_AUTO);
+    FIBITMAP *float_auto = FIA_ConvolveToType(float_border, convolve_kernel, FIT_FLOAT, FIA_ACCUMULATOR_AUTO);
+
+    // FIA_Convolve sums in double so it never uses the single precision FFT.
+    FIBITMAP *legacy_auto = FIA_Convolve(float_border, convolve_kernel);
+
+    FIA_SetConvolutionMethod(method);
+
+	CuAssertTrue(tc, direct != NULL);
+	CuAssertTrue(tc, float_direct != NULL);
+	CuAssertTrue(tc, separable != NULL);
+	CuAssertTrue(tc, fft != NULL);
+	CuAssertTrue(tc, float_auto != NULL);
+	CuAssertTrue(tc, legacy_direct != NULL);
+	CuAssertTrue(tc, legacy_auto != NULL);
+
+    for(int y = 0; y < 157; y++) {
+
+        double *direct_bits = (double *) FreeImage_GetScanLine(direct, y);
+        double *separable_bits = (double *) FreeImage_GetScanLine(separable, y);
+        double *fft_bits = (double *) FreeImage_GetScanLine(fft, y);
+        float *float_direct_bits = (float *) FreeImage_GetScanLine(float_direct, y);
+        float *float_auto_bits = (float *) FreeImage_GetScanLine(float_auto, y);
+        double *legacy_direct_bits = (double *) FreeImage_GetScanLine(legacy_direct, y);
+        double *legacy_auto_bits = (double *) FreeImage_GetScanLine(legacy_auto, y);
+
+        for(int x = 0; x < 211; x++) {
+            CuAssertDblEquals(tc, direct_bits[x], separable_bits[x], 0.0);
+            CuAssertDblEquals(tc, direct_bits[x], fft_bits[x], 0.0);
+            CuAssertDblEquals(tc, float_direct_bits[x], float_auto_bits[x],
+                              fabs(float_direct_bits[x]) * 1e-5 + 1e-3);
+            CuAssertDblEquals(tc, legacy_direct_bits[x], legacy_auto_bits[x], 0.0);
+        }
+    }
+
+    FreeImage_Unload(src);
+    FreeImage_Unload(float_src);
+    FIA_Unload(border);
+    FIA_Unload(float_border);
+    FreeImage_Unload(direct);
+    FreeImage_Unload(float_direct);
+    FreeImage_Unload(separable);
+    FreeImage_Unload(fft);
+    FreeImage_Unload(float_auto);
+    FreeImage_Unload(legacy_direct);
+    FreeImage_Unload(legacy_auto);
+}
+
+static void
+TestFIA_BoxFilterTest(CuTest* tc)
+{
+    const int radius = 9, size = radius * 2 + 1;
+    double ones[size * size], gaussian[size * size];
+
+    for(int y = 0; y < size; y++) {
+        for(int x = 0; x < size; x++) {
+            double dsq = (x - radius) * (x - radius) + (y - radius) * (y - radius);
+
+            ones[y * size + x] = 1.0;
+            gaussian[y * size + x] = exp(-dsq / pow(radius / 2.0, 2));
+        }
+    }
+
+    FIBITMAP *src = FreeImage_Allocate(173, 131, 8, 0, 0, 0);
+
+	CuAssertTrue(tc, src != NULL);
+
+    for(int y = 0; y < 131; y++) {
+
+        BYTE *bits = FreeImage_GetScanLine(src, y);
+
+        for(int x = 0; x < 173; x++)
+            bits[x] = (BYTE) ((x * 37 + y * y * 11) % 256);
+    }
+
+    FIBITMAP *float_src = FreeImage_ConvertToType(src, FIT_FLOAT, 1);
+    FIABITMAP *border = FIA_SetBorder(src, radius, radius, BorderType_Copy, 0.0);
+    FIABITMAP *float_border = FIA_SetBorder(float_src, radius, radius, BorderType_Copy, 0.0);
+
+    FIBITMAP *sum = FIA_BoxSum(border, radius, radius);
+    FIBITMAP *float_mean = FIA_BoxFilter(float_border, radius, radius);
+    FIBITMAP *binned = FIA_Binning(src, FIA_BINNING_SQUARE, radius);
+    FIBITMAP *recursive = FIA_Binning(src, FIA_BINNING_GAUSSIAN_RECURSIVE, radius);
+
+	CuAssertTrue(tc, sum != NULL);
+	CuAssertTrue(tc, float_mean != NULL);
+	CuAssertTrue(tc, binned != NULL);
+	CuAssertTrue(tc, recursive != NULL);
+    CuAssertTrue(tc, FreeImage_GetWidth(sum) == 173 && FreeImage_GetHeight(sum) == 131);
+
+    double worst_gaussian_error = 0.0, mean_gaussian_error = 0.0;
+
+    for(int y = 0; y < 131; y++) {
+
+        double *sum_bits = (double *) FreeImage_GetScanLine(sum, y);
+        double *mean_bits = (double *) FreeImage_GetScanLine(float_mean, y);
+        double *binned_bits = (double *) FreeImage_GetScanLine(binned, y);
+        double *recursive_bits = (double *) FreeImage_GetScanLine(recursive, y);
+
+        for(int x = 0; x < 173; x++) {
+            double expected = DirectConvolvePixel(border, ones, radius, radius, 1.0, x, y);
+            double gaussian_sum = DirectConvolvePixel(border, gaussian, radius, radius, 1.0, x, y);
+
+            CuAssertDblEquals(tc, expected, sum_bits[x], 0.0);
+            CuAssertDblEquals(tc, expected, binned_bits[x], 0.0);
+            CuAssertDblEquals(tc, expected / (size * size), mean_bits[x], 1e-9);
+
+            double error = fabs(recursive_bits[x] - gaussian_sum) / gaussian_sum;
+
+            mean_gaussian_error += error;
+
+            if(error > worst_gaussian_error)
+                worst_gaussian_error = error;
+        }
+    }
+
+    // The recursive filter is only an approximation of the gaussian,
+    // the worst pixels are those where this pattern changes fastest.
+    CuAssertTrue(tc, worst_gaussian_error < 0.06);
+    CuAssertTrue(tc, mean_gaussian_error / (131 * 173) < 0.01);
+
+    FreeImage_Unload(src);
+    FreeImage_Unload(float_src);
+    FIA_Unload(border);
+    FIA_Unload(float_border);
+    FreeImage_Unload(sum);
+    FreeImage_Unload(float_mean);
+    FreeImage_Unload(binned);
+    FreeImage_Unload(recursive);
+}
+
+// Median of the window by sorting, to check FIA_MedianFilter against.
+template<typename T> static T
+SortedWindowMedian(FIABITMAP *src, int x_radius, int y_radius, int x, int y)
+{
+    std::vector<T> values;
+
+    for(int r = -y_radius; r <= y_radius; r++) {
+
+        T *bits = (T *) FreeImage_GetScanLine(src->fib, y + src->yborder + r);
+
+        for(int c = -x_radius; c <= x_radius; c++)
+            values.push_back(bits[x + src->xborder + c]);
+    }
+
+    std::sort(values.begin(), values.end());
+
+    return values[values.size() / 2];
+}
+
+template<typename T> static void
+CheckMedianFilter(CuTest* tc, FREE_IMAGE_TYPE type, int bpp, int x_radius, int y_radius,
+                  int levels, int width = 97, int height = 61)
+{
+    FIBITMAP *src = FreeImage_AllocateT(type, width, height, bpp, 0, 0, 0);
+
+	CuAssertTrue(tc, src != NULL);
+
+    for(int y = 0; y < height; y++) {
+
+        T *bits = (T *) FreeImage_GetScanLine(src, y);
+
+        // Smooth with noise on top, so there are runs of equal values too.
+        for(int x = 0; x < width; x++)
+            bits[x] = (T) (((x * x + y * 7) / 5 + (x * 7919 + y * 104729) % 61) % levels - levels / 3)
+                + (T) ((x * 31 + y * 17) % 1000) / (T) 1000;
+    }
+
+    if(type == FIT_BITMAP)
+        FIA_SetGreyLevelPalette(src);
+
+    FIABITMAP *border = FIA_SetBorder(src, x_radius, y_radius, BorderType_Mirror, 0.0);
+    FIBITMAP *dst = FIA_MedianFilter(border, x_radius, y_radius);
+
+	CuAssertTrue(tc, dst != NULL);
+    CuAssertTrue(tc, FreeImage_GetImageType(dst) == type);
+
+    for(int y = 0; y < height; y++) {
+
+        T *bits = (T *) FreeImage_GetScanLine(dst, y);
+
+        for(int x = 0; x < width; x++)
+            CuAssertDblEquals(tc, (double) SortedWindowMedian<T>(border, x_radius, y_radius, x, y),
+                              (double) bits[x], 0.0);
+    }
+
+    FreeImage_Unload(src);
+    FIA_Unload(border);
+    FreeImage_Unload(dst);
+}
+
+static void
+TestFIA_MedianFilterTypesTest(CuTest* tc)
+{
+    CheckMedianFilter<unsigned char>(tc, FIT_BITMAP, 8, 2, 2, 256);
+    CheckMedianFilter<unsigned char>(tc, FIT_BITMAP, 8, 3, 1, 256);
+    CheckMedianFilter<unsigned short>(tc, FIT_UINT16, 16, 7, 7, 4096);
+    CheckMedianFilter<short>(tc, FIT_INT16, 16, 4, 2, 30000);
+    CheckMedianFilter<int>(tc, FIT_INT32, 32, 3, 3, 1000000);
+    CheckMedianFilter<float>(tc, FIT_FLOAT, 32, 3, 5, 5000);
+
+    // Too many distinct values to be filtered as ranks.
+    CheckMedianFilter<float>(tc, FIT_FLOAT, 32, 3, 2, 1000000, 311, 257);
+    CheckMedianFilter<double>(tc, FIT_DOUBLE, 64, 0, 2, 5000);
+}
+
+static void
+TestFIA_MedianFilterNetworkTest(CuTest* tc)
+{
+    FIA_ISA_LEVEL active = FIA_GetISALevel();
+    FIA_ISA_LEVEL supported = FIA_GetSupportedISALevel();
+
+    // 3x3 and 5x5 windows use the sorting networks at every instruction set level.
+    for(int level = FIA_ISA_SCALAR; level <= supported; level++) {
+
+        CuAssertTrue(tc, FIA_SetISALevel((FIA_ISA_LEVEL) level) == level);
+
+        for(int radius = 1; radius <= 2; radius++) {
+            CheckMedianFilter<unsigned char>(tc, FIT_BITMAP, 8, radius, radius, 256);
+            CheckMedianFilter<short>(tc, FIT_INT16, 16, radius, radius, 60000);
+            CheckMedianFilter<unsigned short>(tc, FIT_UINT16, 16, radius, radius, 65536);
+            CheckMedianFilter<float>(tc, FIT_FLOAT, 32, radius, radius, 5000);
+            CheckMedianFilter<int>(tc, FIT_INT32, 32, radius, radius, 1000000);
+            CheckMedianFilter<double>(tc, FIT_DOUBLE, 64, radius, radius, 5000);
+        }
+    }
+
+    FIA_SetISALevel(active);
+}
+
+static void
+TestFIA_CorrelateImagePairsTest(CuTest* tc)
+{
+    // Sparse dots on black, so the correlation peaks sharply at the true shift.
+    FIBITMAP *scene = FreeImage_Allocate(300, 240, 8, 0, 0, 0);
+    unsigned int seed = 7;
+
+    for(int y = 0; y < 240; y++) {
+
+        BYTE *bits = FreeImage_GetScanLine(scene, y);
+
+        for(int x = 0; x < 300; x++) {
+            seed = seed * 1103515245 + 12345;
+            bits[x] = ((seed >> 16) % 50 == 0) ? 255 : 0;
+        }
+    }
+
+    // A 2x2 mosaic of overlapping tiles.
+    FIBITMAP *tiles[4];
+
+    for(int i = 0; i < 4; i++) {
+        int left = (i % 2) * 100, top = (i / 2) * 80;
+        tiles[i] = FIA_Copy(scene, left, top, left + 139, top + 119);
+    }
+
+    FIA_CORRELATION_PAIR pairs[5] = {{0, 1}, {0, 2}, {1, 3}, {2, 3}, {3, 3}};
+    FIA_CORRELATION_RESULT results[5];
+
+    CuAssertIntEquals(tc, FIA_SUCCESS, FIA_FFTCorrelateImagePairs(tiles, 4, pairs, 5, NULL, results));
+
+    // Each pair gives the same shift as correlating it on its own.
+    for(int i = 0; i < 4; i++) {
+
+        FIAPOINT pt;
+
+        CuAssertIntEquals(tc, FIA_SUCCESS,
+            FIA_FFTCorrelateImages(tiles[pairs[i].first], tiles[pairs[i].second], NULL, &pt));
+
+        CuAssertIntEquals(tc, pt.x, results[i].shift.x);
+        CuAssertIntEquals(tc, pt.y, results[i].shift.y);
+        CuAssertIntEquals(tc, (i == 0 || i == 3) ? 100 : 0, abs(pt.x));
+        CuAssertIntEquals(tc, (i == 1 || i == 2) ? 80 : 0, abs(pt.y));
+        CuAssertTrue(tc, results[i].peak > 0.0 && results[i].peak < 1.0);
+        CuAssertTrue(tc, results[i].quality > 10.0);
+    }
+
+    // A tile matches itself exactly.
+    CuAssertIntEquals(tc, 0, results[4].shift.x);
+    CuAssertIntEquals(tc, 0, results[4].shift.y);
+    CuAssertDblEquals(tc, 1.0, results[4].peak, 1e-3);
+
+    FIA_CORRELATION_PAIR bad_pair = {0, 4};
+    CuAssertIntEquals(tc, FIA_ERROR, FIA_FFTCorrelateImagePairs(tiles, 4, &bad_pair, 1, NULL, results));
+
+    for(int i = 0; i < 4; i++)
+        FreeImage_Unload(tiles[i]);
+
+    FreeImage_Unload(scene);
+}
+
+// Gaussian blobs shifted by dx, dy, so the shift can be a fraction of a pixel.
+static FIBITMAP*
+MakeBlobImage(int width, int height, double dx, double dy, int pattern)
+{
+    FIBITMAP *dib = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+
+    for(int y = 0; y < height; y++) {
+
+        BYTE *bits = (BYTE *) FIA_GetScanLineFromTop(dib, y);
+
+        for(int x = 0; x < width; x++) {
+
+            double value = 0.0;
+
+            for(int k = 0; k < 60; k++) {
+                double ex = x - dx - (15 + (k * pattern) % 100);
+                double ey = y - dy - (12 + (k * 53) % 80);
+                value += exp(-(ex * ex + ey * ey) / 4.5);
+            }
+
+            value = 200.0 * value + 0.5;
+            bits[x] = (BYTE) (value > 255.0 ? 255.0 : value);
+        }
+    }
+
+    return dib;
+}
+
+static void
+TestFIA_CorrelateSubpixelTest(CuTest* tc)
+{
+    FIBITMAP *src1 = MakeBlobImage(128, 100, 0.0, 0.0, 37);
+    FIBITMAP *src2 = MakeBlobImage(128, 100, 10.3, -5.6, 37);
+    FIBITMAP *other = MakeBlobImage(128, 100, 0.0, 0.0, 71);
+
+    FIAPOINT pt;
+    FIAPOINTD subpixel;
+    double peak, other_peak;
+
+    CuAssertIntEquals(tc, FIA_SUCCESS, FIA_FFTCorrelateImages(src1, src2, NULL, &pt));
+
+    // Without a fit the peak is where FIA_FFTCorrelateImages finds it.
+    FIA_FFTCorrelateImagesSubpixel(src1, src2, NULL, 0, FIA_PEAK_FIT_NONE, &subpixel, &peak);
+    CuAssertDblEquals(tc, pt.x, subpixel.x, 1e-9);
+    CuAssertDblEquals(tc, pt.y, subpixel.y, 1e-9);
+    CuAssertTrue(tc, peak > 0.9 && peak <= 1.0);
+
+    FIA_FFTCorrelateImagesSubpixel(src1, src2, NULL, 0, FIA_PEAK_FIT_PARABOLIC, &subpixel, &peak);
+    CuAssertDblEquals(tc, -10.3, subpixel.x, 0.05);
+    CuAssertDblEquals(tc, 5.6, subpixel.y, 0.05);
+
+    FIA_FFTCorrelateImagesSubpixel(src1, src2, NULL, 0, FIA_PEAK_FIT_GAUSSIAN, &subpixel, &peak);
+    CuAssertDblEquals(tc, -10.3, subpixel.x, 0.05);
+    CuAssertDblEquals(tc, 5.6, subpixel.y, 0.05);
+
+    // The phase only peak is narrower, so the fits are rougher.
+    FIA_FFTCorrelateImagesSubpixel(src1, src2, NULL, 1, FIA_PEAK_FIT_GAUSSIAN, &subpixel, &peak);
+    CuAssertDblEquals(tc, -10.3, subpixel.x, 0.15);
+    CuAssertDblEquals(tc, 5.6, subpixel.y, 0.15);
+
+    // The phase only peak height tells a match from images that do not match.
+    FIA_FFTCorrelateImagesSubpixel(src1, other, NULL, 1, FIA_PEAK_FIT_NONE, &subpixel, &other_peak);
+    CuAssertTrue(tc, peak > 4.0 * other_peak);
+
+    FIA_FFTCorrelateImagesSubpixel(src1, src1, NULL, 1, FIA_PEAK_FIT_GAUSSIAN, &subpixel, &peak);
+    CuAssertDblEquals(tc, 0.0, subpixel.x, 1e-6);
+    CuAssertDblEquals(tc, 0.0, subpixel.y, 1e-6);
+    CuAssertDblEquals(tc, 1.0, peak, 1e-3);
+
+    FreeImage_Unload(src1);
+    FreeImage_Unload(src2);
+    FreeImage_Unload(other);
+
+    // Without a prefilter to take away the background, the phase only
+    // correlation must not find the edges of the images at no shift.
+    src1 = MakeBlobImage(128, 100, 0.0, 0.0, 37);
+    src2 = MakeBlobImage(128, 100, 3.3, -2.6, 37);
+
+    for(int y = 0; y < 100; y++) {
+
+        BYTE *bits1 = FreeImage_GetScanLine(src1, y);
+        BYTE *bits2 = FreeImage_GetScanLine(src2, y);
+
+        for(int x = 0; x < 128; x++) {
+            bits1[x] = 100 + bits1[x] / 2;
+            bits2[x] = 100 + bits2[x] / 2;
+        }
+    }
+
+    FIA_FFTCorrelateImagesSubpixel(src1, src2, NULL, 1, FIA_PEAK_FIT_GAUSSIAN, &subpixel, &peak);
+    CuAssertDblEquals(tc, -3.3, subpixel.x, 0.25);
+    CuAssertDblEquals(tc, 2.6, subpixel.y, 0.25);
+
+    FreeImage_Unload(src1);
+    FreeImage_Unload(src2);
+}
+
+static void
+TestFIA_KernelCorrelateMultiResolutionTest(CuTest* tc)
+{
+    // Blobs at random places so the template only matches in one place.
+    FIBITMAP *src1 = FreeImage_Allocate(220, 160, 8, 0, 0, 0);
+    double centres[80][2];
+    unsigned int seed = 5;
+
+    for(int k = 0; k < 80; k++) {
+        seed = seed * 1103515245 + 12345;
+        centres[k][0] = (seed >> 8) % 220;
+        seed = seed * 1103515245 + 12345;
+        centres[k][1] = (seed >> 8) % 160;
+    }
+
+    for(int y = 0; y < 160; y++) {
+
+        BYTE *bits = (BYTE *) FIA_GetScanLineFromTop(src1, y);
+
+        for(int x = 0; x < 220; x++) {
+
+            double value = 0.0;
+
+            for(int k = 0; k < 80; k++) {
+                double ex = x - centres[k][0], ey = y - centres[k][1];
+                value += exp(-(ex * ex + ey * ey) / 32.0);
+            }
+
+            value = 150.0 * value + 0.5;
+            bits[x] = (BYTE) (value > 255.0 ? 255.0 : value);
+        }
+    }
+
+    FIBITMAP *src2 = FIA_Copy(src1, 131, 57, 131 + 48, 57 + 40);
+    FIBITMAP *mask = FreeImage_Allocate(220, 160, 8, 0, 0, 0);
+
+    for(int y = 0; y < 160; y++)
+        memset(FreeImage_GetScanLine(mask, y), 255, 220);
+
+    FIAPOINT expected_pt, pt;
+    double expected_max, max;
+
+    PROFILE_START("FIA_KernelCorrelateImages");
+    FIA_KernelCorrelateImages(src1, src2, FIA_EMPTY_RECT, NULL, NULL, &expected_pt, &expected_max);
+    PROFILE_STOP("FIA_KernelCorrelateImages");
+
+    CuAssertIntEquals(tc, 131, expected_pt.x);
+    CuAssertIntEquals(tc, 57, expected_pt.y);
+
+    for(int levels = 1; levels <= 4; levels++) {
+
+        PROFILE_START("FIA_KernelCorrelateImagesMultiResolution");
+        CuAssertIntEquals(tc, FIA_SUCCESS, FIA_KernelCorrelateImagesMultiResolution(src1, src2,
+            FIA_EMPTY_RECT, NULL, NULL, levels, 2, &pt, &max));
+        PROFILE_STOP("FIA_KernelCorrelateImagesMultiResolution");
+
+        CuAssertIntEquals(tc, expected_pt.x, pt.x);
+        CuAssertIntEquals(tc, expected_pt.y, pt.y);
+        CuAssertDblEquals(tc, expected_max, max, 1e-9);
+    }
+
+    // Search areas and masks are halved with the images.
+    FIA_KernelCorrelateImagesMultiResolution(src1, src2, MakeFIARect(120, 60, 200, 100),
+        mask, NULL, 3, 2, &pt, &max);
+
+    CuAssertIntEquals(tc, expected_pt.x, pt.x);
+    CuAssertIntEquals(tc, expected_pt.y, pt.y);
+    CuAssertDblEquals(tc, expected_max, max, 1e-9);
+
+    // Odd heights of image or template shift the rows of the coarser level,
+    // the smallest refine radius must still find the same point.
+    const int positions[4][2] = {{131, 57}, {20, 31}, {90, 100}, {160, 12}};
+
+    for(int image_height = 159; image_height <= 160; image_height++) {
+
+        FIBITMAP *image = FIA_Copy(src1, 0, 160 - image_height, 220, 160);
+
+        for(int i = 0; i < 4; i++) {
+            for(int template_height = 40; template_height <= 43; template_height++) {
+
+                FIBITMAP *image_template = FIA_Copy(image, positions[i][0], positions[i][1],
+                    positions[i][0] + 48, positions[i][1] + template_height);
+
+                FIA_KernelCorrelateImages(image, image_template, FIA_EMPTY_RECT, NULL, NULL,
+                    &expected_pt, &expected_max);
+
+                for(int levels = 2; levels <= 3; levels++) {
+
+                    FIA_KernelCorrelateImagesMultiResolution(image, image_template, FIA_EMPTY_RECT,
+                        NULL, NULL, levels, 1, &pt, &max);
+
+                    CuAssertIntEquals(tc, expected_pt.x, pt.x);
+                    CuAssertIntEquals(tc, expected_pt.y, pt.y);
+                    CuAssertDblEquals(tc, expected_max, max, 1e-9);
+                }
+
+                FreeImage_Unload(image_template);
+            }
+        }
+
+        FreeImage_Unload(image);
+    }
+
+    FreeImage_Unload(src1);
+    FreeImage_Unload(src2);
+    FreeImage_Unload(mask);
+}
+
+static void
+TestFIA_FastNCCCorrelateTest(CuTest* tc)
+{
+    FIBITMAP *src1 = FreeImage_Allocate(220, 160, 8, 0, 0, 0);
+    double centres[80][2];
+    unsigned int seed = 11;
+
+    for(int k = 0; k < 80; k++) {
+        seed = seed * 1103515245 + 12345;
+        centres[k][0] = (seed >> 8) % 220;
+        seed = seed * 1103515245 + 12345;
+        centres[k][1] = (seed >> 8) % 160;
+    }
+
+    for(int y = 0; y < 160; y++) {
+
+        BYTE *bits = (BYTE *) FIA_GetScanLineFromTop(src1, y);
+
+        for(int x = 0; x < 220; x++) {
+
+            double value = 0.0;
+
+            for(int k = 0; k < 80; k++) {
+                double ex = x - centres[k][0], ey = y - centres[k][1];
+                value += exp(-(ex * ex + ey * ey) / 32.0);
+            }
+
+            value = 150.0 * value + 0.5;
+            bits[x] = (BYTE) (value > 255.0 ? 255.0 : value);
+        }
+    }
+
+    // Even and odd sized templates, one overlapping the zero border.
+    FIARECT templates[3] = { MakeFIARect(131, 57, 131 + 48, 57 + 40),
+                             MakeFIARect(20, 30, 20 + 31, 30 + 25),
+                             MakeFIARect(0, 0, 33, 27) };
+
+    FIAPOINT expected_pt, pt;
+    double expected_max, max;
+
+    for(int i = 0; i < 3; i++) {
+
+        FIBITMAP *src2 = FIA_Copy(src1, templates[i].left, templates[i].top,
+            templates[i].right, templates[i].bottom);
+
+        FIA_KernelCorrelateImages(src1, src2, FIA_EMPTY_RECT, NULL, NULL, &expected_pt, &expected_max);
+
+        PROFILE_START("FIA_FastNCCCorrelateImages");
+        CuAssertIntEquals(tc, FIA_SUCCESS, FIA_FastNCCCorrelateImages(src1, src2,
+            FIA_EMPTY_RECT, NULL, NULL, &pt, &max));
+        PROFILE_STOP("FIA_FastNCCCorrelateImages");
+
+        CuAssertIntEquals(tc, expected_pt.x, pt.x);
+        CuAssertIntEquals(tc, expected_pt.y, pt.y);
+        CuAssertDblEquals(tc, expected_max, max, 1e-5);
+
+        // A search area that does not hold the match.
+        FIA_KernelCorrelateImages(src1, src2, MakeFIARect(60, 80, 150, 140), NULL, NULL,
+            &expected_pt, &expected_max);
+        FIA_FastNCCCorrelateImages(src1, src2, MakeFIARect(60, 80, 150, 140), NULL, NULL, &pt, &max);
+
+        CuAssertIntEquals(tc, expected_pt.x, pt.x);
+        CuAssertIntEquals(tc, expected_pt.y, pt.y);
+        CuAssertDblEquals(tc, expected_max, max, 1e-5);
+
+        CuAssertIntEquals(tc, FIA_SUCCESS, FIA_CorrelateImages(src1, src2, CORRELATION_FAST_NCC, NULL, &pt));
+        CuAssertIntEquals(tc, templates[i].left, pt.x);
+        CuAssertIntEquals(tc, templates[i].top, pt.y);
+
+        FreeImage_Unload(src2);
+    }
+
+    FreeImage_Unload(src1);
+}
 
 CuSuite* DLL_CALLCONV
 CuGetFreeImageAlgorithmsConvolutionSuite(void)
@@ -1882,6 +2770,19 @@ CuGetFreeImageAlgorithmsConvolutionSuite(void)
 
 	MkDir(TEST_DATA_OUTPUT_DIR "/Convolution");
 
+	SUITE_ADD_TEST(suite, TestFIA_ConvolveToTypeTest);
+	SUITE_ADD_TEST(suite, TestFIA_ConvolveThreadedTest);
+	SUITE_ADD_TEST(suite, TestFIA_ConvolveVectorISATest);
+	SUITE_ADD_TEST(suite, TestFIA_ConvolveSeparableKernelTest);
+	SUITE_ADD_TEST(suite, TestFIA_ConvolveMethodTest);
+	SUITE_ADD_TEST(suite, TestFIA_BoxFilterTest);
+	SUITE_ADD_TEST(suite, TestFIA_MedianFilterTypesTest);
+	SUITE_ADD_TEST(suite, TestFIA_MedianFilterNetworkTest);
+	SUITE_ADD_TEST(suite, TestFIA_CorrelateImagePairsTest);
+	SUITE_ADD_TEST(suite, TestFIA_CorrelateSubpixelTest);
+	SUITE_ADD_TEST(suite, TestFIA_KernelCorrelateMultiResolutionTest);
+	SUITE_ADD_TEST(suite, TestFIA_FastNCCCorrelateTest);
+
 	//SUITE_ADD_TEST(suite, TestFIA_SobelAdvancedTest);
 	//SUITE_ADD_TEST(suite, TestFIA_BinningTest);
 	//SUITE_ADD_TEST(suite, TestFIA_SobelTest);
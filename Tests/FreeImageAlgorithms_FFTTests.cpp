@@ -13,6 +13,7 @@
 
 #include "profile.h"
 #include "math.h"
+#include <string.h>
 
 #include "kiss_fftnd.h"
 
@@ -72,6 +73,426 @@ Test_FFT(CuTest* tc)
 	FreeImage_Unload(log_dib);
 }
 
+// The transform of a small image against a direct sum, with rows counted from the top.
+static void
+CheckFFTAgainstDFT(CuTest* tc, FIBITMAP *src, FIBITMAP *fft)
+{
+	const double pi = 3.14159265358979323846;
+	int width = FreeImage_GetWidth(src);
+	int height = FreeImage_GetHeight(src);
+
+	// Half spectra only hold the first columns.
+	int fft_width = FreeImage_GetWidth(fft);
+
+	for(int v = 0; v < height; v++) {
+
+		FICOMPLEX *fft_bits = (FICOMPLEX *) FIA_GetScanLineFromTop(fft, v);
+
+		for(int u = 0; u < fft_width; u++) {
+
+			double r = 0.0, i = 0.0;
+
+			for(int y = 0; y < height; y++) {
+
+				float *bits = (float *) FIA_GetScanLineFromTop(src, y);
+
+				for(int x = 0; x < width; x++) {
+					double angle = -2.0 * pi * ((double) u * x / width + (double) v * y / height);
+					r += bits[x] * cos(angle);
+					i += bits[x] * sin(angle);
+				}
+			}
+
+			CuAssertDblEquals(tc, r, fft_bits[u].r, 1e-3);
+			CuAssertDblEquals(tc, i, fft_bits[u].i, 1e-3);
+		}
+	}
+}
+
+static void
+Test_FFTPlan(CuTest* tc)
+{
+	const int width = 12, height = 7;
+
+	FIBITMAP *src = FreeImage_AllocateT(FIT_FLOAT, width, height, 32, 0, 0, 0);
+
+	for(int y = 0; y < height; y++) {
+
+		float *bits = (float *) FreeImage_GetScanLine(src, y);
+
+		for(int x = 0; x < width; x++)
+			bits[x] = (float) ((x * 7 + y * 13) % 11) - 5.0f;
+	}
+
+	FIA_FFT_PLAN *forward = FIA_CreateFFTPlan(width, height, 0);
+	FIA_FFT_PLAN *inverse = FIA_CreateFFTPlan(width, height, 1);
+	CuAssertTrue(tc, forward != NULL && inverse != NULL);
+
+	// A plan can be run many times.
+	for(int run = 0; run < 3; run++) {
+
+		FIBITMAP *fft = FIA_ExecuteFFTPlan(forward, src);
+		CuAssertTrue(tc, fft != NULL);
+		CheckFFTAgainstDFT(tc, src, fft);
+
+		// The inverse is not scaled so gives back the image times the number of pixels.
+		FIBITMAP *ifft = FIA_ExecuteFFTPlan(inverse, fft);
+		CuAssertTrue(tc, ifft != NULL);
+
+		for(int y = 0; y < height; y++) {
+
+			float *bits = (float *) FreeImage_GetScanLine(src, y);
+			FICOMPLEX *ifft_bits = (FICOMPLEX *) FreeImage_GetScanLine(ifft, y);
+
+			for(int x = 0; x < width; x++) {
+				CuAssertDblEquals(tc, bits[x] * width * height, ifft_bits[x].r, 1e-2);
+				CuAssertDblEquals(tc, 0.0, ifft_bits[x].i, 1e-2);
+			}
+		}
+
+		FreeImage_Unload(fft);
+		FreeImage_Unload(ifft);
+	}
+
+	// Plans only take images of their own size.
+	FIBITMAP *other = FreeImage_AllocateT(FIT_FLOAT, width + 1, height, 32, 0, 0, 0);
+	CuAssertTrue(tc, FIA_ExecuteFFTPlan(forward, other) == NULL);
+
+	// The cached transforms give the same results as the plan.
+	FIBITMAP *planned = FIA_ExecuteFFTPlan(forward, src);
+
+	for(int run = 0; run < 3; run++) {
+
+		FIBITMAP *cached = FIA_FFT(src);
+		FIBITMAP *cached_other = FIA_FFT(other);
+		CuAssertTrue(tc, cached != NULL && cached_other != NULL);
+
+		for(int y = 0; y < height; y++)
+			CuAssertTrue(tc, memcmp(FreeImage_GetScanLine(cached, y), FreeImage_GetScanLine(planned, y),
+				sizeof(FICOMPLEX) * width) == 0);
+
+		FreeImage_Unload(cached);
+		FreeImage_Unload(cached_other);
+	}
+
+	FIA_ClearFFTPlanCache();
+
+	FIBITMAP *cached = FIA_FFT(src);
+	CuAssertTrue(tc, cached != NULL);
+	FreeImage_Unload(cached);
+
+	FreeImage_Unload(planned);
+	FreeImage_Unload(other);
+	FreeImage_Unload(src);
+	FIA_DestroyFFTPlan(forward);
+	FIA_DestroyFFTPlan(inverse);
+}
+
+static FIBITMAP*
+MakeRealTestImage(int width, int height, int seed)
+{
+	FIBITMAP *src = FreeImage_AllocateT(FIT_FLOAT, width, height, 32, 0, 0, 0);
+
+	for(int y = 0; y < height; y++) {
+
+		float *bits = (float *) FreeImage_GetScanLine(src, y);
+
+		for(int x = 0; x < width; x++)
+			bits[x] = (float) ((x * 7 + y * 13 + seed) % 11) - 5.0f;
+	}
+
+	return src;
+}
+
+static void
+CheckDoubleImagesEqual(CuTest* tc, FIBITMAP *expected, FIBITMAP *actual, double scale, double delta)
+{
+	CuAssertTrue(tc, actual != NULL);
+	CuAssertIntEquals(tc, FreeImage_GetWidth(expected), FreeImage_GetWidth(actual));
+	CuAssertIntEquals(tc, FreeImage_GetHeight(expected), FreeImage_GetHeight(actual));
+
+	for(int y = 0; y < (int) FreeImage_GetHeight(expected); y++) {
+
+		double *expected_bits = (double *) FreeImage_GetScanLine(expected, y);
+		double *actual_bits = (double *) FreeImage_GetScanLine(actual, y);
+
+		for(int x = 0; x < (int) FreeImage_GetWidth(expected); x++)
+			CuAssertDblEquals(tc, expected_bits[x] * scale, actual_bits[x], delta);
+	}
+}
+
+static void
+Test_RealFFT(CuTest* tc)
+{
+	// Even and odd widths and heights, and single rows and columns.
+	const int sizes[][2] = {{12, 7}, {9, 6}, {5, 1}, {1, 4}};
+
+	for(int i = 0; i < 4; i++) {
+
+		const int width = sizes[i][0], height = sizes[i][1];
+
+		FIBITMAP *src = MakeRealTestImage(width, height, 0);
+		FIBITMAP *src_double = FreeImage_ConvertToType(src, FIT_DOUBLE, 0);
+
+		FIBITMAP *half = FIA_RealFFT(src);
+		CuAssertTrue(tc, half != NULL);
+		CuAssertIntEquals(tc, width / 2 + 1, FreeImage_GetWidth(half));
+		CuAssertIntEquals(tc, height, FreeImage_GetHeight(half));
+		CuAssertIntEquals(tc, width, FIA_GetHalfSpectrumWidth(half));
+		CheckFFTAgainstDFT(tc, src, half);
+
+		// Images made from half spectra are the full width.
+		FIBITMAP *full = FIA_FFT(src);
+		CuAssertIntEquals(tc, 0, FIA_GetHalfSpectrumWidth(full));
+
+		FIBITMAP *expected = FIA_ConvertComplexImageToAbsoluteValued(full);
+		FIBITMAP *actual = FIA_ConvertComplexImageToAbsoluteValued(half);
+		CheckDoubleImagesEqual(tc, expected, actual, 1.0, 1e-3);
+		FreeImage_Unload(expected);
+		FreeImage_Unload(actual);
+
+		expected = FIA_ComplexImageToRealValued(full);
+		actual = FIA_ComplexImageToRealValued(half);
+		CheckDoubleImagesEqual(tc, expected, actual, 1.0, 1e-3);
+		FreeImage_Unload(expected);
+		FreeImage_Unload(actual);
+
+		// The inverse is not scaled, as with FIA_IFFT.
+		actual = FIA_RealIFFT(half);
+		CheckDoubleImagesEqual(tc, src_double, actual, width * height, 1e-2);
+		FreeImage_Unload(actual);
+
+		// A correlation stays in half spectra to the end.
+		FIBITMAP *other = MakeRealTestImage(width, height, 5);
+		FIBITMAP *other_half = FIA_RealFFT(other);
+		FIBITMAP *other_full = FIA_FFT(other);
+
+		CuAssertIntEquals(tc, FIA_SUCCESS, FIA_ComplexConjugate(other_half));
+		CuAssertIntEquals(tc, width, FIA_GetHalfSpectrumWidth(other_half));
+		CuAssertIntEquals(tc, FIA_SUCCESS, FIA_MultiplyComplexImages(half, other_half));
+		CuAssertIntEquals(tc, width, FIA_GetHalfSpectrumWidth(half));
+
+		FIA_ComplexConjugate(other_full);
+		FIA_MultiplyComplexImages(full, other_full);
+
+		FIBITMAP *ifft = FIA_IFFT(full);
+		expected = FIA_ComplexImageToRealValued(ifft);
+		actual = FIA_RealIFFT(half);
+		CheckDoubleImagesEqual(tc, expected, actual, 1.0, 1e-1);
+		FreeImage_Unload(expected);
+		FreeImage_Unload(actual);
+		FreeImage_Unload(ifft);
+
+		// Half and full spectra can not be mixed.
+		CuAssertIntEquals(tc, FIA_ERROR, FIA_MultiplyComplexImages(full, half));
+		CuAssertTrue(tc, FIA_RealIFFT(full) == NULL);
+
+		FreeImage_Unload(other);
+		FreeImage_Unload(other_half);
+		FreeImage_Unload(other_full);
+		FreeImage_Unload(full);
+		FreeImage_Unload(half);
+		FreeImage_Unload(src_double);
+		FreeImage_Unload(src);
+	}
+
+	// Plans give the same results as the cached transforms.
+	FIBITMAP *src = MakeRealTestImage(12, 7, 0);
+	FIA_FFT_PLAN *forward = FIA_CreateRealFFTPlan(12, 7, 0);
+	FIA_FFT_PLAN *inverse = FIA_CreateRealFFTPlan(12, 7, 1);
+	CuAssertTrue(tc, forward != NULL && inverse != NULL);
+
+	FIBITMAP *planned = FIA_ExecuteFFTPlan(forward, src);
+	FIBITMAP *cached = FIA_RealFFT(src);
+	CuAssertTrue(tc, planned != NULL && cached != NULL);
+
+	for(int y = 0; y < 7; y++)
+		CuAssertTrue(tc, memcmp(FreeImage_GetScanLine(cached, y), FreeImage_GetScanLine(planned, y),
+			sizeof(FICOMPLEX) * 7) == 0);
+
+	FIBITMAP *planned_inverse = FIA_ExecuteFFTPlan(inverse, planned);
+	FIBITMAP *cached_inverse = FIA_RealIFFT(cached);
+	CheckDoubleImagesEqual(tc, cached_inverse, planned_inverse, 1.0, 0.0);
+
+	// An inverse plan only takes half spectra of its own size.
+	CuAssertTrue(tc, FIA_ExecuteFFTPlan(inverse, src) == NULL);
+	CuAssertTrue(tc, FIA_ExecuteFFTPlan(forward, planned) == NULL);
+
+	FreeImage_Unload(planned_inverse);
+	FreeImage_Unload(cached_inverse);
+	FreeImage_Unload(planned);
+	FreeImage_Unload(cached);
+	FreeImage_Unload(src);
+	FIA_DestroyFFTPlan(forward);
+	FIA_DestroyFFTPlan(inverse);
+}
+
+static void
+Test_ComplexFloat(CuTest* tc)
+{
+	const int width = 12, height = 7;
+
+	FIBITMAP *src = MakeRealTestImage(width, height, 0);
+	FIBITMAP *other = MakeRealTestImage(width, height, 5);
+
+	// Single precision images hold the same values as FIT_COMPLEX ones.
+	FIBITMAP *full = FIA_FFT(src);
+	FIBITMAP *single = FIA_FFTToComplexFloat(src);
+	CuAssertTrue(tc, single != NULL);
+	CuAssertTrue(tc, FIA_IsComplexFloatImage(single));
+	CuAssertTrue(tc, !FIA_IsComplexFloatImage(full));
+	CuAssertIntEquals(tc, width, FreeImage_GetWidth(single));
+
+	for(int y = 0; y < height; y++) {
+
+		FICOMPLEX *full_bits = (FICOMPLEX *) FreeImage_GetScanLine(full, y);
+		FIACOMPLEXF *single_bits = (FIACOMPLEXF *) FreeImage_GetScanLine(single, y);
+
+		for(int x = 0; x < width; x++) {
+			CuAssertDblEquals(tc, full_bits[x].r, single_bits[x].r, 0.0);
+			CuAssertDblEquals(tc, full_bits[x].i, single_bits[x].i, 0.0);
+		}
+	}
+
+	FIBITMAP *expected = FIA_ConvertComplexImageToAbsoluteValued(full);
+	FIBITMAP *actual = FIA_ConvertComplexImageToAbsoluteValued(single);
+	CuAssertIntEquals(tc, FIT_FLOAT, FreeImage_GetImageType(actual));
+	FIBITMAP *actual_double = FreeImage_ConvertToType(actual, FIT_DOUBLE, 0);
+	CheckDoubleImagesEqual(tc, expected, actual_double, 1.0, 1e-3);
+	FreeImage_Unload(expected);
+	FreeImage_Unload(actual);
+	FreeImage_Unload(actual_double);
+
+	// Correlations stay in single precision, in full or half spectra.
+	FIBITMAP *other_full = FIA_FFT(other);
+	FIBITMAP *other_single = FIA_FFTToComplexFloat(other);
+
+	CuAssertIntEquals(tc, FIA_ERROR, FIA_MultiplyComplexImages(full, other_single));
+
+	FIA_ComplexConjugate(other_full);
+	FIA_ComplexConjugate(other_single);
+	FIA_MultiplyComplexImages(full, other_full);
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_MultiplyComplexImages(single, other_single));
+
+	FIBITMAP *ifft = FIA_IFFT(full);
+	FIBITMAP *single_ifft = FIA_IFFT(single);
+	CuAssertTrue(tc, FIA_IsComplexFloatImage(single_ifft));
+
+	expected = FIA_ComplexImageToRealValued(ifft);
+	actual = FIA_ComplexImageToRealValued(single_ifft);
+	CuAssertIntEquals(tc, FIT_FLOAT, FreeImage_GetImageType(actual));
+	actual_double = FreeImage_ConvertToType(actual, FIT_DOUBLE, 0);
+	CheckDoubleImagesEqual(tc, expected, actual_double, 1.0, 1e-1);
+	FreeImage_Unload(actual);
+	FreeImage_Unload(actual_double);
+
+	FIBITMAP *half = FIA_RealFFTToComplexFloat(src);
+	FIBITMAP *other_half = FIA_RealFFTToComplexFloat(other);
+	CuAssertTrue(tc, FIA_IsComplexFloatImage(half));
+	CuAssertIntEquals(tc, width, FIA_GetHalfSpectrumWidth(half));
+
+	FIA_ComplexConjugate(other_half);
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_MultiplyComplexImages(half, other_half));
+
+	actual = FIA_RealIFFT(half);
+	CuAssertIntEquals(tc, FIT_FLOAT, FreeImage_GetImageType(actual));
+	actual_double = FreeImage_ConvertToType(actual, FIT_DOUBLE, 0);
+	CheckDoubleImagesEqual(tc, expected, actual_double, 1.0, 1e-1);
+	FreeImage_Unload(actual);
+	FreeImage_Unload(actual_double);
+
+	// Ordinary double images are real, not complex.
+	FIBITMAP *src_double = FreeImage_ConvertToType(src, FIT_DOUBLE, 0);
+	CuAssertTrue(tc, !FIA_IsComplexFloatImage(src_double));
+	CuAssertIntEquals(tc, FIA_ERROR, FIA_ComplexConjugate(src_double));
+
+	FreeImage_Unload(src_double);
+	FreeImage_Unload(expected);
+	FreeImage_Unload(half);
+	FreeImage_Unload(other_half);
+	FreeImage_Unload(ifft);
+	FreeImage_Unload(single_ifft);
+	FreeImage_Unload(other_full);
+	FreeImage_Unload(other_single);
+	FreeImage_Unload(full);
+	FreeImage_Unload(single);
+	FreeImage_Unload(other);
+	FreeImage_Unload(src);
+}
+
+static void
+CheckComplexImagesIdentical(CuTest* tc, FIBITMAP *expected, FIBITMAP *actual)
+{
+	CuAssertTrue(tc, expected != NULL && actual != NULL);
+	CuAssertIntEquals(tc, FreeImage_GetWidth(expected), FreeImage_GetWidth(actual));
+
+	for(int y = 0; y < (int) FreeImage_GetHeight(expected); y++)
+		CuAssertTrue(tc, memcmp(FreeImage_GetScanLine(expected, y), FreeImage_GetScanLine(actual, y),
+			sizeof(FICOMPLEX) * FreeImage_GetWidth(expected)) == 0);
+}
+
+static void
+Test_FFTThreads(CuTest* tc)
+{
+	// Big enough for the row and column passes to be split into several bands.
+	const int width = 515, height = 263;
+
+	FIBITMAP *src = MakeRealTestImage(width, height, 3);
+
+	FIA_FFT_PLAN *forward = FIA_CreateFFTPlan(width, height, 0);
+	FIA_FFT_PLAN *inverse = FIA_CreateFFTPlan(width, height, 1);
+	FIA_FFT_PLAN *real_forward = FIA_CreateRealFFTPlan(width, height, 0);
+	CuAssertTrue(tc, forward != NULL && inverse != NULL && real_forward != NULL);
+
+	CuAssertIntEquals(tc, FIA_ERROR, FIA_SetFFTPlanNumberOfThreads(forward, -1));
+
+	int number_of_threads = FIA_GetNumberOfThreads();
+
+	FIA_SetNumberOfThreads(4);
+
+	FIA_SetFFTPlanNumberOfThreads(forward, 1);
+	FIA_SetFFTPlanNumberOfThreads(real_forward, 1);
+	FIBITMAP *serial = FIA_ExecuteFFTPlan(forward, src);
+	FIBITMAP *real_serial = FIA_ExecuteFFTPlan(real_forward, src);
+
+	FIA_SetFFTPlanNumberOfThreads(forward, 0);
+	FIA_SetFFTPlanNumberOfThreads(real_forward, 0);
+
+	PROFILE_START("FIA_ExecuteFFTPlan Threaded");
+	FIBITMAP *threaded = FIA_ExecuteFFTPlan(forward, src);
+	PROFILE_STOP("FIA_ExecuteFFTPlan Threaded");
+
+	FIBITMAP *real_threaded = FIA_ExecuteFFTPlan(real_forward, src);
+	FIBITMAP *ifft = FIA_ExecuteFFTPlan(inverse, threaded);
+
+	FIA_SetNumberOfThreads(number_of_threads);
+
+	// Each row and column is transformed the same way whichever band it is in.
+	CheckComplexImagesIdentical(tc, serial, threaded);
+	CheckComplexImagesIdentical(tc, real_serial, real_threaded);
+
+	CuAssertTrue(tc, ifft != NULL);
+
+	for(int y = 0; y < height; y++) {
+
+		float *bits = (float *) FreeImage_GetScanLine(src, y);
+		FICOMPLEX *ifft_bits = (FICOMPLEX *) FreeImage_GetScanLine(ifft, y);
+
+		for(int x = 0; x < width; x++)
+			CuAssertDblEquals(tc, bits[x], ifft_bits[x].r / (width * height), 1e-3);
+	}
+
+	FreeImage_Unload(serial);
+	FreeImage_Unload(threaded);
+	FreeImage_Unload(ifft);
+	FreeImage_Unload(real_serial);
+	FreeImage_Unload(real_threaded);
+	FreeImage_Unload(src);
+	FIA_DestroyFFTPlan(forward);
+	FIA_DestroyFFTPlan(inverse);
+	FIA_DestroyFFTPlan(real_forward);
+}
+
 CuSuite* 
 DLL_CALLCONV CuGetFreeImageAlgorithmsFFTSuite(void)
 {
@@ -81,6 +502,10 @@ DLL_CALLCONV CuGetFreeImageAlgorithmsFFTSuite(void)
 
 	SUITE_ADD_TEST(suite, Test_Shift);
 	SUITE_ADD_TEST(suite, Test_FFT);
+	SUITE_ADD_TEST(suite, Test_FFTPlan);
+	SUITE_ADD_TEST(suite, Test_RealFFT);
+	SUITE_ADD_TEST(suite, Test_ComplexFloat);
+	SUITE_ADD_TEST(suite, Test_FFTThreads);
 
 	return suite;
 }
@@ -8,8 +8,12 @@
 #include "FreeImageAlgorithms_Palettes.h"
 #include "FreeImageAlgorithms_Utilities.h"
 #include "FreeImageAlgorithms_Morphology.h"
+#include "FreeImageAlgorithms_Particle.h"
 
 #include <iostream>
+#include <string.h>
+#include <limits>
+#include <algorithm>
 #include <fstream>
 
 static double kernel_values[] = {1.0, 1.0, 1.0, 1.0, 1.0,
@@ -185,6 +189,650 @@ TestFIA_ClosingTest(CuTest* tc)
 	FreeImage_Unload(result_dib);
 }
 
+// Dilation or erosion one pixel at a time, the kernel centre always counts as set.
+// Set pixels keep their values, pixels the dilation sets are 255.
+static FIBITMAP*
+ReferenceMorphology(FIBITMAP *src, int xr, int yr, const double *values, bool dilate)
+{
+	int width = FreeImage_GetWidth(src) - 2 * xr;
+	int height = FreeImage_GetHeight(src) - 2 * yr;
+
+	FIBITMAP *dst = FIA_CloneImageType(src, width, height);
+
+	for(int y = 0; y < height; y++) {
+
+		unsigned char *dst_ptr = (unsigned char *) FreeImage_GetScanLine(dst, y);
+		unsigned char centre;
+
+		for(int x = 0; x < width; x++) {
+
+			bool any = false, all = true;
+
+			centre = ((unsigned char *) FreeImage_GetScanLine(src, y + yr))[x + xr];
+
+			for(int row = 0; row <= 2 * yr; row++) {
+
+				unsigned char *src_ptr = (unsigned char *) FreeImage_GetScanLine(src, y + row);
+
+				for(int col = 0; col <= 2 * xr; col++) {
+
+					if(values[row * (2 * xr + 1) + col] <= 0.0 && !(row == yr && col == xr))
+						continue;
+
+					if(src_ptr[x + col])
+						any = true;
+					else
+						all = false;
+				}
+			}
+
+			if(dilate)
+				dst_ptr[x] = any ? (centre ? centre : 255) : 0;
+			else
+				dst_ptr[x] = all ? centre : 0;
+		}
+	}
+
+	return dst;
+}
+
+static FIBITMAP*
+ReferenceChain(FIBITMAP *src, int xr, int yr, const double *values, bool dilate_first)
+{
+	FIABITMAP *bordered = FIA_SetBorder(src, xr, yr, BorderType_Constant, 0.0);
+	FIBITMAP *first = ReferenceMorphology(bordered->fib, xr, yr, values, dilate_first);
+	FIA_Unload(bordered);
+
+	bordered = FIA_SetBorder(first, xr, yr, BorderType_Constant, 0.0);
+	FIBITMAP *second = ReferenceMorphology(bordered->fib, xr, yr, values, !dilate_first);
+	FIA_Unload(bordered);
+	FreeImage_Unload(first);
+
+	// Pixels left set keep their values in src, or are 255 if they were not set.
+	for(int y = 0; y < (int) FreeImage_GetHeight(second); y++) {
+
+		unsigned char *ptr = (unsigned char *) FreeImage_GetScanLine(second, y);
+		unsigned char *src_ptr = (unsigned char *) FreeImage_GetScanLine(src, y);
+
+		for(int x = 0; x < (int) FreeImage_GetWidth(second); x++) {
+			if(ptr[x])
+				ptr[x] = src_ptr[x] ? src_ptr[x] : 255;
+		}
+	}
+
+	return second;
+}
+
+static bool
+SameImage(FIBITMAP *a, FIBITMAP *b)
+{
+	if(a == NULL || b == NULL || FreeImage_GetWidth(a) != FreeImage_GetWidth(b)
+		|| FreeImage_GetHeight(a) != FreeImage_GetHeight(b))
+		return false;
+
+	for(int y = 0; y < (int) FreeImage_GetHeight(a); y++) {
+		if(memcmp(FreeImage_GetScanLine(a, y), FreeImage_GetScanLine(b, y), FreeImage_GetWidth(a)) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+CheckBinaryMorphology(CuTest* tc, FIBITMAP *src, int xr, int yr, const double *values)
+{
+	FilterKernel kernel = FIA_NewKernel(xr, yr, values, 1.0);
+	FIABITMAP *border_dib = FIA_SetBorder(src, xr, yr, BorderType_Constant, 0.0);
+
+	FIBITMAP *result = FIA_BinaryDilation(border_dib, kernel);
+	FIBITMAP *expected = ReferenceMorphology(border_dib->fib, xr, yr, values, true);
+	CuAssertTrue(tc, SameImage(result, expected));
+	FreeImage_Unload(result);
+	FreeImage_Unload(expected);
+
+	result = FIA_BinaryErosion(border_dib, kernel);
+	expected = ReferenceMorphology(border_dib->fib, xr, yr, values, false);
+	CuAssertTrue(tc, SameImage(result, expected));
+	FreeImage_Unload(result);
+	FreeImage_Unload(expected);
+
+	result = FIA_BinaryOpening(border_dib, kernel);
+	expected = ReferenceChain(src, xr, yr, values, false);
+	CuAssertTrue(tc, SameImage(result, expected));
+	FreeImage_Unload(result);
+	FreeImage_Unload(expected);
+
+	result = FIA_BinaryClosing(border_dib, kernel);
+	expected = ReferenceChain(src, xr, yr, values, true);
+	CuAssertTrue(tc, SameImage(result, expected));
+	FreeImage_Unload(result);
+	FreeImage_Unload(expected);
+
+	FIA_Unload(border_dib);
+}
+
+static void
+TestFIA_BinaryMorphologyTest(CuTest* tc)
+{
+	const int width = 211, height = 97;
+
+	FIBITMAP *src = FreeImage_AllocateT(FIT_BITMAP, width, height, 8, 0, 0, 0);
+
+	// Blobs and noise with a few grey values so kept values can be checked.
+	unsigned int seed = 12345;
+
+	for(int y = 0; y < height; y++) {
+
+		unsigned char *ptr = (unsigned char *) FreeImage_GetScanLine(src, y);
+
+		for(int x = 0; x < width; x++) {
+
+			seed = seed * 1103515245 + 12345;
+
+			bool set = ((x / 13 + y / 11) % 3 == 0) || ((seed >> 16) % 7 == 0);
+
+			ptr[x] = set ? (unsigned char) (100 + (seed >> 8) % 156) : 0;
+		}
+	}
+
+	double values[15 * 15];
+
+	// Rectangle
+	for(int i = 0; i < 7 * 5; i++)
+		values[i] = 1.0;
+
+	CheckBinaryMorphology(tc, src, 3, 2, values);
+
+	CuAssertTrue(tc, FIA_MakeStructuringElement(FIA_STRUCTURING_ELEMENT_DIAMOND, 3, values) == FIA_SUCCESS);
+	CheckBinaryMorphology(tc, src, 3, 3, values);
+
+	CuAssertTrue(tc, FIA_MakeStructuringElement(FIA_STRUCTURING_ELEMENT_DISK, 7, values) == FIA_SUCCESS);
+	CheckBinaryMorphology(tc, src, 7, 7, values);
+
+	// Not symmetric, with gaps and no centre.
+	const double odd_values[] = {1.0, 0.0, 1.0, 1.0, 0.0,
+								 0.0, 0.0, 0.0, 0.0, 1.0,
+								 1.0, 1.0, 0.0, 1.0, 1.0};
+
+	CheckBinaryMorphology(tc, src, 2, 1, odd_values);
+
+	// The 3x3 functions add their own border.
+	const double ones[9] = {1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+
+	FIABITMAP *border_dib = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0.0);
+	FIBITMAP *result = FIA_Binary3x3Dilation(src);
+	FIBITMAP *expected = ReferenceMorphology(border_dib->fib, 1, 1, ones, true);
+	CuAssertTrue(tc, SameImage(result, expected));
+	FreeImage_Unload(result);
+	FreeImage_Unload(expected);
+
+	result = FIA_Binary3x3Opening(src);
+	expected = ReferenceChain(src, 1, 1, ones, false);
+	CuAssertTrue(tc, SameImage(result, expected));
+	FreeImage_Unload(result);
+	FreeImage_Unload(expected);
+	FIA_Unload(border_dib);
+
+	FreeImage_Unload(src);
+
+	// A mask of 1s keeps its value when dilated, so its outer border is
+	// only the ring of pixels around it.
+	src = FreeImage_AllocateT(FIT_BITMAP, 9, 9, 8, 0, 0, 0);
+
+	for(int y = 3; y < 6; y++) {
+		for(int x = 3; x < 6; x++)
+			((unsigned char *) FreeImage_GetScanLine(src, y))[x] = 1;
+	}
+
+	FIABITMAP *mask_border = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0.0);
+	FilterKernel kernel = FIA_NewKernel(1, 1, ones, 1.0);
+	FIBITMAP *dilated = FIA_BinaryDilation(mask_border, kernel);
+	FIBITMAP *dilated3x3 = FIA_Binary3x3Dilation(src);
+	FIBITMAP *outer = FIA_BinaryOuterBorder(src);
+
+	CuAssertTrue(tc, dilated != NULL && dilated3x3 != NULL && outer != NULL);
+
+	for(int y = 0; y < 9; y++) {
+
+		unsigned char *dilated_ptr = (unsigned char *) FreeImage_GetScanLine(dilated, y);
+		unsigned char *dilated3x3_ptr = (unsigned char *) FreeImage_GetScanLine(dilated3x3, y);
+		unsigned char *outer_ptr = (unsigned char *) FreeImage_GetScanLine(outer, y);
+
+		for(int x = 0; x < 9; x++) {
+
+			bool inside = (x >= 3 && x < 6 && y >= 3 && y < 6);
+			bool ring = !inside && (x >= 2 && x < 7 && y >= 2 && y < 7);
+
+			CuAssertIntEquals(tc, inside ? 1 : (ring ? 255 : 0), dilated_ptr[x]);
+			CuAssertIntEquals(tc, inside ? 1 : (ring ? 255 : 0), dilated3x3_ptr[x]);
+			CuAssertIntEquals(tc, ring ? 255 : 0, outer_ptr[x]);
+		}
+	}
+
+	FreeImage_Unload(dilated);
+	FreeImage_Unload(dilated3x3);
+	FreeImage_Unload(outer);
+	FIA_Unload(mask_border);
+	FreeImage_Unload(src);
+}
+
+// Minimum or maximum over the rectangle one pixel at a time, pixels off the image are ignored.
+template <typename T>
+static FIBITMAP*
+ReferenceMinMax(FIBITMAP *src, int xr, int yr, bool maximum)
+{
+	int width = FreeImage_GetWidth(src);
+	int height = FreeImage_GetHeight(src);
+
+	FIBITMAP *dst = FIA_CloneImageType(src, width, height);
+
+	for(int y = 0; y < height; y++) {
+
+		T *dst_ptr = (T *) FreeImage_GetScanLine(dst, y);
+
+		for(int x = 0; x < width; x++) {
+
+			T value = ((T *) FreeImage_GetScanLine(src, y))[x];
+
+			for(int j = y - yr; j <= y + yr; j++) {
+
+				if(j < 0 || j >= height)
+					continue;
+
+				T *src_ptr = (T *) FreeImage_GetScanLine(src, j);
+
+				for(int i = x - xr; i <= x + xr; i++) {
+
+					if(i < 0 || i >= width)
+						continue;
+
+					if(maximum ? (src_ptr[i] > value) : (src_ptr[i] < value))
+						value = src_ptr[i];
+				}
+			}
+
+			dst_ptr[x] = value;
+		}
+	}
+
+	return dst;
+}
+
+// a - b, or a if b is NULL, without the border.
+template <typename T>
+static FIBITMAP*
+ReferenceDifference(FIBITMAP *a, FIBITMAP *b, int xborder, int yborder)
+{
+	int width = FreeImage_GetWidth(a) - 2 * xborder;
+	int height = FreeImage_GetHeight(a) - 2 * yborder;
+
+	FIBITMAP *dst = FIA_CloneImageType(a, width, height);
+
+	for(int y = 0; y < height; y++) {
+
+		T *a_ptr = (T *) FreeImage_GetScanLine(a, y + yborder) + xborder;
+		T *dst_ptr = (T *) FreeImage_GetScanLine(dst, y);
+
+		for(int x = 0; x < width; x++) {
+
+			if(b == NULL) {
+				dst_ptr[x] = a_ptr[x];
+				continue;
+			}
+
+			double diff = (double) a_ptr[x] - ((T *) FreeImage_GetScanLine(b, y + yborder))[x + xborder];
+
+			if(diff > (double) std::numeric_limits<T>::max())
+				diff = (double) std::numeric_limits<T>::max();
+
+			dst_ptr[x] = (T) diff;
+		}
+	}
+
+	return dst;
+}
+
+template <typename T>
+static void
+CheckGreyscaleMorphology(CuTest* tc, FREE_IMAGE_TYPE type, int bpp, int xr, int yr, int xborder, int yborder)
+{
+	const int width = 131, height = 77;
+
+	FIBITMAP *src = FreeImage_AllocateT(type, width, height, bpp, 0, 0, 0);
+
+	// Values spread over the whole range of the type so the gradient can overflow.
+	unsigned int seed = 4321;
+	double low = std::numeric_limits<T>::is_integer ? (double) std::numeric_limits<T>::min() : -1000.0;
+	double high = std::numeric_limits<T>::is_integer ? (double) std::numeric_limits<T>::max() : 1000.0;
+
+	for(int y = 0; y < height; y++) {
+
+		T *ptr = (T *) FreeImage_GetScanLine(src, y);
+
+		for(int x = 0; x < width; x++) {
+			seed = seed * 1103515245 + 12345;
+			ptr[x] = (T) (low + (high - low) * ((seed >> 8) & 0xFFFF) / 65535.0);
+		}
+	}
+
+	FIABITMAP *border_dib = FIA_SetBorder(src, xborder, yborder, BorderType_Mirror, 0.0);
+	FIBITMAP *fib = border_dib->fib;
+
+	FIBITMAP *erosion = ReferenceMinMax<T>(fib, xr, yr, false);
+	FIBITMAP *dilation = ReferenceMinMax<T>(fib, xr, yr, true);
+	FIBITMAP *opening = ReferenceMinMax<T>(erosion, xr, yr, true);
+	FIBITMAP *closing = ReferenceMinMax<T>(dilation, xr, yr, false);
+
+	FIBITMAP *expected[7];
+
+	expected[FIA_GREYSCALE_EROSION] = ReferenceDifference<T>(erosion, NULL, xborder, yborder);
+	expected[FIA_GREYSCALE_DILATION] = ReferenceDifference<T>(dilation, NULL, xborder, yborder);
+	expected[FIA_GREYSCALE_OPENING] = ReferenceDifference<T>(opening, NULL, xborder, yborder);
+	expected[FIA_GREYSCALE_CLOSING] = ReferenceDifference<T>(closing, NULL, xborder, yborder);
+	expected[FIA_GREYSCALE_WHITE_TOP_HAT] = ReferenceDifference<T>(fib, opening, xborder, yborder);
+	expected[FIA_GREYSCALE_BLACK_TOP_HAT] = ReferenceDifference<T>(closing, fib, xborder, yborder);
+	expected[FIA_GREYSCALE_GRADIENT] = ReferenceDifference<T>(dilation, erosion, xborder, yborder);
+
+	for(int operation = 0; operation < 7; operation++) {
+
+		FIBITMAP *result = FIA_GreyscaleMorphology(border_dib, xr, yr,
+			(FIA_GREYSCALE_MORPHOLOGY_OPERATION) operation);
+
+		CuAssertTrue(tc, result != NULL);
+		CuAssertTrue(tc, FreeImage_GetWidth(result) == width && FreeImage_GetHeight(result) == height);
+
+		for(int y = 0; y < height; y++)
+			CuAssertTrue(tc, memcmp(FreeImage_GetScanLine(result, y),
+				FreeImage_GetScanLine(expected[operation], y), sizeof(T) * width) == 0);
+
+		FreeImage_Unload(result);
+		FreeImage_Unload(expected[operation]);
+	}
+
+	FreeImage_Unload(erosion);
+	FreeImage_Unload(dilation);
+	FreeImage_Unload(opening);
+	FreeImage_Unload(closing);
+	FIA_Unload(border_dib);
+	FreeImage_Unload(src);
+}
+
+static void
+TestFIA_GreyscaleMorphologyTest(CuTest* tc)
+{
+	CheckGreyscaleMorphology<unsigned char>(tc, FIT_BITMAP, 8, 3, 2, 0, 0);
+	CheckGreyscaleMorphology<unsigned short>(tc, FIT_UINT16, 16, 7, 7, 4, 4);
+	CheckGreyscaleMorphology<short>(tc, FIT_INT16, 16, 0, 5, 0, 3);
+	CheckGreyscaleMorphology<int>(tc, FIT_INT32, 32, 4, 0, 2, 0);
+	CheckGreyscaleMorphology<float>(tc, FIT_FLOAT, 32, 1, 1, 1, 1);
+	CheckGreyscaleMorphology<double>(tc, FIT_DOUBLE, 64, 40, 30, 0, 0);
+}
+
+// Repeats a geodesic dilation or erosion until nothing changes.
+template <typename T>
+static void
+ReferenceReconstruction(FIBITMAP *marker, FIBITMAP *mask, bool dilation, int connectivity)
+{
+	const int width = FreeImage_GetWidth(marker);
+	const int height = FreeImage_GetHeight(marker);
+
+	bool changed = true;
+
+	while(changed) {
+
+		changed = false;
+
+		for(int y = 0; y < height; y++) {
+
+			T *ptr = (T *) FreeImage_GetScanLine(marker, y);
+			const T *mask_ptr = (const T *) FreeImage_GetScanLine(mask, y);
+
+			for(int x = 0; x < width; x++) {
+
+				T value = ptr[x];
+
+				for(int dy = -1; dy <= 1; dy++) {
+					for(int dx = -1; dx <= 1; dx++) {
+
+						if(x + dx < 0 || x + dx >= width || y + dy < 0 || y + dy >= height)
+							continue;
+
+						if(connectivity == 4 && dx != 0 && dy != 0)
+							continue;
+
+						T neighbour = ((T *) FreeImage_GetScanLine(marker, y + dy))[x + dx];
+						value = dilation ? std::max<T>(value, neighbour) : std::min<T>(value, neighbour);
+					}
+				}
+
+				value = dilation ? std::min<T>(value, mask_ptr[x]) : std::max<T>(value, mask_ptr[x]);
+
+				if(value != ptr[x]) {
+					ptr[x] = value;
+					changed = true;
+				}
+			}
+		}
+	}
+}
+
+template <typename T>
+static void
+CheckReconstruction(CuTest* tc, FREE_IMAGE_TYPE type, int bpp)
+{
+	const int width = 61, height = 47;
+
+	unsigned int seed = 999;
+
+	for(int test = 0; test < 4; test++) {
+
+		bool dilation = (test % 2 == 0);
+		int connectivity = (test < 2) ? 4 : 8;
+
+		FIBITMAP *marker = FreeImage_AllocateT(type, width, height, bpp, 0, 0, 0);
+		FIBITMAP *mask = FreeImage_AllocateT(type, width, height, bpp, 0, 0, 0);
+
+		// A few levels so there are plateaus, the marker on the right side of the mask.
+		for(int y = 0; y < height; y++) {
+
+			T *marker_ptr = (T *) FreeImage_GetScanLine(marker, y);
+			T *mask_ptr = (T *) FreeImage_GetScanLine(mask, y);
+
+			for(int x = 0; x < width; x++) {
+				seed = seed * 1103515245 + 12345;
+				mask_ptr[x] = (T) (((seed >> 16) % 5) * 10);
+				seed = seed * 1103515245 + 12345;
+
+				if((seed >> 16) % 8 == 0)
+					marker_ptr[x] = mask_ptr[x];
+				else
+					marker_ptr[x] = (T) (dilation ? 0 : 50);
+			}
+		}
+
+		FIBITMAP *expected = FreeImage_Clone(marker);
+
+		ReferenceReconstruction<T>(expected, mask, dilation, connectivity);
+
+		CuAssertTrue(tc, FIA_MorphologicalReconstruction(marker, mask,
+			dilation ? FIA_RECONSTRUCTION_BY_DILATION : FIA_RECONSTRUCTION_BY_EROSION,
+			(FIA_CONNECTIVITY) connectivity) == FIA_SUCCESS);
+
+		for(int y = 0; y < height; y++)
+			CuAssertTrue(tc, memcmp(FreeImage_GetScanLine(marker, y),
+				FreeImage_GetScanLine(expected, y), sizeof(T) * width) == 0);
+
+		FreeImage_Unload(expected);
+		FreeImage_Unload(marker);
+		FreeImage_Unload(mask);
+	}
+}
+
+static void
+TestFIA_ReconstructionTest(CuTest* tc)
+{
+	CheckReconstruction<unsigned char>(tc, FIT_BITMAP, 8);
+	CheckReconstruction<short>(tc, FIT_INT16, 16);
+	CheckReconstruction<unsigned int>(tc, FIT_UINT32, 32);
+	CheckReconstruction<float>(tc, FIT_FLOAT, 32);
+
+	// Rows are given bottom up.
+	static const char *rows[] = {
+		"11111.....",
+		"1.111.....",
+		"11111..111",
+		"1.......1.",
+		"1.......11",
+		"1..111....",
+		"1..1.1.1..",
+		"1..111....",
+		".........."
+	};
+
+	const int width = 10, height = 9;
+
+	FIBITMAP *src = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+
+	for(int y = 0; y < height; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(src, y);
+
+		for(int x = 0; x < width; x++)
+			ptr[x] = (rows[y][x] == '1') ? 255 : 0;
+	}
+
+	// The strip on the left edge does not stop the two holes being filled,
+	// the gap open to the edge on the right is not a hole.
+	FIBITMAP *filled = FIA_Fillholes(src, 1);
+
+	CuAssertTrue(tc, filled != NULL);
+
+	for(int y = 0; y < height; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(filled, y);
+
+		for(int x = 0; x < width; x++) {
+			bool hole = (x == 1 && y == 1) || (x == 4 && y == 6);
+			CuAssertIntEquals(tc, (rows[y][x] == '1' || hole) ? 255 : 0, ptr[x]);
+		}
+	}
+
+	// Only the particle in the middle and the single pixel are away from the edge.
+	FIBITMAP *removed = FIA_RemoveBorderParticles(src, 1, FIA_CONNECTIVITY_8);
+
+	CuAssertTrue(tc, removed != NULL);
+
+	for(int y = 0; y < height; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(removed, y);
+
+		for(int x = 0; x < width; x++) {
+			bool kept = (rows[y][x] == '1') && x >= 3 && x <= 7 && y >= 5;
+			CuAssertIntEquals(tc, kept ? 255 : 0, ptr[x]);
+		}
+	}
+
+	// Every particle is a plateau above the background.
+	FIBITMAP *maxima = FIA_RegionalMaxima(src, FIA_CONNECTIVITY_8);
+
+	CuAssertTrue(tc, maxima != NULL);
+
+	for(int y = 0; y < height; y++)
+		CuAssertTrue(tc, memcmp(FreeImage_GetScanLine(maxima, y),
+			FreeImage_GetScanLine(src, y), width) == 0);
+
+	FreeImage_Unload(maxima);
+	FreeImage_Unload(removed);
+	FreeImage_Unload(filled);
+	FreeImage_Unload(src);
+}
+
+static void
+TestFIA_WatershedTest(CuTest* tc)
+{
+	const int width = 21, height = 9;
+
+	// Two valleys with a ridge along x = 10 and a marker at the bottom of each.
+	FIBITMAP *src = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+	FIBITMAP *src_float = FreeImage_AllocateT(FIT_FLOAT, width, height, 32, 0, 0, 0);
+	FIBITMAP *markers = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+	FIBITMAP *mask = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+
+	for(int y = 0; y < height; y++) {
+
+		BYTE *ptr = FreeImage_GetScanLine(src, y);
+		float *float_ptr = (float *) FreeImage_GetScanLine(src_float, y);
+		BYTE *mask_ptr = FreeImage_GetScanLine(mask, y);
+
+		for(int x = 0; x < width; x++) {
+			int distance = (x < 10) ? abs(x - 4) : abs(x - 16);
+			ptr[x] = (x == 10) ? 200 : (BYTE) (10 * distance + abs(y - 4));
+			float_ptr[x] = -0.5f * ptr[x];
+			mask_ptr[x] = (y == 0) ? 0 : 255;
+		}
+	}
+
+	FreeImage_GetScanLine(markers, 4)[4] = 255;
+	FreeImage_GetScanLine(markers, 4)[16] = 255;
+
+	for(int lines = 0; lines < 2; lines++) {
+
+		FIBITMAP *labels = FIA_Watershed(src, markers, mask, FIA_CONNECTIVITY_8, lines);
+
+		CuAssertTrue(tc, labels != NULL);
+		CuAssertTrue(tc, FreeImage_GetImageType(labels) == FIT_INT32);
+
+		for(int y = 0; y < height; y++) {
+
+			int *ptr = (int *) FreeImage_GetScanLine(labels, y);
+
+			for(int x = 0; x < width; x++) {
+
+				int expected = (x < 10) ? 1 : 2;
+
+				if(y == 0 || (lines && x == 10))
+					expected = 0;
+				else if(x == 10)
+					expected = ptr[x];
+
+				CuAssertIntEquals(tc, expected, ptr[x]);
+			}
+
+			CuAssertTrue(tc, ptr[10] >= 0 && ptr[10] <= 2);
+		}
+
+		FreeImage_Unload(labels);
+	}
+
+	// Flooding the float image upside down makes the ridge the valley,
+	// the basins then meet where the valleys were.
+	FIBITMAP *ridge_markers = FreeImage_AllocateT(FIT_INT32, width, height, 32, 0, 0, 0);
+
+	((int *) FreeImage_GetScanLine(ridge_markers, 4))[0] = 1;
+	((int *) FreeImage_GetScanLine(ridge_markers, 4))[10] = 2;
+	((int *) FreeImage_GetScanLine(ridge_markers, 4))[20] = 3;
+
+	FIBITMAP *labels = FIA_Watershed(src_float, ridge_markers, NULL, FIA_CONNECTIVITY_4, 1);
+
+	CuAssertTrue(tc, labels != NULL);
+
+	int *row = (int *) FreeImage_GetScanLine(labels, 4);
+
+	CuAssertIntEquals(tc, 1, row[1]);
+	CuAssertIntEquals(tc, 0, row[4]);
+	CuAssertIntEquals(tc, 2, row[9]);
+	CuAssertIntEquals(tc, 2, row[11]);
+	CuAssertIntEquals(tc, 0, row[16]);
+	CuAssertIntEquals(tc, 3, row[19]);
+
+	FreeImage_Unload(labels);
+	FreeImage_Unload(ridge_markers);
+	FreeImage_Unload(mask);
+	FreeImage_Unload(markers);
+	FreeImage_Unload(src_float);
+	FreeImage_Unload(src);
+}
+
 
 CuSuite* DLL_CALLCONV
 CuGetFreeImageAlgorithmsMorphologySuite(void)
@@ -197,6 +845,10 @@ CuGetFreeImageAlgorithmsMorphologySuite(void)
 	SUITE_ADD_TEST(suite, TestFIA_ErosionTest);
 	SUITE_ADD_TEST(suite, TestFIA_OpeningTest);
 	SUITE_ADD_TEST(suite, TestFIA_ClosingTest);
+	SUITE_ADD_TEST(suite, TestFIA_BinaryMorphologyTest);
+	SUITE_ADD_TEST(suite, TestFIA_GreyscaleMorphologyTest);
+	SUITE_ADD_TEST(suite, TestFIA_ReconstructionTest);
+	SUITE_ADD_TEST(suite, TestFIA_WatershedTest);
 
 	return suite;
 }
@@ -11,6 +11,7 @@
 #include "FreeImageAlgorithms_Utilities.h"
 
 #include <iostream>
+#include <math.h>
 #include <fstream>
 
 static void
@@ -107,6 +108,316 @@ static void TestFIA_ParticleInfoTest(CuTest* tc)
 	FreeImage_Unload(dst);
 }
 
+static void
+TestFIA_LabelParticlesTest(CuTest* tc)
+{
+	// Two squares touching at a corner and a bar, rows from the top.
+	const char *rows[6] = { "##....#",
+	                        "##....#",
+	                        "..##..#",
+	                        "..##...",
+	                        ".......",
+	                        "#######" };
+
+	FIBITMAP *src = FreeImage_Allocate(7, 6, 8, 0, 0, 0);
+
+	for(int y = 0; y < 6; y++) {
+
+		BYTE *bits = FIA_GetScanLineFromTop(src, y);
+
+		for(int x = 0; x < 7; x++)
+			bits[x] = (rows[y][x] == '#') ? 255 : 0;
+	}
+
+	int number_of_particles;
+
+	FIBITMAP *labels = FIA_LabelParticles(src, 1, FIA_CONNECTIVITY_4, &number_of_particles);
+
+	CuAssertTrue(tc, labels != NULL);
+	CuAssertIntEquals(tc, FIT_INT32, FreeImage_GetImageType(labels));
+	CuAssertIntEquals(tc, 4, number_of_particles);
+
+	// Numbered in the order they are met from the top left.
+	CuAssertIntEquals(tc, 1, ((int *) FIA_GetScanLineFromTop(labels, 0))[1]);
+	CuAssertIntEquals(tc, 2, ((int *) FIA_GetScanLineFromTop(labels, 0))[6]);
+	CuAssertIntEquals(tc, 3, ((int *) FIA_GetScanLineFromTop(labels, 3))[2]);
+	CuAssertIntEquals(tc, 4, ((int *) FIA_GetScanLineFromTop(labels, 5))[0]);
+	CuAssertIntEquals(tc, 0, ((int *) FIA_GetScanLineFromTop(labels, 4))[3]);
+
+	FreeImage_Unload(labels);
+
+	labels = FIA_LabelParticles(src, 1, FIA_CONNECTIVITY_8, &number_of_particles);
+
+	CuAssertIntEquals(tc, 3, number_of_particles);
+	CuAssertIntEquals(tc, 1, ((int *) FIA_GetScanLineFromTop(labels, 3))[3]);
+	CuAssertIntEquals(tc, 3, ((int *) FIA_GetScanLineFromTop(labels, 5))[6]);
+
+	FreeImage_Unload(labels);
+
+	// The background is the particle for black on white images.
+	labels = FIA_LabelParticles(src, 0, FIA_CONNECTIVITY_4, &number_of_particles);
+
+	CuAssertIntEquals(tc, 1, number_of_particles);
+
+	FreeImage_Unload(labels);
+	FreeImage_Unload(src);
+
+	// Strips labelled on different threads join up as a single thread does.
+	src = FreeImage_Allocate(301, 517, 8, 0, 0, 0);
+	unsigned int seed = 7;
+
+	for(int y = 0; y < 517; y++) {
+
+		BYTE *bits = FreeImage_GetScanLine(src, y);
+
+		for(int x = 0; x < 301; x++) {
+			seed = seed * 1103515245 + 12345;
+			bits[x] = ((seed >> 16) % 100 < 45) ? 255 : 0;
+		}
+	}
+
+	int number_of_threads = FIA_GetNumberOfThreads();
+	int serial_number, threaded_number;
+
+	FIA_SetNumberOfThreads(1);
+	FIBITMAP *serial = FIA_LabelParticles(src, 1, FIA_CONNECTIVITY_8, &serial_number);
+
+	FIA_SetNumberOfThreads(7);
+
+	PROFILE_START("FIA_LabelParticles");
+	FIBITMAP *threaded = FIA_LabelParticles(src, 1, FIA_CONNECTIVITY_8, &threaded_number);
+	PROFILE_STOP("FIA_LabelParticles");
+
+	FIA_SetNumberOfThreads(number_of_threads);
+
+	CuAssertIntEquals(tc, serial_number, threaded_number);
+
+	for(int y = 0; y < 517; y++) {
+
+		int *serial_bits = (int *) FreeImage_GetScanLine(serial, y);
+		int *threaded_bits = (int *) FreeImage_GetScanLine(threaded, y);
+
+		for(int x = 0; x < 301; x++)
+			CuAssertIntEquals(tc, serial_bits[x], threaded_bits[x]);
+	}
+
+	PARTICLEINFO *info;
+
+	FIA_ParticleInfo(src, &info, 1);
+
+	CuAssertIntEquals(tc, serial_number, info->number_of_blobs);
+
+	FIA_FreeParticleInfo(info);
+
+	FreeImage_Unload(serial);
+	FreeImage_Unload(threaded);
+	FreeImage_Unload(src);
+}
+
+static void
+TestFIA_MeasureParticlesTest(CuTest* tc)
+{
+	FIBITMAP *src = FreeImage_Allocate(40, 30, 8, 0, 0, 0);
+	FIBITMAP *intensity = FreeImage_AllocateT(FIT_FLOAT, 40, 30, 32, 0, 0, 0);
+
+	for(int y = 0; y < 30; y++) {
+
+		BYTE *bits = FIA_GetScanLineFromTop(src, y);
+		float *values = (float *) FIA_GetScanLineFromTop(intensity, y);
+
+		for(int x = 0; x < 40; x++) {
+
+			// A 10 x 4 rectangle and a diagonal line.
+			int in_rect = (x >= 5 && x < 15 && y >= 3 && y < 7);
+			int on_line = (x >= 20 && x < 28 && y == x - 10);
+
+			bits[x] = (in_rect || on_line) ? 255 : 0;
+			values[x] = (float) x;
+		}
+	}
+
+	FIA_PARTICLE_MEASUREMENTS *measurements = NULL;
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, FIA_MeasureParticles(src, 1, FIA_CONNECTIVITY_8,
+		intensity, &measurements));
+
+	CuAssertIntEquals(tc, 2, measurements->number_of_particles);
+
+	CuAssertIntEquals(tc, 40, measurements->area[0]);
+	CuAssertIntEquals(tc, 5, measurements->rect[0].left);
+	CuAssertIntEquals(tc, 3, measurements->rect[0].top);
+	CuAssertIntEquals(tc, 14, measurements->rect[0].right);
+	CuAssertIntEquals(tc, 6, measurements->rect[0].bottom);
+	CuAssertDblEquals(tc, 9.5, measurements->centre_x[0], 1e-9);
+	CuAssertDblEquals(tc, 4.5, measurements->centre_y[0], 1e-9);
+	CuAssertDblEquals(tc, 28.0, measurements->perimeter[0], 1e-9);
+	CuAssertDblEquals(tc, 0.0, measurements->orientation[0], 1e-9);
+	CuAssertDblEquals(tc, sqrt(1.0 - 1.25 / 8.25), measurements->eccentricity[0], 1e-9);
+
+	// Intensity is the x coordinate.
+	CuAssertDblEquals(tc, 380.0, measurements->integrated_intensity[0], 1e-9);
+	CuAssertDblEquals(tc, 5.0, measurements->min_intensity[0], 1e-9);
+	CuAssertDblEquals(tc, 14.0, measurements->max_intensity[0], 1e-9);
+	CuAssertDblEquals(tc, 9.5, measurements->mean_intensity[0], 1e-9);
+	CuAssertDblEquals(tc, (double) (5*5 + 6*6 + 7*7 + 8*8 + 9*9 + 10*10 + 11*11 + 12*12 + 13*13 + 14*14) / 95.0,
+		measurements->intensity_centre_x[0], 1e-9);
+	CuAssertDblEquals(tc, 4.5, measurements->intensity_centre_y[0], 1e-9);
+
+	// The line runs down to the right at 45 degrees.
+	CuAssertIntEquals(tc, 8, measurements->area[1]);
+	CuAssertDblEquals(tc, 32.0, measurements->perimeter[1], 1e-9);
+	CuAssertDblEquals(tc, atan(1.0), measurements->orientation[1], 1e-9);
+	CuAssertDblEquals(tc, 1.0, measurements->eccentricity[1], 1e-9);
+
+	FIA_FreeParticleMeasurements(measurements);
+
+	// Without an intensity image there are no intensity measurements.
+	FIA_MeasureParticles(src, 1, FIA_CONNECTIVITY_4, NULL, &measurements);
+
+	CuAssertIntEquals(tc, 9, measurements->number_of_particles);
+	CuAssertTrue(tc, measurements->mean_intensity == NULL);
+
+	FIA_FreeParticleMeasurements(measurements);
+
+	FreeImage_Unload(src);
+	FreeImage_Unload(intensity);
+}
+
+static void
+TestFIA_FindImageMaximaPlateauTest(CuTest* tc)
+{
+	// A plateau of 9000 pixels, all downhill of the peak in its middle,
+	// and a lower spot on its own. Only the peak and the spot are maxima.
+	FIBITMAP *src = FreeImage_AllocateT(FIT_FLOAT, 200, 100, 32, 0, 0, 0);
+
+	for(int y = 20; y < 80; y++) {
+
+		float *bits = (float *) FIA_GetScanLineFromTop(src, y);
+
+		for(int x = 20; x < 170; x++)
+			bits[x] = 50.0f;
+	}
+
+	((float *) FIA_GetScanLineFromTop(src, 50))[95] = 100.0f;
+	((float *) FIA_GetScanLineFromTop(src, 10))[185] = 30.0f;
+
+	FIAPeak *peaks = NULL;
+	int number_of_peaks;
+
+	PROFILE_START("FindImageMaxima");
+
+	FIBITMAP *dst = FIA_FindImageMaxima(src, NULL, 10.0, 1, 0, &peaks, 0, &number_of_peaks);
+
+	PROFILE_STOP("FindImageMaxima");
+
+	CuAssertTrue(tc, dst != NULL);
+	CuAssertIntEquals(tc, 2, number_of_peaks);
+
+	// Centres are from the top left. The suite turns on the old one pixel
+	// offset when the maxima are drawn.
+	for(int i = 0; i < number_of_peaks; i++) {
+
+		if(peaks[i].centre.x == 96)
+			CuAssertIntEquals(tc, 51, peaks[i].centre.y);
+		else {
+			CuAssertIntEquals(tc, 186, peaks[i].centre.x);
+			CuAssertIntEquals(tc, 11, peaks[i].centre.y);
+		}
+	}
+
+	FIA_FreePeaks(peaks);
+	FreeImage_Unload(dst);
+	FreeImage_Unload(src);
+
+	// Bands of rows on different threads find the same maxima as one thread.
+	src = FreeImage_Allocate(257, 311, 8, 0, 0, 0);
+	unsigned int seed = 3;
+
+	for(int y = 0; y < 311; y++) {
+
+		BYTE *bits = FreeImage_GetScanLine(src, y);
+
+		for(int x = 0; x < 257; x++) {
+			seed = seed * 1103515245 + 12345;
+			bits[x] = (BYTE) ((seed >> 16) % 8);
+		}
+	}
+
+	int number_of_threads = FIA_GetNumberOfThreads();
+	int serial_number, threaded_number;
+	FIAPeak *serial_peaks = NULL, *threaded_peaks = NULL;
+
+	FIA_SetNumberOfThreads(1);
+	FIBITMAP *serial = FIA_FindImageMaxima(src, NULL, 2.0, 1, 0, &serial_peaks, 0, &serial_number);
+
+	FIA_SetNumberOfThreads(5);
+	FIBITMAP *threaded = FIA_FindImageMaxima(src, NULL, 2.0, 1, 0, &threaded_peaks, 0, &threaded_number);
+
+	FIA_SetNumberOfThreads(number_of_threads);
+
+	CuAssertTrue(tc, serial_number > 0);
+	CuAssertIntEquals(tc, serial_number, threaded_number);
+
+	for(int y = 0; y < 311; y++) {
+
+		BYTE *serial_bits = FreeImage_GetScanLine(serial, y);
+		BYTE *threaded_bits = FreeImage_GetScanLine(threaded, y);
+
+		for(int x = 0; x < 257; x++)
+			CuAssertIntEquals(tc, serial_bits[x], threaded_bits[x]);
+	}
+
+	FIA_FreePeaks(serial_peaks);
+	FIA_FreePeaks(threaded_peaks);
+	FreeImage_Unload(serial);
+	FreeImage_Unload(threaded);
+	FreeImage_Unload(src);
+}
+
+static void
+TestFIA_FindImagePeaksTest(CuTest* tc)
+{
+	FIBITMAP *src = FreeImage_AllocateT(FIT_FLOAT, 64, 48, 32, 0, 0, 0);
+
+	((float *) FreeImage_GetScanLine(src, 10))[10] = 90.0f;
+	((float *) FreeImage_GetScanLine(src, 10))[13] = 80.0f;
+	((float *) FreeImage_GetScanLine(src, 30))[40] = 70.0f;
+	((float *) FreeImage_GetScanLine(src, 40))[50] = 60.0f;
+
+	FIAPeak *peaks = NULL;
+	int number_of_peaks;
+
+	// The peak of 80 is too close to the brighter one.
+	int err = FIA_FindImagePeaks(src, NULL, 10.0, 5, 0, &peaks, &number_of_peaks, NULL);
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, err);
+	CuAssertIntEquals(tc, 3, number_of_peaks);
+	CuAssertDblEquals(tc, 90.0, peaks[0].value, 0.0);
+	CuAssertDblEquals(tc, 70.0, peaks[1].value, 0.0);
+	CuAssertDblEquals(tc, 60.0, peaks[2].value, 0.0);
+	CuAssertIntEquals(tc, 40, peaks[1].centre.x);
+	CuAssertIntEquals(tc, 30, peaks[1].centre.y);
+
+	FIA_FreePeaks(peaks);
+	peaks = NULL;
+
+	// The brightest two, with an image of where they are.
+	FIBITMAP *peak_image = NULL;
+
+	err = FIA_FindImagePeaks(src, NULL, 10.0, 1, 2, &peaks, &number_of_peaks, &peak_image);
+
+	CuAssertIntEquals(tc, FIA_SUCCESS, err);
+	CuAssertIntEquals(tc, 2, number_of_peaks);
+	CuAssertDblEquals(tc, 80.0, peaks[1].value, 0.0);
+	CuAssertTrue(tc, peak_image != NULL);
+	CuAssertIntEquals(tc, 255, FreeImage_GetScanLine(peak_image, 10)[13]);
+	CuAssertIntEquals(tc, 0, FreeImage_GetScanLine(peak_image, 30)[40]);
+
+	FIA_FreePeaks(peaks);
+	FreeImage_Unload(peak_image);
+	FreeImage_Unload(src);
+}
+
 /*
 static void
 TestFIA_FindImageMaximaTest(CuTest* tc)
@@ -275,6 +586,10 @@ CuGetFreeImageAlgorithmsParticleSuite(void)
 	//SUITE_ADD_TEST(suite, TestFIA_ParticleInfoTest);
 	//SUITE_ADD_TEST(suite, TestFIA_MultiscaleProductsTest);
 	//SUITE_ADD_TEST(suite, TestFIA_ParticleInfoTest2);
+	SUITE_ADD_TEST(suite, TestFIA_LabelParticlesTest);
+	SUITE_ADD_TEST(suite, TestFIA_MeasureParticlesTest);
+	SUITE_ADD_TEST(suite, TestFIA_FindImageMaximaPlateauTest);
+	SUITE_ADD_TEST(suite, TestFIA_FindImagePeaksTest);
 
 	//SUITE_ADD_TEST(suite, TestFIA_FindImageMaximaTest);
     //SUITE_ADD_TEST(suite, TestFIA_FindImageMaximaTest2);
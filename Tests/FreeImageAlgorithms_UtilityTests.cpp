@@ -192,6 +192,47 @@ TestFIA_DistanceTransformTest2(CuTest* tc)
 	FreeImage_Unload(dib3);
 }
 
+static void
+TestFIA_EuclideanDistanceTransformTest(CuTest* tc)
+{
+	// A 5 x 3 particle in a 9 x 7 image, rows from the top.
+	FIBITMAP *src = FreeImage_Allocate(9, 7, 8, 0, 0, 0);
+
+	for(int y = 2; y < 5; y++) {
+
+		BYTE *bits = FIA_GetScanLineFromTop(src, y);
+
+		for(int x = 2; x < 7; x++)
+			bits[x] = 255;
+	}
+
+	FIBITMAP *features = NULL;
+	FIBITMAP *dst = FIA_EuclideanDistanceTransform(src, 1.0, 1.0, 0, &features);
+
+	CuAssertTrue(tc, dst != NULL);
+	CuAssertIntEquals(tc, FIT_FLOAT, FreeImage_GetImageType(dst));
+	CuAssertDblEquals(tc, 0.0, ((float *) FIA_GetScanLineFromTop(dst, 0))[0], 0.0);
+	CuAssertDblEquals(tc, 1.0, ((float *) FIA_GetScanLineFromTop(dst, 2))[2], 0.0);
+	CuAssertDblEquals(tc, 2.0, ((float *) FIA_GetScanLineFromTop(dst, 3))[4], 0.0);
+
+	// The nearest background pixel to the centre is directly above it.
+	CuAssertIntEquals(tc, 1 * 9 + 4, ((int *) FIA_GetScanLineFromTop(features, 3))[4]);
+
+	FreeImage_Unload(dst);
+	FreeImage_Unload(features);
+
+	// Tall pixels make the sides nearer than the top, the background is negative.
+	dst = FIA_EuclideanDistanceTransform(src, 1.0, 2.0, 1, NULL);
+
+	CuAssertDblEquals(tc, 2.0, ((float *) FIA_GetScanLineFromTop(dst, 3))[3], 0.0);
+	CuAssertDblEquals(tc, 3.0, ((float *) FIA_GetScanLineFromTop(dst, 3))[4], 0.0);
+	CuAssertDblEquals(tc, -1.0, ((float *) FIA_GetScanLineFromTop(dst, 3))[1], 0.0);
+	CuAssertDblEquals(tc, -4.0, ((float *) FIA_GetScanLineFromTop(dst, 0))[4], 0.0);
+
+	FreeImage_Unload(dst);
+	FreeImage_Unload(src);
+}
+
 /*
 static void PasteTest(CuTest* tc)
 {
@@ -500,6 +541,7 @@ CuGetFreeImageAlgorithmsUtilitySuite(void)
 	//SUITE_ADD_TEST(suite, TestFIA_UtilityTest);
 	//SUITE_ADD_TEST(suite, LineTest);
 	//SUITE_ADD_TEST(suite, TestFIA_DistanceTransformTest2);
+	SUITE_ADD_TEST(suite, TestFIA_EuclideanDistanceTransformTest);
 	//SUITE_ADD_TEST(suite, PasteTest);
 
 	return suite;
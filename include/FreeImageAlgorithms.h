@@ -67,6 +67,24 @@ typedef struct
 
 } FIAPOINT;
 
+typedef struct
+{
+	double x;
+	double y;
+
+} FIAPOINTD;
+
+/** Pixel of a single precision complex image.
+ *  FreeImage has no such type so these images are FIT_DOUBLE images
+ *  marked as complex, see FIA_IsComplexFloatImage.
+*/
+typedef struct
+{
+	float r;
+	float i;
+
+} FIACOMPLEXF;
+
 typedef enum
 {
     BorderType_Constant,
@@ -102,6 +120,21 @@ typedef enum _FIA_MatrixOrder {FIA_MatrixOrderPrepend = 0, FIA_MatrixOrderAppend
 #define _CPU_FEATURE_SSE    0x0002
 #define _CPU_FEATURE_SSE2   0x0004
 #define _CPU_FEATURE_3DNOW  0x0008
+#define _CPU_FEATURE_AVX    0x0010
+#define _CPU_FEATURE_AVX2   0x0020
+#define _CPU_FEATURE_FMA    0x0040
+#define _CPU_FEATURE_AVX512F 0x0080
+
+/** Instruction set levels used by the vectorised filters.
+ *  Each level includes the ones below it. FIA_ISA_AVX2 also needs FMA.
+*/
+typedef enum
+{
+	FIA_ISA_SCALAR,
+	FIA_ISA_SSE2,
+	FIA_ISA_AVX2,
+	FIA_ISA_AVX512
+} FIA_ISA_LEVEL;
 
 typedef enum {BIT_NONE=-1, BIT8, BIT16, BIT24, BIT32} FREEIMAGE_ALGORITHMS_SAVE_BITDEPTH;
 
@@ -192,6 +192,8 @@ DLL_API int DLL_CALLCONV
 FIA_SubtractGreyLevelImageConstant(FIBITMAP* dst, double constant);
 
 /** \brief Calculate the complex conjugate of a complex image.
+ *
+ *  A half spectrum from FIA_RealFFT stays a half spectrum.
  *
  *  \param src FIBITMAP bitmap must be of type complex.
  *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
@@ -200,6 +202,9 @@ DLL_API int DLL_CALLCONV
 FIA_ComplexConjugate(FIBITMAP* src);
 
 /** \brief Multiply two complex images.
+ *
+ *  Both images may be half spectra from FIA_RealFFT of the same width,
+ *  the product is then the half spectrum of the product of the full spectra.
  *
  *  \param dst FIBITMAP first bitmap to perform the multiply this also serves as the output.
  *  \param src FIBITMAP second bitmap to perform the multiply operation on.
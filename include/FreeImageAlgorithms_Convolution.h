@@ -38,10 +38,57 @@ typedef struct
 
 } FilterKernel;
 
-typedef enum {CORRELATION_KERNEL, CORRELATION_FFT} CorrelationType;
+typedef enum {CORRELATION_KERNEL, CORRELATION_FFT, CORRELATION_FAST_NCC} CorrelationType;
+
+typedef enum
+{
+	FIA_ACCUMULATOR_AUTO,
+	FIA_ACCUMULATOR_INT32,
+	FIA_ACCUMULATOR_FLOAT,
+	FIA_ACCUMULATOR_DOUBLE
+
+} FIA_ACCUMULATOR_TYPE;
+
+typedef enum
+{
+	FIA_CONVOLUTION_AUTO,
+	FIA_CONVOLUTION_DIRECT,
+	FIA_CONVOLUTION_SEPARABLE,
+	FIA_CONVOLUTION_FFT
+
+} FIA_CONVOLUTION_METHOD;
 
 typedef FIBITMAP* (__cdecl *CORRELATION_PREFILTER) (FIBITMAP*);
 
+/** A pair of images to correlate, indices into the image list
+ *  given to FIA_FFTCorrelateImagePairs.
+ */
+typedef struct
+{
+	int first;
+	int second;
+
+} FIA_CORRELATION_PAIR;
+
+typedef struct
+{
+	FIAPOINT shift;		// As pt from FIA_FFTCorrelateImages(first, second).
+	double peak;		// Peak over the product of the images' norms, 0 to 1 for positive images.
+	double quality;		// Peak height above the mean of the correlation in standard deviations.
+
+} FIA_CORRELATION_RESULT;
+
+/** How a correlation peak is located between pixels.
+ *  Both fits use the peak and its neighbours in x and in y.
+ */
+typedef enum
+{
+	FIA_PEAK_FIT_NONE,
+	FIA_PEAK_FIT_PARABOLIC,
+	FIA_PEAK_FIT_GAUSSIAN
+
+} FIA_PEAK_FIT;
+
 /** \brief Create a kernel.
  *
  *  \param x_radius for a kernel of width 3 the x radius would be 1.
@@ -54,7 +101,37 @@ DLL_API FilterKernel DLL_CALLCONV
 FIA_NewKernel(int x_radius, int y_radius, 
 							  const double *values, double divider);
 
+/** \brief Set how convolutions are calculated.
+ *
+ *  FIA_CONVOLUTION_AUTO, the default, estimates the cost of each method for
+ *  the image and kernel and uses the cheapest. It does not pick the FFT
+ *  when the sums are in double.
+ *  FIA_CONVOLUTION_DIRECT sums the kernel at every pixel.
+ *  FIA_CONVOLUTION_SEPARABLE applies a rank one kernel as a horizontal then
+ *  a vertical pass, other kernels are summed directly.
+ *  FIA_CONVOLUTION_FFT multiplies overlap-save tiles of the image with the
+ *  kernel in the frequency domain. The sums are accurate to single precision.
+ *  Forcing a method is mostly useful for benchmarking.
+ *
+ *  \param method FIA_CONVOLUTION_METHOD to use.
+*/
+DLL_API void DLL_CALLCONV
+FIA_SetConvolutionMethod(FIA_CONVOLUTION_METHOD method);
+
+/** \brief Get the method set by FIA_SetConvolutionMethod.
+ *
+ *  \return FIA_CONVOLUTION_METHOD.
+*/
+DLL_API FIA_CONVOLUTION_METHOD DLL_CALLCONV
+FIA_GetConvolutionMethod(void);
+
 /** \brief Convolve and image with a kernel.
+ *
+ *  Kernels that are the product of a column and a row, like gaussian or square
+ *  kernels, are detected and applied as a horizontal then a vertical pass.
+ *  The sums are in double, or exact in an int for whole number kernels on
+ *  8 and 16 bit images, which may then use an FFT if the kernel is large.
+ *  See FIA_SetConvolutionMethod.
  *
  *  \param src FIBITMAP bitmap to perform the convolution on.
  *  \param kernel FilterKernel The kernel created with FIA_NewKernel.
@@ -63,6 +140,43 @@ FIA_NewKernel(int x_radius, int y_radius,
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_Convolve(FIABITMAP *src, const FilterKernel kernel);
 
+/** \brief Convolve an image with a kernel in the image's own type.
+ *
+ *  8bit, 16bit, float and double greyscale images are read directly rather than
+ *  being converted to a double image first. Other images are converted to double.
+ *  FIA_ACCUMULATOR_INT32 needs an 8 or 16 bit image and a kernel of whole numbers.
+ *  FIA_ACCUMULATOR_AUTO uses int32 when the sums are exact in an int,
+ *  otherwise double for a FIT_DOUBLE result and float for anything else.
+ *
+ *  \param src FIBITMAP bitmap to perform the convolution on.
+ *  \param kernel FilterKernel The kernel created with FIA_NewKernel.
+ *  \param dst_type FREE_IMAGE_TYPE of the result. Integer results are rounded and clamped.
+ *  \param accumulator FIA_ACCUMULATOR_TYPE the type the kernel sums are calculated in.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_ConvolveToType(FIABITMAP *src, const FilterKernel kernel, FREE_IMAGE_TYPE dst_type,
+				   FIA_ACCUMULATOR_TYPE accumulator);
+
+/** \brief Convolve an image with a kernel approximated by a sum of separable kernels.
+ *
+ *  The kernel is split by singular value decomposition into terms of a column
+ *  times a row, and terms are added largest first until the Frobenius norm of
+ *  the part left out is below tolerance times the norm of the kernel.
+ *  Each term is applied as a horizontal then a vertical pass.
+ *  If the kernel needs more than max_terms terms, or the terms would cost as much
+ *  as the full kernel, the image is convolved with the full kernel instead.
+ *
+ *  \param src FIBITMAP bitmap to perform the convolution on.
+ *  \param kernel FilterKernel The kernel created with FIA_NewKernel.
+ *  \param max_terms The most separable terms to use.
+ *  \param tolerance The allowed relative error of the approximated kernel, eg 1e-3.
+ *  \return FIBITMAP of type FIT_DOUBLE on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_ConvolveSeparableApproximation(FIABITMAP *src, const FilterKernel kernel, int max_terms,
+				   double tolerance);
+
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_SeparableConvolve(FIABITMAP *src, FilterKernel horz_kernel, FilterKernel vert_kernel);
 
@@ -70,6 +184,42 @@ DLL_API int DLL_CALLCONV
 FIA_KernelCorrelateImages(FIBITMAP *src1, FIBITMAP *src2, FIARECT search_area, FIBITMAP *mask,
 						  CORRELATION_PREFILTER filter, FIAPOINT *pt, double *max);
 
+/** \brief FIA_KernelCorrelateImages using sums tables and an FFT.
+ *
+ *  Lewis' fast normalised cross correlation. The numerator of each
+ *  correlation comes from one FFT correlation with the template less its
+ *  mean, and the image sums under the template from summed area tables,
+ *  so the time hardly depends on the template size.
+ *  The results are those of FIA_KernelCorrelateImages to single precision,
+ *  except that windows with no variation give 0.
+ *  Also used by FIA_CorrelateImages for CORRELATION_FAST_NCC.
+ *
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+ *  The parameters are those of FIA_KernelCorrelateImages.
+*/
+DLL_API int DLL_CALLCONV
+FIA_FastNCCCorrelateImages(FIBITMAP *src1, FIBITMAP *src2, FIARECT search_area, FIBITMAP *mask,
+						  CORRELATION_PREFILTER filter, FIAPOINT *pt, double *max);
+
+/** \brief FIA_KernelCorrelateImages searching an image pyramid from coarse to fine.
+ *
+ *  The images are halved levels - 1 times. Only the coarsest level is searched
+ *  over the whole search area, each finer level is searched within refine_radius
+ *  pixels of twice the point found at the level above. This is much faster for
+ *  large search areas but can miss a peak that is too narrow to show at the
+ *  coarse levels. Fewer levels are used if the coarsest template would be
+ *  smaller than 8 pixels.
+ *
+ *  \param levels int number of pyramid levels, 1 is the same as FIA_KernelCorrelateImages.
+ *  \param refine_radius int pixels either side searched at the finer levels, 2 is usually enough.
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+ *  The other parameters are those of FIA_KernelCorrelateImages.
+*/
+DLL_API int DLL_CALLCONV
+FIA_KernelCorrelateImagesMultiResolution(FIBITMAP *src1, FIBITMAP *src2, FIARECT search_area,
+        FIBITMAP *mask, CORRELATION_PREFILTER filter, int levels, int refine_radius,
+        FIAPOINT *pt, double *max);
+
 /** \brief Correlate two regions from two two images
  *
  *  \param src1 FIBITMAP Background bitmap to perform the correlation on.
@@ -103,10 +253,59 @@ DLL_API int DLL_CALLCONV
 FIA_FFTCorrelateImageWithPreCorrelationFFT(FIBITMAP * fft_fib, FIBITMAP *_src1, FIBITMAP *_src2, int pad_size,
         CORRELATION_PREFILTER filter, FIAPOINT * pt);
 
+/** \brief FFT correlation giving the shift to a fraction of a pixel.
+ *
+ *  Phase only correlation divides the cross power spectrum by its magnitude,
+ *  which gives a sharp peak whose height is a measure of how well the images
+ *  match, 1.0 for an exact shift of the same image and near 0 for no match.
+ *  The filtered images have their means taken away and are tapered to zero
+ *  at the edges first, so the edges do not give a peak at no shift.
+ *
+ *  \param src1 FIBITMAP Background image.
+ *  \param src2 FIBITMAP Image of the same type and bpp to place over it.
+ *  \param filter CORRELATION_PREFILTER filter run on each image, or NULL.
+ *  \param phase_only int 1 for phase only correlation, 0 for cross correlation.
+ *  \param fit FIA_PEAK_FIT how the peak is fitted between pixels.
+ *  \param pt FIAPOINTD The shift, as pt from FIA_FFTCorrelateImages.
+ *  \param peak double The normalised peak height, may be NULL.
+ *         For cross correlation the peak over the product of the images' norms.
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_FFTCorrelateImagesSubpixel(FIBITMAP *src1, FIBITMAP *src2, CORRELATION_PREFILTER filter,
+        int phase_only, FIA_PEAK_FIT fit, FIAPOINTD *pt, double *peak);
+
+/** \brief Correlates many pairs of images, such as neighbouring tiles of a mosaic.
+ *
+ *  Each image is filtered and transformed once however many pairs it is in,
+ *  and the pairs are correlated in parallel. The images are all padded to
+ *  one size, so every spectrum is kept until the pairs are done; very long
+ *  lists can be split into several calls.
+ *
+ *  \param images FIBITMAP** images of the same type and bpp.
+ *  \param number_of_images int number of images.
+ *  \param pairs FIA_CORRELATION_PAIR* pairs of indices into images.
+ *  \param number_of_pairs int number of pairs.
+ *  \param filter CORRELATION_PREFILTER filter run on each image, or NULL.
+ *  \param results FIA_CORRELATION_RESULT* number_of_pairs results.
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_FFTCorrelateImagePairs(FIBITMAP **images, int number_of_images,
+        const FIA_CORRELATION_PAIR *pairs, int number_of_pairs,
+        CORRELATION_PREFILTER filter, FIA_CORRELATION_RESULT *results);
+
 DLL_API FIBITMAP* __cdecl
 FIA_EdgeDetect(FIBITMAP *src);
 
-
+/** \brief Finds where src2 is in src1 with the method given by type.
+ *
+ *  CORRELATION_KERNEL and CORRELATION_FAST_NCC search the whole of src1 as
+ *  FIA_KernelCorrelateImages and FIA_FastNCCCorrelateImages do,
+ *  CORRELATION_FFT uses FIA_FFTCorrelateImages.
+ *
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+*/
 DLL_API int DLL_CALLCONV
 FIA_CorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, CorrelationType type,
         CORRELATION_PREFILTER filter, FIAPOINT * pt);
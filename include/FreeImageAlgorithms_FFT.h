@@ -42,8 +42,152 @@ FIA_FFT(FIBITMAP *src);
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_IFFT(FIBITMAP *src);
 
+/** \brief Forward FFT that gives a single precision complex image.
+ *
+ *  The transforms are computed in single precision, a FIACOMPLEXF image
+ *  holds the result without widening it and takes half the memory of a
+ *  FIT_COMPLEX one. FIA_IFFT, FIA_RealIFFT, FIA_ComplexConjugate,
+ *  FIA_MultiplyComplexImages and the conversions to absolute and real
+ *  values take these images and give single precision results.
+ *
+ *  \param src FIBITMAP 8 bit, 16 bit, 32 bit, float, double or complex image.
+ *  \return FIBITMAP* single precision complex image on success and NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_FFTToComplexFloat(FIBITMAP *src);
+
+/** \brief Returns whether an image is a single precision complex image.
+ *
+ *  These are FIT_DOUBLE images whose pixels are FIACOMPLEXF, marked by a
+ *  metadata tag. Functions that do not document them see a double image.
+ *
+ *  \param src FIBITMAP image.
+ *  \return int 1 for single precision complex images and 0 otherwise.
+*/
+DLL_API int DLL_CALLCONV
+FIA_IsComplexFloatImage(FIBITMAP *src);
+
+/** \brief Forward FFT of a real image that keeps only half the spectrum.
+ *
+ *  The spectrum of a real image is Hermitian, X(-u, -v) is the conjugate
+ *  of X(u, v), so only the first width / 2 + 1 columns are needed. This
+ *  does about half the work of FIA_FFT and returns a half spectrum, a
+ *  FIT_COMPLEX image width / 2 + 1 wide that records the width of src.
+ *
+ *  FIA_ComplexConjugate and FIA_MultiplyComplexImages work on half spectra
+ *  as they are, so correlations can stay in half spectra until FIA_RealIFFT.
+ *  FIA_ConvertComplexImageToAbsoluteValued, FIA_ConvertComplexImageToAbsoluteValuedSquared
+ *  and FIA_ComplexImageToRealValued return images of the full width.
+ *
+ *  \param src FIBITMAP 8 bit, 16 bit, 32 bit, float or double image.
+ *  \return FIT_COMPLEX FIBITMAP* on success and NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_RealFFT(FIBITMAP *src);
+
+/** \brief As FIA_RealFFT giving a single precision half spectrum.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_RealFFTToComplexFloat(FIBITMAP *src);
+
+/** \brief Inverse FFT of a half spectrum from FIA_RealFFT.
+ *
+ *  Like FIA_IFFT the result is not divided by the number of pixels.
+ *
+ *  \param src FIBITMAP half spectrum.
+ *  \return FIT_DOUBLE FIBITMAP* on success and NULL on error,
+ *          FIT_FLOAT for a single precision half spectrum.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_RealIFFT(FIBITMAP *src);
+
+/** \brief Returns the width of the image a half spectrum was made from.
+ *
+ *  \param src FIBITMAP image.
+ *  \return int the width, or 0 if src is not a half spectrum.
+*/
+DLL_API int DLL_CALLCONV
+FIA_GetHalfSpectrumWidth(FIBITMAP *src);
+
+/** \brief A reusable FFT of one size and direction.
+ *
+ *  FIA_FFT and FIA_IFFT take plans from an internal cache so repeated
+ *  transforms of the same size do not set up the transform or allocate its
+ *  buffers again. An explicit plan does the same without the cache lookup.
+ *  A plan must only be used by one thread at a time, though it splits its
+ *  own row and column passes over the threads set with FIA_SetNumberOfThreads.
+ */
+typedef struct FIA_FFT_PLAN FIA_FFT_PLAN;
+
+/** \brief Creates an FFT plan.
+ *
+ *  \param width int width of the images to transform.
+ *  \param height int height of the images to transform.
+ *  \param inverse int non zero for an inverse transform.
+ *  \return FIA_FFT_PLAN* on success and NULL on error.
+*/
+DLL_API FIA_FFT_PLAN* DLL_CALLCONV
+FIA_CreateFFTPlan(int width, int height, int inverse);
+
+/** \brief Creates an FFT plan for real images and half spectra.
+ *
+ *  A forward plan transforms a real image to a half spectrum as FIA_RealFFT
+ *  does, an inverse plan transforms a half spectrum back as FIA_RealIFFT does.
+ *
+ *  \param width int width of the real images.
+ *  \param height int height of the real images.
+ *  \param inverse int non zero for an inverse transform.
+ *  \return FIA_FFT_PLAN* on success and NULL on error.
+*/
+DLL_API FIA_FFT_PLAN* DLL_CALLCONV
+FIA_CreateRealFFTPlan(int width, int height, int inverse);
+
+/** \brief Transforms an image with a plan.
+ *
+ *  \param plan FIA_FFT_PLAN* plan made for the size of src.
+ *  \param src FIBITMAP 8 bit, 16 bit, 32 bit, float, double or complex image,
+ *         or a half spectrum for an inverse real plan.
+ *  \return FIT_COMPLEX FIBITMAP* on success and NULL on error,
+ *          FIT_DOUBLE for an inverse real plan. Single precision
+ *          complex images give single precision results.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_ExecuteFFTPlan(FIA_FFT_PLAN *plan, FIBITMAP *src);
+
+/** \brief Transforms an image with a plan giving single precision results.
+ *
+ *  As FIA_ExecuteFFTPlan but spectra are single precision complex images
+ *  and inverse real plans give FIT_FLOAT images.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_ExecuteFFTPlanToComplexFloat(FIA_FFT_PLAN *plan, FIBITMAP *src);
+
+/** \brief Limits the number of threads a plan uses.
+ *
+ *  Useful when several plans are run at once from different threads.
+ *
+ *  \param plan FIA_FFT_PLAN* plan.
+ *  \param number_of_threads int most threads to use, 0 for all the
+ *         threads set with FIA_SetNumberOfThreads.
+ *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_SetFFTPlanNumberOfThreads(FIA_FFT_PLAN *plan, int number_of_threads);
+
+/** \brief Frees a plan made with FIA_CreateFFTPlan or FIA_CreateRealFFTPlan.
+*/
+DLL_API void DLL_CALLCONV
+FIA_DestroyFFTPlan(FIA_FFT_PLAN *plan);
+
+/** \brief Frees the plans cached by FIA_FFT and FIA_IFFT.
+*/
+DLL_API void DLL_CALLCONV
+FIA_ClearFFTPlanCache(void);
+
 /** \brief Creates a FIT_DOUBLE absolute image from a complex image.
  *	
+ *  Single precision complex images give FIT_FLOAT images.
+ *
  *  \param src FIBITMAP complex image.
  *  \return FIBITMAP* on success and NULL on error.
 */
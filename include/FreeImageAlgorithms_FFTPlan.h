@@ -0,0 +1,79 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __FREEIMAGE_ALGORITHMS_FFT_PLAN__
+#define __FREEIMAGE_ALGORITHMS_FFT_PLAN__
+
+/*! \file
+	Private view of FFT plans for code in the library that runs transforms
+	on its own buffers rather than on images.
+*/
+
+#include "FreeImageAlgorithms_FFT.h"
+#include "kiss_fft.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** A plan holds the kiss_fft state for its rows and columns and a buffer
+ *  of width * height values, the top row first. The row and column passes
+ *  are split over the thread pool with scratch memory for each band.
+ *  A real plan only keeps the half spectrum, its buffer has
+ *  width / 2 + 1 values per row.
+ *  It must only be used by one thread at a time.
+ */
+struct FIA_FFT_PLAN
+{
+	int width;
+	int height;
+	int inverse;
+	int real;
+	int threads;					// Most bands in a pass, 0 for the pool's size.
+	kiss_fft_cfg row_cfg;
+	kiss_fft_cfg column_cfg;
+	kiss_fft_cpx *buffer;
+	kiss_fft_cpx *scratch;			// Rows and blocks of columns for each band.
+	int scratch_bands;
+
+	struct FIA_FFT_PLAN *next;		// Next idle plan in the cache.
+};
+
+/** Takes a plan from the cache, or makes one if there is none of that size idle.
+ *  Returns NULL if there is not enough memory.
+ */
+FIA_FFT_PLAN* FIA_AcquireFFTPlan(int width, int height, int inverse);
+
+/** As FIA_AcquireFFTPlan for a real plan.
+ */
+FIA_FFT_PLAN* FIA_AcquireRealFFTPlan(int width, int height, int inverse);
+
+/** Gives a plan from FIA_AcquireFFTPlan back to the cache.
+ */
+void FIA_ReleaseFFTPlan(FIA_FFT_PLAN *plan);
+
+/** Transforms width * height values of a complex plan's size in place,
+ *  usually the plan's buffer.
+ */
+void FIA_RunFFTPlan(FIA_FFT_PLAN *plan, kiss_fft_cpx *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
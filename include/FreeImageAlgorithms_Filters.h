@@ -29,13 +29,17 @@ typedef enum
 {
 	FIA_BINNING_SQUARE,
 	FIA_BINNING_CIRCULAR,
-	FIA_BINNING_GAUSSIAN
+	FIA_BINNING_GAUSSIAN,
+	FIA_BINNING_GAUSSIAN_RECURSIVE
 
 } FIA_BINNING_TYPE;
 
 /*! \file 
  *	Provides a median filter function.
  *
+ *  3x3 and 5x5 windows use vectorised sorting networks. Other sizes use a
+ *  sliding histogram for integer data or a sorted window otherwise.
+ *
  *  \param src FIBITMAP bitmap to perform the convolution on.
  *  \param kernel_x_radius for a kernel of width 3 the x radius would be 1.
  *  \param kernel_y_radius for a kernel of height 3 the y radius would be 1.
@@ -72,9 +76,57 @@ FIA_SobelAdvanced(FIBITMAP *src,
                                   FIBITMAP** horizontal,
                                   FIBITMAP** magnitude);
 
+/** \brief Sums the pixels in a square, circular or gaussian weighted region around each pixel.
+ *
+ *  FIA_BINNING_SQUARE costs the same whatever the radius.
+ *  FIA_BINNING_GAUSSIAN_RECURSIVE approximates FIA_BINNING_GAUSSIAN with a recursive
+ *  filter whose cost does not depend on the radius either.
+ *
+ *  \param src FIBITMAP greyscale bitmap to bin.
+ *  \param type FIA_BINNING_TYPE shape of the region.
+ *  \param radius int radius of the region.
+ *  \return FIBITMAP on success or NULL on error.
+*/
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_Binning (FIBITMAP * src, FIA_BINNING_TYPE, int radius);
 
+/** \brief Mean of the rectangle around each pixel.
+ *
+ *  A running sum is used so the cost does not depend on the radius.
+ *  The border of src must be at least the radius, the result does not include it.
+ *
+ *  \param src FIABITMAP greyscale bitmap to filter.
+ *  \param x_radius for a box of width 3 the x radius would be 1.
+ *  \param y_radius for a box of height 3 the y radius would be 1.
+ *  \return FIBITMAP of type FIT_DOUBLE on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_BoxFilter(FIABITMAP* src, int x_radius, int y_radius);
+
+/** \brief Sum of the rectangle around each pixel.
+ *
+ *  As FIA_BoxFilter without the division.
+ *
+ *  \param src FIABITMAP greyscale bitmap to filter.
+ *  \param x_radius for a box of width 3 the x radius would be 1.
+ *  \param y_radius for a box of height 3 the y radius would be 1.
+ *  \return FIBITMAP of type FIT_DOUBLE on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_BoxSum(FIABITMAP* src, int x_radius, int y_radius);
+
+/** \brief Gaussian blur by Young and van Vliet's recursive filter.
+ *
+ *  The cost per pixel does not depend on sigma. The border of src is used to start
+ *  the filter off and is not part of the result, a border of about 3 sigma is enough.
+ *
+ *  \param src FIABITMAP greyscale bitmap to filter.
+ *  \param sigma double standard deviation of the gaussian, at least 0.5.
+ *  \return FIBITMAP of type FIT_DOUBLE on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_RecursiveGaussianFilter(FIABITMAP* src, double sigma);
+
 #ifdef __cplusplus
 }
 #endif
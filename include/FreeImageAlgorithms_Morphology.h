@@ -21,11 +21,56 @@
 
 #include "FreeImageAlgorithms.h"
 #include "FreeImageAlgorithms_Convolution.h"
+#include "FreeImageAlgorithms_Particle.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef enum
+{
+	FIA_MORPHOLOGY_DILATION,
+	FIA_MORPHOLOGY_EROSION
+
+} FIA_MORPHOLOGY_OPERATION;
+
+typedef enum
+{
+	FIA_STRUCTURING_ELEMENT_RECTANGLE,
+	FIA_STRUCTURING_ELEMENT_DIAMOND,
+	FIA_STRUCTURING_ELEMENT_DISK
+
+} FIA_STRUCTURING_ELEMENT;
+
+/*! \file 
+ *	Fills in the values of a square structuring element for use with FIA_NewKernel.
+ *
+ *  \param shape FIA_STRUCTURING_ELEMENT shape of the element.
+ *  \param radius int radius of the element, values must hold (2 * radius + 1)^2 doubles.
+ *  \param values double* set to 1.0 inside the shape and 0.0 outside.
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_MakeStructuringElement(FIA_STRUCTURING_ELEMENT shape, int radius, double *values);
+
+/*! \file 
+ *	Performs a sequence of dilations and erosions with the same kernel.
+ *	The image is held one bit per pixel between operations and is given
+ *	a border of zeros before each one, so an opening is
+ *	{FIA_MORPHOLOGY_EROSION, FIA_MORPHOLOGY_DILATION}.
+ *	Kernel values greater than zero are in the structuring element.
+ *	Pixels set in src keep their values, pixels the operations set are 255.
+ *
+ *  \param src FIABITMAP 8 bit bitmap with a border at least as large as the kernel radius.
+ *  \param kernel FilterKernel kernel to use (e.g. create with FIA_NewKernel)
+ *  \param operations FIA_MORPHOLOGY_OPERATION* operations to perform in order.
+ *  \param count int number of operations.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_BinaryMorphology(FIABITMAP* src, FilterKernel kernel,
+					 const FIA_MORPHOLOGY_OPERATION *operations, int count);
+
 /*! \file 
  *	Dilates the particles in an image.
  *
@@ -119,6 +164,117 @@ DLL_API FIBITMAP *DLL_CALLCONV
 FIA_BinaryOuterBorder (FIBITMAP * src);
 
 
+typedef enum
+{
+	FIA_GREYSCALE_EROSION,
+	FIA_GREYSCALE_DILATION,
+	FIA_GREYSCALE_OPENING,
+	FIA_GREYSCALE_CLOSING,
+	FIA_GREYSCALE_WHITE_TOP_HAT,
+	FIA_GREYSCALE_BLACK_TOP_HAT,
+	FIA_GREYSCALE_GRADIENT
+
+} FIA_GREYSCALE_MORPHOLOGY_OPERATION;
+
+/*! \file 
+ *	Greyscale morphology with a rectangular structuring element.
+ *	Erosion is the minimum and dilation the maximum over the rectangle,
+ *	opening is an erosion then a dilation and closing the reverse.
+ *	The white top hat is src minus its opening, the black top hat the closing
+ *	minus src and the gradient the dilation minus the erosion. Differences too
+ *	large for a signed type are clipped to its largest value.
+ *	The cost per pixel does not depend on the size of the rectangle.
+ *	The border of src is used, pixels outside it are ignored.
+ *
+ *  \param src FIABITMAP 8 bit, 16 bit, 32 bit, float or double greyscale bitmap.
+ *  \param x_radius int half width of the rectangle.
+ *  \param y_radius int half height of the rectangle.
+ *  \param operation FIA_GREYSCALE_MORPHOLOGY_OPERATION operation to perform.
+ *  \return FIBITMAP of the same type without the border on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleMorphology(FIABITMAP* src, int x_radius, int y_radius,
+						FIA_GREYSCALE_MORPHOLOGY_OPERATION operation);
+
+/*! \file 
+ *	Greyscale erosion, the minimum over a rectangle. See FIA_GreyscaleMorphology.
+ *
+ *  \param src FIABITMAP greyscale bitmap.
+ *  \param x_radius int half width of the rectangle.
+ *  \param y_radius int half height of the rectangle.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleErosion(FIABITMAP* src, int x_radius, int y_radius);
+
+/*! \file 
+ *	Greyscale dilation, the maximum over a rectangle. See FIA_GreyscaleMorphology.
+ *
+ *  \param src FIABITMAP greyscale bitmap.
+ *  \param x_radius int half width of the rectangle.
+ *  \param y_radius int half height of the rectangle.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_GreyscaleDilation(FIABITMAP* src, int x_radius, int y_radius);
+
+typedef enum
+{
+	FIA_RECONSTRUCTION_BY_DILATION,
+	FIA_RECONSTRUCTION_BY_EROSION
+
+} FIA_RECONSTRUCTION_OPERATION;
+
+/*! \file 
+ *	Morphological reconstruction of marker under mask, in place.
+ *	By dilation the marker is grown into the mask until it is stable, each
+ *	pixel ends as the highest value that can reach it along a path never
+ *	above the mask. By erosion is the reverse, the marker should start above
+ *	the mask. Uses a forward and a backward scan with a queue for the pixels
+ *	left over, so the time is linear in the number of pixels for binary and
+ *	greyscale images alike.
+ *
+ *  \param marker FIBITMAP 8 bit, 16 bit, 32 bit, float or double greyscale bitmap, replaced by the result.
+ *  \param mask FIBITMAP bitmap of the same type and size as marker.
+ *  \param operation FIA_RECONSTRUCTION_OPERATION reconstruction by dilation or by erosion.
+ *  \param connectivity FIA_CONNECTIVITY neighbours a value can spread to.
+ *  \return FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_MorphologicalReconstruction(FIBITMAP *marker, FIBITMAP *mask,
+								FIA_RECONSTRUCTION_OPERATION operation, FIA_CONNECTIVITY connectivity);
+
+/*! \file 
+ *	Finds the regional maxima of an image, the plateaus with no higher neighbour.
+ *	The maxima come from a reconstruction by dilation of the image lowered by one
+ *	step, so plateaus of any size are found in linear time.
+ *	Pixels at the lowest value of the type are never maxima.
+ *
+ *  \param src FIBITMAP 8 bit, 16 bit, 32 bit, float or double greyscale bitmap.
+ *  \param connectivity FIA_CONNECTIVITY neighbours that make up a plateau.
+ *  \return FIBITMAP 8 bit bitmap, 255 on the maxima and 0 elsewhere, on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_RegionalMaxima(FIBITMAP *src, FIA_CONNECTIVITY connectivity);
+
+/*! \file 
+ *	Marker controlled watershed. Each marker floods the image from its
+ *	lowest pixels up, a pixel takes the label of the basin that reaches it
+ *	first. The flooding uses one queue for each grey level so the time is
+ *	linear in the number of pixels for 8 and 16 bit images. Float images
+ *	are ranked by a sort first.
+ *
+ *  \param src FIBITMAP 8 bit, 16 bit or float greyscale bitmap to flood, often a gradient or an inverted distance map.
+ *  \param markers FIBITMAP FIT_INT32 labels with the markers above 0, or an 8 bit image whose non zero particles are the markers.
+ *  \param mask FIBITMAP 8 bit bitmap, only pixels that are not 0 are flooded, may be NULL.
+ *  \param connectivity FIA_CONNECTIVITY neighbours a basin can spread to.
+ *  \param watershed_lines int if set the pixels where basins meet are left as 0.
+ *  \return FIBITMAP of type FIT_INT32 with the label of each basin, 0 outside the mask and on lines, on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_Watershed(FIBITMAP *src, FIBITMAP *markers, FIBITMAP *mask,
+			  FIA_CONNECTIVITY connectivity, int watershed_lines);
+
 #ifdef __cplusplus
 }
 #endif
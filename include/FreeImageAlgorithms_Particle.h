@@ -58,6 +58,42 @@ typedef struct
 
 } PARTICLEINFO;
 
+/** Which neighbours of a pixel count as touching it when labelling particles.
+*/
+typedef enum
+{
+	FIA_CONNECTIVITY_4 = 4,		// Pixels sharing an edge.
+	FIA_CONNECTIVITY_8 = 8		// Pixels sharing an edge or a corner.
+
+} FIA_CONNECTIVITY;
+
+/** Measurements of all the particles in an image.
+ *  Each array has a value for each particle in label order, so the particle
+ *  labelled n by FIA_LabelParticles is at index n - 1.
+ *  Positions are relative to the top left.
+ *  The intensity arrays are NULL unless an intensity image was measured.
+*/
+typedef struct
+{
+	int number_of_particles;
+
+	FIARECT *rect;
+	int *area;
+	double *centre_x;
+	double *centre_y;
+	double *perimeter;				// Pixel edges between the particle and anything else.
+	double *orientation;			// Angle of the major axis from the x axis in radians, y down.
+	double *eccentricity;			// Of the ellipse with the same second moments, 0 for a circle.
+
+	double *integrated_intensity;
+	double *min_intensity;
+	double *max_intensity;
+	double *mean_intensity;
+	double *intensity_centre_x;		// Centre weighted by intensity.
+	double *intensity_centre_y;
+
+} FIA_PARTICLE_MEASUREMENTS;
+
 
 DLL_API void DLL_CALLCONV
 FIA_EnableOldBrokenCodeCompatibility(void);
@@ -74,6 +110,24 @@ DLL_API int DLL_CALLCONV
 FIA_ParticleInfo(FIBITMAP* src, PARTICLEINFO** info, unsigned char white_on_black);
 
 
+/** \brief Labels each particle or blob in an image.
+ *
+ *  Particles are numbered from 1 in the order they are first met scanning
+ *  rows from the top left, the background is 0.
+ *  The rows are split into strips labelled on separate threads which are then joined.
+ *  Memory used besides the label image depends on the number of runs of particle pixels.
+ *
+ *  \param src FIBITMAP Image with blobs must be a binary 8bit image.
+ *  \param white_on_black unsigned char If set particles are the non zero pixels, otherwise the zero pixels.
+ *  \param connectivity FIA_CONNECTIVITY Whether pixels touching at a corner are in the same particle.
+ *  \param number_of_particles int* Returns the number of particles found, may be NULL.
+ *  \return FIBITMAP of type FIT_INT32 on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_LabelParticles(FIBITMAP* src, unsigned char white_on_black, FIA_CONNECTIVITY connectivity,
+				   int *number_of_particles);
+
+
 /** \brief Frees the data returned by FIA_ParticleInfo.
  *
  *  \param info PARTICLEINFO* pointer to particle information.
@@ -83,9 +137,37 @@ DLL_API void DLL_CALLCONV
 FIA_FreeParticleInfo(PARTICLEINFO* info);
 
 
+/** \brief Measures every particle or blob in an image.
+ *
+ *  The particles are labelled as FIA_LabelParticles does and all the
+ *  measurements are summed in one pass over the runs of particle pixels
+ *  and the intensity image. Sums are kept in 64 bits.
+ *
+ *  \param src FIBITMAP Image with blobs must be a binary 8bit image.
+ *  \param white_on_black unsigned char If set particles are the non zero pixels, otherwise the zero pixels.
+ *  \param connectivity FIA_CONNECTIVITY Whether pixels touching at a corner are in the same particle.
+ *  \param intensity FIBITMAP Greyscale image the same size as src to measure under each particle, may be NULL.
+ *  \param measurements FIA_PARTICLE_MEASUREMENTS** Returns the measurements, free with FIA_FreeParticleMeasurements.
+ *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_MeasureParticles(FIBITMAP* src, unsigned char white_on_black, FIA_CONNECTIVITY connectivity,
+					 FIBITMAP* intensity, FIA_PARTICLE_MEASUREMENTS** measurements);
+
+
+/** \brief Frees the data returned by FIA_MeasureParticles.
+*/
+DLL_API void DLL_CALLCONV
+FIA_FreeParticleMeasurements(FIA_PARTICLE_MEASUREMENTS* measurements);
+
+
 /** \brief Fills the hole in a particle or blob image.
  *
- *  Image data is an 8bit binary image.
+ *  Image data is an 8bit binary image. A hole is background that cannot be
+ *  reached from the edge of the image without crossing a particle, moving
+ *  between pixels that share an edge. Holes are set to 255, or to 0 when
+ *  white_on_black is 0, and every other pixel is left as it was.
+ *  Particles may touch the edge anywhere.
  *
  *  \param src FIBITMAP Image with blobs must be a binary 8bit image.
  *  \param white_on_black unsigned char Determines the background intensity value.
@@ -95,6 +177,18 @@ DLL_API FIBITMAP* DLL_CALLCONV
 FIA_Fillholes(FIBITMAP* src,
 							 unsigned char white_on_black);
 
+/** \brief Removes the particles that touch the edge of the image.
+ *
+ *  The pixels of those particles are set to the background value.
+ *
+ *  \param src FIBITMAP Image with blobs must be a binary 8bit image.
+ *  \param white_on_black unsigned char Determines the background intensity value.
+ *  \param connectivity FIA_CONNECTIVITY Whether pixels touching at a corner are in the same particle.
+ *  \return FIBITMAP on success or NULL on error.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_RemoveBorderParticles(FIBITMAP* src, unsigned char white_on_black, FIA_CONNECTIVITY connectivity);
+
 
 /** \brief Finds the maxima within particles or blobs.
  *
@@ -122,6 +216,29 @@ FIA_FindImageMaxima(FIBITMAP* src, FIBITMAP *mask,
 DLL_API void DLL_CALLCONV
 FIA_FreePeaks(FIAPeak *peaks);
 
+/** \brief Finds the brightest maxima in an image without drawing them.
+ *
+ *  Maxima are found as FIA_FindImageMaxima does, each plateau giving one peak at its
+ *  centre. Peaks are then taken brightest first, dropping any closer than
+ *  min_separation to a brighter one, until number have been taken.
+ *  Only the candidates looked at are ordered, so asking for a few peaks
+ *  out of many is cheap.
+ *
+ *  \param src FIBITMAP Greyscale image of particles.
+ *  \param mask FIBITMAP 8bit image the same size as src, peaks where it is zero are dropped. May be NULL.
+ *  \param threshold double Only pixels above the threshold can be maxima.
+ *  \param min_separation int The minimum distance in pixels between peaks, 1 or less keeps every peak.
+ *  \param number int Number of peaks to find. If 0 then all peaks are returned.
+ *  \param peaks FIAPeak ** Returns the peaks brightest first, free with FIA_FreePeaks.
+ *         Positions are in scanline order, as FIA_GetPixelValue takes them.
+ *  \param peaks_found int* Number of peaks returned.
+ *  \param peak_image FIBITMAP** If not NULL returns an 8bit image with each peak set to 255.
+ *  \return int FIA_SUCCESS on success or FIA_ERROR on error.
+*/
+DLL_API int DLL_CALLCONV
+FIA_FindImagePeaks(FIBITMAP* src, FIBITMAP *mask, double threshold, int min_separation,
+				   int number, FIAPeak **peaks, int *peaks_found, FIBITMAP **peak_image);
+
 DLL_API int DLL_CALLCONV
 FIA_ATrousWaveletTransform(FIBITMAP* src, int levels, FIBITMAP** W);
 
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __FREEIMAGE_ALGORITHMS_SIMD__
+#define __FREEIMAGE_ALGORITHMS_SIMD__
+
+/*! \file
+	Private vectorised inner loops. Each instruction set lives in its own
+	source file built with the matching compiler flags, and the one to use is
+	picked at run time from FIA_GetISALevel.
+*/
+
+#include "FreeImageAlgorithms.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Convolves one output row.
+ *  src points at the bottom left pixel under the kernel for the first output pixel,
+ *  src_pitch is the image pitch in pixels and kernel holds kernel_height rows of
+ *  kernel_width values. dst[x] is set to the sum of the kernel times the image
+ *  for width output pixels.
+ */
+typedef void (*FIA_FloatConvolveRowFunction) (const float *src, int src_pitch,
+        const float *kernel, int kernel_width, int kernel_height, float *dst, int width);
+
+typedef void (*FIA_ShortConvolveRowFunction) (const short *src, int src_pitch,
+        const int *kernel, int kernel_width, int kernel_height, int *dst, int width);
+
+typedef void (*FIA_UShortConvolveRowFunction) (const unsigned short *src, int src_pitch,
+        const int *kernel, int kernel_width, int kernel_height, int *dst, int width);
+
+/** Median filters one output row with a 3x3 (radius 1) or 5x5 (radius 2) window.
+ *  rows holds the 2 * radius + 1 source rows, each pointing at the leftmost pixel
+ *  under the window for the first output pixel. scratch has room for
+ *  (2 * radius + 1) * (width + 2 * radius) values.
+ */
+typedef void (*FIA_UCharMedianRowFunction) (const unsigned char *const *rows, int radius,
+        unsigned char *scratch, unsigned char *dst, int width);
+
+typedef void (*FIA_ShortMedianRowFunction) (const short *const *rows, int radius,
+        short *scratch, short *dst, int width);
+
+typedef void (*FIA_UShortMedianRowFunction) (const unsigned short *const *rows, int radius,
+        unsigned short *scratch, unsigned short *dst, int width);
+
+typedef void (*FIA_FloatMedianRowFunction) (const float *const *rows, int radius,
+        float *scratch, float *dst, int width);
+
+/** Sets dst[x] to the largest value in the 3x3 window of each output pixel.
+ *  rows holds the three source rows, each pointing at the leftmost pixel under
+ *  the window for the first output pixel. scratch has room for width + 2 values.
+ */
+typedef void (*FIA_UCharMaximumRowFunction) (const unsigned char *const *rows,
+        unsigned char *scratch, unsigned char *dst, int width);
+
+typedef void (*FIA_ShortMaximumRowFunction) (const short *const *rows,
+        short *scratch, short *dst, int width);
+
+typedef void (*FIA_UShortMaximumRowFunction) (const unsigned short *const *rows,
+        unsigned short *scratch, unsigned short *dst, int width);
+
+typedef void (*FIA_FloatMaximumRowFunction) (const float *const *rows,
+        float *scratch, float *dst, int width);
+
+typedef struct
+{
+    FIA_FloatConvolveRowFunction float_convolve_row;
+    FIA_ShortConvolveRowFunction short_convolve_row;
+    FIA_UShortConvolveRowFunction ushort_convolve_row;
+
+    FIA_UCharMedianRowFunction uchar_median_row;
+    FIA_ShortMedianRowFunction short_median_row;
+    FIA_UShortMedianRowFunction ushort_median_row;
+    FIA_FloatMedianRowFunction float_median_row;
+
+    FIA_UCharMaximumRowFunction uchar_maximum_row;
+    FIA_ShortMaximumRowFunction short_maximum_row;
+    FIA_UShortMaximumRowFunction ushort_maximum_row;
+    FIA_FloatMaximumRowFunction float_maximum_row;
+
+} FIA_VectorFunctions;
+
+/** Returns the functions for one instruction set, or NULL if that
+ *  instruction set was not compiled in.
+ */
+const FIA_VectorFunctions *FIA_GetSSE2VectorFunctions (void);
+const FIA_VectorFunctions *FIA_GetAVX2VectorFunctions (void);
+const FIA_VectorFunctions *FIA_GetAVX512VectorFunctions (void);
+
+/** Returns the functions for the active instruction set level,
+ *  or NULL when the level is FIA_ISA_SCALAR.
+ */
+const FIA_VectorFunctions *FIA_GetVectorFunctions (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __FREEIMAGE_ALGORITHMS_THREADPOOL__
+#define __FREEIMAGE_ALGORITHMS_THREADPOOL__
+
+/*! \file
+	Private thread pool used to split image work into bands of rows.
+	Set the number of workers with FIA_SetNumberOfThreads.
+*/
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/** Locks for the pool and for other shared state such as caches.
+ *  Statically initialise an FIA_MUTEX with FIA_MUTEX_INITIALISER.
+ */
+#ifdef WIN32
+
+typedef SRWLOCK FIA_MUTEX;
+typedef CONDITION_VARIABLE FIA_CONDITION;
+
+#define FIA_MUTEX_INITIALISER SRWLOCK_INIT
+#define FIA_CONDITION_INITIALISER CONDITION_VARIABLE_INIT
+
+#define FIA_MutexLock(m) AcquireSRWLockExclusive(m)
+#define FIA_MutexUnlock(m) ReleaseSRWLockExclusive(m)
+#define FIA_ConditionWait(c, m) SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define FIA_ConditionSignal(c) WakeConditionVariable(c)
+#define FIA_ConditionBroadcast(c) WakeAllConditionVariable(c)
+
+#else
+
+typedef pthread_mutex_t FIA_MUTEX;
+typedef pthread_cond_t FIA_CONDITION;
+
+#define FIA_MUTEX_INITIALISER PTHREAD_MUTEX_INITIALIZER
+#define FIA_CONDITION_INITIALISER PTHREAD_COND_INITIALIZER
+
+#define FIA_MutexLock(m) pthread_mutex_lock(m)
+#define FIA_MutexUnlock(m) pthread_mutex_unlock(m)
+#define FIA_ConditionWait(c, m) pthread_cond_wait(c, m)
+#define FIA_ConditionSignal(c) pthread_cond_signal(c)
+#define FIA_ConditionBroadcast(c) pthread_cond_broadcast(c)
+
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Called once for each band with the rows [start, end).
+ *  band is in the range [0, number_of_bands) and no two threads are
+ *  given the same band at the same time so it can index per band scratch memory.
+ */
+typedef void (*FIA_BandFunction) (void *data, int band, int start, int end);
+
+/** Returns the number of bands to split count items into so that each band
+ *  has at least min_band_size items and there is no more than one band per worker.
+ */
+int FIA_GetNumberOfBands (int count, int min_band_size);
+
+/** Splits [start, end) into number_of_bands contiguous bands and runs function on
+ *  each one using the thread pool. Returns when all the bands are finished.
+ *  If the pool is already busy (a nested call or another thread) the bands are
+ *  run one after the other on the calling thread.
+ */
+void FIA_RunBands (int start, int end, int number_of_bands, FIA_BandFunction function, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
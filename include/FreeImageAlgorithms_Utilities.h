@@ -84,15 +84,59 @@ FIAImageRect(FIBITMAP *src);
 DLL_API int DLL_CALLCONV
 FIA_CheckSizesAreSame(FIBITMAP *fib1, FIBITMAP *fib2);
 
+/** \brief Checks whether the processor and operating system support a feature.
+ *
+ *  \param feature One of the _CPU_FEATURE_ values.
+ *  \return int 1 if the feature can be used, 0 if not.
+*/
 DLL_API int DLL_CALLCONV
 _os_support(int feature);
 
+/** \brief Get the best instruction set level this machine supports.
+ *
+ *  \return FIA_ISA_LEVEL highest supported level.
+*/
+DLL_API FIA_ISA_LEVEL DLL_CALLCONV
+FIA_GetSupportedISALevel(void);
+
+/** \brief Get the instruction set level the vectorised filters are using.
+ *
+ *  \return FIA_ISA_LEVEL active level.
+*/
+DLL_API FIA_ISA_LEVEL DLL_CALLCONV
+FIA_GetISALevel(void);
+
+/** \brief Set the instruction set level the vectorised filters use.
+ *   Levels above the supported level are lowered to it.
+ *   FIA_ISA_SCALAR turns the vectorised code off.
+ *
+ *  \param level Wanted level.
+ *  \return FIA_ISA_LEVEL the level now in use.
+*/
+DLL_API FIA_ISA_LEVEL DLL_CALLCONV
+FIA_SetISALevel(FIA_ISA_LEVEL level);
+
 DLL_API void DLL_CALLCONV
 FIA_SSEFindFloatMinMax(const float *data, long n, float *min, float *max);
 
 DLL_API int DLL_CALLCONV
 FIA_GetPitchInPixels(FIBITMAP *dib);
 
+/** \brief Set the number of threads used by the multithreaded filters.
+ *
+ *  \param number_of_threads Number of threads to use. 1 runs everything on the
+ *         calling thread, 0 uses one thread per processor (the default).
+*/
+DLL_API void DLL_CALLCONV
+FIA_SetNumberOfThreads(int number_of_threads);
+
+/** \brief Get the number of threads used by the multithreaded filters.
+ *
+ *  \return int number of threads.
+*/
+DLL_API int DLL_CALLCONV
+FIA_GetNumberOfThreads(void);
+
 /** \brief Find the mininum and maximum values in a char array.
  *
  *  \param data Array of char data.
@@ -650,6 +694,24 @@ FIA_Is8Bit(FIBITMAP *src);
 DLL_API FIBITMAP* DLL_CALLCONV
 FIA_DistanceTransform(FIBITMAP *src);
 
+/** \brief Compute the exact Euclidean distance from each pixel to the nearest zero pixel.
+ *
+ *  The columns are transformed first, blocks of columns at a time, then the rows,
+ *  both split over the thread pool.
+ *
+ *  \param src 8bit image, zero pixels are the background.
+ *  \param x_spacing double Width of a pixel, the distances are in these units.
+ *  \param y_spacing double Height of a pixel.
+ *  \param signed_distance int If set the background gets the negative distance to the nearest non zero pixel.
+ *  \param features FIBITMAP** If not NULL returns a FIT_INT32 image holding, for each pixel, the index
+ *         y * width + x (rows from the top) of the nearest zero pixel, or -1 if there is none.
+ *  \return FIBITMAP* FIT_FLOAT image on success or NULL on error. Pixels with no zero pixel
+ *          in the image are FLT_MAX.
+*/
+DLL_API FIBITMAP* DLL_CALLCONV
+FIA_EuclideanDistanceTransform(FIBITMAP *src, double x_spacing, double y_spacing,
+							   int signed_distance, FIBITMAP **features);
+
 /** \brief Get the value of a particular pixel.
  *
  *	Does not check the position is valid works with all greyscale types.
@@ -19,6 +19,7 @@
 #include "FreeImageAlgorithms_Arithmetic.h"
 #include "FreeImageAlgorithms_Utilities.h"
 #include "FreeImageAlgorithms_Palettes.h"
+#include "FreeImageAlgorithms_FFT.h"
 
 #include <iostream>
 #include <limits>
@@ -1538,29 +1539,37 @@ FIA_SubtractGreyLevelImageConstant (FIBITMAP * dst, double constant)
     return FIA_ERROR;
 }
 
-int DLL_CALLCONV
-FIA_ComplexConjugate (FIBITMAP * src)
+template < class Tcomplex > static void
+ComplexConjugate (FIBITMAP * src)
 {
-    if (src == NULL)
-        return FIA_ERROR;
-
-    if (FreeImage_GetImageType (src) != FIT_COMPLEX)
-        return FIA_ERROR;
-
     int width = FreeImage_GetWidth (src);
     int height = FreeImage_GetHeight (src);
 
-    FICOMPLEX *src_ptr = NULL;
+    Tcomplex *src_ptr = NULL;
 
-    for(register int y = 0; y < height; y++)
+    for(int y = 0; y < height; y++)
     {
-        src_ptr = (FICOMPLEX *) FreeImage_GetScanLine (src, y);
+        src_ptr = (Tcomplex *) FreeImage_GetScanLine (src, y);
 
-        for(register int x = 0; x < width; x++)
+        for(int x = 0; x < width; x++)
         {
             src_ptr[x].i = -src_ptr[x].i;
         }
     }
+}
+
+int DLL_CALLCONV
+FIA_ComplexConjugate (FIBITMAP * src)
+{
+    if (src == NULL)
+        return FIA_ERROR;
+
+    if (FIA_IsComplexFloatImage (src))
+        ComplexConjugate < FIACOMPLEXF > (src);
+    else if (FreeImage_GetImageType (src) == FIT_COMPLEX)
+        ComplexConjugate < FICOMPLEX > (src);
+    else
+        return FIA_ERROR;
 
     return FIA_SUCCESS;
 }
@@ -1569,6 +1578,33 @@ FIA_ComplexConjugate (FIBITMAP * src)
 // = ac + ibc + ida + i^2bd
 // = ac + ibc + ida - bd
 // = (ac - bd) + i(bc + da)
+template < class Tcomplex > static void
+MultiplyComplexImages (FIBITMAP * dst, FIBITMAP * src)
+{
+    Tcomplex *dst_ptr = NULL;
+    Tcomplex *src_ptr = NULL;
+
+    double tmp;
+    int width = FreeImage_GetWidth (src);
+    int height = FreeImage_GetHeight (src);
+
+    for(int y = 0; y < height; y++)
+    {
+        src_ptr = (Tcomplex *) FreeImage_GetScanLine (src, y);
+        dst_ptr = (Tcomplex *) FreeImage_GetScanLine (dst, y);
+
+        for(int x = 0; x < width; x++)
+        {
+            // real part = ac - bd
+            tmp = (dst_ptr[x].r * src_ptr[x].r) - (dst_ptr[x].i * src_ptr[x].i);
+
+            // imaginary part = bc + da
+            dst_ptr[x].i = (dst_ptr[x].i * src_ptr[x].r) + (src_ptr[x].i * dst_ptr[x].r);
+            dst_ptr[x].r = tmp;
+        }
+    }
+}
+
 int DLL_CALLCONV
 FIA_MultiplyComplexImages (FIBITMAP * dst, FIBITMAP * src)
 {
@@ -1582,43 +1618,43 @@ FIA_MultiplyComplexImages (FIBITMAP * dst, FIBITMAP * src)
         return FIA_ERROR;
     }
 
+    bool single_precision = FIA_IsComplexFloatImage (dst) != 0;
+
     // Make dst a double so it can hold all the results of
     // the arithmatic.
-    if (FreeImage_GetImageType (dst) != FIT_COMPLEX)
+    if (FreeImage_GetImageType (dst) != FIT_COMPLEX && !single_precision)
     {
         FreeImage_OutputMessageProc (FIF_UNKNOWN, "Destination image must be of type FIT_COMPLEX");
         return FIA_ERROR;
     }
 
-    if (FreeImage_GetImageType (src) != FIT_COMPLEX)
+    if (FreeImage_GetImageType (src) != FIT_COMPLEX && !FIA_IsComplexFloatImage (src))
     {
         FreeImage_OutputMessageProc (FIF_UNKNOWN, "Source image must be of type FIT_COMPLEX");
         return FIA_ERROR;
     }
 
-    FICOMPLEX *dst_ptr = NULL;
-    FICOMPLEX *src_ptr = NULL;
-
-    double tmp;
-    int width = FreeImage_GetWidth (src);
-    int height = FreeImage_GetHeight (src);
-
-    for(register int y = 0; y < height; y++)
+    if (FIA_IsComplexFloatImage (src) != (int) single_precision)
     {
-        src_ptr = (FICOMPLEX *) FreeImage_GetScanLine (src, y);
-        dst_ptr = (FICOMPLEX *) FreeImage_GetScanLine (dst, y);
-
-        for(register int x = 0; x < width; x++)
-        {
-            // real part = ac - bd
-            tmp = (dst_ptr[x].r * src_ptr[x].r) - (dst_ptr[x].i * src_ptr[x].i);
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Images must both be double or both be single precision");
+        return FIA_ERROR;
+    }
 
-            // imaginary part = bc + da
-            dst_ptr[x].i = (dst_ptr[x].i * src_ptr[x].r) + (src_ptr[x].i * dst_ptr[x].r);
-            dst_ptr[x].r = tmp;
-        }
+    // Half spectra multiply value by value like full ones, but must not be
+    // mixed with full spectra or the half spectra of other widths.
+    if (FIA_GetHalfSpectrumWidth (dst) != FIA_GetHalfSpectrumWidth (src))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Images must both be full spectra or half spectra of the same width");
+        return FIA_ERROR;
     }
 
+    if (single_precision)
+        MultiplyComplexImages < FIACOMPLEXF > (dst, src);
+    else
+        MultiplyComplexImages < FICOMPLEX > (dst, src);
+
     return FIA_SUCCESS;
 }
 
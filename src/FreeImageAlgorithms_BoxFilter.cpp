@@ -0,0 +1,355 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "FreeImageAlgorithms.h"
+#include "FreeImageAlgorithms_Utils.h"
+#include "FreeImageAlgorithms_Filters.h"
+#include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_ThreadPool.h"
+
+#include <math.h>
+#include <string.h>
+
+// Each band sums its first window in full, so bands are kept a fair size.
+#define BOX_ROWS_PER_BAND 64
+
+template < typename Tsrc > struct BoxBandData
+{
+    FIABITMAP *src;
+    FIBITMAP *dst;
+    int x_radius;
+    int y_radius;
+    double scale;
+};
+
+// Keeps a sum down each column of the window and slides it up a row at a
+// time, then slides a sum of those along the row. Each pixel costs four
+// additions whatever the radius. Sums are kept in double, which is exact
+// for all the integer image types.
+template < typename Tsrc > static void
+BoxFilterBand (void *data, int band, int start, int end)
+{
+    BoxBandData < Tsrc > *box = (BoxBandData < Tsrc > *) data;
+
+    const int kernel_width = box->x_radius * 2 + 1;
+    const int kernel_height = box->y_radius * 2 + 1;
+    const int src_width = FreeImage_GetWidth (box->src->fib);
+    const int dst_width = FreeImage_GetWidth (box->dst);
+    const int x_start = box->src->xborder - box->x_radius;
+    const int y_start = box->src->yborder - box->y_radius;
+
+    double *column_sums = (double *) calloc (src_width, sizeof (double));
+
+    register Tsrc *src_ptr;
+    register double *dst_ptr;
+    register double sum;
+
+    for(register int row = 0; row < kernel_height; row++)
+    {
+        src_ptr = (Tsrc *) FreeImage_GetScanLine (box->src->fib, start + y_start + row);
+
+        for(register int x = 0; x < src_width; x++)
+            column_sums[x] += src_ptr[x];
+    }
+
+    for(register int y = start; y < end; y++)
+    {
+        const double *window = column_sums + x_start;
+
+        dst_ptr = (double *) FreeImage_GetScanLine (box->dst, y);
+
+        sum = 0.0;
+
+        for(register int x = 0; x < kernel_width; x++)
+            sum += window[x];
+
+        dst_ptr[0] = sum * box->scale;
+
+        for(register int x = 1; x < dst_width; x++)
+        {
+            sum += window[x + kernel_width - 1] - window[x - 1];
+            dst_ptr[x] = sum * box->scale;
+        }
+
+        if (y + 1 == end)
+            break;
+
+        // Move the window up a row.
+        Tsrc *add_ptr = (Tsrc *) FreeImage_GetScanLine (box->src->fib, y + y_start + kernel_height);
+        Tsrc *remove_ptr = (Tsrc *) FreeImage_GetScanLine (box->src->fib, y + y_start);
+
+        for(register int x = 0; x < src_width; x++)
+            column_sums[x] += (double) add_ptr[x] - (double) remove_ptr[x];
+    }
+
+    free (column_sums);
+}
+
+template < typename Tsrc > static FIBITMAP *
+BoxFilterImageType (FIABITMAP * src, int x_radius, int y_radius, double scale)
+{
+    const int dst_width = FreeImage_GetWidth (src->fib) - 2 * src->xborder;
+    const int dst_height = FreeImage_GetHeight (src->fib) - 2 * src->yborder;
+
+    FIBITMAP *dst = FreeImage_AllocateT (FIT_DOUBLE, dst_width, dst_height, 8, 0, 0, 0);
+
+    if (dst == NULL)
+        return NULL;
+
+    BoxBandData < Tsrc > box;
+
+    box.src = src;
+    box.dst = dst;
+    box.x_radius = x_radius;
+    box.y_radius = y_radius;
+    box.scale = scale;
+
+    FIA_RunBands (0, dst_height, FIA_GetNumberOfBands (dst_height, BOX_ROWS_PER_BAND),
+                  BoxFilterBand < Tsrc >, &box);
+
+    return dst;
+}
+
+// Returns the sum of the window around each pixel times scale as a double image.
+static FIBITMAP *
+BoxFilter (FIABITMAP * src, int x_radius, int y_radius, double scale)
+{
+    if (src == NULL || src->fib == NULL)
+        return NULL;
+
+    if (x_radius < 0 || y_radius < 0 || src->xborder < x_radius || src->yborder < y_radius)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "The border must be at least as large as the box radius");
+        return NULL;
+    }
+
+    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType (src->fib);
+
+    switch (src_type)
+    {
+        case FIT_BITMAP:
+            if (FreeImage_GetBPP (src->fib) == 8)
+                return BoxFilterImageType < unsigned char > (src, x_radius, y_radius, scale);
+            break;
+
+        case FIT_UINT16:
+            return BoxFilterImageType < unsigned short > (src, x_radius, y_radius, scale);
+
+        case FIT_INT16:
+            return BoxFilterImageType < short > (src, x_radius, y_radius, scale);
+
+        case FIT_UINT32:
+            return BoxFilterImageType < unsigned int > (src, x_radius, y_radius, scale);
+
+        case FIT_INT32:
+            return BoxFilterImageType < int > (src, x_radius, y_radius, scale);
+
+        case FIT_FLOAT:
+            return BoxFilterImageType < float > (src, x_radius, y_radius, scale);
+
+        case FIT_DOUBLE:
+            return BoxFilterImageType < double > (src, x_radius, y_radius, scale);
+
+        default:
+            break;
+    }
+
+    FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                 "FREE_IMAGE_TYPE: Unable to perform box filter on type %d.",
+                                 src_type);
+
+    return NULL;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_BoxFilter (FIABITMAP * src, int x_radius, int y_radius)
+{
+    return BoxFilter (src, x_radius, y_radius,
+                      1.0 / ((x_radius * 2 + 1) * (y_radius * 2 + 1)));
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_BoxSum (FIABITMAP * src, int x_radius, int y_radius)
+{
+    return BoxFilter (src, x_radius, y_radius, 1.0);
+}
+
+// Coefficients of Young and van Vliet's recursive gaussian, a three pole
+// filter run forwards then backwards along a line. The cost per pixel does
+// not depend on sigma.
+typedef struct
+{
+    double B;
+    double b1, b2, b3;
+
+} RecursiveGaussianCoefficients;
+
+static RecursiveGaussianCoefficients
+GetRecursiveGaussianCoefficients (double sigma)
+{
+    RecursiveGaussianCoefficients c;
+    double q;
+
+    if (sigma >= 2.5)
+        q = 0.98711 * sigma - 0.96330;
+    else
+        q = 3.97156 - 4.14554 * sqrt (1.0 - 0.26891 * sigma);
+
+    double q2 = q * q, q3 = q2 * q;
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+
+    c.b1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+    c.b2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+    c.b3 = (0.422205 * q3) / b0;
+    c.B = 1.0 - (c.b1 + c.b2 + c.b3);
+
+    return c;
+}
+
+typedef struct
+{
+    FIBITMAP *fib;
+    RecursiveGaussianCoefficients c;
+
+} RecursiveGaussianData;
+
+// Filters each row in place. The filter starts as if the edge pixel went on for ever.
+static void
+RecursiveGaussianRows (void *data, int band, int start, int end)
+{
+    RecursiveGaussianData *gauss = (RecursiveGaussianData *) data;
+    RecursiveGaussianCoefficients c = gauss->c;
+
+    const int width = FreeImage_GetWidth (gauss->fib);
+
+    for(register int y = start; y < end; y++)
+    {
+        register double *ptr = (double *) FreeImage_GetScanLine (gauss->fib, y);
+        register double w1, w2, w3, w;
+
+        w1 = w2 = w3 = ptr[0];
+
+        for(register int x = 0; x < width; x++)
+        {
+            w = c.B * ptr[x] + c.b1 * w1 + c.b2 * w2 + c.b3 * w3;
+            ptr[x] = w;
+            w3 = w2;
+            w2 = w1;
+            w1 = w;
+        }
+
+        w1 = w2 = w3 = ptr[width - 1];
+
+        for(register int x = width - 1; x >= 0; x--)
+        {
+            w = c.B * ptr[x] + c.b1 * w1 + c.b2 * w2 + c.b3 * w3;
+            ptr[x] = w;
+            w3 = w2;
+            w2 = w1;
+            w1 = w;
+        }
+    }
+}
+
+// Filters the columns from start to end in place, a row at a time so
+// memory is read in order.
+static void
+RecursiveGaussianColumns (void *data, int band, int start, int end)
+{
+    RecursiveGaussianData *gauss = (RecursiveGaussianData *) data;
+    RecursiveGaussianCoefficients c = gauss->c;
+
+    const int height = FreeImage_GetHeight (gauss->fib);
+
+    double *rows[3];
+
+    for(int direction = 0; direction < 2; direction++)
+    {
+        int first = (direction == 0) ? 0 : height - 1;
+        int step = (direction == 0) ? 1 : -1;
+
+        // As for the rows the first line is its own history, so it is left as it is.
+        rows[0] = rows[1] = rows[2] = (double *) FreeImage_GetScanLine (gauss->fib, first);
+
+        for(register int y = first; y >= 0 && y < height; y += step)
+        {
+            register double *ptr = (double *) FreeImage_GetScanLine (gauss->fib, y);
+
+            for(register int x = start; x < end; x++)
+                ptr[x] = c.B * ptr[x] + c.b1 * rows[0][x] + c.b2 * rows[1][x] + c.b3 * rows[2][x];
+
+            rows[2] = rows[1];
+            rows[1] = rows[0];
+            rows[0] = ptr;
+        }
+    }
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_RecursiveGaussianFilter (FIABITMAP * src, double sigma)
+{
+    if (src == NULL || src->fib == NULL)
+        return NULL;
+
+    if (sigma < 0.5)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "The recursive gaussian needs a sigma of at least 0.5");
+        return NULL;
+    }
+
+    FIBITMAP *fib = FIA_ConvertToGreyscaleFloatType (src->fib, FIT_DOUBLE);
+
+    if (fib == NULL)
+        return NULL;
+
+    RecursiveGaussianData gauss;
+
+    gauss.fib = fib;
+    gauss.c = GetRecursiveGaussianCoefficients (sigma);
+
+    const int width = FreeImage_GetWidth (fib);
+    const int height = FreeImage_GetHeight (fib);
+
+    FIA_RunBands (0, height, FIA_GetNumberOfBands (height, BOX_ROWS_PER_BAND),
+                  RecursiveGaussianRows, &gauss);
+
+    FIA_RunBands (0, width, FIA_GetNumberOfBands (width, BOX_ROWS_PER_BAND),
+                  RecursiveGaussianColumns, &gauss);
+
+    // The border was only there to start the filter off.
+    const int dst_width = width - 2 * src->xborder;
+    const int dst_height = height - 2 * src->yborder;
+
+    FIBITMAP *dst = FreeImage_AllocateT (FIT_DOUBLE, dst_width, dst_height, 8, 0, 0, 0);
+
+    if (dst != NULL)
+    {
+        for(register int y = 0; y < dst_height; y++)
+        {
+            memcpy (FreeImage_GetScanLine (dst, y),
+                    (double *) FreeImage_GetScanLine (fib, y + src->yborder) + src->xborder,
+                    sizeof (double) * dst_width);
+        }
+    }
+
+    FreeImage_Unload (fib);
+
+    return dst;
+}
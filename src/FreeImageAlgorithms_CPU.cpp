@@ -0,0 +1,222 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "FreeImageAlgorithms.h"
+#include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_SIMD.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define FIA_X86
+#endif
+
+#ifdef FIA_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef FIA_X86
+
+static void
+CpuId (int leaf, int subleaf, unsigned int regs[4])
+{
+    #ifdef _MSC_VER
+    int info[4];
+    __cpuidex (info, leaf, subleaf);
+    regs[0] = info[0];
+    regs[1] = info[1];
+    regs[2] = info[2];
+    regs[3] = info[3];
+    #else
+    __cpuid_count (leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+    #endif
+}
+
+// Reads the register that says which register states the OS saves on a context switch.
+static unsigned long long
+GetXCR0 (void)
+{
+    #ifdef _MSC_VER
+    return _xgetbv (0);
+    #else
+    unsigned int eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((unsigned long long) edx << 32) | eax;
+    #endif
+}
+
+// Returns a mask of the _CPU_FEATURE_ values the processor and OS support.
+static int
+DetectFeatures (void)
+{
+    unsigned int regs[4];
+    unsigned int max_leaf;
+    unsigned long long xcr0 = 0;
+    int features = 0;
+    int os_saves_ymm = 0, os_saves_zmm = 0;
+
+    CpuId (0, 0, regs);
+    max_leaf = regs[0];
+
+    if (max_leaf < 1)
+        return 0;
+
+    CpuId (1, 0, regs);
+
+    if (regs[3] & (1 << 23))
+        features |= _CPU_FEATURE_MMX;
+
+    if (regs[3] & (1 << 25))
+        features |= _CPU_FEATURE_SSE;
+
+    if (regs[3] & (1 << 26))
+        features |= _CPU_FEATURE_SSE2;
+
+    // OSXSAVE, the OS must save the wide registers before AVX can be used.
+    if (regs[2] & (1 << 27))
+    {
+        xcr0 = GetXCR0 ();
+        os_saves_ymm = (xcr0 & 0x6) == 0x6;
+        os_saves_zmm = os_saves_ymm && (xcr0 & 0xE0) == 0xE0;
+    }
+
+    if (os_saves_ymm)
+    {
+        if (regs[2] & (1 << 28))
+            features |= _CPU_FEATURE_AVX;
+
+        if (regs[2] & (1 << 12))
+            features |= _CPU_FEATURE_FMA;
+    }
+
+    if (max_leaf >= 7)
+    {
+        CpuId (7, 0, regs);
+
+        if (os_saves_ymm && (regs[1] & (1 << 5)))
+            features |= _CPU_FEATURE_AVX2;
+
+        if (os_saves_zmm && (regs[1] & (1 << 16)))
+            features |= _CPU_FEATURE_AVX512F;
+    }
+
+    CpuId (0x80000000, 0, regs);
+
+    if (regs[0] >= 0x80000001)
+    {
+        CpuId (0x80000001, 0, regs);
+
+        if (regs[3] & (1 << 31))
+            features |= _CPU_FEATURE_3DNOW;
+    }
+
+    return features;
+}
+
+#else
+
+static int
+DetectFeatures (void)
+{
+    return 0;
+}
+
+#endif // FIA_X86
+
+// -1 until the first call works them out.
+static int cpu_features = -1;
+static int active_isa_level = -1;
+
+static int
+GetFeatures (void)
+{
+    if (cpu_features < 0)
+        cpu_features = DetectFeatures ();
+
+    return cpu_features;
+}
+
+int DLL_CALLCONV
+_os_support (int feature)
+{
+    return (GetFeatures () & feature) == feature;
+}
+
+FIA_ISA_LEVEL DLL_CALLCONV
+FIA_GetSupportedISALevel (void)
+{
+    int features = GetFeatures ();
+
+    if ((features & _CPU_FEATURE_AVX512F) && FIA_GetAVX512VectorFunctions () != NULL)
+        return FIA_ISA_AVX512;
+
+    if ((features & _CPU_FEATURE_AVX2) && (features & _CPU_FEATURE_FMA)
+        && FIA_GetAVX2VectorFunctions () != NULL)
+        return FIA_ISA_AVX2;
+
+    if ((features & _CPU_FEATURE_SSE2) && FIA_GetSSE2VectorFunctions () != NULL)
+        return FIA_ISA_SSE2;
+
+    return FIA_ISA_SCALAR;
+}
+
+FIA_ISA_LEVEL DLL_CALLCONV
+FIA_GetISALevel (void)
+{
+    if (active_isa_level < 0)
+        active_isa_level = FIA_GetSupportedISALevel ();
+
+    return (FIA_ISA_LEVEL) active_isa_level;
+}
+
+FIA_ISA_LEVEL DLL_CALLCONV
+FIA_SetISALevel (FIA_ISA_LEVEL level)
+{
+    FIA_ISA_LEVEL supported = FIA_GetSupportedISALevel ();
+
+    if (level > supported)
+        level = supported;
+
+    if (level < FIA_ISA_SCALAR)
+        level = FIA_ISA_SCALAR;
+
+    active_isa_level = level;
+
+    return level;
+}
+
+const FIA_VectorFunctions *
+FIA_GetVectorFunctions (void)
+{
+    switch (FIA_GetISALevel ())
+    {
+        case FIA_ISA_AVX512:
+            return FIA_GetAVX512VectorFunctions ();
+
+        case FIA_ISA_AVX2:
+            return FIA_GetAVX2VectorFunctions ();
+
+        case FIA_ISA_SSE2:
+            return FIA_GetSSE2VectorFunctions ();
+
+        default:
+            return NULL;
+    }
+}
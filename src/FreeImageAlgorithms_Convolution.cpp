@@ -33,12 +33,30 @@
 #include "FreeImageAlgorithms_LinearScale.h"
 
 #include "kiss_fft.h"
+#include "FreeImageAlgorithms_FFTPlan.h"
+#include "FreeImageAlgorithms_SIMD.h"
+#include "FreeImageAlgorithms_ThreadPool.h"
 
 #include <math.h>
+#include <limits.h>
 #include <iostream>
 
 #include "Constants.h"
 
+static FIA_CONVOLUTION_METHOD convolution_method = FIA_CONVOLUTION_AUTO;
+
+void DLL_CALLCONV
+FIA_SetConvolutionMethod(FIA_CONVOLUTION_METHOD method)
+{
+    convolution_method = method;
+}
+
+FIA_CONVOLUTION_METHOD DLL_CALLCONV
+FIA_GetConvolutionMethod(void)
+{
+    return convolution_method;
+}
+
 FilterKernel DLL_CALLCONV
 FIA_NewKernel(int x_radius, int y_radius, const double *values, double divider)
 {
@@ -52,939 +70,2912 @@ FIA_NewKernel(int x_radius, int y_radius, const double *values, double divider)
     return kernel;
 }
 
-FIBITMAP *
-DLL_CALLCONV
-FIA_Convolve(FIABITMAP * src, FilterKernel kernel)
+// Returns 1 if the kernel only holds whole numbers and the largest possible
+// sum over an image of the given type fits in an int.
+static int
+KernelFitsIntegerAccumulator(FilterKernel kernel, FREE_IMAGE_TYPE type)
 {
-    FIBITMAP *dst = NULL;
-    FIABITMAP border_tmp;
+    double max_pixel = 0.0, min_pixel = 0.0, abs_sum = 0.0;
+    int kernel_size = (kernel.x_radius * 2 + 1) * (kernel.y_radius * 2 + 1);
 
-    if (!src)
+    for (int i = 0; i < kernel_size; i++)
     {
-        return NULL;
+        if (kernel.values[i] != floor(kernel.values[i]))
+        {
+            return 0;
+        }
+
+        abs_sum += fabs(kernel.values[i]);
     }
 
-    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src->fib);
+    FIA_GetMaxPosibleValueForGreyScaleType(type, &max_pixel);
+    FIA_GetMinPosibleValueForGreyScaleType(type, &min_pixel);
 
-    if (src_type == FIT_COMPLEX)
+    if (abs_sum * MAX(max_pixel, fabs(min_pixel)) >= INT_MAX)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Error can not perform convolution on a complex image");
-        return NULL;
+        return 0;
     }
 
-    border_tmp.fib = FIA_ConvertToGreyscaleFloatType(src->fib, FIT_DOUBLE);
-
-    border_tmp.xborder = src->xborder;
-    border_tmp.yborder = src->yborder;
+    return 1;
+}
 
-    Kernel<double>*kern = new Kernel<double> (&border_tmp, kernel.x_radius,
-            kernel.y_radius, kernel.values, kernel.divider);
+// A kernel is treated as separable when every value is the product of its
+// column and row factors to within this fraction of the largest value.
+#define SEPARABLE_KERNEL_TOLERANCE 1e-12
 
-    dst = kern->Convolve();
+// One separable term of a kernel, the value at row r and column c
+// is vertical[r] * horizontal[c].
+typedef struct
+{
+    const double *horizontal;
+    const double *vertical;
 
-    FreeImage_Unload(border_tmp.fib);
+} KernelFactors;
 
-    if (NULL == dst)
+static int
+ValuesAreWholeNumbers(const double *values, int count)
+{
+    for (int i = 0; i < count; i++)
     {
-        FreeImage_OutputMessageProc(
-                FIF_UNKNOWN,
-                "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
-                src_type, FIT_BITMAP);
+        if (values[i] != floor(values[i]))
+        {
+            return 0;
+        }
     }
 
-    delete kern;
+    return 1;
+}
 
-    return dst;
+static double
+GreatestCommonDivisor(double a, double b)
+{
+    while (b != 0.0)
+    {
+        double tmp = fmod(a, b);
+
+        a = b;
+        b = tmp;
+    }
+
+    return a;
 }
 
-static FIBITMAP *
-DLL_CALLCONV
-FIA_Correlate(FIABITMAP * src, FilterKernel kernel, FIARECT search_area, FIBITMAP *mask)
+// Splits a rank one kernel into a column and a row. Returns 0 if the kernel
+// is not separable. Whole number kernels like 1 2 1 times 1 2 1 are split
+// into whole numbers where possible so they can still be summed in an int.
+static int
+FactoriseRankOneKernel(FilterKernel kernel, double *horizontal, double *vertical)
 {
-    FIBITMAP *dst = NULL;
-    FIABITMAP border_tmp;
+    int kernel_width = kernel.x_radius * 2 + 1;
+    int kernel_height = kernel.y_radius * 2 + 1;
+    int pivot_row = 0, pivot_col = 0;
+    double pivot = 0.0, divisor;
 
-    if (!src)
+    for (int r = 0; r < kernel_height; r++)
     {
-        return NULL;
+        for (int c = 0; c < kernel_width; c++)
+        {
+            if (fabs(kernel.values[r * kernel_width + c]) > fabs(pivot))
+            {
+                pivot = kernel.values[r * kernel_width + c];
+                pivot_row = r;
+                pivot_col = c;
+            }
+        }
     }
 
-    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src->fib);
-
-    if (src_type == FIT_COMPLEX)
+    if (pivot == 0.0)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Error can not perform convolution on a complex image");
-        return NULL;
+        return 0;
     }
 
-    border_tmp.fib = FIA_ConvertToGreyscaleFloatType(src->fib, FIT_DOUBLE);
-    border_tmp.xborder = src->xborder;
-    border_tmp.yborder = src->yborder;
+    const double *pivot_row_values = kernel.values + pivot_row * kernel_width;
 
-    Kernel<double>*kern = new Kernel<double> (&border_tmp, kernel.x_radius,
-            kernel.y_radius, kernel.values, kernel.divider);
+    divisor = pivot;
 
-	kern->SetSearchArea(search_area);
-	kern->SetMask(mask);
+    if (ValuesAreWholeNumbers(kernel.values, kernel_width * kernel_height))
+    {
+        divisor = 0.0;
 
-    dst = kern->Correlate();
+        for (int c = 0; c < kernel_width; c++)
+        {
+            divisor = GreatestCommonDivisor(fabs(pivot_row_values[c]), divisor);
+        }
+    }
 
-    FreeImage_Unload(border_tmp.fib);
+    for (int c = 0; c < kernel_width; c++)
+    {
+        horizontal[c] = pivot_row_values[c] / divisor;
+    }
 
-    if (NULL == dst)
+    for (int r = 0; r < kernel_height; r++)
     {
-        FreeImage_OutputMessageProc(
-                FIF_UNKNOWN,
-                "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
-                src_type, FIT_BITMAP);
+        vertical[r] = kernel.values[r * kernel_width + pivot_col] * divisor / pivot;
     }
 
-    delete kern;
+    for (int r = 0; r < kernel_height; r++)
+    {
+        for (int c = 0; c < kernel_width; c++)
+        {
+            if (fabs(kernel.values[r * kernel_width + c] - vertical[r] * horizontal[c])
+                    > SEPARABLE_KERNEL_TOLERANCE * fabs(pivot))
+            {
+                return 0;
+            }
+        }
+    }
 
-    return dst;
+    return 1;
 }
 
-FIBITMAP *
-DLL_CALLCONV
-FIA_SeparableConvolve(FIABITMAP * src, FilterKernel horz_kernel,
-        FilterKernel vert_kernel)
+// Splits a kernel into a sum of separable terms using the singular value
+// decomposition, found from the eigenvectors of K'K with cyclic Jacobi rotations.
+// Terms are taken largest first until the Frobenius norm of what is left is
+// below tolerance times the norm of the kernel. What is left is worked out
+// from the kernel rather than the eigenvalues, which only hold half the precision.
+// Term t is stored at horizontal + t * kernel_width and vertical + t * kernel_height.
+// Returns the number of terms or 0 if more than max_terms are needed.
+static int
+DecomposeKernel(FilterKernel kernel, int max_terms, double tolerance,
+        double *horizontal, double *vertical)
 {
-    FIBITMAP *tmp_dst = NULL, *dst = NULL;
-    FIABITMAP *tmp_border = NULL;
-    FIABITMAP border_tmp;
-    int xborder = src->xborder;
-    int yborder = src->yborder;
-
-    if (!src)
+    int n = kernel.x_radius * 2 + 1;
+    int kernel_height = kernel.y_radius * 2 + 1;
+    int terms = 0;
+    double *a = new double[n * n];
+    double *v = new double[n * n];
+    int *order = new int[n];
+    double *residual = new double[n * kernel_height];
+    double total = 0.0, left = 0.0;
+
+    for (int i = 0; i < n; i++)
     {
-        return NULL;
+        for (int j = 0; j < n; j++)
+        {
+            double sum = 0.0;
+
+            for (int r = 0; r < kernel_height; r++)
+            {
+                sum += kernel.values[r * n + i] * kernel.values[r * n + j];
+            }
+
+            a[i * n + j] = sum;
+            v[i * n + j] = (i == j) ? 1.0 : 0.0;
+        }
+
+        total += a[i * n + i];
     }
 
-    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src->fib);
+    for (int sweep = 0; sweep < 50; sweep++)
+    {
+        double off = 0.0;
 
-    if (src_type == FIT_COMPLEX)
+        for (int p = 0; p < n; p++)
+        {
+            for (int q = p + 1; q < n; q++)
+            {
+                off += a[p * n + q] * a[p * n + q];
+            }
+        }
+
+        if (off <= 1e-30 * total * total)
+        {
+            break;
+        }
+
+        for (int p = 0; p < n; p++)
+        {
+            for (int q = p + 1; q < n; q++)
+            {
+                double apq = a[p * n + q];
+
+                if (apq == 0.0)
+                {
+                    continue;
+                }
+
+                double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+                double t = 1.0 / (fabs(theta) + sqrt(theta * theta + 1.0));
+
+                if (theta < 0.0)
+                {
+                    t = -t;
+                }
+
+                double c = 1.0 / sqrt(t * t + 1.0);
+                double s = t * c;
+
+                for (int k = 0; k < n; k++)
+                {
+                    double akp = a[k * n + p], akq = a[k * n + q];
+
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+
+                for (int k = 0; k < n; k++)
+                {
+                    double apk = a[p * n + k], aqk = a[q * n + k];
+
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+
+                for (int k = 0; k < n; k++)
+                {
+                    double vkp = v[k * n + p], vkq = v[k * n + q];
+
+                    v[k * n + p] = c * vkp - s * vkq;
+                    v[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    // Largest eigenvalues first.
+    for (int i = 0; i < n; i++)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Error can not perform convolution on a complex image");
-        return NULL;
+        order[i] = i;
     }
 
-    if (src_type == FIT_DOUBLE)
+    for (int i = 0; i < n; i++)
     {
-        border_tmp.fib = FreeImage_Clone(src->fib);
+        for (int j = i + 1; j < n; j++)
+        {
+            if (a[order[j] * n + order[j]] > a[order[i] * n + order[i]])
+            {
+                SWAP(order[i], order[j]);
+            }
+        }
     }
-    else
+
+    for (int i = 0; i < n * kernel_height; i++)
     {
-        border_tmp.fib = FIA_ConvertToGreyscaleFloatType(src->fib, FIT_DOUBLE);
+        residual[i] = kernel.values[i];
     }
 
-    border_tmp.xborder = src->xborder;
-    border_tmp.yborder = src->yborder;
+    while (terms < n && terms < max_terms)
+    {
+        int e = order[terms];
+
+        for (int c = 0; c < n; c++)
+        {
+            horizontal[terms * n + c] = v[c * n + e];
+        }
 
-    Kernel<double>*kern1 = new Kernel<double> (&border_tmp,
-            horz_kernel.x_radius, horz_kernel.y_radius, horz_kernel.values,
-            horz_kernel.divider);
+        for (int r = 0; r < kernel_height; r++)
+        {
+            double sum = 0.0;
 
-    tmp_dst = kern1->Convolve();
+            for (int c = 0; c < n; c++)
+            {
+                sum += kernel.values[r * n + c] * v[c * n + e];
+            }
 
-    tmp_border = FIA_SetZeroBorder(tmp_dst, xborder, yborder);
+            vertical[terms * kernel_height + r] = sum;
+        }
 
-    Kernel<double>*kern2 = new Kernel<double> (tmp_border,
-            vert_kernel.x_radius, vert_kernel.y_radius, vert_kernel.values,
-            vert_kernel.divider);
+        left = 0.0;
 
-    dst = kern2->Convolve();
+        for (int r = 0; r < kernel_height; r++)
+        {
+            for (int c = 0; c < n; c++)
+            {
+                residual[r * n + c] -= vertical[terms * kernel_height + r]
+                        * horizontal[terms * n + c];
 
-    FIA_Unload(tmp_border);
-    FreeImage_Unload(tmp_dst);
-    FreeImage_Unload(border_tmp.fib);
+                left += residual[r * n + c] * residual[r * n + c];
+            }
+        }
 
-    if (NULL == dst)
+        terms++;
+
+        if (left <= tolerance * tolerance * total)
+        {
+            break;
+        }
+    }
+
+    if (left > tolerance * tolerance * total)
     {
-        FreeImage_OutputMessageProc(
-                FIF_UNKNOWN,
-                "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
-                src_type, FIT_BITMAP);
+        terms = 0;
     }
 
-    return dst;
+    delete[] a;
+    delete[] v;
+    delete[] order;
+    delete[] residual;
+
+    return terms;
 }
 
-static int DLL_CALLCONV
-FIA_NewKernelFromImage(FIBITMAP * src, FilterKernel * kernel)
+template<typename Tacc> static FREE_IMAGE_TYPE AccumulatorImageType(void);
+template<> FREE_IMAGE_TYPE AccumulatorImageType<int>(void) { return FIT_INT32; }
+template<> FREE_IMAGE_TYPE AccumulatorImageType<float>(void) { return FIT_FLOAT; }
+template<> FREE_IMAGE_TYPE AccumulatorImageType<double>(void) { return FIT_DOUBLE; }
+
+// Convolves the rows with the horizontal factors into an image of the
+// accumulator type, then the columns of that with the vertical factors.
+template<typename Tsrc, typename Tacc>
+static FIBITMAP *
+ConvolveSeparableTerm(FIABITMAP * src, FilterKernel kernel, const KernelFactors *factors,
+        FREE_IMAGE_TYPE dst_type)
 {
-    FIBITMAP *fib = NULL;
-    int dimension_changed = 0;
-    int width = FreeImage_GetWidth(src);
-    int height = FreeImage_GetHeight(src);
-	int new_width=width, new_height=height;
+    int kernel_width = kernel.x_radius * 2 + 1;
+    int kernel_height = kernel.y_radius * 2 + 1;
+    Tacc *horizontal = new Tacc[kernel_width];
+    Tacc *vertical = new Tacc[kernel_height];
+    FIABITMAP rows_src, columns_src;
+    FIBITMAP *dst = NULL;
 
-    if (width % 2 == 0)
+    for (int i = 0; i < kernel_width; i++)
     {
-        // We need an odd sized image
-        new_width = width - 1;
-        dimension_changed = 1;
+        horizontal[i] = (Tacc) factors->horizontal[i];
     }
 
-    if (height % 2 == 0)
+    for (int i = 0; i < kernel_height; i++)
     {
-        new_height = height - 1;
-        dimension_changed = 1;
+        vertical[i] = (Tacc) factors->vertical[i];
     }
 
-    if (dimension_changed)
+    // The row pass keeps the top and bottom borders so the column
+    // pass sees the same pixels the full kernel would.
+    rows_src.fib = src->fib;
+    rows_src.xborder = src->xborder;
+    rows_src.yborder = 0;
+
+    Kernel<Tsrc, Tacc> rows(&rows_src, kernel.x_radius, 0, horizontal, 1.0);
+
+    FIBITMAP *tmp = rows.Convolve(AccumulatorImageType<Tacc>());
+
+    if (tmp != NULL)
     {
-        fib = FreeImage_Copy(src, 0, 0, new_width, new_height);
-        width = FreeImage_GetWidth(fib);
-        height = FreeImage_GetHeight(fib);
+        columns_src.fib = tmp;
+        columns_src.xborder = 0;
+        columns_src.yborder = src->yborder;
+
+        Kernel<Tacc, Tacc> columns(&columns_src, 0, kernel.y_radius, vertical, kernel.divider);
+
+        dst = columns.Convolve(dst_type);
+
+        FreeImage_Unload(tmp);
     }
-    else
+
+    delete[] horizontal;
+    delete[] vertical;
+
+    return dst;
+}
+
+template<typename Tsrc, typename Tacc>
+static FIBITMAP *
+ConvolveWithAccumulator(FIABITMAP * src, FilterKernel kernel, const KernelFactors *factors,
+        FREE_IMAGE_TYPE dst_type)
+{
+    if (factors != NULL)
     {
-        fib = FreeImage_Clone(src);
+        return ConvolveSeparableTerm<Tsrc, Tacc> (src, kernel, factors, dst_type);
     }
 
-    kernel->x_radius = width / 2;
-    kernel->y_radius = height / 2;
+    int kernel_size = (kernel.x_radius * 2 + 1) * (kernel.y_radius * 2 + 1);
+    Tacc *values = new Tacc[kernel_size];
 
-    double *values = (double *) malloc(sizeof(double) * width * height);
+    for (int i = 0; i < kernel_size; i++)
+    {
+        values[i] = (Tacc) kernel.values[i];
+    }
 
-    kernel->divider = 1.0;
+    Kernel<Tsrc, Tacc> *kern = new Kernel<Tsrc, Tacc> (src, kernel.x_radius,
+            kernel.y_radius, values, kernel.divider);
 
-	//int bpp = FreeImage_GetBPP(fib);
-	//int ty = FreeImage_GetImageType(fib);
+    FIBITMAP *dst = kern->Convolve(dst_type);
 
-    FIBITMAP *double_dib = FreeImage_ConvertToType(fib, FIT_DOUBLE, 1);
-    double *ptr = NULL;
-    int i = 0;
+    delete kern;
+    delete[] values;
 
-    for (register int y = 0; y < height; y++)
-    {
-        ptr = (double *) FreeImage_GetScanLine(double_dib, y);
+    return dst;
+}
 
-        for (register int x = 0; x < width; x++)
-        {
-            values[i++] = (double) ptr[x];
-        }
-    }
+// The longest FFT used for one overlap-save tile, larger images are tiled.
+#define MAX_FFT_TILE_LENGTH 1024
 
-    FreeImage_Unload(double_dib);
-    FreeImage_Unload(fib);
+// Each tile also costs about this many butterflies to read and write.
+#define FFT_TILE_OVERHEAD 2000.0
 
-    kernel->values = values;
+// Lists the fast FFT lengths worth trying along one axis, from twice the
+// kernel up to the whole output or MAX_FFT_TILE_LENGTH.
+static int
+GetFFTLengths(int output_length, int kernel_length, int *lengths, int max_lengths)
+{
+    int whole_length = kiss_fft_next_fast_size(output_length + kernel_length - 1);
+    int length = MIN(kiss_fft_next_fast_size(2 * kernel_length), whole_length);
+    int max_length = MAX(length, MIN(whole_length, MAX_FFT_TILE_LENGTH));
+    int count = 0;
 
-    return FIA_SUCCESS;
+    for (; length <= max_length && count < max_lengths; length = kiss_fft_next_fast_size(length + 1))
+    {
+        lengths[count++] = length;
+    }
+
+    return count;
 }
 
-int DLL_CALLCONV
-FIA_KernelCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_area, FIBITMAP *mask,
-        CORRELATION_PREFILTER filter, FIAPOINT * pt, double *max)
+// Picks the size of the overlap-save tiles for an output image, keeping the
+// number of tiles times the cost of the FFTs low. Returns that cost.
+static double
+ChooseFFTTileSize(int width, int height, int kernel_width, int kernel_height,
+        int *fft_width, int *fft_height)
 {
-    FilterKernel kernel;
-    FIABITMAP *tmp = NULL;
-    int height, bpp1, bpp2, filtered_src1_width, filtered_src1_height;
-    double found_max;
+    int widths[256], heights[256];
+    int number_of_widths = GetFFTLengths(width, kernel_width, widths, 256);
+    int number_of_heights = GetFFTLengths(height, kernel_height, heights, 256);
+    double best_cost = -1.0;
 
-    FREE_IMAGE_TYPE src1_type, src2_type;
+    for (int i = 0; i < number_of_widths; i++)
+    {
+        for (int j = 0; j < number_of_heights; j++)
+        {
+            double size = (double) widths[i] * heights[j];
+            double tiles = ceil((double) width / (widths[i] - kernel_width + 1))
+                    * ceil((double) height / (heights[j] - kernel_height + 1));
+            double cost = tiles * (size * log(size) / log(2.0) + FFT_TILE_OVERHEAD);
+
+            if (best_cost < 0.0 || cost < best_cost)
+            {
+                best_cost = cost;
+                *fft_width = widths[i];
+                *fft_height = heights[j];
+            }
+        }
+    }
 
-    FIBITMAP *filtered_src1 = NULL;
-    FIBITMAP *filtered_src2 = NULL;
+    return best_cost;
+}
 
-    *max = 0.0;
+typedef struct
+{
+    FIABITMAP *src;
+    FIBITMAP *dst;
+    FREE_IMAGE_TYPE dst_type;
+    double divider;
+    int round_sums;
+    int fft_width, fft_height;
+    int kernel_width, kernel_height;
+    int x_start, y_start;
+    int tiles_across;
+    const kiss_fft_cpx *kernel_spectrum;
+    volatile int failed;            // Set by a band that could not get its plans.
+
+} FFTConvolveData;
+
+// Convolves whole overlap-save tiles, tile t is at column t % tiles_across
+// and row t / tiles_across of the tile grid.
+template<typename Tsrc>
+static void
+ConvolveFFTTiles(void *data, int band, int start, int end)
+{
+    FFTConvolveData *fft = (FFTConvolveData *) data;
 
-    pt->x = 0;
-    pt->y = 0;
+    int fft_size = fft->fft_width * fft->fft_height;
+    int valid_width = fft->fft_width - fft->kernel_width + 1;
+    int valid_height = fft->fft_height - fft->kernel_height + 1;
+    int src_width = FreeImage_GetWidth(fft->src->fib);
+    int src_height = FreeImage_GetHeight(fft->src->fib);
+    int dst_width = FreeImage_GetWidth(fft->dst);
+    int dst_height = FreeImage_GetHeight(fft->dst);
+    int dst_bytes_per_pixel = FreeImage_GetBPP(fft->dst) / 8;
 
-    FIBITMAP *src1 = FreeImage_Clone(_src1);
-    FIBITMAP *src2 = FreeImage_Clone(_src2);
-    FIBITMAP *dib = NULL;
+    // The fft state holds a scratch buffer so each band has its own plans.
+    // They come from the cache so later convolutions of the same size reuse them.
+    FIA_FFT_PLAN *forward = FIA_AcquireFFTPlan(fft->fft_width, fft->fft_height, 0);
+    FIA_FFT_PLAN *inverse = FIA_AcquireFFTPlan(fft->fft_width, fft->fft_height, 1);
 
-    unsigned int src1_width = FreeImage_GetWidth(src1);
-    unsigned int src1_height = FreeImage_GetHeight(src1);
-    unsigned int src2_width = FreeImage_GetWidth(src2);
-    unsigned int src2_height = FreeImage_GetHeight(src2);
+    double *row = (double *) malloc(sizeof(double) * valid_width);
 
-    if (src1 == NULL || src2 == NULL)
+    if (forward == NULL || inverse == NULL || row == NULL)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Conversion to standard image falied");
-        
-		goto CLEANUP;
+        FIA_ReleaseFFTPlan(forward);
+        FIA_ReleaseFFTPlan(inverse);
+        free(row);
+        fft->failed = 1;
+        return;
     }
 
-    if (src2_width > src1_width || src2_height > src1_height)
+    kiss_fft_cpx *buffer = forward->buffer;
+
+    for (int tile = start; tile < end; tile++)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "_src2 image must be smaller or equal than src1");
-        
-		goto CLEANUP;
-    }
+        int dst_x = (tile % fft->tiles_across) * valid_width;
+        int dst_y = (tile / fft->tiles_across) * valid_height;
 
-    src1_type = FreeImage_GetImageType(src1);
-    src2_type = FreeImage_GetImageType(src2);
+        // Reads the source under the tile, beyond the image is zero.
+        for (int y = 0; y < fft->fft_height; y++)
+        {
+            kiss_fft_cpx *buffer_ptr = buffer + y * fft->fft_width;
+            int src_y = fft->y_start + dst_y + y;
+            int x = 0;
+
+            if (src_y < src_height)
+            {
+                Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine(fft->src->fib, src_y)
+                        + fft->x_start + dst_x;
+
+                int count = MIN(fft->fft_width, src_width - fft->x_start - dst_x);
+
+                for (; x < count; x++)
+                {
+                    buffer_ptr[x].r = (kiss_fft_scalar) src_ptr[x];
+                    buffer_ptr[x].i = 0;
+                }
+            }
+
+            for (; x < fft->fft_width; x++)
+            {
+                buffer_ptr[x].r = 0;
+                buffer_ptr[x].i = 0;
+            }
+        }
+
+        FIA_RunFFTPlan(forward, buffer);
+
+        for (int i = 0; i < fft_size; i++)
+        {
+            kiss_fft_scalar r = buffer[i].r, im = buffer[i].i;
+
+            buffer[i].r = r * fft->kernel_spectrum[i].r - im * fft->kernel_spectrum[i].i;
+            buffer[i].i = r * fft->kernel_spectrum[i].i + im * fft->kernel_spectrum[i].r;
+        }
+
+        FIA_RunFFTPlan(inverse, buffer);
+
+        int width = MIN(valid_width, dst_width - dst_x);
+        int height = MIN(valid_height, dst_height - dst_y);
+
+        for (int y = 0; y < height; y++)
+        {
+            kiss_fft_cpx *buffer_ptr = buffer + y * fft->fft_width;
+
+            for (int x = 0; x < width; x++)
+            {
+                double sum = buffer_ptr[x].r;
+
+                // Whole number kernels on integer images have whole number sums,
+                // rounding takes away the error of the single precision fft.
+                if (fft->round_sums)
+                {
+                    sum = floor(sum + 0.5);
+                }
+
+                row[x] = sum / fft->divider;
+            }
+
+            StoreConvolvedRow(row, FreeImage_GetScanLine(fft->dst, dst_y + y)
+                    + dst_x * dst_bytes_per_pixel, fft->dst_type, width);
+        }
+    }
+
+    free(row);
+    FIA_ReleaseFFTPlan(forward);
+    FIA_ReleaseFFTPlan(inverse);
+}
+
+// Convolves by multiplying overlap-save tiles of the image with the kernel in
+// the frequency domain. The sums are accurate to single precision.
+template<typename Tsrc>
+static FIBITMAP *
+ConvolveFFT(FIABITMAP * src, FilterKernel kernel, FREE_IMAGE_TYPE dst_type, int round_sums)
+{
+    FFTConvolveData fft;
+
+    int kernel_width = kernel.x_radius * 2 + 1;
+    int kernel_height = kernel.y_radius * 2 + 1;
+    int dst_width = FreeImage_GetWidth(src->fib) - 2 * src->xborder;
+    int dst_height = FreeImage_GetHeight(src->fib) - 2 * src->yborder;
+
+    FIBITMAP *dst = AllocateConvolutionDestination(dst_type, dst_width, dst_height);
+
+    if (dst == NULL)
+    {
+        return NULL;
+    }
+
+    fft.src = src;
+    fft.dst = dst;
+    fft.dst_type = dst_type;
+    fft.divider = kernel.divider;
+    fft.round_sums = round_sums;
+    ChooseFFTTileSize(dst_width, dst_height, kernel_width, kernel_height,
+            &fft.fft_width, &fft.fft_height);
+
+    fft.kernel_width = kernel_width;
+    fft.kernel_height = kernel_height;
+    fft.x_start = src->xborder - kernel.x_radius;
+    fft.y_start = src->yborder - kernel.y_radius;
+
+    int fft_size = fft.fft_width * fft.fft_height;
+    int tiles_across = (dst_width + fft.fft_width - kernel_width) / (fft.fft_width - kernel_width + 1);
+    int tiles_down = (dst_height + fft.fft_height - kernel_height) / (fft.fft_height - kernel_height + 1);
+
+    fft.tiles_across = tiles_across;
+
+    // The conjugate of the kernel spectrum correlates rather than convolves, which
+    // is how the kernel is applied elsewhere. It also takes the 1 / n of the inverse.
+    kiss_fft_cpx *kernel_spectrum = (kiss_fft_cpx *) calloc(fft_size, sizeof(kiss_fft_cpx));
+
+    for (int r = 0; r < kernel_height; r++)
+    {
+        for (int c = 0; c < kernel_width; c++)
+        {
+            kernel_spectrum[r * fft.fft_width + c].r =
+                    (kiss_fft_scalar) kernel.values[r * kernel_width + c];
+        }
+    }
+
+    FIA_FFT_PLAN *forward = FIA_AcquireFFTPlan(fft.fft_width, fft.fft_height, 0);
+
+    if (forward == NULL)
+    {
+        free(kernel_spectrum);
+        FreeImage_Unload(dst);
+        return NULL;
+    }
+
+    FIA_RunFFTPlan(forward, kernel_spectrum);
+
+    FIA_ReleaseFFTPlan(forward);
+
+    for (int i = 0; i < fft_size; i++)
+    {
+        kernel_spectrum[i].r /= fft_size;
+        kernel_spectrum[i].i /= -fft_size;
+    }
+
+    fft.kernel_spectrum = kernel_spectrum;
+    fft.failed = 0;
+
+    FIA_RunBands(0, tiles_across * tiles_down, FIA_GetNumberOfBands(tiles_across * tiles_down, 1),
+            ConvolveFFTTiles<Tsrc>, &fft);
+
+    free(kernel_spectrum);
+
+    if (fft.failed)
+    {
+        FreeImage_Unload(dst);
+        return NULL;
+    }
+
+    return dst;
+}
+
+template<typename Tsrc>
+static FIBITMAP *
+ConvolveImageType(FIABITMAP * src, FilterKernel kernel, FIA_CONVOLUTION_METHOD method,
+        const KernelFactors *factors, FREE_IMAGE_TYPE dst_type, FIA_ACCUMULATOR_TYPE accumulator)
+{
+    if (method == FIA_CONVOLUTION_FFT)
+    {
+        return ConvolveFFT<Tsrc> (src, kernel, dst_type, accumulator == FIA_ACCUMULATOR_INT32);
+    }
+
+    switch (accumulator)
+    {
+        case FIA_ACCUMULATOR_INT32:
+            return ConvolveWithAccumulator<Tsrc, int> (src, kernel, factors, dst_type);
+
+        case FIA_ACCUMULATOR_FLOAT:
+            return ConvolveWithAccumulator<Tsrc, float> (src, kernel, factors, dst_type);
+
+        default:
+            return ConvolveWithAccumulator<Tsrc, double> (src, kernel, factors, dst_type);
+    }
+}
+
+static int
+KernelFitsBorder(FIABITMAP * src, FilterKernel kernel)
+{
+    return src->xborder >= kernel.x_radius && src->yborder >= kernel.y_radius;
+}
+
+// Rough costs of each method in multiply adds, the constants were measured
+// with a 1024x1024 image. The vector rows of the direct method are faster
+// by about the number of values that fit in a register.
+#define SEPARABLE_PASS_COST 2.0
+#define FFT_COST 4.5
+
+static FIA_CONVOLUTION_METHOD
+ChooseConvolutionMethod(FIABITMAP * src, FilterKernel kernel, int vector_rows,
+        int separable, int fft_allowed)
+{
+    int kernel_width = kernel.x_radius * 2 + 1;
+    int kernel_height = kernel.y_radius * 2 + 1;
+    double width = FreeImage_GetWidth(src->fib) - 2 * src->xborder;
+    double height = FreeImage_GetHeight(src->fib) - 2 * src->yborder;
+    double speedup = 1.0;
+
+    if (vector_rows)
+    {
+        switch (FIA_GetISALevel())
+        {
+            case FIA_ISA_AVX512:
+                speedup = 12.0;
+                break;
+
+            case FIA_ISA_AVX2:
+                speedup = 8.0;
+                break;
+
+            case FIA_ISA_SSE2:
+                speedup = 4.0;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    FIA_CONVOLUTION_METHOD method = FIA_CONVOLUTION_DIRECT;
+    double cost = width * height * kernel_width * kernel_height / speedup;
+
+    if (separable)
+    {
+        double separable_cost = width * height * (kernel_width + kernel_height)
+                * SEPARABLE_PASS_COST / speedup;
+
+        if (separable_cost < cost)
+        {
+            method = FIA_CONVOLUTION_SEPARABLE;
+            cost = separable_cost;
+        }
+    }
+
+    if (fft_allowed)
+    {
+        int fft_width, fft_height;
+        double fft_cost = ChooseFFTTileSize((int) width, (int) height, kernel_width,
+                kernel_height, &fft_width, &fft_height) * FFT_COST;
+
+        if (fft_cost < cost)
+        {
+            method = FIA_CONVOLUTION_FFT;
+        }
+    }
+
+    return method;
+}
+
+// Convolves with the given separable term, or when factors is NULL with the
+// kernel itself, which is split automatically if it is rank one.
+static FIBITMAP *
+ConvolveWithFactors(FIABITMAP * src, FilterKernel kernel, const KernelFactors *factors,
+        FREE_IMAGE_TYPE dst_type, FIA_ACCUMULATOR_TYPE accumulator)
+{
+    FIBITMAP *dst = NULL;
+    FIABITMAP border_tmp;
+    KernelFactors rank_one;
+    double *horizontal = NULL, *vertical = NULL;
+    FIA_ACCUMULATOR_TYPE requested_accumulator = accumulator;
+    FIA_CONVOLUTION_METHOD method = FIA_CONVOLUTION_DIRECT;
+
+    if (!src)
+    {
+        return NULL;
+    }
+
+    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src->fib);
+
+    if (src_type == FIT_COMPLEX)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Error can not perform convolution on a complex image");
+        return NULL;
+    }
+
+    int is_integer_type = (src_type == FIT_UINT16 || src_type == FIT_INT16
+            || (src_type == FIT_BITMAP && FreeImage_GetBPP(src->fib) == 8));
+
+    int is_native_type = is_integer_type || src_type == FIT_FLOAT
+            || src_type == FIT_DOUBLE;
+
+    if (accumulator == FIA_ACCUMULATOR_INT32)
+    {
+        if (!is_integer_type || !KernelFitsIntegerAccumulator(kernel, src_type))
+        {
+            FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                    "An int32 accumulator needs an 8 or 16 bit image and a kernel of whole numbers");
+            return NULL;
+        }
+    }
+    else if (accumulator == FIA_ACCUMULATOR_AUTO)
+    {
+        if (is_integer_type && KernelFitsIntegerAccumulator(kernel, src_type))
+        {
+            accumulator = FIA_ACCUMULATOR_INT32;
+        }
+        else if (dst_type == FIT_DOUBLE || src_type == FIT_DOUBLE)
+        {
+            accumulator = FIA_ACCUMULATOR_DOUBLE;
+        }
+        else
+        {
+            accumulator = FIA_ACCUMULATOR_FLOAT;
+        }
+    }
+
+    if (factors != NULL)
+    {
+        method = FIA_CONVOLUTION_SEPARABLE;
+    }
+    else if (KernelFitsBorder(src, kernel) && (kernel.x_radius > 0 || kernel.y_radius > 0))
+    {
+        int separable = 0;
+
+        method = convolution_method;
+
+        if (method == FIA_CONVOLUTION_AUTO || method == FIA_CONVOLUTION_SEPARABLE)
+        {
+            horizontal = new double[kernel.x_radius * 2 + 1];
+            vertical = new double[kernel.y_radius * 2 + 1];
+
+            // An int accumulator needs whole number factors to give the same result.
+            separable = FactoriseRankOneKernel(kernel, horizontal, vertical)
+                    && (accumulator != FIA_ACCUMULATOR_INT32
+                            || (ValuesAreWholeNumbers(horizontal, kernel.x_radius * 2 + 1)
+                                    && ValuesAreWholeNumbers(vertical, kernel.y_radius * 2 + 1)));
+        }
+
+        if (method == FIA_CONVOLUTION_AUTO)
+        {
+            // The fft sums in single precision so it is not picked when the sums are
+            // in double, which they are for a double source or destination, and for
+            // int sums only when rounding gives back the exact sum.
+            double max_pixel = 0.0, min_pixel = 0.0, abs_sum = 0.0;
+            int kernel_size = (kernel.x_radius * 2 + 1) * (kernel.y_radius * 2 + 1);
+
+            for (int i = 0; i < kernel_size; i++)
+            {
+                abs_sum += fabs(kernel.values[i]);
+            }
+
+            FIA_GetMaxPosibleValueForGreyScaleType(src_type, &max_pixel);
+            FIA_GetMinPosibleValueForGreyScaleType(src_type, &min_pixel);
+
+            int fft_allowed = requested_accumulator != FIA_ACCUMULATOR_INT32
+                    && accumulator != FIA_ACCUMULATOR_DOUBLE
+                    && (accumulator != FIA_ACCUMULATOR_INT32
+                            || abs_sum * MAX(max_pixel, fabs(min_pixel)) < (1 << 20));
+
+            int vector_rows = (src_type == FIT_FLOAT && accumulator == FIA_ACCUMULATOR_FLOAT)
+                    || ((src_type == FIT_INT16 || src_type == FIT_UINT16)
+                            && accumulator == FIA_ACCUMULATOR_INT32);
+
+            method = ChooseConvolutionMethod(src, kernel, vector_rows, separable, fft_allowed);
+        }
+
+        if (method == FIA_CONVOLUTION_SEPARABLE)
+        {
+            if (separable)
+            {
+                rank_one.horizontal = horizontal;
+                rank_one.vertical = vertical;
+                factors = &rank_one;
+            }
+            else
+            {
+                method = FIA_CONVOLUTION_DIRECT;
+            }
+        }
+    }
+
+    if (!is_native_type)
+    {
+        // Colour and 32 bit integer images are converted to double first.
+        border_tmp.fib = FIA_ConvertToGreyscaleFloatType(src->fib, FIT_DOUBLE);
+        border_tmp.xborder = src->xborder;
+        border_tmp.yborder = src->yborder;
+
+        if (border_tmp.fib == NULL)
+        {
+            FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                    "Unable to convert image type %d for convolution", src_type);
+            delete[] horizontal;
+            delete[] vertical;
+            return NULL;
+        }
+
+        dst = ConvolveImageType<double> (&border_tmp, kernel, method, factors, dst_type,
+                accumulator);
+
+        FreeImage_Unload(border_tmp.fib);
+    }
+    else
+    {
+        switch (src_type)
+        {
+            case FIT_BITMAP:
+                dst = ConvolveImageType<unsigned char> (src, kernel, method, factors, dst_type,
+                        accumulator);
+                break;
+
+            case FIT_UINT16:
+                dst = ConvolveImageType<unsigned short> (src, kernel, method, factors, dst_type,
+                        accumulator);
+                break;
+
+            case FIT_INT16:
+                dst = ConvolveImageType<short> (src, kernel, method, factors, dst_type,
+                        accumulator);
+                break;
+
+            case FIT_FLOAT:
+                dst = ConvolveImageType<float> (src, kernel, method, factors, dst_type,
+                        accumulator);
+                break;
+
+            default:
+                dst = ConvolveImageType<double> (src, kernel, method, factors, dst_type,
+                        accumulator);
+                break;
+        }
+    }
+
+    delete[] horizontal;
+    delete[] vertical;
+
+    if (NULL == dst)
+    {
+        FreeImage_OutputMessageProc(
+                FIF_UNKNOWN,
+                "FREE_IMAGE_TYPE: Unable to convolve type %d to type %d.\n No such conversion exists.",
+                src_type, dst_type);
+    }
+
+    return dst;
+}
+
+FIBITMAP *
+DLL_CALLCONV
+FIA_ConvolveToType(FIABITMAP * src, FilterKernel kernel, FREE_IMAGE_TYPE dst_type,
+        FIA_ACCUMULATOR_TYPE accumulator)
+{
+    return ConvolveWithFactors(src, kernel, NULL, dst_type, accumulator);
+}
+
+FIBITMAP *
+DLL_CALLCONV
+FIA_Convolve(FIABITMAP * src, FilterKernel kernel)
+{
+    // Integer kernels on integer images are summed exactly in an int,
+    // so the result is the same as summing in double.
+    return FIA_ConvolveToType(src, kernel, FIT_DOUBLE, FIA_ACCUMULATOR_AUTO);
+}
+
+FIBITMAP *
+DLL_CALLCONV
+FIA_ConvolveSeparableApproximation(FIABITMAP * src, FilterKernel kernel, int max_terms,
+        double tolerance)
+{
+    FIBITMAP *dst = NULL;
+
+    if (!src)
+    {
+        return NULL;
+    }
+
+    int kernel_width = kernel.x_radius * 2 + 1;
+    int kernel_height = kernel.y_radius * 2 + 1;
+
+    max_terms = MAX(1, MIN(max_terms, MIN(kernel_width, kernel_height)));
+
+    double *horizontal = new double[max_terms * kernel_width];
+    double *vertical = new double[max_terms * kernel_height];
+
+    int terms = 0;
+
+    if (KernelFitsBorder(src, kernel))
+    {
+        terms = DecomposeKernel(kernel, max_terms, tolerance, horizontal, vertical);
+    }
+
+    // Not worth it if the terms cost as much as the full kernel.
+    if (terms == 0 || terms * (kernel_width + kernel_height) >= kernel_width * kernel_height)
+    {
+        delete[] horizontal;
+        delete[] vertical;
+
+        return FIA_Convolve(src, kernel);
+    }
+
+    for (int t = 0; t < terms; t++)
+    {
+        KernelFactors factors;
+
+        factors.horizontal = horizontal + t * kernel_width;
+        factors.vertical = vertical + t * kernel_height;
+
+        FIBITMAP *term = ConvolveWithFactors(src, kernel, &factors, FIT_DOUBLE,
+                FIA_ACCUMULATOR_DOUBLE);
+
+        if (term == NULL)
+        {
+            FreeImage_Unload(dst);
+            dst = NULL;
+            break;
+        }
+
+        if (dst == NULL)
+        {
+            dst = term;
+            continue;
+        }
+
+        int width = FreeImage_GetWidth(dst);
+        int height = FreeImage_GetHeight(dst);
+
+        for (register int y = 0; y < height; y++)
+        {
+            double *dst_ptr = (double *) FreeImage_GetScanLine(dst, y);
+            double *term_ptr = (double *) FreeImage_GetScanLine(term, y);
+
+            for (register int x = 0; x < width; x++)
+            {
+                dst_ptr[x] += term_ptr[x];
+            }
+        }
+
+        FreeImage_Unload(term);
+    }
+
+    delete[] horizontal;
+    delete[] vertical;
+
+    return dst;
+}
+
+static FIBITMAP *
+DLL_CALLCONV
+FIA_Correlate(FIABITMAP * src, FilterKernel kernel, FIARECT search_area, FIBITMAP *mask)
+{
+    FIBITMAP *dst = NULL;
+    FIABITMAP border_tmp;
+
+    if (!src)
+    {
+        return NULL;
+    }
+
+    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src->fib);
+
+    if (src_type == FIT_COMPLEX)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Error can not perform convolution on a complex image");
+        return NULL;
+    }
+
+    border_tmp.fib = FIA_ConvertToGreyscaleFloatType(src->fib, FIT_DOUBLE);
+    border_tmp.xborder = src->xborder;
+    border_tmp.yborder = src->yborder;
+
+    Kernel<double>*kern = new Kernel<double> (&border_tmp, kernel.x_radius,
+            kernel.y_radius, kernel.values, kernel.divider);
+
+	kern->SetSearchArea(search_area);
+	kern->SetMask(mask);
+
+    dst = kern->Correlate();
+
+    FreeImage_Unload(border_tmp.fib);
+
+    if (NULL == dst)
+    {
+        FreeImage_OutputMessageProc(
+                FIF_UNKNOWN,
+                "FREE_IMAGE_TYPE: Unable to convert from type %d to type %d.\n No such conversion exists.",
+                src_type, FIT_BITMAP);
+    }
+
+    delete kern;
+
+    return dst;
+}
+
+FIBITMAP *
+DLL_CALLCONV
+FIA_SeparableConvolve(FIABITMAP * src, FilterKernel horz_kernel,
+        FilterKernel vert_kernel)
+{
+    FIBITMAP *tmp_dst = NULL, *dst = NULL;
+    FIABITMAP *tmp_border = NULL;
+
+    if (!src)
+    {
+        return NULL;
+    }
+
+    // The first pass reads the image in its own type.
+    tmp_dst = FIA_ConvolveToType(src, horz_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_AUTO);
+
+    if (tmp_dst == NULL)
+    {
+        return NULL;
+    }
+
+    tmp_border = FIA_SetZeroBorder(tmp_dst, src->xborder, src->yborder);
+
+    dst = FIA_ConvolveToType(tmp_border, vert_kernel, FIT_DOUBLE, FIA_ACCUMULATOR_DOUBLE);
+
+    FIA_Unload(tmp_border);
+    FreeImage_Unload(tmp_dst);
+
+    return dst;
+}
+
+static int DLL_CALLCONV
+FIA_NewKernelFromImage(FIBITMAP * src, FilterKernel * kernel)
+{
+    FIBITMAP *fib = NULL;
+    int dimension_changed = 0;
+    int width = FreeImage_GetWidth(src);
+    int height = FreeImage_GetHeight(src);
+	int new_width=width, new_height=height;
+
+    if (width % 2 == 0)
+    {
+        // We need an odd sized image
+        new_width = width - 1;
+        dimension_changed = 1;
+    }
+
+    if (height % 2 == 0)
+    {
+        new_height = height - 1;
+        dimension_changed = 1;
+    }
+
+    if (dimension_changed)
+    {
+        fib = FreeImage_Copy(src, 0, 0, new_width, new_height);
+        width = FreeImage_GetWidth(fib);
+        height = FreeImage_GetHeight(fib);
+    }
+    else
+    {
+        fib = FreeImage_Clone(src);
+    }
+
+    kernel->x_radius = width / 2;
+    kernel->y_radius = height / 2;
+
+    double *values = (double *) malloc(sizeof(double) * width * height);
+
+    kernel->divider = 1.0;
+
+	//int bpp = FreeImage_GetBPP(fib);
+	//int ty = FreeImage_GetImageType(fib);
+
+    FIBITMAP *double_dib = FreeImage_ConvertToType(fib, FIT_DOUBLE, 1);
+    double *ptr = NULL;
+    int i = 0;
+
+    for (register int y = 0; y < height; y++)
+    {
+        ptr = (double *) FreeImage_GetScanLine(double_dib, y);
+
+        for (register int x = 0; x < width; x++)
+        {
+            values[i++] = (double) ptr[x];
+        }
+    }
+
+    FreeImage_Unload(double_dib);
+    FreeImage_Unload(fib);
+
+    kernel->values = values;
+
+    return FIA_SUCCESS;
+}
+
+// Lewis' fast normalised cross correlation, giving the surface FIA_Correlate
+// gives for src with a zero border of the kernel's radius.
+// With the kernel mean taken from the kernel the image mean drops out of the
+// numerator, which is then one FFT correlation. The sums and sums of squares
+// of the image under the kernel, for the denominator, come from summed area tables.
+// The image mean is taken off before the FFT so the single precision
+// transforms only carry the variation about it.
+static FIBITMAP *
+FastNCCSurface(FIBITMAP * src, FilterKernel kernel, FIARECT search_area, FIBITMAP *mask)
+{
+    FIBITMAP *src_double = FIA_ConvertToGreyscaleFloatType(src, FIT_DOUBLE);
+
+    if (src_double == NULL)
+    {
+        return NULL;
+    }
+
+    const int width = FreeImage_GetWidth(src_double);
+    const int height = FreeImage_GetHeight(src_double);
+    const int kernel_width = kernel.x_radius * 2 + 1;
+    const int kernel_height = kernel.y_radius * 2 + 1;
+    const int kernel_size = kernel_width * kernel_height;
+
+    // The image with its zero border, as rows from the top.
+    const int border_width = width + 2 * kernel.x_radius;
+    const int border_height = height + 2 * kernel.y_radius;
+
+    // Windows never reach past the border so the correlation does not wrap.
+    const int pad_width = kiss_fft_next_fast_size(border_width);
+    const int pad_height = kiss_fft_next_fast_size(border_height);
+
+    double image_mean = 0.0;
+
+    for (int y = 0; y < height; y++)
+    {
+        double *src_ptr = (double *) FreeImage_GetScanLine(src_double, y);
+
+        for (int x = 0; x < width; x++)
+        {
+            image_mean += src_ptr[x];
+        }
+    }
+
+    image_mean /= ((double) width * height);
+
+    double kernel_average = 0.0;
+
+    for (int i = 0; i < kernel_size; i++)
+    {
+        kernel_average += kernel.values[i];
+    }
+
+    kernel_average /= kernel_size;
+
+    double kernel_normalise_sum = 0.0;
+
+    for (int i = 0; i < kernel_size; i++)
+    {
+        kernel_normalise_sum += (kernel.values[i] - kernel_average) * (kernel.values[i] - kernel_average);
+    }
+
+    FIBITMAP *padded = FreeImage_AllocateT(FIT_DOUBLE, pad_width, pad_height, 64, 0, 0, 0);
+    FIBITMAP *padded_kernel = FreeImage_AllocateT(FIT_DOUBLE, pad_width, pad_height, 64, 0, 0, 0);
+
+    const int table_width = border_width + 1;
+    double *sums = (double *) calloc((size_t) table_width * (border_height + 1), sizeof(double));
+    double *squares = (double *) calloc((size_t) table_width * (border_height + 1), sizeof(double));
+
+    FIBITMAP *dst = NULL;
+    FIBITMAP *surface = NULL;
+
+    if (padded == NULL || padded_kernel == NULL || sums == NULL || squares == NULL)
+    {
+        goto CLEANUP;
+    }
+
+    for (int y = 0; y < pad_height; y++)
+    {
+        double *ptr = (double *) FIA_GetScanLineFromTop(padded, y);
+        double *kernel_ptr = (double *) FIA_GetScanLineFromTop(padded_kernel, y);
+
+        memset(ptr, 0, pad_width * sizeof(double));
+        memset(kernel_ptr, 0, pad_width * sizeof(double));
+
+        if (y < border_height)
+        {
+            int src_y = y - kernel.y_radius;
+            double *src_ptr = (src_y >= 0 && src_y < height) ?
+                (double *) FIA_GetScanLineFromTop(src_double, src_y) : NULL;
+
+            double *sums_row = sums + (size_t) (y + 1) * table_width;
+            double *squares_row = squares + (size_t) (y + 1) * table_width;
+            double row_sum = 0.0, row_squares = 0.0;
+
+            for (int x = 0; x < border_width; x++)
+            {
+                int src_x = x - kernel.x_radius;
+                double value = -image_mean;
+
+                if (src_ptr != NULL && src_x >= 0 && src_x < width)
+                {
+                    value += src_ptr[src_x];
+                }
+
+                ptr[x] = value;
+
+                row_sum += value;
+                row_squares += value * value;
+                sums_row[x + 1] = sums_row[x + 1 - table_width] + row_sum;
+                squares_row[x + 1] = squares_row[x + 1 - table_width] + row_squares;
+            }
+        }
+
+        // The kernel values are in scanline order, from the bottom.
+        if (y < kernel_height)
+        {
+            const double *values = kernel.values + (kernel_height - 1 - y) * kernel_width;
+
+            for (int x = 0; x < kernel_width; x++)
+            {
+                kernel_ptr[x] = values[x] - kernel_average;
+            }
+        }
+    }
+
+    {
+        FIBITMAP *spectrum = FIA_RealFFTToComplexFloat(padded);
+        FIBITMAP *kernel_spectrum = FIA_RealFFTToComplexFloat(padded_kernel);
+
+        if (spectrum != NULL && kernel_spectrum != NULL)
+        {
+            FIA_ComplexConjugate(kernel_spectrum);
+            FIA_MultiplyComplexImages(kernel_spectrum, spectrum);
+            surface = FIA_RealIFFT(kernel_spectrum);
+        }
+
+        FreeImage_Unload(spectrum);
+        FreeImage_Unload(kernel_spectrum);
+    }
+
+    if (surface == NULL || (dst = AllocateConvolutionDestination(FIT_DOUBLE, width, height)) == NULL)
+    {
+        goto CLEANUP;
+    }
+
+    {
+        // The inverse transform is not scaled.
+        const double scale = 1.0 / ((double) pad_width * pad_height);
+
+        // The same area as Kernel::Correlate searches.
+        FIARECT rect = FIAImageRect(dst);
+
+        if (!FIARectIsEmpty(search_area))
+            rect = search_area;
+
+        rect = FIA_MakeFiaRectRelativeToImageBottomLeft(dst, rect);
+
+        if (rect.top > height)
+            rect.top = height;
+
+        if (rect.left < 0)
+            rect.left = 0;
+
+        if (rect.right > width)
+            rect.right = width;
+
+        if (rect.bottom < 0)
+            rect.bottom = 0;
+
+        for (int y = rect.bottom; y < rect.top; y++)
+        {
+            double *dst_ptr = (double *) FreeImage_GetScanLine(dst, y);
+            BYTE *mask_ptr = (mask != NULL) ? (BYTE *) FreeImage_GetScanLine(mask, y) : NULL;
+
+            // The window centred on row y starts kernel_height - 1 rows above it
+            // with the border, at row height - 1 - y from the top.
+            const int top = height - 1 - y;
+            const float *surface_ptr = (float *) FIA_GetScanLineFromTop(surface, top);
+            const double *sums_top = sums + (size_t) top * table_width;
+            const double *sums_bottom = sums + (size_t) (top + kernel_height) * table_width;
+            const double *squares_top = squares + (size_t) top * table_width;
+            const double *squares_bottom = squares + (size_t) (top + kernel_height) * table_width;
+
+            for (int x = rect.left; x < rect.right; x++)
+            {
+                if (mask_ptr != NULL && mask_ptr[x] == 0)
+                {
+                    continue;
+                }
+
+                const int right = x + kernel_width;
+
+                double sum = sums_bottom[right] - sums_bottom[x] - sums_top[right] + sums_top[x];
+                double sum_squares = squares_bottom[right] - squares_bottom[x]
+                    - squares_top[right] + squares_top[x];
+                double variance_sum = sum_squares - sum * sum / kernel_size;
+
+                // Flat windows are left at 0 rather than dividing rounding errors.
+                if (variance_sum <= 1e-10 * sum_squares || kernel_normalise_sum <= 0.0)
+                {
+                    continue;
+                }
+
+                double value = surface_ptr[x] * scale / sqrt(variance_sum * kernel_normalise_sum);
+
+                if (value > 1.0)
+                    value = 1.0;
+                else if (value < -1.0)
+                    value = -1.0;
+
+                dst_ptr[x] = value;
+            }
+        }
+    }
+
+CLEANUP:
+
+    FreeImage_Unload(src_double);
+    FreeImage_Unload(padded);
+    FreeImage_Unload(padded_kernel);
+    FreeImage_Unload(surface);
+
+    free(sums);
+    free(squares);
+
+    return dst;
+}
+
+// The checks and the search for the peak shared by FIA_KernelCorrelateImages
+// and FIA_FastNCCCorrelateImages, fast chooses how the surface is made.
+static int
+KernelCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_area, FIBITMAP *mask,
+        CORRELATION_PREFILTER filter, int fast, FIAPOINT * pt, double *max)
+{
+    FilterKernel kernel;
+    FIABITMAP *tmp = NULL;
+    int height, bpp1, bpp2, filtered_src1_width, filtered_src1_height;
+    double found_max;
+
+    FREE_IMAGE_TYPE src1_type, src2_type;
+
+    FIBITMAP *filtered_src1 = NULL;
+    FIBITMAP *filtered_src2 = NULL;
+
+    *max = 0.0;
+
+    pt->x = 0;
+    pt->y = 0;
+
+    // CLEANUP frees the kernel values, so they must be NULL until allocated.
+    kernel.x_radius = 0;
+    kernel.y_radius = 0;
+    kernel.values = NULL;
+    kernel.divider = 1.0;
+
+    FIBITMAP *src1 = FreeImage_Clone(_src1);
+    FIBITMAP *src2 = FreeImage_Clone(_src2);
+    FIBITMAP *dib = NULL;
+
+    unsigned int src1_width = FreeImage_GetWidth(src1);
+    unsigned int src1_height = FreeImage_GetHeight(src1);
+    unsigned int src2_width = FreeImage_GetWidth(src2);
+    unsigned int src2_height = FreeImage_GetHeight(src2);
+
+    if (src1 == NULL || src2 == NULL)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Conversion to standard image falied");
+        
+		goto CLEANUP;
+    }
+
+    if (src2_width > src1_width || src2_height > src1_height)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "_src2 image must be smaller or equal than src1");
+        
+		goto CLEANUP;
+    }
+
+    src1_type = FreeImage_GetImageType(src1);
+    src2_type = FreeImage_GetImageType(src2);
+
+    if (src1_type != src2_type)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Images must be of the same type");
+        
+		goto CLEANUP;
+    }
+
+    if (src1_type == FIT_COMPLEX)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Error can not perform correlation on a complex image");
+        
+		goto CLEANUP;
+    }
+
+    bpp1 = FreeImage_GetBPP(src1);
+    bpp2 = FreeImage_GetBPP(src2);
+
+    if (bpp1 != bpp2)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Images must have the same bpp");
+        
+		goto CLEANUP;
+    }
+
+    // Convert colour images to greyscale
+    if (bpp1 >= 24 && src1_type == FIT_BITMAP)
+    {
+        FreeImage_Unload(src1);
+        FreeImage_Unload(src2);
+
+        src1 = FreeImage_ConvertToGreyscale(_src1);
+        src2 = FreeImage_ConvertToGreyscale(_src2);
+    }
+
+    if (filter != NULL)
+    {
+        if ((filtered_src1 = filter(src1)) == NULL)
+        {
+            FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                    "Filter function returned NULL");
+            
+			goto CLEANUP;
+        }
+
+        if ((filtered_src2 = filter(src2)) == FIA_ERROR)
+        {
+            FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                    "Filter function returned NULL");
+            
+			goto CLEANUP;
+        }
+    }
+    else
+    {
+        filtered_src1 = FreeImage_Clone(src1);
+        filtered_src2 = FreeImage_Clone(src2);
+    }
+
+    filtered_src1_width = FreeImage_GetWidth(filtered_src1);
+    filtered_src1_height = FreeImage_GetHeight(filtered_src1);
+
+    if (filtered_src1_width != src1_width || filtered_src1_height
+            != src1_height)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Filter function has changed the size of the source input");
+
+        goto CLEANUP;
+    }
+
+	if(mask != NULL) {
+
+		if (FreeImage_GetImageType (mask) != FIT_BITMAP)
+		{
+			FreeImage_OutputMessageProc (FIF_UNKNOWN,
+										 "mask is not a FIT_BITMAP image");
+			goto CLEANUP;
+		}
+	
+		if(FIA_CheckSizesAreSame(filtered_src1, mask) == 0)
+		{
+			FreeImage_OutputMessageProc (FIF_UNKNOWN, "Background image and mask image are not the same size");
+
+			goto CLEANUP;
+		}
+	}
+
+    if (FIA_NewKernelFromImage(filtered_src2, &kernel) == FIA_ERROR)
+    {
+        goto CLEANUP;
+    }
+
+    if (fast)
+    {
+        dib = FastNCCSurface(filtered_src1, kernel, search_area, mask);
+    }
+    else
+    {
+        tmp = FIA_SetZeroBorder(filtered_src1, kernel.x_radius, kernel.y_radius);
+
+        dib = FIA_Correlate(tmp, kernel, search_area, mask);
+    }
+
+	if(dib == NULL)
+	{
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "FIA_Correlate returned NULL");
+
+        goto CLEANUP;
+    }
+
+    found_max = 0.0;
+
+    FIA_FindMaxXY(dib, &found_max, pt);
+
+    if (max != NULL)
+        *max = found_max;
+
+    pt->x -= kernel.x_radius;
+    pt->y += kernel.y_radius;
+
+    height = src1_height;
+
+    pt->y = height - pt->y - 1;
+
+	if(src1 != NULL)
+		FreeImage_Unload(src1);
+
+	if(src2 != NULL)
+		FreeImage_Unload(src2);
+
+	if(filtered_src1 != NULL)
+		FreeImage_Unload(filtered_src1);
+
+	if(filtered_src2 != NULL)
+		FreeImage_Unload(filtered_src2);
+
+	if(dib != NULL)
+		FreeImage_Unload(dib);
+
+	if(tmp != NULL)
+		FIA_Unload(tmp);
+
+	if(kernel.values != NULL)
+		free((void *) kernel.values);
+
+    return FIA_SUCCESS;
+
+CLEANUP:
+
+	if(src1 != NULL)
+		FreeImage_Unload(src1);
+
+	if(src2 != NULL)
+		FreeImage_Unload(src2);
+
+    if(filtered_src1 != NULL)
+		FreeImage_Unload(filtered_src1);
+
+	if(filtered_src2 != NULL)
+		FreeImage_Unload(filtered_src2);
+
+	if(dib != NULL)
+		FreeImage_Unload(dib);
+
+	if(tmp != NULL)
+		FIA_Unload(tmp);
+
+	if(kernel.values != NULL)
+		free((void *) kernel.values);
+
+    return FIA_ERROR;
+}
+
+int DLL_CALLCONV
+FIA_KernelCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_area, FIBITMAP *mask,
+        CORRELATION_PREFILTER filter, FIAPOINT * pt, double *max)
+{
+    return KernelCorrelateImages(_src1, _src2, search_area, mask, filter, 0, pt, max);
+}
+
+int DLL_CALLCONV
+FIA_FastNCCCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_area, FIBITMAP *mask,
+        CORRELATION_PREFILTER filter, FIAPOINT * pt, double *max)
+{
+    return KernelCorrelateImages(_src1, _src2, search_area, mask, filter, 1, pt, max);
+}
+
+// Pyramid levels are not made once the template would be smaller than this.
+#define MIN_PYRAMID_TEMPLATE_SIZE 8
+
+// Halves a mask keeping any pixel that is set in each 2x2 block.
+static FIBITMAP *
+HalveMask(FIBITMAP * mask)
+{
+    int width = FreeImage_GetWidth(mask) / 2;
+    int height = FreeImage_GetHeight(mask) / 2;
+
+    FIBITMAP *dst = FreeImage_Allocate(width, height, 8, 0, 0, 0);
+
+    if (dst == NULL)
+    {
+        return NULL;
+    }
+
+    FIA_SetGreyLevelPalette(dst);
+
+    for (int y = 0; y < height; y++)
+    {
+        BYTE *src_ptr1 = FreeImage_GetScanLine(mask, 2 * y);
+        BYTE *src_ptr2 = FreeImage_GetScanLine(mask, 2 * y + 1);
+        BYTE *dst_ptr = FreeImage_GetScanLine(dst, y);
+
+        for (int x = 0; x < width; x++)
+        {
+            dst_ptr[x] = (src_ptr1[2 * x] | src_ptr1[2 * x + 1] | src_ptr2[2 * x]
+                    | src_ptr2[2 * x + 1]) ? 255 : 0;
+        }
+    }
+
+    return dst;
+}
+
+// The search area at a level of the pyramid, widened by a pixel for the rounding.
+static FIARECT
+PyramidSearchArea(FIARECT search_area, int level)
+{
+    if (FIARectIsEmpty(search_area) || level == 0)
+    {
+        return search_area;
+    }
+
+    return MakeFIARect((search_area.left >> level) - 1, (search_area.top >> level) - 1,
+            (search_area.right >> level) + 1, (search_area.bottom >> level) + 1);
+}
+
+int DLL_CALLCONV
+FIA_KernelCorrelateImagesMultiResolution(FIBITMAP * _src1, FIBITMAP * _src2, FIARECT search_area,
+        FIBITMAP *mask, CORRELATION_PREFILTER filter, int levels, int refine_radius,
+        FIAPOINT * pt, double *max)
+{
+    *max = 0.0;
+
+    pt->x = 0;
+    pt->y = 0;
+
+    if (_src1 == NULL || _src2 == NULL)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "NULL values passed");
+        return FIA_ERROR;
+    }
+
+    int src2_size = MIN(FreeImage_GetWidth(_src2), FreeImage_GetHeight(_src2));
+
+    levels = MAX(1, levels);
+    refine_radius = MAX(1, refine_radius);
+
+    while (levels > 1 && (src2_size >> (levels - 1)) < MIN_PYRAMID_TEMPLATE_SIZE)
+    {
+        levels--;
+    }
+
+    if (levels == 1)
+    {
+        return FIA_KernelCorrelateImages(_src1, _src2, search_area, mask, filter, pt, max);
+    }
+
+    // The images are filtered once at full size, the coarser levels are
+    // halved from them.
+    FIBITMAP **src1 = new FIBITMAP *[levels];
+    FIBITMAP **src2 = new FIBITMAP *[levels];
+    FIBITMAP **masks = new FIBITMAP *[levels];
+    int err = FIA_SUCCESS;
+
+    for (int level = 0; level < levels; level++)
+    {
+        src1[level] = src2[level] = masks[level] = NULL;
+    }
+
+    if (FreeImage_GetBPP(_src1) >= 24 && FreeImage_GetImageType(_src1) == FIT_BITMAP)
+    {
+        src1[0] = FreeImage_ConvertToGreyscale(_src1);
+        src2[0] = FreeImage_ConvertToGreyscale(_src2);
+    }
+    else
+    {
+        src1[0] = FreeImage_Clone(_src1);
+        src2[0] = FreeImage_Clone(_src2);
+    }
+
+    if (filter != NULL && src1[0] != NULL && src2[0] != NULL)
+    {
+        FIBITMAP *filtered_src1 = filter(src1[0]);
+        FIBITMAP *filtered_src2 = filter(src2[0]);
+
+        FreeImage_Unload(src1[0]);
+        FreeImage_Unload(src2[0]);
+
+        src1[0] = filtered_src1;
+        src2[0] = filtered_src2;
+    }
+
+    masks[0] = (mask != NULL) ? FreeImage_Clone(mask) : NULL;
+
+    for (int level = 1; level < levels; level++)
+    {
+        src1[level] = FIA_RescaleToHalf(src1[level - 1]);
+        src2[level] = FIA_RescaleToHalf(src2[level - 1]);
+
+        if (masks[level - 1] != NULL)
+        {
+            masks[level] = HalveMask(masks[level - 1]);
+        }
+    }
+
+    if (src1[levels - 1] == NULL || src2[levels - 1] == NULL
+            || (mask != NULL && masks[levels - 1] == NULL))
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "Unable to make the image pyramids");
+        err = FIA_ERROR;
+    }
+
+    // Exhaustive search at the coarsest level only.
+    if (err == FIA_SUCCESS)
+    {
+        err = FIA_KernelCorrelateImages(src1[levels - 1], src2[levels - 1],
+                PyramidSearchArea(search_area, levels - 1), masks[levels - 1], NULL, pt, max);
+    }
+
+    // Each finer level searches round twice the point found at the level above.
+    // The search area holds the centres of the template, which are the
+    // points found plus its radius.
+    for (int level = levels - 2; level >= 0 && err == FIA_SUCCESS; level--)
+    {
+        int template_height = FreeImage_GetHeight(src2[level]);
+        int x_radius = (FreeImage_GetWidth(src2[level]) - 1) / 2;
+        int y_radius = (template_height - 1) / 2;
+
+        // Halving pairs the scanlines from the bottom, so from the top
+        // an odd height starts a row lower at the coarser level.
+        int top = 2 * pt->y + (FreeImage_GetHeight(src1[level]) & 1) - (template_height & 1);
+
+        int centre_x = 2 * pt->x + x_radius;
+        int centre_y = top + y_radius;
+
+        // The kernel search leaves out the top row of the area and includes the bottom one.
+        FIARECT area = MakeFIARect(centre_x - refine_radius, centre_y - refine_radius - 1,
+                centre_x + refine_radius + 1, centre_y + refine_radius);
+
+        FIARECT limit = PyramidSearchArea(search_area, level);
+
+        if (!FIARectIsEmpty(limit))
+        {
+            area.left = MAX(area.left, limit.left);
+            area.top = MAX(area.top, limit.top);
+            area.right = MIN(area.right, limit.right);
+            area.bottom = MIN(area.bottom, limit.bottom);
+        }
+
+        err = FIA_KernelCorrelateImages(src1[level], src2[level], area, masks[level], NULL, pt, max);
+    }
+
+    for (int level = 0; level < levels; level++)
+    {
+        FreeImage_Unload(src1[level]);
+        FreeImage_Unload(src2[level]);
+        FreeImage_Unload(masks[level]);
+    }
+
+    delete[] src1;
+    delete[] src2;
+    delete[] masks;
+
+    return err;
+}
+
+int DLL_CALLCONV
+FIA_KernelCorrelateImageRegions(FIBITMAP * src1, FIARECT rect1,
+        FIBITMAP * src2, FIARECT rect2, FIARECT search_rect, FIBITMAP *mask, CORRELATION_PREFILTER filter,
+        FIAPOINT * pt, double *max)
+{
+    FIBITMAP *src1_rgn = FIA_Copy(src1, rect1.left, rect1.top, rect1.right,
+            rect1.bottom);
+    FIBITMAP *src2_rgn = FIA_Copy(src2, rect2.left, rect2.top, rect2.right,
+            rect2.bottom);
+
+	*max = 0.0;
+
+    pt->x = 0;
+    pt->y = 0;
+
+    if (src1_rgn == NULL || src2_rgn == NULL)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "NULL values passed");
+        return FIA_ERROR;
+    }
+
+	// Search_rect is relative to the whole of src1
+	// we need to make it relative to the src1 region
+	search_rect.left -= rect1.left;
+	search_rect.top -= rect1.top;
+	search_rect.right -= rect1.left;
+	search_rect.bottom -= rect1.top;
+
+    int err = FIA_KernelCorrelateImages(src1_rgn, src2_rgn, search_rect, mask, filter, pt, max);
+
+    if (err == FIA_ERROR)
+    {
+        return FIA_ERROR;
+    }
+
+    // Add the point found to the start of the region searched
+    if (src1 == src2)
+    { // Images are the same image
+        pt->x += rect1.left;
+        pt->y += rect1.top;
+    }
+    else
+    {
+
+        // Images are different so we need to adjust for the selected region in both images
+        pt->x = pt->x - rect2.left + rect1.left;
+        pt->y = pt->y - rect2.top + rect1.top;
+    }
+
+    FreeImage_Unload(src1_rgn);
+    FreeImage_Unload(src2_rgn);
+
+    if (err == FIA_ERROR)
+    {
+        return FIA_ERROR;
+    }
+
+    return FIA_SUCCESS;
+}
+
+FIBITMAP *
+FIA_EdgeDetect(FIBITMAP * src)
+{
+    double kernel[] =
+        { -1.0 / 8.0, -1.0 / 8.0, -1.0 / 8.0, -1.0 / 8.0, 1.0, -1.0 / 8.0, -1.0
+                / 8.0, -1.0 / 8.0, -1.0 / 8.0 };
+
+    FIABITMAP *src_bordered = FIA_SetBorder(src, 1, 1, BorderType_Copy, 0.0);
+
+    FilterKernel convolve_kernel = FIA_NewKernel(1, 1, kernel, 1.0);
+
+    FIBITMAP *dib = FIA_Convolve(src_bordered, convolve_kernel);
+
+    FIA_Unload(src_bordered);
+
+    return dib;
+}
+
+static FIBITMAP *
+PadImage(FIBITMAP * src, int padded_width_size, int padded_height_size)
+{
+    // Must pad the images so circular convolution does not take place.
+    int width = FreeImage_GetWidth(src);
+    int height = FreeImage_GetHeight(src);
+
+    assert (padded_width_size > width);
+    assert (padded_height_size > height);
+
+    FIBITMAP *border_src = FreeImage_Allocate(padded_width_size,
+            padded_height_size, 8, 0, 0, 0);
+
+    FIA_SetGreyLevelPalette(border_src);
+
+    FreeImage_Paste(border_src, src, 0, 0, 256);
+
+    return border_src;
+}
+
+// Fraction of each side of an image that is tapered to zero for the phase
+// only correlation.
+#define PHASE_CORRELATION_TAPER 0.25
+
+// Weight of pixel i of n, rising from near zero at the edges as half a cosine.
+static double
+EdgeTaper(int i, int n)
+{
+    const double pi = 3.14159265358979323846;
+    int taper = MAX(1, (int) (n * PHASE_CORRELATION_TAPER));
+    int from_edge = MIN(i, n - 1 - i);
+
+    if (from_edge >= taper)
+    {
+        return 1.0;
+    }
+
+    return 0.5 - 0.5 * cos(pi * (from_edge + 0.5) / taper);
+}
+
+// PadImage into a FIT_FLOAT image of src less its mean, tapered to zero at
+// the edges. The phase only correlation whitens the step between an image
+// and its padding, which otherwise gives a peak at no shift.
+static FIBITMAP *
+PadTaperedImage(FIBITMAP * src, int padded_width_size, int padded_height_size)
+{
+    int width = FreeImage_GetWidth(src);
+    int height = FreeImage_GetHeight(src);
+
+    assert (padded_width_size > width);
+    assert (padded_height_size > height);
+
+    FIBITMAP *border_src = FreeImage_AllocateT(FIT_FLOAT, padded_width_size,
+            padded_height_size, 32, 0, 0, 0);
+
+    if (border_src == NULL)
+    {
+        return NULL;
+    }
+
+    double mean = 0.0;
+
+    for (int y = 0; y < height; y++)
+    {
+        BYTE *bits = FIA_GetScanLineFromTop(src, y);
+
+        for (int x = 0; x < width; x++)
+        {
+            mean += bits[x];
+        }
+    }
+
+    mean /= (double) width * height;
+
+    // Placed at the top left as FreeImage_Paste does in PadImage.
+    for (int y = 0; y < height; y++)
+    {
+        BYTE *bits = FIA_GetScanLineFromTop(src, y);
+        float *dst_bits = (float *) FIA_GetScanLineFromTop(border_src, y);
+        double wy = EdgeTaper(y, height);
+
+        for (int x = 0; x < width; x++)
+        {
+            dst_bits[x] = (float) ((bits[x] - mean) * EdgeTaper(x, width) * wy);
+        }
+    }
+
+    return border_src;
+}
+
+int DLL_CALLCONV
+FIA_FFTCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2,
+        CORRELATION_PREFILTER filter, FIAPOINT * pt)
+{
+    FIBITMAP *src1 = FreeImage_Clone(_src1);
+    FIBITMAP *src2 = FreeImage_Clone(_src2);
+
+    pt->x = 0;
+    pt->y = 0;
+
+    FREE_IMAGE_TYPE src1_type = FreeImage_GetImageType(src1);
+    FREE_IMAGE_TYPE src2_type = FreeImage_GetImageType(src2);
+
+    if (src1_type != src2_type)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Images must be of the same type");
+        return FIA_ERROR;
+    }
+
+    int bpp1 = FreeImage_GetBPP(src1);
+    int bpp2 = FreeImage_GetBPP(src2);
+
+    if (bpp1 != bpp2)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Images must have the same bpp");
+        return FIA_ERROR;
+    }
+
+    // Convert colour images to greyscale
+    if (bpp1 >= 24 && src1_type == FIT_BITMAP)
+    {
+        FIA_InPlaceConvertToGreyscale(&src1);
+        FIA_InPlaceConvertToGreyscale(&src2);
+    }
+
+    FIA_InPlaceConvertToStandardType(&src1, 0);
+    FIA_InPlaceConvertToStandardType(&src2, 0);
+
+    FIBITMAP *filtered_src1 = NULL;
+    FIBITMAP *filtered_src2 = NULL;
+
+    if (filter != NULL)
+    {
+        filtered_src1 = filter(src1);
+        filtered_src2 = filter(src2);
+
+        if (filtered_src1 == NULL || filtered_src2 == NULL)
+        {
+            FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                    "Filter function returned NULL");
+            return FIA_ERROR;
+        }
+    }
+    else
+    {
+        filtered_src1 = FreeImage_Clone(src1);
+        filtered_src2 = FreeImage_Clone(src2);
+    }
+
+    FIA_InPlaceConvertToStandardType(&filtered_src1, 0);
+    FIA_InPlaceConvertToStandardType(&filtered_src2, 0);
+
+#ifdef GENERATE_DEBUG_IMAGES
+    FIA_SaveFIBToFile(filtered_src1,  DEBUG_DATA_DIR "fft-prefiltered1.png", BIT8);
+    FIA_SaveFIBToFile(filtered_src2,  DEBUG_DATA_DIR "fft-prefiltered2.png", BIT8);
+#endif
+
+    int src1_width = FreeImage_GetWidth(src1);
+    int src1_height = FreeImage_GetHeight(src1);
+    int filtered_src1_width = FreeImage_GetWidth(filtered_src1);
+    int filtered_src1_height = FreeImage_GetHeight(filtered_src1);
+
+    if (filtered_src1_width != src1_width && filtered_src1_height
+            != src1_height)
+    {
+        FreeImage_OutputMessageProc(
+                FIF_UNKNOWN,
+                "Filter function has changed the size of the source input from %d,%d to %d,%d",
+                src1_width, src1_height, filtered_src1_width,
+                filtered_src1_height);
+
+        return FIA_ERROR;
+    }
+
+    // Find the padded width and height.
+    int pad_width = kiss_fft_next_fast_size(src1_width + FreeImage_GetWidth(
+            filtered_src2) + 1);
+    int pad_height = kiss_fft_next_fast_size(src1_height + FreeImage_GetHeight(
+            filtered_src2) + 1);
+
+    FIBITMAP *border_src1 = PadImage(filtered_src1, pad_width, pad_height);
+    FIBITMAP *border_src2 = PadImage(filtered_src2, pad_width, pad_height);
+
+    // The images are real so their half spectra are all that is needed,
+    // and kiss_fft works in single precision so they are kept that way.
+    FIBITMAP *fft1 = FIA_RealFFTToComplexFloat(border_src1);
+    FIBITMAP *fft2 = FIA_RealFFTToComplexFloat(border_src2);
+
+#ifdef GENERATE_DEBUG_IMAGES
+    FIBITMAP *r = FIA_RealIFFT(fft1);
+    FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(r, 1),  DEBUG_DATA_DIR "FIA_FFTCorrelateImages-fft.png", BIT24);
+    FreeImage_Unload(r);
+#endif
+
+    FIA_ComplexConjugate(fft2);
+
+    if (FIA_MultiplyComplexImages(fft1, fft2) == FIA_ERROR)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "FIA_MultiplyComplexImages Failed");
+        return FIA_ERROR;
+    }
+
+    FIBITMAP *real = FIA_RealIFFT(fft1);
+
+#ifdef GENERATE_DEBUG_IMAGES
+    FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(real, 1),  DEBUG_DATA_DIR "fft.png", BIT24);
+#endif
+
+    double max;
+
+    FIA_FindMaxXY(real, &max, pt);
+
+    if (pt->x > src1_width)
+    {
+        pt->x = pt->x - pad_width;
+    }
+
+    // FIBITMAPS start 0 at bottom row
+    pt->y = pad_height - pt->y - 1;
+
+    if (pt->y > src1_height)
+    {
+        pt->y = pt->y - pad_height;
+    }
+
+    FreeImage_Unload(real);
+    FreeImage_Unload(fft1);
+    FreeImage_Unload(fft2);
+    FreeImage_Unload(src1);
+    FreeImage_Unload(src2);
+    FreeImage_Unload(filtered_src1);
+    FreeImage_Unload(filtered_src2);
+    FreeImage_Unload(border_src1);
+    FreeImage_Unload(border_src2);
+
+    return FIA_SUCCESS;
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_PreCalculateCorrelationFFT(FIBITMAP *_src1, FIBITMAP *_src2, int pad_size, CORRELATION_PREFILTER filter)
+{
+    FIBITMAP *src1 = FreeImage_Clone(_src1);
+    FIBITMAP *src2 = FreeImage_Clone(_src2);
+
+    FREE_IMAGE_TYPE src1_type = FreeImage_GetImageType(src1);
+    FREE_IMAGE_TYPE src2_type = FreeImage_GetImageType(src2);
 
     if (src1_type != src2_type)
     {
         FreeImage_OutputMessageProc(FIF_UNKNOWN,
                 "Images must be of the same type");
-        
-		goto CLEANUP;
-    }
-
-    if (src1_type == FIT_COMPLEX)
-    {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Error can not perform correlation on a complex image");
-        
-		goto CLEANUP;
+        return FIA_ERROR;
     }
 
-    bpp1 = FreeImage_GetBPP(src1);
-    bpp2 = FreeImage_GetBPP(src2);
+    int bpp1 = FreeImage_GetBPP(src1);
+    int bpp2 = FreeImage_GetBPP(src2);
 
     if (bpp1 != bpp2)
     {
         FreeImage_OutputMessageProc(FIF_UNKNOWN,
                 "Images must have the same bpp");
-        
-		goto CLEANUP;
+        return FIA_ERROR;
     }
 
     // Convert colour images to greyscale
     if (bpp1 >= 24 && src1_type == FIT_BITMAP)
     {
-        FreeImage_Unload(src1);
-        FreeImage_Unload(src2);
-
-        src1 = FreeImage_ConvertToGreyscale(_src1);
-        src2 = FreeImage_ConvertToGreyscale(_src2);
+        FIA_InPlaceConvertToGreyscale(&src1);
     }
 
+    FIA_InPlaceConvertToStandardType(&src1, 0);
+
+    FIBITMAP *filtered_src1 = NULL;
+
     if (filter != NULL)
     {
-        if ((filtered_src1 = filter(src1)) == NULL)
-        {
-            FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                    "Filter function returned NULL");
-            
-			goto CLEANUP;
-        }
+        filtered_src1 = filter(src1);
 
-        if ((filtered_src2 = filter(src2)) == FIA_ERROR)
+        if (filtered_src1 == NULL)
         {
             FreeImage_OutputMessageProc(FIF_UNKNOWN,
                     "Filter function returned NULL");
-            
-			goto CLEANUP;
+            return FIA_ERROR;
         }
     }
     else
     {
         filtered_src1 = FreeImage_Clone(src1);
-        filtered_src2 = FreeImage_Clone(src2);
-    }
-
-    filtered_src1_width = FreeImage_GetWidth(filtered_src1);
-    filtered_src1_height = FreeImage_GetHeight(filtered_src1);
-
-    if (filtered_src1_width != src1_width || filtered_src1_height
-            != src1_height)
-    {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Filter function has changed the size of the source input");
-
-        goto CLEANUP;
     }
 
-	if(mask != NULL) {
-
-		if (FreeImage_GetImageType (mask) != FIT_BITMAP)
-		{
-			FreeImage_OutputMessageProc (FIF_UNKNOWN,
-										 "mask is not a FIT_BITMAP image");
-			goto CLEANUP;
-		}
-	
-		if(FIA_CheckSizesAreSame(filtered_src1, mask) == 0)
-		{
-			FreeImage_OutputMessageProc (FIF_UNKNOWN, "Background image and mask image are not the same size");
+    FIA_InPlaceConvertToStandardType(&filtered_src1, 0);
 
-			goto CLEANUP;
-		}
-	}
+#ifdef GENERATE_DEBUG_IMAGES
+    FIA_SaveFIBToFile(filtered_src1,  DEBUG_DATA_DIR "fft-prefiltered1.png", BIT8);
+#endif
 
-    kernel.x_radius = 0;
-    kernel.y_radius = 0;
-    kernel.values = NULL;
+    int src1_width = FreeImage_GetWidth(src1);
+    int src1_height = FreeImage_GetHeight(src1);
+    int filtered_src1_width = FreeImage_GetWidth(filtered_src1);
+    int filtered_src1_height = FreeImage_GetHeight(filtered_src1);
 
-    if (FIA_NewKernelFromImage(filtered_src2, &kernel) == FIA_ERROR)
+    if(!FIA_CheckSizesAreSame(src1, filtered_src1))
     {
-        goto CLEANUP;
-    }
-
-    tmp = FIA_SetZeroBorder(filtered_src1, kernel.x_radius, kernel.y_radius);
-
-    dib = FIA_Correlate(tmp, kernel, search_area, mask);
-
-	if(dib == NULL)
-	{
-        FreeImage_OutputMessageProc(FIF_UNKNOWN, "FIA_Correlate returned NULL");
+        FreeImage_OutputMessageProc(
+                FIF_UNKNOWN,
+                "Filter function has changed the size of the source input from %d,%d to %d,%d",
+                src1_width, src1_height, filtered_src1_width,
+                filtered_src1_height);
 
-        goto CLEANUP;
+        return FIA_ERROR;
     }
 
-    found_max = 0.0;
-
-    FIA_FindMaxXY(dib, &found_max, pt);
-
-    if (max != NULL)
-        *max = found_max;
-
-    pt->x -= kernel.x_radius;
-    pt->y += kernel.y_radius;
+    // Find the padded width and height.
+    int pad_width = kiss_fft_next_fast_size(src1_width + pad_size );
+    int pad_height = kiss_fft_next_fast_size(src1_height + pad_size);
 
-    height = src1_height;
+    FIBITMAP *border_src1 = PadImage(filtered_src1, pad_width, pad_height);
 
-    pt->y = height - pt->y - 1;
+    FIBITMAP *fft = FIA_RealFFTToComplexFloat(border_src1);
 
-	if(src1 != NULL)
-		FreeImage_Unload(src1);
+    FreeImage_Unload(src1);
+    FreeImage_Unload(src2);
+    FreeImage_Unload(filtered_src1);
+    FreeImage_Unload(border_src1);
 
-	if(src2 != NULL)
-		FreeImage_Unload(src2);
+#ifdef GENERATE_DEBUG_IMAGES
+    FIBITMAP *real = FIA_RealIFFT(fft);
 
-	if(filtered_src1 != NULL)
-		FreeImage_Unload(filtered_src1);
+    FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(real, 1),  DEBUG_DATA_DIR "fft-pre-generated.png", BIT24);
 
-	if(filtered_src2 != NULL)
-		FreeImage_Unload(filtered_src2);
+    FreeImage_Unload(real);
 
-	if(dib != NULL)
-		FreeImage_Unload(dib);
+#endif
 
-	if(tmp != NULL)
-		FIA_Unload(tmp);
+    return fft;
+}
 
-	if(kernel.values != NULL)
-		free((void *) kernel.values);
+int DLL_CALLCONV
+FIA_FFTCorrelateImageWithPreCorrelationFFT(FIBITMAP * fft1_fib, FIBITMAP *_src1, FIBITMAP *_src2, int pad_size,
+        CORRELATION_PREFILTER filter, FIAPOINT * pt)
+{
+    if(FreeImage_GetImageType(fft1_fib) != FIT_COMPLEX && !FIA_IsComplexFloatImage(fft1_fib))
+        return FIA_ERROR;
 
-    return FIA_SUCCESS;
+    FIBITMAP *fft_fib = FreeImage_Clone(fft1_fib);
+    FIBITMAP *src1 = FreeImage_Clone(_src1);
+    FIBITMAP *src2 = FreeImage_Clone(_src2);
 
-CLEANUP:
+     pt->x = 0;
+     pt->y = 0;
 
-	if(src1 != NULL)
-		FreeImage_Unload(src1);
+     FREE_IMAGE_TYPE src1_type = FreeImage_GetImageType(src1);
+     FREE_IMAGE_TYPE src2_type = FreeImage_GetImageType(src2);
 
-	if(src2 != NULL)
-		FreeImage_Unload(src2);
+     if (src1_type != src2_type)
+     {
+         FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                 "Images must be of the same type");
+         return FIA_ERROR;
+     }
 
-    if(filtered_src1 != NULL)
-		FreeImage_Unload(filtered_src1);
+     int bpp1 = FreeImage_GetBPP(src1);
+     int bpp2 = FreeImage_GetBPP(src2);
 
-	if(filtered_src2 != NULL)
-		FreeImage_Unload(filtered_src2);
+     if (bpp1 != bpp2)
+     {
+         FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                 "Images must have the same bpp");
+         return FIA_ERROR;
+     }
 
-	if(dib != NULL)
-		FreeImage_Unload(dib);
+     // Convert colour images to greyscale
+     if (bpp2 >= 24 && src2_type == FIT_BITMAP)
+     {
+         FIA_InPlaceConvertToGreyscale(&src2);
+     }
 
-	if(tmp != NULL)
-		FIA_Unload(tmp);
+     FIA_InPlaceConvertToStandardType(&src2, 0);
 
-	if(kernel.values != NULL)
-		free((void *) kernel.values);
+     FIBITMAP *filtered_src2 = NULL;
 
-    return FIA_ERROR;
-}
+     if (filter != NULL)
+     {
+         filtered_src2 = filter(src2);
 
-int DLL_CALLCONV
-FIA_KernelCorrelateImageRegions(FIBITMAP * src1, FIARECT rect1,
-        FIBITMAP * src2, FIARECT rect2, FIARECT search_rect, FIBITMAP *mask, CORRELATION_PREFILTER filter,
-        FIAPOINT * pt, double *max)
-{
-    FIBITMAP *src1_rgn = FIA_Copy(src1, rect1.left, rect1.top, rect1.right,
-            rect1.bottom);
-    FIBITMAP *src2_rgn = FIA_Copy(src2, rect2.left, rect2.top, rect2.right,
-            rect2.bottom);
+         if (filtered_src2 == NULL)
+         {
+             FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                     "Filter function returned NULL");
+             return FIA_ERROR;
+         }
+     }
+     else
+     {
+         filtered_src2 = FreeImage_Clone(src2);
+     }
 
-	*max = 0.0;
+     FIA_InPlaceConvertToStandardType(&filtered_src2, 0);
 
-    pt->x = 0;
-    pt->y = 0;
+ #ifdef GENERATE_DEBUG_IMAGES
+     FIA_SaveFIBToFile(filtered_src2,  DEBUG_DATA_DIR "fft-prefiltered2.png", BIT8);
+ #endif
 
-    if (src1_rgn == NULL || src2_rgn == NULL)
-    {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN, "NULL values passed");
-        return FIA_ERROR;
-    }
+     int src1_width = FreeImage_GetWidth(src1);
+     int src1_height = FreeImage_GetHeight(src1);
+     int filtered_src_width = FreeImage_GetWidth(filtered_src2);
+     int filtered_src_height = FreeImage_GetHeight(filtered_src2);
 
-	// Search_rect is relative to the whole of src1
-	// we need to make it relative to the src1 region
-	search_rect.left -= rect1.left;
-	search_rect.top -= rect1.top;
-	search_rect.right -= rect1.left;
-	search_rect.bottom -= rect1.top;
+     if(!FIA_CheckSizesAreSame(src2, filtered_src2))
+     {
+         FreeImage_OutputMessageProc(
+                 FIF_UNKNOWN,
+                 "Filter function has changed the size of the source input from %d,%d to %d,%d",
+                 src1_width, src1_height, filtered_src_width,
+                 filtered_src_height);
 
-    int err = FIA_KernelCorrelateImages(src1_rgn, src2_rgn, search_rect, mask, filter, pt, max);
+         return FIA_ERROR;
+     }
 
-    if (err == FIA_ERROR)
-    {
-        return FIA_ERROR;
-    }
+     // Find the padded width and height.
+     int pad_width = kiss_fft_next_fast_size(src1_width + pad_size);
+     int pad_height = kiss_fft_next_fast_size(src1_height + pad_size);
 
-    // Add the point found to the start of the region searched
-    if (src1 == src2)
-    { // Images are the same image
-        pt->x += rect1.left;
-        pt->y += rect1.top;
-    }
-    else
-    {
+     FIBITMAP *border_src2 = PadImage(filtered_src2, pad_width, pad_height);
 
-        // Images are different so we need to adjust for the selected region in both images
-        pt->x = pt->x - rect2.left + rect1.left;
-        pt->y = pt->y - rect2.top + rect1.top;
-    }
+     // Spectra from FIA_PreCalculateCorrelationFFT are single precision
+     // half spectra, older callers may still pass a full FIT_COMPLEX spectrum.
+     bool half_spectrum = FIA_GetHalfSpectrumWidth(fft_fib) > 0;
+     bool single_precision = FIA_IsComplexFloatImage(fft_fib) != 0;
 
-    FreeImage_Unload(src1_rgn);
-    FreeImage_Unload(src2_rgn);
+     FIBITMAP *fft2 = NULL;
 
-    if (err == FIA_ERROR)
-    {
-        return FIA_ERROR;
-    }
+     if (half_spectrum)
+         fft2 = single_precision ? FIA_RealFFTToComplexFloat(border_src2) : FIA_RealFFT(border_src2);
+     else
+         fft2 = single_precision ? FIA_FFTToComplexFloat(border_src2) : FIA_FFT(border_src2);
 
-    return FIA_SUCCESS;
-}
+     FIA_ComplexConjugate(fft2);
 
-FIBITMAP *
-FIA_EdgeDetect(FIBITMAP * src)
-{
-    double kernel[] =
-        { -1.0 / 8.0, -1.0 / 8.0, -1.0 / 8.0, -1.0 / 8.0, 1.0, -1.0 / 8.0, -1.0
-                / 8.0, -1.0 / 8.0, -1.0 / 8.0 };
+     if (FIA_MultiplyComplexImages(fft_fib, fft2) == FIA_ERROR)
+     {
+         FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                 "FIA_MultiplyComplexImages Failed");
+         return FIA_ERROR;
+     }
 
-    FIABITMAP *src_bordered = FIA_SetBorder(src, 1, 1, BorderType_Copy, 0.0);
+     FIBITMAP *real = NULL;
 
-    FilterKernel convolve_kernel = FIA_NewKernel(1, 1, kernel, 1.0);
+     if (half_spectrum)
+     {
+         real = FIA_RealIFFT(fft_fib);
+     }
+     else
+     {
+         FIBITMAP *ifft = FIA_IFFT(fft_fib);
 
-    FIBITMAP *dib = FIA_Convolve(src_bordered, convolve_kernel);
+         real = FIA_ComplexImageToRealValued(ifft);
 
-    FIA_Unload(src_bordered);
+         FreeImage_Unload(ifft);
+     }
 
-    return dib;
-}
+ #ifdef GENERATE_DEBUG_IMAGES
+     FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(real, 1),  DEBUG_DATA_DIR "fft.png", BIT24);
+ #endif
 
-static FIBITMAP *
-PadImage(FIBITMAP * src, int padded_width_size, int padded_height_size)
-{
-    // Must pad the images so circular convolution does not take place.
-    int width = FreeImage_GetWidth(src);
-    int height = FreeImage_GetHeight(src);
+     double max;
 
-    assert (padded_width_size > width);
-    assert (padded_height_size > height);
+     FIA_FindMaxXY(real, &max, pt);
 
-    FIBITMAP *border_src = FreeImage_Allocate(padded_width_size,
-            padded_height_size, 8, 0, 0, 0);
+     if (pt->x > src1_width)
+     {
+         pt->x = pt->x - pad_width;
+     }
 
-    FIA_SetGreyLevelPalette(border_src);
+     // FIBITMAPS start 0 at bottom row
+     pt->y = pad_height - pt->y - 1;
 
-    FreeImage_Paste(border_src, src, 0, 0, 256);
+     if (pt->y > src1_height)
+     {
+         pt->y = pt->y - pad_height;
+     }
 
-    return border_src;
-}
+     FreeImage_Unload(real);
+     FreeImage_Unload(fft_fib);
+     FreeImage_Unload(fft2);
+     FreeImage_Unload(src1);
+     FreeImage_Unload(src2);
+     FreeImage_Unload(filtered_src2);
+     FreeImage_Unload(border_src2);
 
-int DLL_CALLCONV
-FIA_FFTCorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2,
-        CORRELATION_PREFILTER filter, FIAPOINT * pt)
-{
-    FIBITMAP *src1 = FreeImage_Clone(_src1);
-    FIBITMAP *src2 = FreeImage_Clone(_src2);
+     return FIA_SUCCESS;
+ }
 
-    pt->x = 0;
-    pt->y = 0;
+// Converts an image to 8 bit greyscale and runs the prefilter over it, as
+// FIA_FFTCorrelateImages does for each of its images.
+static FIBITMAP *
+FilterForCorrelation(FIBITMAP * src, CORRELATION_PREFILTER filter)
+{
+    FIBITMAP *standard = FreeImage_Clone(src);
 
-    FREE_IMAGE_TYPE src1_type = FreeImage_GetImageType(src1);
-    FREE_IMAGE_TYPE src2_type = FreeImage_GetImageType(src2);
+    if (standard == NULL)
+    {
+        return NULL;
+    }
 
-    if (src1_type != src2_type)
+    if (FreeImage_GetBPP(standard) >= 24 && FreeImage_GetImageType(standard) == FIT_BITMAP)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Images must be of the same type");
-        return FIA_ERROR;
+        FIA_InPlaceConvertToGreyscale(&standard);
     }
 
-    int bpp1 = FreeImage_GetBPP(src1);
-    int bpp2 = FreeImage_GetBPP(src2);
+    FIA_InPlaceConvertToStandardType(&standard, 0);
 
-    if (bpp1 != bpp2)
+    FIBITMAP *filtered = (filter != NULL) ? filter(standard) : FreeImage_Clone(standard);
+
+    if (filtered == NULL)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Images must have the same bpp");
-        return FIA_ERROR;
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "Filter function returned NULL");
+        FreeImage_Unload(standard);
+        return NULL;
     }
 
-    // Convert colour images to greyscale
-    if (bpp1 >= 24 && src1_type == FIT_BITMAP)
+    FIA_InPlaceConvertToStandardType(&filtered, 0);
+
+    if (!FIA_CheckSizesAreSame(standard, filtered))
     {
-        FIA_InPlaceConvertToGreyscale(&src1);
-        FIA_InPlaceConvertToGreyscale(&src2);
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Filter function has changed the size of the source input from %d,%d to %d,%d",
+                FreeImage_GetWidth(standard), FreeImage_GetHeight(standard),
+                FreeImage_GetWidth(filtered), FreeImage_GetHeight(filtered));
+
+        FreeImage_Unload(filtered);
+        filtered = NULL;
     }
 
-    FIA_InPlaceConvertToStandardType(&src1, 0);
-    FIA_InPlaceConvertToStandardType(&src2, 0);
+    FreeImage_Unload(standard);
 
-    FIBITMAP *filtered_src1 = NULL;
-    FIBITMAP *filtered_src2 = NULL;
+    return filtered;
+}
 
-    if (filter != NULL)
+static double
+ImageNorm(FIBITMAP * src)
+{
+    double sum_of_squares = 0.0;
+
+    for (int y = 0; y < (int) FreeImage_GetHeight(src); y++)
     {
-        filtered_src1 = filter(src1);
-        filtered_src2 = filter(src2);
+        BYTE *bits = FreeImage_GetScanLine(src, y);
 
-        if (filtered_src1 == NULL || filtered_src2 == NULL)
+        for (int x = 0; x < (int) FreeImage_GetWidth(src); x++)
         {
-            FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                    "Filter function returned NULL");
-            return FIA_ERROR;
+            sum_of_squares += (double) bits[x] * bits[x];
         }
     }
-    else
-    {
-        filtered_src1 = FreeImage_Clone(src1);
-        filtered_src2 = FreeImage_Clone(src2);
-    }
 
-    FIA_InPlaceConvertToStandardType(&filtered_src1, 0);
-    FIA_InPlaceConvertToStandardType(&filtered_src2, 0);
+    return sqrt(sum_of_squares);
+}
 
-#ifdef GENERATE_DEBUG_IMAGES
-    FIA_SaveFIBToFile(filtered_src1,  DEBUG_DATA_DIR "fft-prefiltered1.png", BIT8);
-    FIA_SaveFIBToFile(filtered_src2,  DEBUG_DATA_DIR "fft-prefiltered2.png", BIT8);
-#endif
+// Inverse transforms spectrum1 times the conjugate of spectrum2, both single
+// precision half spectra of the same size. The phase only correlation divides
+// each value of the product by its magnitude so only the phase difference is left.
+static FIBITMAP *
+CorrelationSurface(FIBITMAP * spectrum1, FIBITMAP * spectrum2, int phase_only)
+{
+    // The spectra may be shared so the conjugate is taken of a copy.
+    FIBITMAP *product = FreeImage_Clone(spectrum2);
 
-    int src1_width = FreeImage_GetWidth(src1);
-    int src1_height = FreeImage_GetHeight(src1);
-    int filtered_src1_width = FreeImage_GetWidth(filtered_src1);
-    int filtered_src1_height = FreeImage_GetHeight(filtered_src1);
+    if (product == NULL)
+    {
+        return NULL;
+    }
 
-    if (filtered_src1_width != src1_width && filtered_src1_height
-            != src1_height)
+    FIA_ComplexConjugate(product);
+    FIA_MultiplyComplexImages(product, spectrum1);
+
+    if (phase_only)
     {
-        FreeImage_OutputMessageProc(
-                FIF_UNKNOWN,
-                "Filter function has changed the size of the source input from %d,%d to %d,%d",
-                src1_width, src1_height, filtered_src1_width,
-                filtered_src1_height);
+        int width = FreeImage_GetWidth(product);
 
-        return FIA_ERROR;
+        for (int y = 0; y < (int) FreeImage_GetHeight(product); y++)
+        {
+            FIACOMPLEXF *bits = (FIACOMPLEXF *) FreeImage_GetScanLine(product, y);
+
+            for (int x = 0; x < width; x++)
+            {
+                float magnitude = sqrtf(bits[x].r * bits[x].r + bits[x].i * bits[x].i);
+
+                if (magnitude > 1e-12f)
+                {
+                    bits[x].r /= magnitude;
+                    bits[x].i /= magnitude;
+                }
+                else
+                {
+                    bits[x].r = bits[x].i = 0.0f;
+                }
+            }
+        }
     }
 
-    // Find the padded width and height.
-    int pad_width = kiss_fft_next_fast_size(src1_width + FreeImage_GetWidth(
-            filtered_src2) + 1);
-    int pad_height = kiss_fft_next_fast_size(src1_height + FreeImage_GetHeight(
-            filtered_src2) + 1);
+    FIBITMAP *surface = FIA_RealIFFT(product);
 
-    FIBITMAP *border_src1 = PadImage(filtered_src1, pad_width, pad_height);
-    FIBITMAP *border_src2 = PadImage(filtered_src2, pad_width, pad_height);
+    FreeImage_Unload(product);
 
-    FIBITMAP *fft1 = FIA_FFT(border_src1);
-    FIBITMAP *fft2 = FIA_FFT(border_src2);
+    return surface;
+}
 
-#ifdef GENERATE_DEBUG_IMAGES
-    FIBITMAP *i = FIA_IFFT(fft1);
-    FIBITMAP *r = FIA_ComplexImageToRealValued(i);
-    FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(r, 1),  DEBUG_DATA_DIR "FIA_FFTCorrelateImages-fft.png", BIT24);
-    FreeImage_Unload(i);
-    FreeImage_Unload(r);
-#endif
+// Offset of the peak from its centre by fitting the values either side of it,
+// which wrap round the correlation surface.
+static double
+FitPeakOffset(double before, double centre, double after, FIA_PEAK_FIT fit)
+{
+    double offset = 0.0;
 
-    FIA_ComplexConjugate(fft2);
+    if (fit == FIA_PEAK_FIT_GAUSSIAN && before > 0.0 && centre > 0.0 && after > 0.0)
+    {
+        double l = log(before), c = log(centre), r = log(after);
+        double denominator = 2.0 * (l - 2.0 * c + r);
 
-    if (FIA_MultiplyComplexImages(fft1, fft2) == FIA_ERROR)
+        if (denominator < 0.0)
+        {
+            offset = (l - r) / denominator;
+        }
+    }
+    else if (fit != FIA_PEAK_FIT_NONE)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "FIA_MultiplyComplexImages Failed");
-        return FIA_ERROR;
+        // A gaussian can not be fitted to values that are not positive.
+        double denominator = 2.0 * (before - 2.0 * centre + after);
+
+        if (denominator < 0.0)
+        {
+            offset = (before - after) / denominator;
+        }
     }
 
-    FIBITMAP *ifft = FIA_IFFT(fft1);
+    return MAX(-0.5, MIN(0.5, offset));
+}
+
+// Finds the highest point of a FIT_FLOAT correlation surface as a shift of
+// the second image relative to the first, src1_width by src1_height.
+static void
+FindCorrelationPeak(FIBITMAP * surface, int src1_width, int src1_height, FIA_PEAK_FIT fit,
+        FIAPOINTD * shift, double *max)
+{
+    int width = FreeImage_GetWidth(surface);
+    int height = FreeImage_GetHeight(surface);
+    FIAPOINT pt;
 
-    FIBITMAP *real = FIA_ComplexImageToRealValued(ifft);
+    FIA_FindMaxXY(surface, max, &pt);
 
-#ifdef GENERATE_DEBUG_IMAGES
-    FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(real, 1),  DEBUG_DATA_DIR "fft.png", BIT24);
-#endif
+    float *row = (float *) FreeImage_GetScanLine(surface, pt.y);
+    float *row_below = (float *) FreeImage_GetScanLine(surface, (pt.y + height - 1) % height);
+    float *row_above = (float *) FreeImage_GetScanLine(surface, (pt.y + 1) % height);
 
-    double max;
+    double x = pt.x + FitPeakOffset(row[(pt.x + width - 1) % width], *max,
+            row[(pt.x + 1) % width], fit);
 
-    FIA_FindMaxXY(real, &max, pt);
+    double y = pt.y + FitPeakOffset(row_below[pt.x], *max, row_above[pt.x], fit);
 
-    if (pt->x > src1_width)
+    if (pt.x > src1_width)
     {
-        pt->x = pt->x - pad_width;
+        x = x - width;
     }
 
     // FIBITMAPS start 0 at bottom row
-    pt->y = pad_height - pt->y - 1;
+    y = height - y - 1;
 
-    if (pt->y > src1_height)
+    if (height - pt.y - 1 > src1_height)
     {
-        pt->y = pt->y - pad_height;
+        y = y - height;
     }
 
-    FreeImage_Unload(real);
-    FreeImage_Unload(ifft);
-    FreeImage_Unload(fft1);
-    FreeImage_Unload(fft2);
-    FreeImage_Unload(src1);
-    FreeImage_Unload(src2);
-    FreeImage_Unload(filtered_src1);
-    FreeImage_Unload(filtered_src2);
-    FreeImage_Unload(border_src1);
-    FreeImage_Unload(border_src2);
-
-    return FIA_SUCCESS;
+    shift->x = x;
+    shift->y = y;
 }
 
-FIBITMAP* DLL_CALLCONV
-FIA_PreCalculateCorrelationFFT(FIBITMAP *_src1, FIBITMAP *_src2, int pad_size, CORRELATION_PREFILTER filter)
+typedef struct
 {
-    FIBITMAP *src1 = FreeImage_Clone(_src1);
-    FIBITMAP *src2 = FreeImage_Clone(_src2);
-
-    FREE_IMAGE_TYPE src1_type = FreeImage_GetImageType(src1);
-    FREE_IMAGE_TYPE src2_type = FreeImage_GetImageType(src2);
+    FIBITMAP **images;
+    FIBITMAP **spectra;
+    double *norms;
+    int pad_width;
+    int pad_height;
+    const FIA_CORRELATION_PAIR *pairs;
+    FIA_CORRELATION_RESULT *results;
+    volatile int failed;
+
+} CorrelationBatch;
+
+static void
+CorrelatePairsBand(void *data, int band, int start, int end)
+{
+    CorrelationBatch *batch = (CorrelationBatch *) data;
 
-    if (src1_type != src2_type)
+    for (int i = start; i < end && !batch->failed; i++)
     {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Images must be of the same type");
-        return FIA_ERROR;
-    }
+        const FIA_CORRELATION_PAIR *pair = batch->pairs + i;
+        FIA_CORRELATION_RESULT *result = batch->results + i;
 
-    int bpp1 = FreeImage_GetBPP(src1);
-    int bpp2 = FreeImage_GetBPP(src2);
+        FIBITMAP *real = CorrelationSurface(batch->spectra[pair->first],
+                batch->spectra[pair->second], 0);
 
-    if (bpp1 != bpp2)
-    {
-        FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                "Images must have the same bpp");
-        return FIA_ERROR;
+        if (real == NULL)
+        {
+            batch->failed = 1;
+            break;
+        }
+
+        double max, sum = 0.0, sum_of_squares = 0.0;
+        FIAPOINTD shift;
+
+        FindCorrelationPeak(real, FreeImage_GetWidth(batch->images[pair->first]),
+                FreeImage_GetHeight(batch->images[pair->first]), FIA_PEAK_FIT_NONE, &shift, &max);
+
+        for (int y = 0; y < batch->pad_height; y++)
+        {
+            float *bits = (float *) FreeImage_GetScanLine(real, y);
+
+            for (int x = 0; x < batch->pad_width; x++)
+            {
+                sum += bits[x];
+                sum_of_squares += (double) bits[x] * bits[x];
+            }
+        }
+
+        FreeImage_Unload(real);
+
+        // The inverse transform is not scaled, so the sums are count times too big.
+        double count = (double) batch->pad_width * batch->pad_height;
+        double mean = sum / count;
+        double deviation = sqrt(MAX(0.0, sum_of_squares / count - mean * mean));
+        double norms = batch->norms[pair->first] * batch->norms[pair->second];
+
+        result->shift.x = (int) shift.x;
+        result->shift.y = (int) shift.y;
+        result->peak = (norms > 0.0) ? max / (count * norms) : 0.0;
+        result->quality = (deviation > 0.0) ? (max - mean) / deviation : 0.0;
     }
+}
 
-    // Convert colour images to greyscale
-    if (bpp1 >= 24 && src1_type == FIT_BITMAP)
+int DLL_CALLCONV
+FIA_FFTCorrelateImagePairs(FIBITMAP **images, int number_of_images,
+        const FIA_CORRELATION_PAIR *pairs, int number_of_pairs,
+        CORRELATION_PREFILTER filter, FIA_CORRELATION_RESULT *results)
+{
+    if (images == NULL || pairs == NULL || results == NULL || number_of_images < 1
+            || number_of_pairs < 0)
     {
-        FIA_InPlaceConvertToGreyscale(&src1);
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "NULL values passed");
+        return FIA_ERROR;
     }
 
-    FIA_InPlaceConvertToStandardType(&src1, 0);
-
-    FIBITMAP *filtered_src1 = NULL;
+    int max_width = 0, max_height = 0;
 
-    if (filter != NULL)
+    for (int i = 0; i < number_of_images; i++)
     {
-        filtered_src1 = filter(src1);
-
-        if (filtered_src1 == NULL)
+        if (images[i] == NULL
+                || FreeImage_GetImageType(images[i]) != FreeImage_GetImageType(images[0])
+                || FreeImage_GetBPP(images[i]) != FreeImage_GetBPP(images[0]))
         {
             FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                    "Filter function returned NULL");
+                    "Images must be of the same type and bpp");
             return FIA_ERROR;
         }
+
+        max_width = MAX(max_width, (int) FreeImage_GetWidth(images[i]));
+        max_height = MAX(max_height, (int) FreeImage_GetHeight(images[i]));
     }
-    else
+
+    for (int i = 0; i < number_of_pairs; i++)
     {
-        filtered_src1 = FreeImage_Clone(src1);
+        if (pairs[i].first < 0 || pairs[i].first >= number_of_images
+                || pairs[i].second < 0 || pairs[i].second >= number_of_images)
+        {
+            FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                    "Pair %d refers to an image that is not in the list", i);
+            return FIA_ERROR;
+        }
     }
 
-    FIA_InPlaceConvertToStandardType(&filtered_src1, 0);
-
-#ifdef GENERATE_DEBUG_IMAGES
-    FIA_SaveFIBToFile(filtered_src1,  DEBUG_DATA_DIR "fft-prefiltered1.png", BIT8);
-#endif
+    CorrelationBatch batch;
 
-    int src1_width = FreeImage_GetWidth(src1);
-    int src1_height = FreeImage_GetHeight(src1);
-    int filtered_src1_width = FreeImage_GetWidth(filtered_src1);
-    int filtered_src1_height = FreeImage_GetHeight(filtered_src1);
+    // One size that fits any pair without the correlation wrapping round.
+    batch.images = images;
+    batch.pad_width = kiss_fft_next_fast_size(2 * max_width + 1);
+    batch.pad_height = kiss_fft_next_fast_size(2 * max_height + 1);
+    batch.pairs = pairs;
+    batch.results = results;
+    batch.failed = 0;
+    batch.spectra = (FIBITMAP **) calloc(number_of_images, sizeof(FIBITMAP *));
+    batch.norms = (double *) calloc(number_of_images, sizeof(double));
 
-    if(!FIA_CheckSizesAreSame(src1, filtered_src1))
+    if (batch.spectra == NULL || batch.norms == NULL)
     {
-        FreeImage_OutputMessageProc(
-                FIF_UNKNOWN,
-                "Filter function has changed the size of the source input from %d,%d to %d,%d",
-                src1_width, src1_height, filtered_src1_width,
-                filtered_src1_height);
-
+        free(batch.spectra);
+        free(batch.norms);
         return FIA_ERROR;
     }
 
-    // Find the padded width and height.
-    int pad_width = kiss_fft_next_fast_size(src1_width + pad_size );
-    int pad_height = kiss_fft_next_fast_size(src1_height + pad_size);
-
-    FIBITMAP *border_src1 = PadImage(filtered_src1, pad_width, pad_height);
-
-    FIBITMAP *fft = FIA_FFT(border_src1);
-
-    FreeImage_Unload(src1);
-    FreeImage_Unload(src2);
-    FreeImage_Unload(filtered_src1);
-    FreeImage_Unload(border_src1);
-
-#ifdef GENERATE_DEBUG_IMAGES
-    FIBITMAP *ifft = FIA_IFFT(fft);
-    FIBITMAP *real = FIA_ComplexImageToRealValued(ifft);
-
-    FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(real, 1),  DEBUG_DATA_DIR "fft-pre-generated.png", BIT24);
+    // Each image's spectrum is found once, the transforms use the thread pool themselves.
+    for (int i = 0; i < number_of_pairs && !batch.failed; i++)
+    {
+        int indices[2] = {pairs[i].first, pairs[i].second};
 
-    FreeImage_Unload(ifft);
-    FreeImage_Unload(real);
+        for (int j = 0; j < 2; j++)
+        {
+            int index = indices[j];
 
-#endif
+            if (batch.spectra[index] != NULL)
+            {
+                continue;
+            }
 
-    return fft;
-}
+            FIBITMAP *filtered = FilterForCorrelation(images[index], filter);
 
-int DLL_CALLCONV
-FIA_FFTCorrelateImageWithPreCorrelationFFT(FIBITMAP * fft1_fib, FIBITMAP *_src1, FIBITMAP *_src2, int pad_size,
-        CORRELATION_PREFILTER filter, FIAPOINT * pt)
-{
-    if(FreeImage_GetImageType(fft1_fib) != FIT_COMPLEX)
-        return FIA_ERROR;
+            if (filtered == NULL)
+            {
+                batch.failed = 1;
+                break;
+            }
 
-    FIBITMAP *fft_fib = FreeImage_Clone(fft1_fib);
-    FIBITMAP *src1 = FreeImage_Clone(_src1);
-    FIBITMAP *src2 = FreeImage_Clone(_src2);
+            FIBITMAP *padded = PadImage(filtered, batch.pad_width, batch.pad_height);
 
-     pt->x = 0;
-     pt->y = 0;
+            batch.norms[index] = ImageNorm(filtered);
+            batch.spectra[index] = FIA_RealFFTToComplexFloat(padded);
 
-     FREE_IMAGE_TYPE src1_type = FreeImage_GetImageType(src1);
-     FREE_IMAGE_TYPE src2_type = FreeImage_GetImageType(src2);
+            FreeImage_Unload(filtered);
+            FreeImage_Unload(padded);
 
-     if (src1_type != src2_type)
-     {
-         FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                 "Images must be of the same type");
-         return FIA_ERROR;
-     }
+            if (batch.spectra[index] == NULL)
+            {
+                batch.failed = 1;
+                break;
+            }
+        }
+    }
 
-     int bpp1 = FreeImage_GetBPP(src1);
-     int bpp2 = FreeImage_GetBPP(src2);
+    if (!batch.failed)
+    {
+        FIA_RunBands(0, number_of_pairs, FIA_GetNumberOfBands(number_of_pairs, 1),
+                CorrelatePairsBand, &batch);
+    }
 
-     if (bpp1 != bpp2)
-     {
-         FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                 "Images must have the same bpp");
-         return FIA_ERROR;
-     }
+    for (int i = 0; i < number_of_images; i++)
+    {
+        FreeImage_Unload(batch.spectra[i]);
+    }
 
-     // Convert colour images to greyscale
-     if (bpp2 >= 24 && src2_type == FIT_BITMAP)
-     {
-         FIA_InPlaceConvertToGreyscale(&src2);
-     }
+    free(batch.spectra);
+    free(batch.norms);
 
-     FIA_InPlaceConvertToStandardType(&src2, 0);
+    if (batch.failed)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "Unable to correlate the image pairs");
+        return FIA_ERROR;
+    }
 
-     FIBITMAP *filtered_src2 = NULL;
+    return FIA_SUCCESS;
+}
 
-     if (filter != NULL)
-     {
-         filtered_src2 = filter(src2);
+int DLL_CALLCONV
+FIA_FFTCorrelateImagesSubpixel(FIBITMAP * src1, FIBITMAP * src2, CORRELATION_PREFILTER filter,
+        int phase_only, FIA_PEAK_FIT fit, FIAPOINTD * pt, double *peak)
+{
+    if (src1 == NULL || src2 == NULL || pt == NULL)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "NULL values passed");
+        return FIA_ERROR;
+    }
 
-         if (filtered_src2 == NULL)
-         {
-             FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                     "Filter function returned NULL");
-             return FIA_ERROR;
-         }
-     }
-     else
-     {
-         filtered_src2 = FreeImage_Clone(src2);
-     }
+    pt->x = 0.0;
+    pt->y = 0.0;
 
-     FIA_InPlaceConvertToStandardType(&filtered_src2, 0);
+    if (FreeImage_GetImageType(src1) != FreeImage_GetImageType(src2)
+            || FreeImage_GetBPP(src1) != FreeImage_GetBPP(src2))
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN,
+                "Images must be of the same type and bpp");
+        return FIA_ERROR;
+    }
 
- #ifdef GENERATE_DEBUG_IMAGES
-     FIA_SaveFIBToFile(filtered_src2,  DEBUG_DATA_DIR "fft-prefiltered2.png", BIT8);
- #endif
+    FIBITMAP *filtered_src1 = FilterForCorrelation(src1, filter);
+    FIBITMAP *filtered_src2 = FilterForCorrelation(src2, filter);
 
-     int src1_width = FreeImage_GetWidth(src1);
-     int src1_height = FreeImage_GetHeight(src1);
-     int filtered_src_width = FreeImage_GetWidth(filtered_src2);
-     int filtered_src_height = FreeImage_GetHeight(filtered_src2);
+    if (filtered_src1 == NULL || filtered_src2 == NULL)
+    {
+        FreeImage_Unload(filtered_src1);
+        FreeImage_Unload(filtered_src2);
+        return FIA_ERROR;
+    }
 
-     if(!FIA_CheckSizesAreSame(src2, filtered_src2))
-     {
-         FreeImage_OutputMessageProc(
-                 FIF_UNKNOWN,
-                 "Filter function has changed the size of the source input from %d,%d to %d,%d",
-                 src1_width, src1_height, filtered_src_width,
-                 filtered_src_height);
+    int src1_width = FreeImage_GetWidth(src1);
+    int src1_height = FreeImage_GetHeight(src1);
 
-         return FIA_ERROR;
-     }
+    // Padded as FIA_FFTCorrelateImages so the shifts are the same.
+    int pad_width = kiss_fft_next_fast_size(src1_width + FreeImage_GetWidth(src2) + 1);
+    int pad_height = kiss_fft_next_fast_size(src1_height + FreeImage_GetHeight(src2) + 1);
 
-     // Find the padded width and height.
-     int pad_width = kiss_fft_next_fast_size(src1_width + pad_size);
-     int pad_height = kiss_fft_next_fast_size(src1_height + pad_size);
+    FIBITMAP *border_src1, *border_src2;
 
-     FIBITMAP *border_src2 = PadImage(filtered_src2, pad_width, pad_height);
+    if (phase_only)
+    {
+        border_src1 = PadTaperedImage(filtered_src1, pad_width, pad_height);
+        border_src2 = PadTaperedImage(filtered_src2, pad_width, pad_height);
+    }
+    else
+    {
+        border_src1 = PadImage(filtered_src1, pad_width, pad_height);
+        border_src2 = PadImage(filtered_src2, pad_width, pad_height);
+    }
 
-     FIBITMAP *fft2 = FIA_FFT(border_src2);
+    FIBITMAP *fft1 = FIA_RealFFTToComplexFloat(border_src1);
+    FIBITMAP *fft2 = FIA_RealFFTToComplexFloat(border_src2);
 
-     FIA_ComplexConjugate(fft2);
+    double norms = ImageNorm(filtered_src1) * ImageNorm(filtered_src2);
 
-     if (FIA_MultiplyComplexImages(fft_fib, fft2) == FIA_ERROR)
-     {
-         FreeImage_OutputMessageProc(FIF_UNKNOWN,
-                 "FIA_MultiplyComplexImages Failed");
-         return FIA_ERROR;
-     }
+    FreeImage_Unload(filtered_src1);
+    FreeImage_Unload(filtered_src2);
+    FreeImage_Unload(border_src1);
+    FreeImage_Unload(border_src2);
 
-     FIBITMAP *ifft = FIA_IFFT(fft_fib);
+    FIBITMAP *surface = NULL;
 
-     FIBITMAP *real = FIA_ComplexImageToRealValued(ifft);
+    if (fft1 != NULL && fft2 != NULL)
+    {
+        surface = CorrelationSurface(fft1, fft2, phase_only);
+    }
 
- #ifdef GENERATE_DEBUG_IMAGES
-     FIA_SaveFIBToFile(FreeImage_ConvertToStandardType(real, 1),  DEBUG_DATA_DIR "fft.png", BIT24);
- #endif
+    FreeImage_Unload(fft1);
+    FreeImage_Unload(fft2);
 
-     double max;
+    if (surface == NULL)
+    {
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "Unable to correlate the images");
+        return FIA_ERROR;
+    }
 
-     FIA_FindMaxXY(real, &max, pt);
+    double max;
 
-     if (pt->x > src1_width)
-     {
-         pt->x = pt->x - pad_width;
-     }
+    FindCorrelationPeak(surface, src1_width, src1_height, fit, pt, &max);
 
-     // FIBITMAPS start 0 at bottom row
-     pt->y = pad_height - pt->y - 1;
+    FreeImage_Unload(surface);
 
-     if (pt->y > src1_height)
-     {
-         pt->y = pt->y - pad_height;
-     }
+    if (peak != NULL)
+    {
+        // The inverse transform is not scaled, so the sums are count times too big.
+        double count = (double) pad_width * pad_height;
 
-     FreeImage_Unload(real);
-     FreeImage_Unload(fft_fib);
-     FreeImage_Unload(ifft);
-     FreeImage_Unload(fft2);
-     FreeImage_Unload(src1);
-     FreeImage_Unload(src2);
-     FreeImage_Unload(filtered_src2);
-     FreeImage_Unload(border_src2);
+        if (phase_only)
+        {
+            *peak = max / count;
+        }
+        else
+        {
+            *peak = (norms > 0.0) ? max / (count * norms) : 0.0;
+        }
+    }
 
-     return FIA_SUCCESS;
- }
+    return FIA_SUCCESS;
+}
 
 int DLL_CALLCONV
 FIA_FFTCorrelateImageRegions(FIBITMAP * src1, FIARECT rect1, FIBITMAP * src2,
@@ -1035,3 +3026,73 @@ FIA_FFTCorrelateImageRegions(FIBITMAP * src1, FIARECT rect1, FIBITMAP * src2,
 
     return FIA_SUCCESS;
 }
+
+int DLL_CALLCONV
+FIA_CorrelateImages(FIBITMAP * _src1, FIBITMAP * _src2, CorrelationType type,
+        CORRELATION_PREFILTER filter, FIAPOINT * pt)
+{
+    double max;
+
+    switch (type)
+    {
+        case CORRELATION_KERNEL:
+            return FIA_KernelCorrelateImages(_src1, _src2, FIA_EMPTY_RECT, NULL, filter, pt, &max);
+
+        case CORRELATION_FFT:
+            return FIA_FFTCorrelateImages(_src1, _src2, filter, pt);
+
+        case CORRELATION_FAST_NCC:
+            return FIA_FastNCCCorrelateImages(_src1, _src2, FIA_EMPTY_RECT, NULL, filter, pt, &max);
+    }
+
+    FreeImage_OutputMessageProc(FIF_UNKNOWN, "Unknown correlation type %d", type);
+
+    return FIA_ERROR;
+}
+
+int DLL_CALLCONV
+FIA_CorrelateImageRegions(FIBITMAP * src1, FIARECT rect1, FIBITMAP * src2, FIARECT rect2,
+        CorrelationType type, CORRELATION_PREFILTER filter, FIAPOINT * pt)
+{
+    FIBITMAP *src1_rgn = FIA_Copy(src1, rect1.left, rect1.top, rect1.right,
+            rect1.bottom);
+    FIBITMAP *src2_rgn = FIA_Copy(src2, rect2.left, rect2.top, rect2.right,
+            rect2.bottom);
+
+    pt->x = 0;
+    pt->y = 0;
+
+    if (src1_rgn == NULL || src2_rgn == NULL)
+    {
+        FreeImage_Unload(src1_rgn);
+        FreeImage_Unload(src2_rgn);
+
+        FreeImage_OutputMessageProc(FIF_UNKNOWN, "NULL values passed");
+        return FIA_ERROR;
+    }
+
+    int err = FIA_CorrelateImages(src1_rgn, src2_rgn, type, filter, pt);
+
+    FreeImage_Unload(src1_rgn);
+    FreeImage_Unload(src2_rgn);
+
+    if (err == FIA_ERROR)
+    {
+        return FIA_ERROR;
+    }
+
+    // Add the point found to the start of the region searched
+    if (src1 == src2)
+    { // Images are the same image
+        pt->x += rect1.left;
+        pt->y += rect1.top;
+    }
+    else
+    {
+        // Images are different so we need to adjust for the selected region in both images
+        pt->x = pt->x - rect2.left + rect1.left;
+        pt->y = pt->y - rect2.top + rect1.top;
+    }
+
+    return FIA_SUCCESS;
+}
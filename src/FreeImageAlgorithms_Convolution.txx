@@ -23,19 +23,30 @@
 #include "FreeImageAlgorithms_Utilities.h"
 
 #include "FreeImageAlgorithms_Utils.h"
+#include "FreeImageAlgorithms_Palettes.h"
+#include "FreeImageAlgorithms_ThreadPool.h"
+#include "FreeImageAlgorithms_SIMD.h"
+
+#include <math.h>
 
 #define BLOCKSIZE 8
 
-template < typename Tsrc > class Kernel;
+// Fewest output rows given to one thread.
+#define KERNEL_ROWS_PER_BAND 8
+
+// Tsrc is the pixel type of the image being walked and Tacc the type of the
+// kernel values and of the running sum. Tacc defaults to Tsrc so the morphology
+// code can keep walking unsigned char kernels over unsigned char images.
+template < typename Tsrc, typename Tacc = Tsrc > class Kernel;
 
-template < typename Tsrc > class KernelIterator
+template < typename Tsrc, typename Tacc = Tsrc > class KernelIterator
 {
   public:
 
-    KernelIterator (Kernel < Tsrc > *kernel)
+    KernelIterator (Kernel < Tsrc, Tacc > *kernel)
     {
         this->kernel = kernel;
-        this->current_kernel_ptr = const_cast < Tsrc * >(kernel->KernelValues ());
+        this->current_kernel_ptr = const_cast < Tacc * >(kernel->KernelValues ());
         this->current_image_ptr = kernel->KernelFirstValuePtr ();
     }
 
@@ -51,7 +62,7 @@ template < typename Tsrc > class KernelIterator
         this->current_image_ptr += kernel->ImagePitchInPixels ();
     }
 
-    inline Tsrc GetKernelValue ()
+    inline Tacc GetKernelValue ()
     {
         return *(this->current_kernel_ptr);
     }
@@ -61,7 +72,7 @@ template < typename Tsrc > class KernelIterator
         return *(this->current_image_ptr);
     }
 
-    inline Tsrc *GetKernelPtrValue ()
+    inline Tacc *GetKernelPtrValue ()
     {
         return this->current_kernel_ptr;
     }
@@ -71,23 +82,23 @@ template < typename Tsrc > class KernelIterator
         return this->current_image_ptr;
     }
 
-    inline Kernel < Tsrc > *GetKernel ()
+    inline Kernel < Tsrc, Tacc > *GetKernel ()
     {
         return this->kernel;
     }
 
   private:
 
-    Tsrc * current_kernel_ptr;
+    Tacc * current_kernel_ptr;
     Tsrc *current_image_ptr;
 
-    Kernel < Tsrc > *kernel;
+    Kernel < Tsrc, Tacc > *kernel;
 };
 
-template < typename Tsrc > class Kernel
+template < typename Tsrc, typename Tacc > class Kernel
 {
   public:
-    Kernel (FIABITMAP * src, int x_radius, int y_radius, const Tsrc * values, double divider);
+    Kernel (FIABITMAP * src, int x_radius, int y_radius, const Tacc * values, double divider);
 
 	inline Tsrc* GetPtrToLine (int line)
     {
@@ -157,7 +168,7 @@ template < typename Tsrc > class Kernel
     {
         return this->src_pitch_in_pixels;
     }
-    inline const Tsrc *KernelValues ()
+    inline const Tacc *KernelValues ()
     {
         return this->values;
     }
@@ -197,22 +208,30 @@ template < typename Tsrc > class Kernel
     {
         return *(this->current_src_center_ptr);
     }
-    inline KernelIterator < Tsrc > Begin ()
+    inline KernelIterator < Tsrc, Tacc > Begin ()
     {
-        return KernelIterator < Tsrc > (this);
+        return KernelIterator < Tsrc, Tacc > (this);
     }
 
-    FIBITMAP *Convolve ();
+    // Convolves the image returning an image of dst_type.
+    // Values are rounded and clamped when dst_type is an integer type.
+    // Bands of rows are shared out over the thread pool.
+    FIBITMAP *Convolve (FREE_IMAGE_TYPE dst_type = FIT_DOUBLE);
     FIBITMAP *Correlate ();
 
+    // Work on the output rows [start, end) using this kernel's cursor.
+    // Each thread calls these on its own copy of the kernel.
+    void ConvolveRows (FIBITMAP * dst, FREE_IMAGE_TYPE dst_type, int start, int end);
+    void CorrelateRows (FIBITMAP * dst, FIARECT rect, int start, int end);
+
   private:
 
     inline void ConvolveKernel ();
     inline void CorrelateKernel ();
-    inline void ConvolveKernelRow (KernelIterator < Tsrc > &iterator);
-    inline double AddKernelRow (KernelIterator < Tsrc > &iterator);
+    inline void ConvolveKernelRow (KernelIterator < Tsrc, Tacc > &iterator);
+    inline double AddKernelRow (KernelIterator < Tsrc, Tacc > &iterator);
     inline double ImageAverageAtKernel (void);
-    inline void CorrelateKernelRow (KernelIterator < Tsrc > &iterator, double average);
+    inline void CorrelateKernelRow (KernelIterator < Tsrc, Tacc > &iterator, double average);
 
     FIBITMAP *dib;
     FIBITMAP *mask;
@@ -233,14 +252,16 @@ template < typename Tsrc > class Kernel
     const int y_max_block_size;
     const int src_pitch_in_pixels;
     const FREE_IMAGE_TYPE src_image_type;
-    const Tsrc *values;
+    const Tacc *values;
     int x_amount_to_image;
     int y_amount_to_image;
     double kernel_average;
+    double kernel_normalise_sum;
 
     Tsrc *src_first_pixel_address_ptr;
 
-    double sum;
+    Tacc sum;
+    double correlation_sum;
     double correlation_sum_squared;
 
     Tsrc *current_src_center_ptr;
@@ -248,8 +269,8 @@ template < typename Tsrc > class Kernel
 };
 
 // The following code does a lot of loop unrolling for performance.
-template < typename Tsrc > Kernel < Tsrc >::Kernel (FIABITMAP * src, int x_radius, int y_radius,
-                                                    const Tsrc * values, double divider):
+template < typename Tsrc, typename Tacc > Kernel < Tsrc, Tacc >::Kernel (FIABITMAP * src, int x_radius, int y_radius,
+                                                    const Tacc * values, double divider):
 xborder (src->xborder),
 yborder (src->yborder),
 x_radius (x_radius),
@@ -285,10 +306,11 @@ values (values)
     this->Move (0, 0);
 }
 
-template < typename Tsrc > inline void Kernel < Tsrc >::ConvolveKernelRow (KernelIterator < Tsrc >
+template < typename Tsrc, typename Tacc > inline void Kernel < Tsrc, Tacc >::ConvolveKernelRow (KernelIterator < Tsrc, Tacc >
                                                                            &iterator)
 {
-    register double *tmp, *kernel_ptr;
+    register Tsrc *tmp;
+    register Tacc *kernel_ptr;
 
     int x_max_block_size = this->x_max_block_size;
     int x_reminder = this->x_reminder;
@@ -353,11 +375,11 @@ template < typename Tsrc > inline void Kernel < Tsrc >::ConvolveKernelRow (Kerne
     }
 }
 
-template < typename Tsrc > inline void Kernel < Tsrc >::ConvolveKernel ()
+template < typename Tsrc, typename Tacc > inline void Kernel < Tsrc, Tacc >::ConvolveKernel ()
 {
-    this->sum = 0.0f;
+    this->sum = 0;
 
-    KernelIterator < Tsrc > iterator = this->Begin ();
+    KernelIterator < Tsrc, Tacc > iterator = this->Begin ();
 
     for(register int row = 0; row < this->y_max_block_size; row += BLOCKSIZE)
     {
@@ -425,41 +447,279 @@ template < typename Tsrc > inline void Kernel < Tsrc >::ConvolveKernel ()
     }
 }
 
-template < typename Tsrc > FIBITMAP * Kernel < Tsrc >::Convolve ()
+// Rounds and clamps a row of convolved values into an integer destination row.
+template < typename Tdst > inline void
+StoreConvolvedIntegerRow (const double *row, Tdst *dst_ptr, int width, double min, double max)
 {
-    const int dst_width = src_image_width - (2 * this->xborder);
-    const int dst_height = src_image_height - (2 * this->yborder);
+    register double value;
+
+    for(register int x = 0; x < width; x++)
+    {
+        value = floor (row[x] + 0.5);
+
+        if (value < min)
+            value = min;
+        else if (value > max)
+            value = max;
+
+        dst_ptr[x] = (Tdst) value;
+    }
+}
+
+template < typename Tdst > inline void
+StoreConvolvedFloatRow (const double *row, Tdst *dst_ptr, int width)
+{
+    for(register int x = 0; x < width; x++)
+        dst_ptr[x] = (Tdst) row[x];
+}
+
+// Writes a row of convolved values into a scanline of a greyscale image of any type.
+static inline void
+StoreConvolvedRow (const double *row, BYTE *scanline, FREE_IMAGE_TYPE type, int width)
+{
+    double min = 0.0, max = 0.0;
+
+    FIA_GetMinPosibleValueForGreyScaleType (type, &min);
+    FIA_GetMaxPosibleValueForGreyScaleType (type, &max);
+
+    switch (type)
+    {
+        case FIT_BITMAP:
+            StoreConvolvedIntegerRow (row, (unsigned char *) scanline, width, min, max);
+            break;
+        case FIT_UINT16:
+            StoreConvolvedIntegerRow (row, (unsigned short *) scanline, width, min, max);
+            break;
+        case FIT_INT16:
+            StoreConvolvedIntegerRow (row, (short *) scanline, width, min, max);
+            break;
+        case FIT_UINT32:
+            StoreConvolvedIntegerRow (row, (unsigned int *) scanline, width, min, max);
+            break;
+        case FIT_INT32:
+            StoreConvolvedIntegerRow (row, (int *) scanline, width, min, max);
+            break;
+        case FIT_FLOAT:
+            StoreConvolvedFloatRow (row, (float *) scanline, width);
+            break;
+        case FIT_DOUBLE:
+            StoreConvolvedFloatRow (row, (double *) scanline, width);
+            break;
+        default:
+            break;
+    }
+}
+
+// Allocates a greyscale image of the given type. 8bit images get a grey palette.
+static inline FIBITMAP *
+AllocateConvolutionDestination (FREE_IMAGE_TYPE type, int width, int height)
+{
+    FIBITMAP *dst = NULL;
+
+    switch (type)
+    {
+        case FIT_BITMAP:
+            dst = FreeImage_Allocate (width, height, 8, 0, 0, 0);
+            FIA_SetGreyLevelPalette (dst);
+            break;
+        case FIT_UINT16:
+        case FIT_INT16:
+        case FIT_UINT32:
+        case FIT_INT32:
+        case FIT_FLOAT:
+        case FIT_DOUBLE:
+            dst = FreeImage_AllocateT (type, width, height, 8, 0, 0, 0);
+            break;
+        default:
+            break;
+    }
+
+    return dst;
+}
+
+// Vectorised rows for the pixel and accumulator types in FIA_VectorFunctions.
+// Other types use the unrolled scalar code.
+template < typename Tsrc, typename Tacc > struct KernelVectorRow
+{
+    static const int available = 0;
+
+    static inline void Convolve (const FIA_VectorFunctions * functions, const Tsrc * src, int src_pitch,
+                                 const Tacc * kernel, int kernel_width, int kernel_height, Tacc * dst, int width)
+    {
+    }
+};
+
+template <> struct KernelVectorRow < float, float >
+{
+    static const int available = 1;
+
+    static inline void Convolve (const FIA_VectorFunctions * functions, const float *src, int src_pitch,
+                                 const float *kernel, int kernel_width, int kernel_height, float *dst, int width)
+    {
+        functions->float_convolve_row (src, src_pitch, kernel, kernel_width, kernel_height, dst, width);
+    }
+};
 
-    FIBITMAP *dst = FIA_CloneImageType (this->dib, dst_width, dst_height);
+template <> struct KernelVectorRow < short, int >
+{
+    static const int available = 1;
 
-    const int dst_pitch_in_pixels = FreeImage_GetPitch (dst) / sizeof (Tsrc);
+    static inline void Convolve (const FIA_VectorFunctions * functions, const short *src, int src_pitch,
+                                 const int *kernel, int kernel_width, int kernel_height, int *dst, int width)
+    {
+        functions->short_convolve_row (src, src_pitch, kernel, kernel_width, kernel_height, dst, width);
+    }
+};
+
+template <> struct KernelVectorRow < unsigned short, int >
+{
+    static const int available = 1;
+
+    static inline void Convolve (const FIA_VectorFunctions * functions, const unsigned short *src, int src_pitch,
+                                 const int *kernel, int kernel_width, int kernel_height, int *dst, int width)
+    {
+        functions->ushort_convolve_row (src, src_pitch, kernel, kernel_width, kernel_height, dst, width);
+    }
+};
+
+template < typename Tsrc, typename Tacc > void Kernel < Tsrc, Tacc >::ConvolveRows (FIBITMAP * dst,
+                                                    FREE_IMAGE_TYPE dst_type, int start, int end)
+{
+    const int dst_width = FreeImage_GetWidth (dst);
 
     register double *dst_ptr;
+    double *row_buffer = NULL;
+    Tacc *vector_row = NULL;
+    const FIA_VectorFunctions *vector_functions = NULL;
+
+    // Double results go straight into the image, everything else is
+    // converted a row at a time from a small buffer.
+    if (dst_type != FIT_DOUBLE)
+        row_buffer = (double *) malloc (sizeof (double) * dst_width);
+
+    if (KernelVectorRow < Tsrc, Tacc >::available)
+        vector_functions = FIA_GetVectorFunctions ();
 
-    double *dst_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (dst);
+    if (vector_functions != NULL || this->kernel_width == 1)
+        vector_row = (Tacc *) malloc (sizeof (Tacc) * dst_width);
 
-    for(register int y = 0; y < dst_height; y++)
+    for(register int y = start; y < end; y++)
     {
         this->Move (0, y);
-        dst_ptr = (dst_first_pixel_address_ptr + y * dst_pitch_in_pixels);
 
-        for(register int x = 0; x < dst_width; x++)
+        if (row_buffer == NULL)
+            dst_ptr = (double *) FreeImage_GetScanLine (dst, y);
+        else
+            dst_ptr = row_buffer;
+
+        if (vector_functions != NULL)
         {
-            this->ConvolveKernel ();
-            *dst_ptr++ = this->sum / this->divider;
-            this->Increment ();
+            KernelVectorRow < Tsrc, Tacc >::Convolve (vector_functions, this->KernelFirstValuePtr (),
+                    this->src_pitch_in_pixels, this->values, this->kernel_width, this->kernel_height,
+                    vector_row, dst_width);
+
+            for(register int x = 0; x < dst_width; x++)
+                *dst_ptr++ = vector_row[x] / this->divider;
         }
+        else if (this->kernel_width == 1)
+        {
+            // A single column kernel, like the second pass of a separable
+            // convolution, is summed a kernel row at a time. The sums are
+            // added in the same order as ConvolveKernel.
+            Tsrc *src_ptr = this->KernelFirstValuePtr ();
+
+            for(register int x = 0; x < dst_width; x++)
+                vector_row[x] = 0;
+
+            for(register int row = 0; row < this->kernel_height; row++)
+            {
+                register Tacc value = this->values[row];
+
+                for(register int x = 0; x < dst_width; x++)
+                    vector_row[x] += src_ptr[x] * value;
+
+                src_ptr += this->src_pitch_in_pixels;
+            }
+
+            for(register int x = 0; x < dst_width; x++)
+                *dst_ptr++ = vector_row[x] / this->divider;
+        }
+        else
+        {
+            for(register int x = 0; x < dst_width; x++)
+            {
+                this->ConvolveKernel ();
+                *dst_ptr++ = this->sum / this->divider;
+                this->Increment ();
+            }
+        }
+
+        if (row_buffer != NULL)
+            StoreConvolvedRow (row_buffer, FreeImage_GetScanLine (dst, y), dst_type, dst_width);
     }
 
+    if (row_buffer != NULL)
+        free (row_buffer);
+
+    if (vector_row != NULL)
+        free (vector_row);
+}
+
+template < typename Tsrc, typename Tacc > struct KernelBandData
+{
+    Kernel < Tsrc, Tacc > *kernel;
+    FIBITMAP *dst;
+    FREE_IMAGE_TYPE dst_type;
+    FIARECT rect;
+};
+
+// Each band copies the kernel so it moves its own cursor over the image.
+template < typename Tsrc, typename Tacc > static void
+ConvolveKernelBand (void *data, int band, int start, int end)
+{
+    KernelBandData < Tsrc, Tacc > *band_data = (KernelBandData < Tsrc, Tacc > *) data;
+    Kernel < Tsrc, Tacc > kernel (*(band_data->kernel));
+
+    kernel.ConvolveRows (band_data->dst, band_data->dst_type, start, end);
+}
+
+template < typename Tsrc, typename Tacc > static void
+CorrelateKernelBand (void *data, int band, int start, int end)
+{
+    KernelBandData < Tsrc, Tacc > *band_data = (KernelBandData < Tsrc, Tacc > *) data;
+    Kernel < Tsrc, Tacc > kernel (*(band_data->kernel));
+
+    kernel.CorrelateRows (band_data->dst, band_data->rect, start, end);
+}
+
+template < typename Tsrc, typename Tacc > FIBITMAP * Kernel < Tsrc, Tacc >::Convolve (FREE_IMAGE_TYPE dst_type)
+{
+    const int dst_width = src_image_width - (2 * this->xborder);
+    const int dst_height = src_image_height - (2 * this->yborder);
+
+    FIBITMAP *dst = AllocateConvolutionDestination (dst_type, dst_width, dst_height);
+
+    if (dst == NULL)
+        return NULL;
+
+    KernelBandData < Tsrc, Tacc > band_data;
+
+    band_data.kernel = this;
+    band_data.dst = dst;
+    band_data.dst_type = dst_type;
+
+    FIA_RunBands (0, dst_height, FIA_GetNumberOfBands (dst_height, KERNEL_ROWS_PER_BAND),
+                  ConvolveKernelBand < Tsrc, Tacc >, &band_data);
+
     return dst;
 }
 
 // Adds the pixel values of the original image pixels
 // that are covered by the kernel row.
-template < typename Tsrc > inline double Kernel < Tsrc >::AddKernelRow (KernelIterator < Tsrc >
+template < typename Tsrc, typename Tacc > inline double Kernel < Tsrc, Tacc >::AddKernelRow (KernelIterator < Tsrc, Tacc >
                                                                         &iterator)
 {
-    register double *tmp;
+    register Tsrc *tmp;
 
     int x_max_block_size = this->x_max_block_size;
     int x_reminder = this->x_reminder;
@@ -522,10 +782,11 @@ template < typename Tsrc > inline double Kernel < Tsrc >::AddKernelRow (KernelIt
     return sum;
 }
 
-template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (KernelIterator < Tsrc >
+template < typename Tsrc, typename Tacc > inline void Kernel < Tsrc, Tacc >::CorrelateKernelRow (KernelIterator < Tsrc, Tacc >
                                                                             &iterator, double avg)
 {
-    register double *tmp, *kernel_ptr;
+    register Tsrc *tmp;
+    register Tacc *kernel_ptr;
 
     int x_max_block_size = this->x_max_block_size;
     int x_reminder = this->x_reminder;
@@ -546,7 +807,7 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (Kern
         var6 = tmp[6] - avg;
         var7 = tmp[7] - avg;
 
-        this->sum += (var0 * (kernel_ptr[0] - kavg) + var1 * (kernel_ptr[1] - kavg) + var2
+        this->correlation_sum += (var0 * (kernel_ptr[0] - kavg) + var1 * (kernel_ptr[1] - kavg) + var2
                       * (kernel_ptr[2] - kavg) + var3 * (kernel_ptr[3] - kavg) +
                       var4 * (kernel_ptr[4] - kavg) + var5 * (kernel_ptr[5] - kavg) +
                       var6 * (kernel_ptr[6] - kavg) + var7 * (kernel_ptr[7] - kavg));
@@ -576,7 +837,7 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (Kern
     {
         case 7:
         {
-            this->sum += ((tmp[6] - avg) * (kernel_ptr[6] - kavg) + (tmp[5] - avg) * (kernel_ptr[5]
+            this->correlation_sum += ((tmp[6] - avg) * (kernel_ptr[6] - kavg) + (tmp[5] - avg) * (kernel_ptr[5]
                                                                                       - kavg) +
                           (tmp[4] - avg) * (kernel_ptr[4] - kavg) + (tmp[3] -
                                                                      avg) * (kernel_ptr[3] - kavg) +
@@ -593,7 +854,7 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (Kern
         }
         case 6:
         {
-            this->sum += ((tmp[5] - avg) * (kernel_ptr[5] - kavg) + (tmp[4] - avg) * (kernel_ptr[4]
+            this->correlation_sum += ((tmp[5] - avg) * (kernel_ptr[5] - kavg) + (tmp[4] - avg) * (kernel_ptr[4]
                                                                                       - kavg) +
                           (tmp[3] - avg) * (kernel_ptr[3] - kavg) + (tmp[2] -
                                                                      avg) * (kernel_ptr[2] - kavg) +
@@ -609,7 +870,7 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (Kern
         }
         case 5:
         {
-            this->sum += ((tmp[4] - avg) * (kernel_ptr[4] - kavg) + (tmp[3] - avg) * (kernel_ptr[3]
+            this->correlation_sum += ((tmp[4] - avg) * (kernel_ptr[4] - kavg) + (tmp[3] - avg) * (kernel_ptr[3]
                                                                                       - kavg) +
                           (tmp[2] - avg) * (kernel_ptr[2] - kavg) + (tmp[1] -
                                                                      avg) * (kernel_ptr[1] - kavg) +
@@ -624,7 +885,7 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (Kern
         }
         case 4:
         {
-            this->sum += ((tmp[3] - avg) * (kernel_ptr[3] - kavg) + (tmp[2] - avg) * (kernel_ptr[2]
+            this->correlation_sum += ((tmp[3] - avg) * (kernel_ptr[3] - kavg) + (tmp[2] - avg) * (kernel_ptr[2]
                                                                                       - kavg) +
                           (tmp[1] - avg) * (kernel_ptr[1] - kavg) + (tmp[0] -
                                                                      avg) * (kernel_ptr[0] - kavg));
@@ -637,7 +898,7 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (Kern
         }
         case 3:
         {
-            this->sum += ((tmp[2] - avg) * (kernel_ptr[2] - kavg) + (tmp[1] - avg) * (kernel_ptr[1]
+            this->correlation_sum += ((tmp[2] - avg) * (kernel_ptr[2] - kavg) + (tmp[1] - avg) * (kernel_ptr[1]
                                                                                       - kavg) +
                           (tmp[0] - avg) * (kernel_ptr[0] - kavg));
 
@@ -647,7 +908,7 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (Kern
         }
         case 2:
         {
-            this->sum += ((tmp[1] - avg) * (kernel_ptr[1] - kavg) + (tmp[0] - avg) * (kernel_ptr[0]
+            this->correlation_sum += ((tmp[1] - avg) * (kernel_ptr[1] - kavg) + (tmp[0] - avg) * (kernel_ptr[0]
                                                                                       - kavg));
 
             this->correlation_sum_squared += ((var1 * var1) + (var0 * var0));
@@ -656,7 +917,7 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (Kern
         }
         case 1:
         {
-            this->sum += (tmp[0] - avg) * (kernel_ptr[0] - kavg);
+            this->correlation_sum += (tmp[0] - avg) * (kernel_ptr[0] - kavg);
 
             this->correlation_sum_squared += (var0 * var0);
         }
@@ -665,12 +926,12 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernelRow (Kern
 
 // Calculates the average value of the pixels in the original image
 // of the pixels covered by the kernel.
-template < typename Tsrc > inline double Kernel < Tsrc >::ImageAverageAtKernel (void)
+template < typename Tsrc, typename Tacc > inline double Kernel < Tsrc, Tacc >::ImageAverageAtKernel (void)
 {
     double sum = 0.0f;
     int kernel_size = kernel_width * kernel_height;
 
-    KernelIterator < Tsrc > iterator = this->Begin ();
+    KernelIterator < Tsrc, Tacc > iterator = this->Begin ();
 
     for(register int row = 0; row < this->y_max_block_size; row += BLOCKSIZE)
     {
@@ -740,13 +1001,13 @@ template < typename Tsrc > inline double Kernel < Tsrc >::ImageAverageAtKernel (
     return sum / kernel_size;
 }
 
-template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernel ()
+template < typename Tsrc, typename Tacc > inline void Kernel < Tsrc, Tacc >::CorrelateKernel ()
 {
-    this->sum = 0.0f;
+    this->correlation_sum = 0.0f;
     this->correlation_sum_squared = 0.0f;
     double average = ImageAverageAtKernel ();
 
-    KernelIterator < Tsrc > iterator = this->Begin ();
+    KernelIterator < Tsrc, Tacc > iterator = this->Begin ();
 
     for(register int row = 0; row < this->y_max_block_size; row += BLOCKSIZE)
     {
@@ -814,18 +1075,64 @@ template < typename Tsrc > inline void Kernel < Tsrc >::CorrelateKernel ()
     }
 }
 
-template < typename Tsrc > FIBITMAP * Kernel < Tsrc >::Correlate ()
+template < typename Tsrc, typename Tacc > void Kernel < Tsrc, Tacc >::CorrelateRows (FIBITMAP * dst,
+                                                    FIARECT rect, int start, int end)
 {
-    const int dst_width = src_image_width - (2 * this->xborder);
-    const int dst_height = src_image_height - (2 * this->yborder);
+    register double *dst_ptr;
 
-    FIBITMAP *dst = FIA_CloneImageType (this->dib, dst_width, dst_height);
+	if(this->mask != NULL)
+	{
+		BYTE *mask_ptr = NULL;
+	
+		for(register int y = start; y < end; y++)
+		{
+			this->Move (rect.left, y);
+			dst_ptr = (double *) FreeImage_GetScanLine (dst, y);
+			mask_ptr = (BYTE *) FreeImage_GetScanLine (this->mask, y);
 
-    const int dst_pitch_in_pixels = FreeImage_GetPitch (dst) / sizeof (Tsrc);
+			for(register int x = rect.left; x < rect.right; x++)
+			{
+				if(mask_ptr[x] == 0) {
+					this->Increment ();
+					continue;
+				}
+				
+				this->CorrelateKernel ();
+				double dominator = sqrt (this->correlation_sum_squared * this->kernel_normalise_sum);
 
-    register double *dst_ptr;
+				dst_ptr[x] = this->correlation_sum / dominator;
+				this->Increment ();
+			}
+		}
+    }
+    else
+    {
+		for(register int y = start; y < end; y++)
+		{
+			this->Move (rect.left, y);
+			dst_ptr = (double *) FreeImage_GetScanLine (dst, y);
+
+			for(register int x = rect.left; x < rect.right; x++)
+			{
+				this->CorrelateKernel ();
+				double dominator = sqrt (this->correlation_sum_squared * this->kernel_normalise_sum);
+
+				dst_ptr[x] = this->correlation_sum / dominator;
+				this->Increment ();
+			}
+		}
+    }
+}
+
+template < typename Tsrc, typename Tacc > FIBITMAP * Kernel < Tsrc, Tacc >::Correlate ()
+{
+    const int dst_width = src_image_width - (2 * this->xborder);
+    const int dst_height = src_image_height - (2 * this->yborder);
 
-    double *dst_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (dst);
+    FIBITMAP *dst = AllocateConvolutionDestination (FIT_DOUBLE, dst_width, dst_height);
+
+    if (dst == NULL)
+        return NULL;
 
     this->kernel_average = 0.0;
     int kernel_size = kernel_width * kernel_height;
@@ -837,19 +1144,14 @@ template < typename Tsrc > FIBITMAP * Kernel < Tsrc >::Correlate ()
 
     this->kernel_average /= kernel_size;
 
-    double kernel_normalise_sum = 0.0;
+    this->kernel_normalise_sum = 0.0;
 
     for(int i = 0; i < kernel_size; i++)
     {
-        kernel_normalise_sum += ((this->values[i] - this->kernel_average) * 
+        this->kernel_normalise_sum += ((this->values[i] - this->kernel_average) * 
 				(this->values[i] - this->kernel_average));
     }
 
-	register int search_bottom = 0;
-	int search_top = dst_height;
-	int search_left = 0;
-	int search_right = dst_width;
-	
 	FIARECT rect = FIAImageRect(dst);
 	
 	if(!FIARectIsEmpty(this->search_area))
@@ -871,48 +1173,15 @@ template < typename Tsrc > FIBITMAP * Kernel < Tsrc >::Correlate ()
 	if(rect.bottom < 0)
 		rect.bottom = 0;
 
-	if(this->mask != NULL)
-	{
-		BYTE *mask_ptr = NULL;
-	
-		for(register int y = rect.bottom; y < rect.top; y++)
-		{
-			this->Move (rect.left, y);
-			dst_ptr = (double *) FreeImage_GetScanLine (dst, y);
-			mask_ptr = (BYTE *) FreeImage_GetScanLine (this->mask, y);
+    KernelBandData < Tsrc, Tacc > band_data;
 
-			for(register int x = rect.left; x < rect.right; x++)
-			{
-				if(mask_ptr[x] == 0) {
-					this->Increment ();
-					continue;
-				}
-				
-				this->CorrelateKernel ();
-				double dominator = sqrt (this->correlation_sum_squared * kernel_normalise_sum);
-
-				dst_ptr[x] = this->sum / dominator;
-				this->Increment ();
-			}
-		}
-    }
-    else
-    {
-		for(register int y = rect.bottom; y < rect.top; y++)
-		{
-			this->Move (rect.left, y);
-			dst_ptr = (double *) FreeImage_GetScanLine (dst, y);
+    band_data.kernel = this;
+    band_data.dst = dst;
+    band_data.dst_type = FIT_DOUBLE;
+    band_data.rect = rect;
 
-			for(register int x = rect.left; x < rect.right; x++)
-			{
-				this->CorrelateKernel ();
-				double dominator = sqrt (this->correlation_sum_squared * kernel_normalise_sum);
-
-				dst_ptr[x] = this->sum / dominator;
-				this->Increment ();
-			}
-		}
-    }
+    FIA_RunBands (rect.bottom, rect.top, FIA_GetNumberOfBands (rect.top - rect.bottom, KERNEL_ROWS_PER_BAND),
+                  CorrelateKernelBand < Tsrc, Tacc >, &band_data);
 
     return dst;
 }
@@ -19,13 +19,17 @@
 #include "FreeImageAlgorithms.h"
 #include "FreeImageAlgorithms_Utils.h"
 #include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_ThreadPool.h"
 
-#include <algorithm>
 #include <math.h>
 #include <float.h>
-#include <iostream>
 
-#define INF 1E10
+// Columns swept together in the first pass by each thread at least, so
+// each row is read a block of columns at a time.
+#define DISTANCE_COLUMNS_PER_BAND 64
+
+// Rows given to each thread at least in the second pass.
+#define DISTANCE_ROWS_PER_BAND 16
 
 template < class T > static inline T
 square (const T & x)
@@ -33,148 +37,260 @@ square (const T & x)
     return x * x;
 }
 
-/* dt of 1d function using squared distance */
-static float *
-dt (float *f, int n)
+// The exact transform of Felzenszwalb and Huttenlocher as two passes.
+// The first finds the nearest feature pixel in each column, the second
+// the lower envelope of the parabolas that gives the nearest one along
+// each row. Feature pixels are the ones that are zero, or non zero when
+// feature_value is set, and rows are numbered from the top.
+struct DistanceData
+{
+    FIBITMAP *src;
+    int width;
+    int height;
+    int feature_value;
+    double x_spacing;
+    double y_spacing;
+
+    int *column_nearest;        // Row of the nearest feature in the column, -1 if none.
+    float *distance;            // width * height distances, rows from the top.
+    int *features;              // Index of the nearest feature, may be NULL.
+};
+
+static inline bool
+IsFeature (BYTE value, int feature_value)
+{
+    return (value != 0) == (feature_value != 0);
+}
+
+// Sweeps down then up a block of columns together.
+static void
+ColumnPassBand (void *data, int band, int start, int end)
 {
-    float *d = new float[n];
-    int *v = new int[n];
-    float *z = new float[n + 1];
-    int k = 0;
+    DistanceData *dt = (DistanceData *) data;
 
-    v[0] = 0;
-    z[0] = -INF;
-    z[1] = INF;
+    const int width = dt->width;
+    const int height = dt->height;
 
-    for(int q = 1; q <= n - 1; q++)
+    for(int y = 0; y < height; y++)
     {
-        float s = ((f[q] + square (q)) - (f[v[k]] + square (v[k]))) / (2 * q - 2 * v[k]);
+        const BYTE *src_ptr = FIA_GetScanLineFromTop (dt->src, y);
+        int *nearest = dt->column_nearest + y * width;
+        const int *above = nearest - width;
 
-        while (s <= z[k])
+        for(int x = start; x < end; x++)
         {
-            k--;
-            s = ((f[q] + square (q)) - (f[v[k]] + square (v[k]))) / (2 * q - 2 * v[k]);
+            if (IsFeature (src_ptr[x], dt->feature_value))
+                nearest[x] = y;
+            else
+                nearest[x] = (y > 0) ? above[x] : -1;
         }
-        k++;
-        v[k] = q;
-        z[k] = s;
-        z[k + 1] = INF;
     }
 
-    k = 0;
-    for(int q = 0; q <= n - 1; q++)
+    for(int y = height - 2; y >= 0; y--)
     {
-        while (z[k + 1] < q)
+        int *nearest = dt->column_nearest + y * width;
+        const int *below = nearest + width;
+
+        for(int x = start; x < end; x++)
         {
-            k++;
+            // The feature below is only nearer if it is strictly nearer.
+            if (below[x] >= 0 && (nearest[x] < 0 || below[x] - y < y - nearest[x]))
+                nearest[x] = below[x];
         }
-
-        d[q] = square (q - v[k]) + f[v[k]];
     }
-
-    delete[]v;
-    delete[]z;
-    return d;
 }
 
-/* dt of 2d function using squared distance */
+// Finds the lower envelope of the parabolas of one row at a time. The
+// scratch arrays are made once for the band and used for all its rows.
 static void
-dt2d (FIBITMAP * src)
+RowPassBand (void *data, int band, int start, int end)
 {
-    int width = FreeImage_GetWidth (src);
-    int height = FreeImage_GetHeight (src);
-    float *f = new float[MAX (width, height)];
-    register int x, y;
+    DistanceData *dt = (DistanceData *) data;
 
-    register float *src_ptr;
+    const int width = dt->width;
+    const double x_spacing_squared = dt->x_spacing * dt->x_spacing;
 
-    // transform along columns
-    for(x = 0; x < width; x++)
+    double *f = new double[width];
+    int *v = new int[width];
+    double *z = new double[width + 1];
+
+    for(int y = start; y < end; y++)
     {
-        for(y = 0; y < height; y++)
+        const int *nearest = dt->column_nearest + y * width;
+        float *distance = dt->distance + y * width;
+        int *features = (dt->features != NULL) ? dt->features + y * width : NULL;
+
+        // Columns without a feature add no parabola.
+        int k = -1;
+
+        for(int q = 0; q < width; q++)
         {
+            if (nearest[q] < 0)
+                continue;
 
-            src_ptr = (float *) FreeImage_GetScanLine (src, y);
-            f[y] = src_ptr[x];
-        }
+            f[q] = square ((nearest[q] - y) * dt->y_spacing);
 
-        float *d = dt (f, height);
+            double s = 0.0;
 
-        for(y = 0; y < height; y++)
-        {
+            while (k >= 0)
+            {
+                s = ((f[q] + square ((double) q) * x_spacing_squared)
+                     - (f[v[k]] + square ((double) v[k]) * x_spacing_squared))
+                    / (2.0 * x_spacing_squared * (q - v[k]));
 
-            src_ptr = (float *) FreeImage_GetScanLine (src, y);
-            src_ptr[x] = d[y];
-        }
+                if (s > z[k])
+                    break;
 
-        delete[]d;
-    }
+                k--;
+            }
 
-    // transform along rows
-    for(y = 0; y < height; y++)
-    {
-        src_ptr = (float *) FreeImage_GetScanLine (src, y);
+            k++;
+            v[k] = q;
+            z[k] = (k == 0) ? -DBL_MAX : s;
+            z[k + 1] = DBL_MAX;
+        }
 
-        for(x = 0; x < width; x++)
+        if (k < 0)
         {
-            f[x] = src_ptr[x];
+            for(int q = 0; q < width; q++)
+            {
+                distance[q] = FLT_MAX;
+
+                if (features != NULL)
+                    features[q] = -1;
+            }
+
+            continue;
         }
 
-        float *d = dt (f, width);
+        k = 0;
 
-        for(x = 0; x < width; x++)
+        for(int q = 0; q < width; q++)
         {
-            src_ptr[x] = d[x];
-        }
+            while (z[k + 1] < q)
+                k++;
+
+            distance[q] = (float) sqrt (square ((q - v[k]) * dt->x_spacing) + f[v[k]]);
 
-        delete[]d;
+            if (features != NULL)
+                features[q] = nearest[v[k]] * width + v[k];
+        }
     }
 
-    delete f;
+    delete[]f;
+    delete[]v;
+    delete[]z;
+}
+
+static void
+EuclideanDistance (DistanceData * dt)
+{
+    FIA_RunBands (0, dt->width, FIA_GetNumberOfBands (dt->width, DISTANCE_COLUMNS_PER_BAND),
+                  ColumnPassBand, dt);
+
+    FIA_RunBands (0, dt->height, FIA_GetNumberOfBands (dt->height, DISTANCE_ROWS_PER_BAND),
+                  RowPassBand, dt);
 }
 
-/* dt of binary image using squared distance */
 FIBITMAP *DLL_CALLCONV
-FIA_DistanceTransform (FIBITMAP * src)
+FIA_EuclideanDistanceTransform (FIBITMAP * src, double x_spacing, double y_spacing,
+                                int signed_distance, FIBITMAP ** features)
 {
-    int width = FreeImage_GetWidth (src);
-    int height = FreeImage_GetHeight (src);
-    float *out_ptr;
-    unsigned char *src_ptr;
+    if (src == NULL || FreeImage_GetImageType (src) != FIT_BITMAP || FreeImage_GetBPP (src) != 8)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Distance transform needs an 8bit image");
+        return NULL;
+    }
+
+    if (x_spacing <= 0.0 || y_spacing <= 0.0)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Pixel spacing must be greater than zero");
+        return NULL;
+    }
+
+    DistanceData dt;
+
+    dt.src = src;
+    dt.width = FreeImage_GetWidth (src);
+    dt.height = FreeImage_GetHeight (src);
+    dt.feature_value = 0;
+    dt.x_spacing = x_spacing;
+    dt.y_spacing = y_spacing;
+    dt.features = NULL;
+
+    const int total = dt.width * dt.height;
+
+    dt.column_nearest = (int *) malloc (total * sizeof (int));
+    dt.distance = (float *) malloc (total * sizeof (float));
+    CheckMemory (dt.column_nearest);
+    CheckMemory (dt.distance);
+
+    FIBITMAP *feature_dib = NULL;
+    int *feature_indices = NULL;
+
+    if (features != NULL)
+    {
+        feature_dib = FreeImage_AllocateT (FIT_INT32, dt.width, dt.height, 32, 0, 0, 0);
+        feature_indices = (int *) malloc (total * sizeof (int));
+        CheckMemory (feature_indices);
+    }
+
+    dt.features = feature_indices;
+
+    EuclideanDistance (&dt);
 
-    FIBITMAP *out = FIA_ConvertToGreyscaleFloatType (src, FIT_FLOAT);
+    FIBITMAP *dst = FreeImage_AllocateT (FIT_FLOAT, dt.width, dt.height, 32, 0, 0, 0);
 
-    for(register int y = 0; y < height; y++)
+    for(int y = 0; y < dt.height; y++)
     {
-        src_ptr = (unsigned char *) FreeImage_GetScanLine (src, y);
-        out_ptr = (float *) FreeImage_GetScanLine (out, y);
+        memcpy (FIA_GetScanLineFromTop (dst, y), dt.distance + y * dt.width,
+                dt.width * sizeof (float));
 
-        for(register int x = 0; x < width; x++)
+        if (feature_dib != NULL)
+            memcpy (FIA_GetScanLineFromTop (feature_dib, y), dt.features + y * dt.width,
+                    dt.width * sizeof (int));
+    }
+
+    // The background gets the negative distance to the nearest particle pixel.
+    if (signed_distance)
+    {
+        dt.feature_value = 1;
+        dt.features = NULL;
+
+        EuclideanDistance (&dt);
+
+        for(int y = 0; y < dt.height; y++)
         {
+            const BYTE *src_ptr = FIA_GetScanLineFromTop (src, y);
+            const float *outside = dt.distance + y * dt.width;
+            float *dst_ptr = (float *) FIA_GetScanLineFromTop (dst, y);
 
-            if (src_ptr[x] == 0)
+            for(int x = 0; x < dt.width; x++)
             {
-                out_ptr[x] = 0.0f;
-            }
-            else
-            {
-                out_ptr[x] = INF;
+                if (src_ptr[x] == 0)
+                    dst_ptr[x] = -outside[x];
             }
         }
     }
 
-    dt2d (out);
+    if (features != NULL)
+        *features = feature_dib;
 
-    // take square roots
-    for(register int y = 0; y < height; y++)
-    {
-        out_ptr = (float *) FreeImage_GetScanLine (out, y);
+    free (dt.column_nearest);
+    free (dt.distance);
+    free (feature_indices);
 
-        for(register int x = 0; x < width; x++)
-        {
-            out_ptr[x] = sqrt (out_ptr[x]);
-        }
-    }
+    return dst;
+}
+
+/* dt of binary image scaled to 8 bits */
+FIBITMAP *DLL_CALLCONV
+FIA_DistanceTransform (FIBITMAP * src)
+{
+    FIBITMAP *out = FIA_EuclideanDistanceTransform (src, 1.0, 1.0, 0, NULL);
+
+    if (out == NULL)
+        return NULL;
 
     FIBITMAP *ret = FreeImage_ConvertToStandardType (out, 1);
 
@@ -20,24 +20,32 @@
 #include "FreeImageAlgorithms_Utilities.h"
 #include "FreeImageAlgorithms_Utils.h"
 #include "FreeImageAlgorithms_FFT.h"
+#include "FreeImageAlgorithms_FFTPlan.h"
+#include "FreeImageAlgorithms_ThreadPool.h"
 
-#include "kiss_fftnd.h"
+#include "kiss_fft.h"
 #include <iostream>
 
-template<class Tsrc> class FFT2D
-{
-    public:
-        FIBITMAP* FFT(FIBITMAP *src);
-};
+// Idle plans are kept for reuse, newest first. The cache keeps at most this
+// many plans and drops the oldest once they hold more than the memory limit,
+// though the newest plan is always kept.
+#define FFT_PLAN_CACHE_SIZE 16
+#define FFT_PLAN_CACHE_BYTES (256 * 1024 * 1024)
+
+// Columns are copied out of the buffer this many at a time.
+#define FFT_COLUMN_BLOCK 8
+
+// Passes are split into bands of at least this many values for the thread pool.
+#define FFT_MIN_BAND_VALUES 32768
 
-// Do FFT for type X
-static FFT2D<unsigned char> fftUCharImage;
-static FFT2D<unsigned short> fftUShortImage;
-static FFT2D<short> fftShortImage;
-static FFT2D<unsigned long> fftULongImage;
-static FFT2D<long> fftLongImage;
-static FFT2D<float> fftFloatImage;
-static FFT2D<double> fftDoubleImage;
+// Half spectra carry the width of the image they came from in this tag.
+#define HALF_SPECTRUM_WIDTH_KEY "FIA_HalfSpectrumWidth"
+
+// Single precision complex images are FIT_DOUBLE images with this tag set to 1.
+#define COMPLEX_FLOAT_KEY "FIA_ComplexFloat"
+
+static FIA_MUTEX plan_cache_lock = FIA_MUTEX_INITIALISER;
+static FIA_FFT_PLAN *plan_cache = NULL;
 
 /*
 static inline void GetAbsoluteXValues(kiss_fft_cpx* fftbuf, double *out_values, int size)
@@ -95,336 +103,1009 @@ static inline void GetShiftedComplexXValues(kiss_fft_cpx* fftbuf, FICOMPLEX *out
 }
 */
 
-template<class Tsrc> FIBITMAP* 
-FFT2D<Tsrc>::FFT(FIBITMAP *src)
+// Values in each row of a plan's buffer.
+static int
+BufferWidth(FIA_FFT_PLAN *plan)
 {
-	int height, width;
+	return plan->real ? plan->width / 2 + 1 : plan->width;
+}
 
-	int i=0, x, y;
-	int dims[2];
-	int ndims = 2;
-    size_t bufsize;
-	Tsrc *bits; 
-	FICOMPLEX *outbits;
-	FIBITMAP *dst = NULL;
-	
-	kiss_fftnd_cfg st;
-	kiss_fft_cpx* fftbuf;
-	kiss_fft_cpx* fftoutbuf;
-    kiss_fft_cpx* tmp_fftoutbuf;
-
-	// Dims needs to be {rows, cols}, if you have contiguous rows.
-	dims[0] = height = FreeImage_GetHeight(src);
-	dims[1] = width = FreeImage_GetWidth(src);
-	
-    bufsize = width * height * sizeof(kiss_fft_cpx);
-	fftbuf = (kiss_fft_cpx*) malloc(bufsize);
-	tmp_fftoutbuf = fftoutbuf = (kiss_fft_cpx*) malloc(bufsize); 
-	
-    CheckMemory(fftbuf);
-    CheckMemory(fftoutbuf);
+// Each band of a pass needs room for a row and its transform, or for a
+// block of columns and one more for the transform.
+static size_t
+ScratchLength(FIA_FFT_PLAN *plan)
+{
+	return MAX(2 * (size_t) plan->width, (size_t) (FFT_COLUMN_BLOCK + 1) * plan->height);
+}
+
+static kiss_fft_cpx*
+BandScratch(FIA_FFT_PLAN *plan, int band)
+{
+	return plan->scratch + band * ScratchLength(plan);
+}
+
+static size_t
+FFTPlanBytes(FIA_FFT_PLAN *plan)
+{
+	return ((size_t) BufferWidth(plan) * plan->height + ScratchLength(plan) * plan->scratch_bands)
+		* sizeof(kiss_fft_cpx);
+}
+
+static FIA_FFT_PLAN*
+CreatePlan(int width, int height, int inverse, int real)
+{
+	if(width < 1 || height < 1) {
+		FreeImage_OutputMessageProc(FIF_UNKNOWN, "FFT plan size must be at least 1x1");
+		return NULL;
+	}
+
+	FIA_FFT_PLAN *plan = (FIA_FFT_PLAN*) calloc(1, sizeof(FIA_FFT_PLAN));
+
+	if(plan == NULL)
+		return NULL;
+
+	plan->width = width;
+	plan->height = height;
+	plan->inverse = inverse ? 1 : 0;
+	plan->real = real;
+
+	// Scratch for more bands is added when a pass first uses them.
+	plan->row_cfg = kiss_fft_alloc(width, plan->inverse, NULL, NULL);
+	plan->column_cfg = kiss_fft_alloc(height, plan->inverse, NULL, NULL);
+	plan->scratch = (kiss_fft_cpx*) malloc(ScratchLength(plan) * sizeof(kiss_fft_cpx));
+	plan->scratch_bands = 1;
+	plan->buffer = (kiss_fft_cpx*) malloc((size_t) BufferWidth(plan) * height * sizeof(kiss_fft_cpx));
+
+	if(plan->row_cfg == NULL || plan->column_cfg == NULL || plan->scratch == NULL || plan->buffer == NULL) {
+		FIA_DestroyFFTPlan(plan);
+		FreeImage_OutputMessageProc(FIF_UNKNOWN, "Unable to allocate memory for a %dx%d FFT", width, height);
+		return NULL;
+	}
 
-	memset(fftbuf,0,bufsize);
-    memset(tmp_fftoutbuf,0,bufsize);
+	return plan;
+}
+
+FIA_FFT_PLAN* DLL_CALLCONV
+FIA_CreateFFTPlan(int width, int height, int inverse)
+{
+	return CreatePlan(width, height, inverse, 0);
+}
+
+FIA_FFT_PLAN* DLL_CALLCONV
+FIA_CreateRealFFTPlan(int width, int height, int inverse)
+{
+	return CreatePlan(width, height, inverse, 1);
+}
+
+int DLL_CALLCONV
+FIA_SetFFTPlanNumberOfThreads(FIA_FFT_PLAN *plan, int number_of_threads)
+{
+	if(plan == NULL || number_of_threads < 0)
+		return FIA_ERROR;
+
+	plan->threads = number_of_threads;
+
+	return FIA_SUCCESS;
+}
+
+void DLL_CALLCONV
+FIA_DestroyFFTPlan(FIA_FFT_PLAN *plan)
+{
+	if(plan == NULL)
+		return;
+
+	free(plan->row_cfg);
+	free(plan->column_cfg);
+	free(plan->buffer);
+	free(plan->scratch);
+	free(plan);
+}
+
+static FIA_FFT_PLAN*
+AcquirePlan(int width, int height, int inverse, int real)
+{
+	FIA_FFT_PLAN *plan, **link;
+
+	inverse = inverse ? 1 : 0;
+
+	FIA_MutexLock(&plan_cache_lock);
+
+	for(link = &plan_cache; *link != NULL; link = &(*link)->next) {
+
+		plan = *link;
+
+		if(plan->width == width && plan->height == height && plan->inverse == inverse && plan->real == real) {
+			*link = plan->next;
+			plan->next = NULL;
+			FIA_MutexUnlock(&plan_cache_lock);
+			return plan;
+		}
+	}
+
+	FIA_MutexUnlock(&plan_cache_lock);
+
+	return CreatePlan(width, height, inverse, real);
+}
 
-	st = kiss_fftnd_alloc (dims, ndims, 0, 0, 0);
+FIA_FFT_PLAN*
+FIA_AcquireFFTPlan(int width, int height, int inverse)
+{
+	return AcquirePlan(width, height, inverse, 0);
+}
+
+FIA_FFT_PLAN*
+FIA_AcquireRealFFTPlan(int width, int height, int inverse)
+{
+	return AcquirePlan(width, height, inverse, 1);
+}
+
+void
+FIA_ReleaseFFTPlan(FIA_FFT_PLAN *plan)
+{
+	FIA_FFT_PLAN *evicted = NULL;
+	size_t bytes;
+	int count;
+
+	if(plan == NULL)
+		return;
+
+	FIA_MutexLock(&plan_cache_lock);
+
+	plan->next = plan_cache;
+	plan_cache = plan;
+
+	bytes = FFTPlanBytes(plan);
+	count = 1;
+
+	for(; plan->next != NULL; plan = plan->next) {
+
+		bytes += FFTPlanBytes(plan->next);
+		count++;
+
+		if(count > FFT_PLAN_CACHE_SIZE || bytes > FFT_PLAN_CACHE_BYTES) {
+			evicted = plan->next;
+			plan->next = NULL;
+			break;
+		}
+	}
+
+	FIA_MutexUnlock(&plan_cache_lock);
+
+	while(evicted != NULL) {
+		plan = evicted->next;
+		FIA_DestroyFFTPlan(evicted);
+		evicted = plan;
+	}
+}
+
+void DLL_CALLCONV
+FIA_ClearFFTPlanCache(void)
+{
+	FIA_MutexLock(&plan_cache_lock);
+
+	FIA_FFT_PLAN *plan = plan_cache;
+	plan_cache = NULL;
+
+	FIA_MutexUnlock(&plan_cache_lock);
+
+	while(plan != NULL) {
+		FIA_FFT_PLAN *next = plan->next;
+		FIA_DestroyFFTPlan(plan);
+		plan = next;
+	}
+}
+
+typedef struct
+{
+	FIA_FFT_PLAN *plan;
+	kiss_fft_cpx *data;
+	FIBITMAP *image;
+
+} FFTPass;
+
+// Splits count rows or blocks of columns into bands for the thread pool.
+// Each band has its own scratch, if there is no memory for more the
+// pass runs as one band.
+static void
+RunPass(FIA_FFT_PLAN *plan, int count, int values_per_item, FIA_BandFunction function, FFTPass *pass)
+{
+	int bands = FIA_GetNumberOfBands(count, MAX(1, FFT_MIN_BAND_VALUES / values_per_item));
+
+	if(plan->threads > 0)
+		bands = MIN(bands, plan->threads);
+
+	if(bands > plan->scratch_bands) {
+
+		kiss_fft_cpx *scratch = (kiss_fft_cpx*) realloc(plan->scratch,
+			bands * ScratchLength(plan) * sizeof(kiss_fft_cpx));
+
+		if(scratch != NULL) {
+			plan->scratch = scratch;
+			plan->scratch_bands = bands;
+		}
+		else
+			bands = plan->scratch_bands;
+	}
+
+	FIA_RunBands(0, count, bands, function, pass);
+}
+
+static void
+RowsBand(void *data, int band, int start, int end)
+{
+	FFTPass *pass = (FFTPass *) data;
+	FIA_FFT_PLAN *plan = pass->plan;
+	kiss_fft_cpx *out = BandScratch(plan, band);
+
+	for(int y = start; y < end; y++) {
+
+		kiss_fft_cpx *row = pass->data + (size_t) y * plan->width;
+
+		kiss_fft(plan->row_cfg, row, out);
+		memcpy(row, out, plan->width * sizeof(kiss_fft_cpx));
+	}
+}
+
+// Transforms blocks of FFT_COLUMN_BLOCK columns in place. Each block is
+// copied out to contiguous columns and back, a blocked transpose, so each
+// row is only visited once per block rather than once per column.
+static void
+ColumnsBand(void *data, int band, int start, int end)
+{
+	FFTPass *pass = (FFTPass *) data;
+	FIA_FFT_PLAN *plan = pass->plan;
+
+	const int height = plan->height;
+	const int buffer_width = BufferWidth(plan);
+	kiss_fft_cpx *columns = BandScratch(plan, band);
+	kiss_fft_cpx *out = columns + (size_t) FFT_COLUMN_BLOCK * height;
+	kiss_fft_cpx *ptr;
+
+	for(int x = start * FFT_COLUMN_BLOCK; x < MIN(end * FFT_COLUMN_BLOCK, buffer_width); x += FFT_COLUMN_BLOCK) {
+
+		int block = MIN(FFT_COLUMN_BLOCK, buffer_width - x);
+
+		ptr = pass->data + x;
+
+		for(int y=0; y < height; y++, ptr += buffer_width) {
+			for(int c=0; c < block; c++)
+				columns[(size_t) c * height + y] = ptr[c];
+		}
 
-	for(y = height - 1; y >= 0; y--) { 
+		for(int c=0; c < block; c++) {
+			kiss_fft(plan->column_cfg, columns + (size_t) c * height, out);
+			memcpy(columns + (size_t) c * height, out, height * sizeof(kiss_fft_cpx));
+		}
+
+		ptr = pass->data + x;
+
+		for(int y=0; y < height; y++, ptr += buffer_width) {
+			for(int c=0; c < block; c++)
+				ptr[c] = columns[(size_t) c * height + y];
+		}
+	}
+}
+
+static void
+TransformColumns(FIA_FFT_PLAN *plan, kiss_fft_cpx *data)
+{
+	FFTPass pass = {plan, data, NULL};
+	int blocks = (BufferWidth(plan) + FFT_COLUMN_BLOCK - 1) / FFT_COLUMN_BLOCK;
+
+	RunPass(plan, blocks, FFT_COLUMN_BLOCK * plan->height, ColumnsBand, &pass);
+}
+
+void
+FIA_RunFFTPlan(FIA_FFT_PLAN *plan, kiss_fft_cpx *data)
+{
+	FFTPass pass = {plan, data, NULL};
+
+	RunPass(plan, plan->height, plan->width, RowsBand, &pass);
+	TransformColumns(plan, data);
+}
+
+// Copies a real image into the plan's buffer, the top row first.
+template<class Tsrc> static void
+LoadRealImage(FIA_FFT_PLAN *plan, FIBITMAP *src)
+{
+	kiss_fft_cpx *buffer = plan->buffer;
+
+	for(int y = plan->height - 1; y >= 0; y--) { 
 		
-		bits = (Tsrc *) FreeImage_GetScanLine(src, y);
+		Tsrc *bits = (Tsrc *) FreeImage_GetScanLine(src, y);
 		
-		for(x=0; x < width; x++) {
+		for(int x=0; x < plan->width; x++) {
 		
-			fftbuf[i].r = (float) bits[x];
-   		    fftbuf[i].i = 0.0;
-   		 
-   		    i++;
+			buffer[x].r = (kiss_fft_scalar) bits[x];
+   		    buffer[x].i = 0.0;
 		}
+
+		buffer += plan->width;
 	}
+}
+
+// Copies a complex image, or a half spectrum for a real plan, into the
+// plan's buffer.
+template<class Tcomplex> static void
+LoadComplexImage(FIA_FFT_PLAN *plan, FIBITMAP *src)
+{
+	kiss_fft_cpx *buffer = plan->buffer;
+	const int width = BufferWidth(plan);
 
-	kiss_fftnd(st, fftbuf, tmp_fftoutbuf);
+	for(int y = plan->height - 1; y >= 0; y--) { 
+		
+		Tcomplex *bits = (Tcomplex *) FreeImage_GetScanLine(src, y);
+		
+		for(int x=0; x < width; x++) {
+		
+			buffer[x].r = (kiss_fft_scalar) bits[x].r;
+   		    buffer[x].i = (kiss_fft_scalar) bits[x].i;
+		}
+
+		buffer += width;
+	}
+}
 
-	if ( (dst = FreeImage_AllocateT(FIT_COMPLEX, width, height, 32, 0, 0, 0)) == NULL )
-		goto Error;
+// Copies the plan's buffer to a complex image.
+template<class Tcomplex> static void
+StoreComplexImage(FIA_FFT_PLAN *plan, FIBITMAP *dst)
+{
+	kiss_fft_cpx *buffer = plan->buffer;
+	const int width = BufferWidth(plan);
 
-	for(y = height - 1; y >= 0; y--) { 
+	for(int y = plan->height - 1; y >= 0; y--) { 
 		
-		outbits = (FICOMPLEX *) FreeImage_GetScanLine(dst, y);
+		Tcomplex *outbits = (Tcomplex *) FreeImage_GetScanLine(dst, y);
 
-		for(x=0; x < width; x++) {
+		for(int x=0; x < width; x++) {
 				
-			(outbits + x)->r = (double)((tmp_fftoutbuf + x)->r);
-			(outbits + x)->i = (double)((tmp_fftoutbuf + x)->i);	  
+			outbits[x].r = buffer[x].r;
+			outbits[x].i = buffer[x].i;	  
 		}
 
-		tmp_fftoutbuf += width;
+		buffer += width;
 	}
+}
+
+static void
+SetTag(FIBITMAP *dib, const char *key, DWORD value)
+{
+	FITAG *tag = FreeImage_CreateTag();
+
+	if(tag == NULL)
+		return;
+
+	FreeImage_SetTagKey(tag, key);
+	FreeImage_SetTagType(tag, FIDT_LONG);
+	FreeImage_SetTagCount(tag, 1);
+	FreeImage_SetTagLength(tag, sizeof(DWORD));
+	FreeImage_SetTagValue(tag, &value);
+
+	FreeImage_SetMetadata(FIMD_CUSTOM, dib, key, tag);
+
+	FreeImage_DeleteTag(tag);
+}
+
+static DWORD
+GetTag(FIBITMAP *dib, const char *key)
+{
+	FITAG *tag = NULL;
+
+	if(!FreeImage_GetMetadata(FIMD_CUSTOM, dib, key, &tag) || tag == NULL)
+		return 0;
+
+	if(FreeImage_GetTagType(tag) != FIDT_LONG || FreeImage_GetTagCount(tag) != 1)
+		return 0;
+
+	return *(const DWORD *) FreeImage_GetTagValue(tag);
+}
+
+int DLL_CALLCONV
+FIA_IsComplexFloatImage(FIBITMAP *src)
+{
+	if(src == NULL || FreeImage_GetImageType(src) != FIT_DOUBLE)
+		return 0;
+
+	return GetTag(src, COMPLEX_FLOAT_KEY) == 1;
+}
+
+// Single precision images are FIT_DOUBLE, which has the same pixel size.
+static FIBITMAP*
+AllocateComplexImage(int width, int height, bool single_precision)
+{
+	if(!single_precision)
+		return FreeImage_AllocateT(FIT_COMPLEX, width, height, 32, 0, 0, 0);
 
-Error:
- 
-    free(fftbuf);
-    free(fftoutbuf);
-    free(st);
+	FIBITMAP *dst = FreeImage_AllocateT(FIT_DOUBLE, width, height, 32, 0, 0, 0);
+
+	if(dst != NULL)
+		SetTag(dst, COMPLEX_FLOAT_KEY, 1);
 
 	return dst;
 }
 
-FIBITMAP* DLL_CALLCONV
-FIA_ShiftImageEdgeToCenter(FIBITMAP *src)
+int DLL_CALLCONV
+FIA_GetHalfSpectrumWidth(FIBITMAP *src)
 {
-	int width = FreeImage_GetWidth(src);
-	int height = FreeImage_GetHeight(src);
-	int xhalf = (width / 2);
-	int yhalf = (height / 2);
-	int bytes_pp = FreeImage_GetBPP(src) / 8;
-	int xhalf_bytes = xhalf * bytes_pp;
+	if(src == NULL || (FreeImage_GetImageType(src) != FIT_COMPLEX && !FIA_IsComplexFloatImage(src)))
+		return 0;
 
-	//std::cout << "width " << width << std::endl;
-	//std::cout << "xhalf " << xhalf << std::endl;
-	
-	FIBITMAP *dst = FIA_CloneImageType(src, width, height);
+	int width = (int) GetTag(src, HALF_SPECTRUM_WIDTH_KEY);
 
-	for(int y=0; y < yhalf; y++) { 
-		
-		BYTE* srcbits = (BYTE *) FIA_GetScanLineFromTop(src, y);
-		BYTE* outbits = (BYTE *) FIA_GetScanLineFromTop(dst, y + yhalf);
+	// The tag is meaningless if the image has been resized since.
+	if(width < 1 || width / 2 + 1 != (int) FreeImage_GetWidth(src))
+		return 0;
 
-		memcpy(outbits + xhalf_bytes, srcbits, xhalf_bytes);
-		memcpy(outbits, srcbits + xhalf_bytes, xhalf_bytes);
+	return width;
+}
+
+// Row pass of a forward real transform. Two real rows a and b go through
+// one complex transform as z = a + ib and are separated with
+// A(k) = (Z(k) + Z*(N - k)) / 2 and B(k) = (Z(k) - Z*(N - k)) / 2i.
+// Bands are of pairs of rows.
+template<class Tsrc> static void
+RealForwardRowsBand(void *data, int band, int start, int end)
+{
+	FFTPass *pass = (FFTPass *) data;
+	FIA_FFT_PLAN *plan = pass->plan;
+	FIBITMAP *src = pass->image;
+
+	const int width = plan->width;
+	const int half_width = BufferWidth(plan);
+	kiss_fft_cpx *in = BandScratch(plan, band);
+	kiss_fft_cpx *out = in + width;
+
+	for(int row = 2 * start; row < MIN(2 * end, plan->height); row += 2) {
+
+		// The buffer has the top row first.
+		Tsrc *a = (Tsrc *) FreeImage_GetScanLine(src, plan->height - 1 - row);
+		Tsrc *b = (row + 1 < plan->height) ? (Tsrc *) FreeImage_GetScanLine(src, plan->height - 2 - row) : NULL;
+
+		for(int x=0; x < width; x++) {
+			in[x].r = (kiss_fft_scalar) a[x];
+			in[x].i = (b != NULL) ? (kiss_fft_scalar) b[x] : 0;
+		}
+
+		kiss_fft(plan->row_cfg, in, out);
+
+		kiss_fft_cpx *dst_a = pass->data + (size_t) row * half_width;
+		kiss_fft_cpx *dst_b = dst_a + half_width;
+
+		if(b == NULL) {
+			memcpy(dst_a, out, half_width * sizeof(kiss_fft_cpx));
+			continue;
+		}
+
+		for(int k=0; k < half_width; k++) {
+
+			kiss_fft_cpx z = out[k];
+			kiss_fft_cpx c = out[(k == 0) ? 0 : width - k];
+
+			dst_a[k].r = (z.r + c.r) * 0.5f;
+			dst_a[k].i = (z.i - c.i) * 0.5f;
+			dst_b[k].r = (z.i + c.i) * 0.5f;
+			dst_b[k].i = (c.r - z.r) * 0.5f;
+		}
 	}
+}
 
-	for(int y=yhalf; y < height; y++) { 
-		
-		BYTE* srcbits = (BYTE *) FIA_GetScanLineFromTop(src, y);
-		BYTE* outbits = (BYTE *) FIA_GetScanLineFromTop(dst, y - yhalf);
+template<class Tsrc> static void
+RealForwardRows(FIA_FFT_PLAN *plan, FIBITMAP *src)
+{
+	FFTPass pass = {plan, plan->buffer, src};
 
-		memcpy(outbits + xhalf_bytes, srcbits, xhalf_bytes);
-		memcpy(outbits, srcbits + xhalf_bytes, xhalf_bytes);
+	RunPass(plan, (plan->height + 1) / 2, 2 * plan->width, RealForwardRowsBand<Tsrc>, &pass);
+}
+
+// Value k of the full spectrum of a real row from its half, A(N - k) = A*(k).
+// The first value, and the middle one for even lengths, must be real.
+static inline kiss_fft_cpx
+FullSpectrumValue(const kiss_fft_cpx *half, int k, int width)
+{
+	kiss_fft_cpx value;
+
+	if(2 * k > width) {
+		value.r = half[width - k].r;
+		value.i = -half[width - k].i;
+	}
+	else {
+		value.r = half[k].r;
+		value.i = (k == 0 || 2 * k == width) ? 0 : half[k].i;
 	}
 
-	return dst;
+	return value;
 }
 
-int DLL_CALLCONV
-FIA_InPlaceShiftImageEdgeToCenter(FIBITMAP **src)
+// Row pass of an inverse real transform. The full spectra of two rows go
+// through one complex transform as Z = A + iB, the rows come out as the
+// real and imaginary parts.
+// Bands are of pairs of rows.
+template<class Tdst> static void
+RealInverseRowsBand(void *data, int band, int start, int end)
 {
-    FIBITMAP *dst = FIA_ShiftImageEdgeToCenter(*src);
+	FFTPass *pass = (FFTPass *) data;
+	FIA_FFT_PLAN *plan = pass->plan;
+	FIBITMAP *dst = pass->image;
 
-    FreeImage_Unload(*src);
-    *src = dst;
+	const int width = plan->width;
+	const int half_width = BufferWidth(plan);
+	kiss_fft_cpx *in = BandScratch(plan, band);
+	kiss_fft_cpx *out = in + width;
 
-    return FIA_SUCCESS;
+	for(int row = 2 * start; row < MIN(2 * end, plan->height); row += 2) {
+
+		const kiss_fft_cpx *a = pass->data + (size_t) row * half_width;
+		const kiss_fft_cpx *b = (row + 1 < plan->height) ? a + half_width : NULL;
+
+		for(int k=0; k < width; k++) {
+
+			kiss_fft_cpx value_a = FullSpectrumValue(a, k, width);
+			kiss_fft_cpx value_b = {0, 0};
+
+			if(b != NULL)
+				value_b = FullSpectrumValue(b, k, width);
+
+			in[k].r = value_a.r - value_b.i;
+			in[k].i = value_a.i + value_b.r;
+		}
+
+		kiss_fft(plan->row_cfg, in, out);
+
+		Tdst *dst_a = (Tdst *) FreeImage_GetScanLine(dst, plan->height - 1 - row);
+
+		for(int x=0; x < width; x++)
+			dst_a[x] = (Tdst) out[x].r;
+
+		if(b == NULL)
+			continue;
+
+		Tdst *dst_b = (Tdst *) FreeImage_GetScanLine(dst, plan->height - 2 - row);
+
+		for(int x=0; x < width; x++)
+			dst_b[x] = (Tdst) out[x].i;
+	}
 }
 
-FIBITMAP* DLL_CALLCONV
-FIA_IFFT(FIBITMAP *src)
+template<class Tdst> static void
+RealInverseRows(FIA_FFT_PLAN *plan, FIBITMAP *dst)
 {
-	int height, width;
+	FFTPass pass = {plan, plan->buffer, dst};
 
-	int i=0, x, y;
-	int dims[2];
-	int ndims = 2;
-    size_t bufsize;
-	FICOMPLEX *bits; 
-	FICOMPLEX *outbits;
-	FIBITMAP *dst = NULL;
-	
-	kiss_fftnd_cfg st;
-	kiss_fft_cpx* fftbuf;
-	kiss_fft_cpx* fftoutbuf;
-    kiss_fft_cpx* tmp_fftoutbuf;
-
-	// Dims needs to be {rows, cols}, if you have contiguous rows.
-    dims[0] = height = FreeImage_GetHeight(src);
-    dims[1] = width = FreeImage_GetWidth(src);
-	
-    bufsize = width * height * sizeof(kiss_fft_cpx);
-	fftbuf = (kiss_fft_cpx*) malloc(bufsize);
-	tmp_fftoutbuf = fftoutbuf = (kiss_fft_cpx*) malloc(bufsize); 
-	
-    memset(fftbuf,0,bufsize);
-    memset(tmp_fftoutbuf,0,bufsize);
+	RunPass(plan, (plan->height + 1) / 2, 2 * plan->width, RealInverseRowsBand<Tdst>, &pass);
+}
 
-	st = kiss_fftnd_alloc (dims, ndims, 1, 0, 0);
-	
-	for(y = height - 1; y >= 0; y--) { 
-			
-		bits = (FICOMPLEX*) FreeImage_GetScanLine(src, y);
-			
-		for(x=0; x < width; x++) {	
+static FIBITMAP*
+ExecuteRealFFTPlan(FIA_FFT_PLAN *plan, FIBITMAP *src, bool single_precision)
+{
+	const int half_width = BufferWidth(plan);
+	FIBITMAP *dst;
 
-			fftbuf[i].r = (float) bits[x].r;
-   			fftbuf[i].i = (float) bits[x].i;
-	        
-   			i++;
+	if(plan->inverse) {
+
+		int width = FIA_GetHalfSpectrumWidth(src);
+		bool complex_float = FIA_IsComplexFloatImage(src) != 0;
+
+		if((FreeImage_GetImageType(src) != FIT_COMPLEX && !complex_float) || (int) FreeImage_GetWidth(src) != half_width
+			|| (int) FreeImage_GetHeight(src) != plan->height || (width != 0 && width != plan->width)) {
+			FreeImage_OutputMessageProc(FIF_UNKNOWN, "Image is not the half spectrum of a %dx%d image",
+				plan->width, plan->height);
+			return NULL;
 		}
+
+		single_precision = single_precision || complex_float;
+
+		dst = FreeImage_AllocateT(single_precision ? FIT_FLOAT : FIT_DOUBLE, plan->width, plan->height, 32, 0, 0, 0);
+
+		if(dst == NULL)
+			return NULL;
+
+		if(complex_float)
+			LoadComplexImage<FIACOMPLEXF>(plan, src);
+		else
+			LoadComplexImage<FICOMPLEX>(plan, src);
+
+		TransformColumns(plan, plan->buffer);
+
+		if(single_precision)
+			RealInverseRows<float>(plan, dst);
+		else
+			RealInverseRows<double>(plan, dst);
+
+		return dst;
 	}
 
-	kiss_fftnd(st, fftbuf, tmp_fftoutbuf);
+	if((int) FreeImage_GetWidth(src) != plan->width || (int) FreeImage_GetHeight(src) != plan->height) {
+		FreeImage_OutputMessageProc(FIF_UNKNOWN, "Image size does not match the %dx%d FFT plan",
+			plan->width, plan->height);
+		return NULL;
+	}
 
-	if ( (dst = FreeImage_AllocateT(FIT_COMPLEX, width, height, 32, 0, 0, 0)) == NULL )
-		goto Error;
+	FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src);
+	bool supported = true;
 
-	for(y = height - 1; y >= 0; y--) { 
+	switch (src_type)
+    {
+		case FIT_BITMAP:
+			if(FreeImage_GetBPP(src) != 8) {
+				supported = false;
+				break;
+			}
+			RealForwardRows<unsigned char>(plan, src);
+			break;
+			
+		case FIT_UINT16:
+			RealForwardRows<unsigned short>(plan, src);
+			break;
+	
+		case FIT_INT16:
+			RealForwardRows<short>(plan, src);
+			break;
 		
-		outbits = (FICOMPLEX *) FreeImage_GetScanLine(dst, y);
-
-		for(x=0; x < width; x++) {
+		case FIT_UINT32:
+			RealForwardRows<unsigned int>(plan, src);
+			break;
+		
+		case FIT_INT32:
+			RealForwardRows<int>(plan, src);
+			break;
+		
+		case FIT_FLOAT:
+			RealForwardRows<float>(plan, src);
+			break;
+		
+		case FIT_DOUBLE:
+			if(FIA_IsComplexFloatImage(src)) {
+				supported = false;
+				break;
+			}
+			RealForwardRows<double>(plan, src);
+			break;
 				
-			outbits[x].r = (double)((tmp_fftoutbuf + x)->r);  
-			outbits[x].i = (double)((tmp_fftoutbuf + x)->i); 
-		}
+		default:
+			supported = false;
+			break;
+	}
 
-		tmp_fftoutbuf += width;
+	if(!supported) {
+		FreeImage_OutputMessageProc(FIF_UNKNOWN, "FREE_IMAGE_TYPE: Unable to perform a real FFT for type %d.", src_type);
+		return NULL;
 	}
 
-	return dst;
+	TransformColumns(plan, plan->buffer);
 
-Error:
- 
-    free(fftbuf);
-    free(fftoutbuf);
-    free(st);
+	if ( (dst = AllocateComplexImage(half_width, plan->height, single_precision)) == NULL )
+		return NULL;
+
+	SetTag(dst, HALF_SPECTRUM_WIDTH_KEY, plan->width);
+
+	if(single_precision)
+		StoreComplexImage<FIACOMPLEXF>(plan, dst);
+	else
+		StoreComplexImage<FICOMPLEX>(plan, dst);
 
 	return dst;
 }
 
-
-FIBITMAP* DLL_CALLCONV
-FIA_FFT(FIBITMAP *src)
+// Spectra come out in single precision if asked for or if src is one.
+static FIBITMAP*
+ExecuteFFTPlan(FIA_FFT_PLAN *plan, FIBITMAP *src, bool single_precision)
 {
-	if(!src)
+	if(plan == NULL || src == NULL)
 		return NULL;
 
-	// Convert from src_type to FIT_BITMAP
+	if(plan->real)
+		return ExecuteRealFFTPlan(plan, src, single_precision);
+
+	if((int) FreeImage_GetWidth(src) != plan->width || (int) FreeImage_GetHeight(src) != plan->height) {
+		FreeImage_OutputMessageProc(FIF_UNKNOWN, "Image size does not match the %dx%d FFT plan",
+			plan->width, plan->height);
+		return NULL;
+	}
+
 	FREE_IMAGE_TYPE src_type = FreeImage_GetImageType(src);
+	bool supported = true;
 
 	switch (src_type)
     {
 		case FIT_BITMAP:	// standard image: 1-, 4-, 8-, 16-, 24-, 32-bit
-			if(FreeImage_GetBPP(src) == 8)
-				return fftUCharImage.FFT(src);				
+			if(FreeImage_GetBPP(src) != 8) {
+				supported = false;
+				break;
+			}
+			LoadRealImage<unsigned char>(plan, src);
 			break;
 			
 		case FIT_UINT16:	// array of unsigned short: unsigned 16-bit
-			return fftUShortImage.FFT(src);
+			LoadRealImage<unsigned short>(plan, src);
+			break;
 	
 		case FIT_INT16:		// array of short: signed 16-bit
-			return fftShortImage.FFT(src);
+			LoadRealImage<short>(plan, src);
+			break;
 		
 		case FIT_UINT32:	// array of unsigned long: unsigned 32-bit
-			return fftULongImage.FFT(src);
+			LoadRealImage<unsigned int>(plan, src);
+			break;
 		
 		case FIT_INT32:		// array of long: signed 32-bit
-			return fftLongImage.FFT(src);
+			LoadRealImage<int>(plan, src);
+			break;
 		
 		case FIT_FLOAT:		// array of float: 32-bit
-			return fftFloatImage.FFT(src);
+			LoadRealImage<float>(plan, src);
+			break;
 		
-		case FIT_DOUBLE:	// array of double: 64-bit
-			return fftDoubleImage.FFT(src);
+		case FIT_DOUBLE:	// array of double: 64-bit, or FIACOMPLEXF: 2 x 32-bit
+			if(FIA_IsComplexFloatImage(src)) {
+				LoadComplexImage<FIACOMPLEXF>(plan, src);
+				single_precision = true;
+				break;
+			}
+			LoadRealImage<double>(plan, src);
+			break;
+
+		case FIT_COMPLEX:	// array of FICOMPLEX: 2 x 64-bit
+			LoadComplexImage<FICOMPLEX>(plan, src);
+			break;
 				
 		default:
+			supported = false;
 			break;
 	}
 
-	FreeImage_OutputMessageProc(FIF_UNKNOWN, "FREE_IMAGE_TYPE: Unable to perform FFT for type %d.", src_type);
+	if(!supported) {
+		FreeImage_OutputMessageProc(FIF_UNKNOWN, "FREE_IMAGE_TYPE: Unable to perform FFT for type %d.", src_type);
+		return NULL;
+	}
+
+	FIA_RunFFTPlan(plan, plan->buffer);
+
+	FIBITMAP *dst;
+	
+	if ( (dst = AllocateComplexImage(plan->width, plan->height, single_precision)) == NULL )
+		return NULL;
+
+	if(single_precision)
+		StoreComplexImage<FIACOMPLEXF>(plan, dst);
+	else
+		StoreComplexImage<FICOMPLEX>(plan, dst);
 
-	return NULL;
+	return dst;
 }
 
+FIBITMAP* DLL_CALLCONV
+FIA_ExecuteFFTPlan(FIA_FFT_PLAN *plan, FIBITMAP *src)
+{
+	return ExecuteFFTPlan(plan, src, false);
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_ExecuteFFTPlanToComplexFloat(FIA_FFT_PLAN *plan, FIBITMAP *src)
+{
+	return ExecuteFFTPlan(plan, src, true);
+}
 
 static FIBITMAP*
-ConvertComplexImageToAbsoluteValued(FIBITMAP *src, bool squared)
+CachedFFT(FIBITMAP *src, int inverse, bool single_precision)
 {
-	FIBITMAP *dst = NULL;
-	unsigned x, y;
-						
-	unsigned width	= FreeImage_GetWidth(src);
-	unsigned height = FreeImage_GetHeight(src);
+	if(!src)
+		return NULL;
 
-	// Allocate a double bit dib
-	dst = FreeImage_AllocateT(FIT_DOUBLE, width, height, 32, 0, 0, 0);
-	
-	if(!dst)
+	FIA_FFT_PLAN *plan = FIA_AcquireFFTPlan(FreeImage_GetWidth(src), FreeImage_GetHeight(src), inverse);
+
+	if(plan == NULL)
 		return NULL;
 
-	FICOMPLEX *src_bits, *src_bit; 	
-	double	  *dst_bits; 
+	FIBITMAP *dst = ExecuteFFTPlan(plan, src, single_precision);
 
-	if(squared) {
+	FIA_ReleaseFFTPlan(plan);
 
-		for(y = 0; y < height; y++) { 
-		
-			src_bits = (FICOMPLEX *) FreeImage_GetScanLine(src, y);
-			dst_bits = (double *) FreeImage_GetScanLine(dst, y);
+	return dst;
+}
 
-			for(x=0; x < width; x++) {
-				
-                src_bit = src_bits + x;
+static FIBITMAP*
+CachedRealFFT(FIBITMAP *src, int inverse, bool single_precision)
+{
+	if(!src)
+		return NULL;
 
-				*(dst_bits + x) = (double) ((src_bit->r * src_bit->r) + (src_bit->i * src_bit->i));
-			}
-		}
+	int width = FreeImage_GetWidth(src);
+
+	if(inverse && (width = FIA_GetHalfSpectrumWidth(src)) == 0) {
+		FreeImage_OutputMessageProc(FIF_UNKNOWN, "Image is not a half spectrum");
+		return NULL;
 	}
-	else {
 
-		for(y = 0; y < height; y++) { 
+	FIA_FFT_PLAN *plan = FIA_AcquireRealFFTPlan(width, FreeImage_GetHeight(src), inverse);
+
+	if(plan == NULL)
+		return NULL;
+
+	FIBITMAP *dst = ExecuteFFTPlan(plan, src, single_precision);
+
+	FIA_ReleaseFFTPlan(plan);
+
+	return dst;
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_ShiftImageEdgeToCenter(FIBITMAP *src)
+{
+	int width = FreeImage_GetWidth(src);
+	int height = FreeImage_GetHeight(src);
+	int xhalf = (width / 2);
+	int yhalf = (height / 2);
+	int bytes_pp = FreeImage_GetBPP(src) / 8;
+	int xhalf_bytes = xhalf * bytes_pp;
+
+	//std::cout << "width " << width << std::endl;
+	//std::cout << "xhalf " << xhalf << std::endl;
+	
+	FIBITMAP *dst = FIA_CloneImageType(src, width, height);
+
+	for(int y=0; y < yhalf; y++) { 
 		
-			src_bits = (FICOMPLEX *) FreeImage_GetScanLine(src, y);
-			dst_bits = (double *) FreeImage_GetScanLine(dst, y);
+		BYTE* srcbits = (BYTE *) FIA_GetScanLineFromTop(src, y);
+		BYTE* outbits = (BYTE *) FIA_GetScanLineFromTop(dst, y + yhalf);
 
-			for(x=0; x < width; x++) {
-				
-                src_bit = src_bits + x;
+		memcpy(outbits + xhalf_bytes, srcbits, xhalf_bytes);
+		memcpy(outbits, srcbits + xhalf_bytes, xhalf_bytes);
+	}
 
-				*(dst_bits + x) = sqrt((double) ((src_bit->r * src_bit->r) + (src_bit->i * src_bit->i)));
-			}
-		}
+	for(int y=yhalf; y < height; y++) { 
+		
+		BYTE* srcbits = (BYTE *) FIA_GetScanLineFromTop(src, y);
+		BYTE* outbits = (BYTE *) FIA_GetScanLineFromTop(dst, y - yhalf);
+
+		memcpy(outbits + xhalf_bytes, srcbits, xhalf_bytes);
+		memcpy(outbits, srcbits + xhalf_bytes, xhalf_bytes);
 	}
 
 	return dst;
 }
 
+int DLL_CALLCONV
+FIA_InPlaceShiftImageEdgeToCenter(FIBITMAP **src)
+{
+    FIBITMAP *dst = FIA_ShiftImageEdgeToCenter(*src);
+
+    FreeImage_Unload(*src);
+    *src = dst;
+
+    return FIA_SUCCESS;
+}
+
 FIBITMAP* DLL_CALLCONV
-FIA_ConvertComplexImageToAbsoluteValuedSquared(FIBITMAP *src)
+FIA_IFFT(FIBITMAP *src)
 {
-	return ConvertComplexImageToAbsoluteValued(src, true);
+	return CachedFFT(src, 1, false);
 }
 
 FIBITMAP* DLL_CALLCONV
-FIA_ConvertComplexImageToAbsoluteValued(FIBITMAP *src)
+FIA_FFT(FIBITMAP *src)
 {
-	return ConvertComplexImageToAbsoluteValued(src, false);
+	return CachedFFT(src, 0, false);
 }
 
 FIBITMAP* DLL_CALLCONV
-FIA_ComplexImageToRealValued(FIBITMAP *src)
+FIA_FFTToComplexFloat(FIBITMAP *src)
+{
+	return CachedFFT(src, 0, true);
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_RealFFT(FIBITMAP *src)
+{
+	return CachedRealFFT(src, 0, false);
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_RealFFTToComplexFloat(FIBITMAP *src)
+{
+	return CachedRealFFT(src, 0, true);
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_RealIFFT(FIBITMAP *src)
+{
+	return CachedRealFFT(src, 1, false);
+}
+
+
+struct AbsoluteValue
+{
+	template<class Tcomplex> static inline double Get(const Tcomplex &value)
+	{
+		return sqrt((double) ((value.r * value.r) + (value.i * value.i)));
+	}
+};
+
+struct SquaredAbsoluteValue
+{
+	template<class Tcomplex> static inline double Get(const Tcomplex &value)
+	{
+		return (double) ((value.r * value.r) + (value.i * value.i));
+	}
+};
+
+struct RealValue
+{
+	template<class Tcomplex> static inline double Get(const Tcomplex &value)
+	{
+		return (double) value.r;
+	}
+};
+
+// A half spectrum is expanded to the full width. The values it leaves out
+// are conjugates, X(-u, -v) = X*(u, v), which none of these functions
+// change, so they are read from the mirrored row and column.
+template<class Function, class Tcomplex, class Tdst> static FIBITMAP*
+ComplexImageToReal(FIBITMAP *src, FREE_IMAGE_TYPE dst_type)
 {
 	FIBITMAP *dst = NULL;
 	unsigned x, y;
 						
-	unsigned width	= FreeImage_GetWidth(src);
+	unsigned stored_width = FreeImage_GetWidth(src);
+	unsigned width = stored_width;
 	unsigned height = FreeImage_GetHeight(src);
+	int full_width = FIA_GetHalfSpectrumWidth(src);
+
+	if(full_width > 0)
+		width = full_width;
 
-	// allocate a 8-bit dib
-	dst = FreeImage_AllocateT(FIT_DOUBLE, width, height, 32, 0, 0, 0);
+	dst = FreeImage_AllocateT(dst_type, width, height, 32, 0, 0, 0);
 	
 	if(!dst)
 		return NULL;
 
-	FICOMPLEX *src_bits; 	
-	double	  *dst_bits; 
+	Tcomplex *src_bits, *mirror_bits;
+	Tdst	 *dst_bits; 
 
 	for(y = 0; y < height; y++) { 
 		
-		src_bits = (FICOMPLEX *) FreeImage_GetScanLine(src, y);
-		dst_bits = (double *) FreeImage_GetScanLine(dst, y);
+		src_bits = (Tcomplex *) FreeImage_GetScanLine(src, y);
+		dst_bits = (Tdst *) FreeImage_GetScanLine(dst, y);
 
-		for(x=0; x < width; x++) {
-			dst_bits[x] = (double) src_bits[x].r;
-		}
+		// Scanlines are bottom up, the top row is its own mirror.
+		mirror_bits = (Tcomplex *) FreeImage_GetScanLine(src, (y == height - 1) ? y : height - 2 - y);
+
+		for(x=0; x < stored_width; x++)
+			dst_bits[x] = (Tdst) Function::Get(src_bits[x]);
+
+		for(; x < width; x++)
+			dst_bits[x] = (Tdst) Function::Get(mirror_bits[width - x]);
 	}
 
 	return dst;
 }
+
+// Single precision complex images give FIT_FLOAT images.
+template<class Function> static FIBITMAP*
+ComplexImageToReal(FIBITMAP *src)
+{
+	if(src == NULL)
+		return NULL;
+
+	if(FIA_IsComplexFloatImage(src))
+		return ComplexImageToReal<Function, FIACOMPLEXF, float>(src, FIT_FLOAT);
+
+	return ComplexImageToReal<Function, FICOMPLEX, double>(src, FIT_DOUBLE);
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_ConvertComplexImageToAbsoluteValuedSquared(FIBITMAP *src)
+{
+	return ComplexImageToReal<SquaredAbsoluteValue>(src);
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_ConvertComplexImageToAbsoluteValued(FIBITMAP *src)
+{
+	return ComplexImageToReal<AbsoluteValue>(src);
+}
+
+FIBITMAP* DLL_CALLCONV
+FIA_ComplexImageToRealValued(FIBITMAP *src)
+{
+	return ComplexImageToReal<RealValue>(src);
+}
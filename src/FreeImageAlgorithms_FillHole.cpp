@@ -18,76 +18,154 @@
 
 #include "FreeImageAlgorithms.h"
 #include "FreeImageAlgorithms_Utils.h"
-#include "FreeImageAlgorithms_Drawing.h"
+#include "FreeImageAlgorithms_Morphology.h"
 #include "FreeImageAlgorithms_Palettes.h"
 #include "FreeImageAlgorithms_Particle.h"
 #include "FreeImageAlgorithms_Utilities.h"
 
-FIBITMAP *DLL_CALLCONV
-FIA_Fillholes (FIBITMAP * src, unsigned char white_on_black)
+// An 8 bit image, 255 where src is a particle and 0 elsewhere.
+static FIBITMAP *
+ParticleMask (FIBITMAP * src, unsigned char white_on_black)
 {
     const int width = FreeImage_GetWidth (src);
     const int height = FreeImage_GetHeight (src);
 
-    unsigned char *src_ptr;
+    FIBITMAP *mask = FreeImage_Allocate (width, height, 8, 0, 0, 0);
 
-    int bg_val, fg_val;
+    if (mask == NULL)
+        return NULL;
 
-    if (white_on_black)
+    for(int y = 0; y < height; y++)
     {
-        bg_val = 0;
-        fg_val = 255;
+        const BYTE *src_ptr = FreeImage_GetScanLine (src, y);
+        BYTE *mask_ptr = FreeImage_GetScanLine (mask, y);
+
+        for(int x = 0; x < width; x++)
+            mask_ptr[x] = ((src_ptr[x] != 0) == (white_on_black != 0)) ? 255 : 0;
     }
-    else
+
+    return mask;
+}
+
+static bool
+CheckBinaryImage (FIBITMAP * src)
+{
+    if (src == NULL)
+        return false;
+
+    if (FreeImage_GetImageType (src) != FIT_BITMAP || FreeImage_GetBPP (src) != 8)
     {
-        bg_val = 1;
-        fg_val = 255;
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Image must be an 8 bit binary image");
+        return false;
     }
 
-    FIBITMAP *filled_src;
-    register int y;
+    return true;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_Fillholes (FIBITMAP * src, unsigned char white_on_black)
+{
+    if (!CheckBinaryImage (src))
+        return NULL;
+
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+
+    FIBITMAP *mask = ParticleMask (src, white_on_black);
+
+    if (mask == NULL)
+        return NULL;
+
+    // The marker starts full inside and equal to the mask on the edge.
+    // Eroding it under the mask lets the background in from the whole edge,
+    // what is left set and not a particle is a hole.
+    FIBITMAP *marker = FreeImage_Clone (mask);
 
-    // Find first background pixel
-    // To be a valid image I am assumming one of the first pixels on
-    // the left side of the image is background.
-    // Ie if there is a large strip of foreground on the left the image
-    // is not valis for filling holes.
-    for(y = 0; y < height - 1; y++)
+    for(int y = 1; y < height - 1; y++)
     {
-        src_ptr = (unsigned char *) FreeImage_GetScanLine (src, y);
+        BYTE *marker_ptr = FreeImage_GetScanLine (marker, y);
+
+        for(int x = 1; x < width - 1; x++)
+            marker_ptr[x] = 255;
+    }
+
+    FIA_MorphologicalReconstruction (marker, mask, FIA_RECONSTRUCTION_BY_EROSION,
+                                     FIA_CONNECTIVITY_4);
+
+    FIBITMAP *dst = FreeImage_Clone (src);
+    const BYTE fill = white_on_black ? 255 : 0;
 
-        if (src_ptr[0] == bg_val)
+    for(int y = 0; y < height; y++)
+    {
+        const BYTE *marker_ptr = FreeImage_GetScanLine (marker, y);
+        const BYTE *mask_ptr = FreeImage_GetScanLine (mask, y);
+        BYTE *dst_ptr = FreeImage_GetScanLine (dst, y);
+
+        for(int x = 0; x < width; x++)
         {
-            break;
+            if (marker_ptr[x] && !mask_ptr[x])
+                dst_ptr[x] = fill;
         }
     }
 
-    filled_src = FIA_FloodFill (src, 0, y, fg_val);
+    FreeImage_Unload (marker);
+    FreeImage_Unload (mask);
 
-    FIBITMAP *dst = FreeImage_Clone (src);
+    return dst;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_RemoveBorderParticles (FIBITMAP * src, unsigned char white_on_black,
+                           FIA_CONNECTIVITY connectivity)
+{
+    if (!CheckBinaryImage (src))
+        return NULL;
+
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+
+    FIBITMAP *mask = ParticleMask (src, white_on_black);
 
-    // Go through filled_src image find background pixels and copy then to dst
-    unsigned char *filled_src_first_ptr = (unsigned char *) FreeImage_GetBits (filled_src);
-    unsigned char *dst_first_ptr = (unsigned char *) FreeImage_GetBits (dst);
-    unsigned char *filled_src_ptr, *dst_ptr;
-    unsigned int src_pitch_in_pixels = FreeImage_GetPitch (src) / sizeof (unsigned char);
+    if (mask == NULL)
+        return NULL;
+
+    // The marker is the particle pixels on the edge, dilating it under the
+    // mask recovers the whole of each particle that touches the edge.
+    FIBITMAP *marker = FreeImage_Clone (mask);
+
+    for(int y = 1; y < height - 1; y++)
+    {
+        BYTE *marker_ptr = FreeImage_GetScanLine (marker, y);
+
+        for(int x = 1; x < width - 1; x++)
+            marker_ptr[x] = 0;
+    }
+
+    if (FIA_MorphologicalReconstruction (marker, mask, FIA_RECONSTRUCTION_BY_DILATION,
+                                         connectivity) == FIA_ERROR)
+    {
+        FreeImage_Unload (marker);
+        FreeImage_Unload (mask);
+        return NULL;
+    }
+
+    FIBITMAP *dst = FreeImage_Clone (src);
+    const BYTE background = white_on_black ? 0 : 255;
 
-    for(register int y = 0; y < height; y++)
+    for(int y = 0; y < height; y++)
     {
-        filled_src_ptr = (filled_src_first_ptr + y * src_pitch_in_pixels);
-        dst_ptr = (dst_first_ptr + y * src_pitch_in_pixels);
+        const BYTE *marker_ptr = FreeImage_GetScanLine (marker, y);
+        BYTE *dst_ptr = FreeImage_GetScanLine (dst, y);
 
-        for(register int x = 0; x < width; x++)
+        for(int x = 0; x < width; x++)
         {
-            // If bg pixel copy to dst
-            if (filled_src_ptr[x] == bg_val)
-            {
-                dst_ptr[x] = fg_val;
-            }
+            if (marker_ptr[x])
+                dst_ptr[x] = background;
         }
     }
 
-    FreeImage_Unload (filled_src);
+    FreeImage_Unload (marker);
+    FreeImage_Unload (mask);
 
     return dst;
-};
+}
@@ -21,6 +21,7 @@
 #include "FreeImageAlgorithms_Filters.h"
 #include "FreeImageAlgorithms_Utilities.h"
 #include "FreeImageAlgorithms_Convolution.h"
+#include "FreeImageAlgorithms_Arithmetic.h"
 
 #include <math.h>
 
@@ -201,9 +202,46 @@ FIBITMAP* DLL_CALLCONV
 FIA_Binning (FIBITMAP * src, FIA_BINNING_TYPE type, int radius)
 {
 	int size = radius * 2 + 1;
+
+	// The square sum does not need a kernel, a running sum is used.
+	if(type == FIA_BINNING_SQUARE) {
+
+		FIABITMAP *src_bordered = FIA_SetBorder (src, radius, radius, BorderType_Copy, 0.0);
+		FIBITMAP* binned_fib = FIA_BoxSum (src_bordered, radius, radius);
+
+		FIA_Unload (src_bordered);
+
+		return binned_fib;
+	}
+
+	// The gaussian kernel is exp(-d^2 / (radius/2)^2).
+	double sigma = radius / (2.0 * sqrt(2.0));
+
+	if(type == FIA_BINNING_GAUSSIAN_RECURSIVE && sigma >= 0.5) {
+
+		// The recursive filter gives the weighted mean, scale it
+		// by the sum of the kernel weights to match the exact binning.
+		double line_sum = 0.0;
+
+		for (int i = -radius; i <= radius; i++)
+			line_sum += exp(-((double) i * i) / pow(radius/2.0,2));
+
+		int border = MAX(radius, (int) ceil(3.0 * sigma));
+
+		FIABITMAP *src_bordered = FIA_SetBorder (src, border, border, BorderType_Copy, 0.0);
+		FIBITMAP* binned_fib = FIA_RecursiveGaussianFilter (src_bordered, sigma);
+
+		FIA_Unload (src_bordered);
+
+		if(binned_fib != NULL)
+			FIA_MultiplyGreyLevelImageConstant (binned_fib, line_sum * line_sum);
+
+		return binned_fib;
+	}
+
 	double *kernel = (double*) malloc ((size*size)*sizeof(double));
 	
-	if(type == FIA_BINNING_GAUSSIAN)
+	if(type == FIA_BINNING_GAUSSIAN || type == FIA_BINNING_GAUSSIAN_RECURSIVE)
 		FIA_MakeGaussianKernel (radius, kernel);
 	else if(type == FIA_BINNING_CIRCULAR)
 		FIA_MakeCircularKernel (radius, kernel);
@@ -26,12 +26,25 @@
 #include "FreeImageAlgorithms_Utilities.h"
 #include "FreeImageAlgorithms_Arithmetic.h"
 #include "FreeImageAlgorithms_Convolution.h"
+#include "FreeImageAlgorithms_ThreadPool.h"
+#include "FreeImageAlgorithms_SIMD.h"
+#include "FreeImageAlgorithms_MedianNetwork.txx"
 
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <algorithm>
 #include <math.h>
+#include <float.h>
 
-#define MAX_REGIONGROW_CALLS 5000
+// Rows of the non-maximum suppression pass given to each thread at least.
+#define MAXIMA_ROWS_PER_BAND 64
+
+// Values in the processing image.
+#define MAXIMA_CANDIDATE 1
+#define MAXIMA_NEIGHBOUR 2
+#define MAXIMA_DOWNHILL 3
+#define MAXIMA_COLLECTED 4
 
 typedef float (*GetPixelValueFunction) (FIBITMAP * src, int x, int y);
 
@@ -42,14 +55,15 @@ class FindMaxima
     FIBITMAP * FindImageMaxima (FIBITMAP * src, FIBITMAP * mask, double threshold,
                                 int min_separation, int oval_draw, FIAPeak ** peaks, int number, int *peaks_found);
 
+    int FindImagePeaks (FIBITMAP * src, FIBITMAP * mask, double threshold, int min_separation,
+                        int number, FIAPeak ** peaks, int *peaks_found, FIBITMAP ** peak_image);
+
   private:
 
-    void NonMaxSupression ();
-    inline unsigned char NeighbourhoodNMS (double *ptr);
-    inline void SetNeighbours (unsigned char *ptr);
+    int FindMaximaPixels (FIBITMAP * src, double threshold);
+    template < typename T > void FindCandidates (FIBITMAP * src);
+    void CollectPeaks (FIBITMAP * mask, std::vector < FIAPeak > &peaks);
     void SetNeigbourPixels ();
-    void RegionGrow (int x, int y);
-    void PerformRegionGrow ();
     void DrawMaxima (int size);
     int StoreBrightestPeaks (int number, FIAPeak ** peaks);
 
@@ -59,320 +73,206 @@ class FindMaxima
 	int oval_draw;
     int width;
     int height;
-    int regionGrowCount;
 
     FIBITMAP *original_image;
-    FIBITMAP *original_image_double;
     FIBITMAP *processing_image;
     FIBITMAP *peek_image;
 };
 
-inline unsigned char
-FindMaxima::NeighbourhoodNMS (double *ptr)
+// The vector 3x3 maximum row for each pixel type, NULL where there is none.
+template < typename T > struct MaximumRowFunction
 {
-    int pitch_in_pixels = FIA_GetPitchInPixels (this->original_image_double);
-    
-    // Top left of 3x3 kernel
-    double *tmp_ptr = ptr - pitch_in_pixels - 1;
-
-    if (*ptr < tmp_ptr[0])
-    {
-        return 0;
-    }
-
-    if (*ptr < tmp_ptr[1])
-    {
-        return 0;
-    }
-
-    if (*ptr < tmp_ptr[2])
-    {
-        return 0;
-    }
-
-    // Next kernel line
-    tmp_ptr = ptr - 1;
-
-    if (*ptr < tmp_ptr[0])
-    {
-        return 0;
-    }
-
-    if (*ptr < tmp_ptr[2])
-    {
-        return 0;
-    }
-
-    // Next kernel line
-    tmp_ptr = ptr + pitch_in_pixels - 1;
-
-    if (*ptr < tmp_ptr[0])
-    {
-        return 0;
-    }
-
-    if (*ptr < tmp_ptr[1])
-    {
-        return 0;
-    }
+    typedef void (*Function) (const T * const *rows, T * scratch, T * dst, int width);
 
-    if (*ptr < tmp_ptr[2])
+    static Function Get (const FIA_VectorFunctions * functions)
     {
-        return 0;
+        return NULL;
     }
+};
 
-    return 1;
+template <> inline MaximumRowFunction < unsigned char >::Function
+MaximumRowFunction < unsigned char >::Get (const FIA_VectorFunctions * functions)
+{
+    return functions->uchar_maximum_row;
 }
 
-void
-FindMaxima::NonMaxSupression ()
+template <> inline MaximumRowFunction < short >::Function
+MaximumRowFunction < short >::Get (const FIA_VectorFunctions * functions)
 {
-    register double *src_ptr;
-    register unsigned char *dst_ptr;
-
-    for(register int y = 1; y < height - 1; y++)
-    {
-        src_ptr = (double *) FreeImage_GetScanLine(this->original_image_double, y);
-        dst_ptr = (unsigned char *) FreeImage_GetScanLine(this->processing_image, y);
-
-        for(register int x = 1; x < width - 1; x++)
-        {
-            if (src_ptr[x] > this->threshold)
-            {
-                dst_ptr[x] = NeighbourhoodNMS (src_ptr + x);
-            }
-        }
-    }
+    return functions->short_maximum_row;
 }
 
-inline void
-FindMaxima::SetNeighbours (unsigned char *ptr)
+template <> inline MaximumRowFunction < unsigned short >::Function
+MaximumRowFunction < unsigned short >::Get (const FIA_VectorFunctions * functions)
 {
-    int pitch_in_pixels = FIA_GetPitchInPixels (this->processing_image);
-    
-    unsigned char *tmp_ptr = ptr - pitch_in_pixels - 1;
+    return functions->ushort_maximum_row;
+}
 
-    if (!tmp_ptr[0])
-    {
-        tmp_ptr[0] = 2;
-    }
+template <> inline MaximumRowFunction < float >::Function
+MaximumRowFunction < float >::Get (const FIA_VectorFunctions * functions)
+{
+    return functions->float_maximum_row;
+}
 
-    if (!tmp_ptr[1])
-    {
-        tmp_ptr[1] = 2;
-    }
+struct NonMaxSuppressionData
+{
+    FIBITMAP *src;
+    FIBITMAP *processing;
+    double threshold;
+};
 
-    if (!tmp_ptr[2])
-    {
-        tmp_ptr[2] = 2;
-    }
+// Marks the pixels above the threshold that are not below any of their
+// eight neighbours. A pixel is not below any neighbour when it equals the
+// maximum of its 3x3 window, which is found a vector of pixels at a time.
+template < typename T > static void
+NonMaxSuppressionBand (void *data, int band, int start, int end)
+{
+    NonMaxSuppressionData *nms = (NonMaxSuppressionData *) data;
 
-    // Next kernel line
-    tmp_ptr += pitch_in_pixels;
+    const int width = FreeImage_GetWidth (nms->src);
+    const int inner_width = width - 2;
+    const double threshold = nms->threshold;
 
-    if (!tmp_ptr[0])
-    {
-        tmp_ptr[0] = 2;
-    }
+    const FIA_VectorFunctions *functions = FIA_GetVectorFunctions ();
 
-    if (!tmp_ptr[2])
-    {
-        tmp_ptr[2] = 2;
-    }
+    typename MaximumRowFunction < T >::Function maximum_row = NULL;
 
-    // Next kernel line
-    tmp_ptr += pitch_in_pixels;
+    if (functions != NULL)
+        maximum_row = MaximumRowFunction < T >::Get (functions);
 
-    if (!tmp_ptr[0])
-    {
-        tmp_ptr[0] = 2;
-    }
+    const T *rows[3];
+    T *scratch = new T[width];
+    T *window_max = new T[inner_width];
 
-    if (!tmp_ptr[1])
+    for(int y = start; y < end; y++)
     {
-        tmp_ptr[1] = 2;
-    }
+        for(int row = 0; row < 3; row++)
+            rows[row] = (T *) FreeImage_GetScanLine (nms->src, y + row - 1);
 
-    if (!tmp_ptr[2])
-    {
-        tmp_ptr[2] = 2;
-    }
-}
+        if (maximum_row != NULL)
+            maximum_row (rows, scratch, window_max, inner_width);
+        else
+            MaximumRow < ScalarMedianVector < T > > (rows, scratch, window_max, inner_width);
 
-// Set adjoining pixels to 2
-void
-FindMaxima::SetNeigbourPixels ()
-{
-    register BYTE *src_ptr;
+        const T *src_ptr = rows[1] + 1;
+        BYTE *dst_ptr = (BYTE *) FreeImage_GetScanLine (nms->processing, y) + 1;
 
-    for(register int y = 1; y < height - 1; y++)
-    {
-        src_ptr = (BYTE *) FreeImage_GetScanLine(this->processing_image, y);
-    
-        for(register int x = 1; x < width - 1; x++)
+        for(int x = 0; x < inner_width; x++)
         {
-            if (src_ptr[x] == 1)
-            {
-                this->SetNeighbours (src_ptr + x);
-            }
+            if (src_ptr[x] >= window_max[x] && src_ptr[x] > threshold)
+                dst_ptr[x] = MAXIMA_CANDIDATE;
         }
     }
+
+    delete[]scratch;
+    delete[]window_max;
 }
 
-/*
-// Region growing downhill
-void
-FindMaxima::RegionGrow (int x, int y)
+// Marks every pixel that can be reached from a pixel next to a candidate
+// without going uphill or through a zero. A candidate reached this way is
+// on the plateau or shoulder of another peak and is no longer a maximum.
+// The region is grown from an explicit stack so it has no size limit.
+template < typename T > static void
+GrowDownhill (FIBITMAP * src, FIBITMAP * processing)
 {
-    if (regionGrowCount++ > MAX_REGIONGROW_CALLS)
-        return;
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+    const int src_pitch = FIA_GetPitchInPixels (src);
+    const int processing_pitch = FreeImage_GetPitch (processing);
 
-    register double *optr = this->original_first_pixel_address_ptr;
-    register byte *pptr = this->processing_first_pixel_address_ptr;
+    const T *src_bits = (T *) FreeImage_GetBits (src);
+    BYTE *processing_bits = FreeImage_GetBits (processing);
 
-    int pos, n_pos;
+    std::vector < int > stack;
 
-    if (x > 0 && x < (this->width - 1) && y > 0 && y < (this->height - 1))
+    for(int y = 1; y < height - 1; y++)
     {
-        pos = y * this->pitch_in_pixels + x;
-        n_pos = pos - this->pitch_in_pixels - 1;        // Position of neighbour
-        pptr[pos] = 3;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x - 1, y - 1);
-        }
-
-
-
-        n_pos++;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
+        for(int x = 1; x < width - 1; x++)
         {
-            RegionGrow (x, y - 1);
-        }
-
-        n_pos++;
+            if (processing_bits[y * processing_pitch + x] != MAXIMA_NEIGHBOUR)
+                continue;
 
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x + 1, y - 1);
-        }
+            processing_bits[y * processing_pitch + x] = MAXIMA_DOWNHILL;
+            stack.push_back (y * width + x);
 
-        n_pos = pos - 1;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x - 1, y);
-        }
-
-        n_pos += 2;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x + 1, y);
+            while (!stack.empty ())
+            {
+                const int position = stack.back ();
+                const int px = position % width;
+                const int py = position / width;
+                const T value = src_bits[py * src_pitch + px];
+
+                stack.pop_back ();
+
+                for(int ny = py - 1; ny <= py + 1; ny++)
+                {
+                    if (ny <= 0 || ny >= height - 1)
+                        continue;
+
+                    const T *src_ptr = src_bits + ny * src_pitch;
+                    BYTE *processing_ptr = processing_bits + ny * processing_pitch;
+
+                    for(int nx = px - 1; nx <= px + 1; nx++)
+                    {
+                        if (nx <= 0 || nx >= width - 1)
+                            continue;
+
+                        if (processing_ptr[nx] == MAXIMA_DOWNHILL || src_ptr[nx] == 0
+                            || src_ptr[nx] > value)
+                            continue;
+
+                        processing_ptr[nx] = MAXIMA_DOWNHILL;
+                        stack.push_back (ny * width + nx);
+                    }
+                }
+            }
         }
+    }
+}
 
-        n_pos = pos + this->pitch_in_pixels - 1;
-
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x - 1, y + 1);
-        }
+template < typename T > void
+FindMaxima::FindCandidates (FIBITMAP * src)
+{
+    NonMaxSuppressionData nms;
 
-        n_pos++;
+    nms.src = src;
+    nms.processing = this->processing_image;
+    nms.threshold = this->threshold;
 
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x, y + 1);
-        }
+    if (this->width > 2 && this->height > 2)
+        FIA_RunBands (1, this->height - 1,
+                      FIA_GetNumberOfBands (this->height - 2, MAXIMA_ROWS_PER_BAND),
+                      NonMaxSuppressionBand < T >, &nms);
 
-        n_pos++;
+    SetNeigbourPixels ();
 
-        if (optr[n_pos] <= optr[pos] && optr[n_pos] && pptr[n_pos] != 3)
-        {
-            RegionGrow (x + 1, y + 1);
-        }
-    }
+    GrowDownhill < T > (src, this->processing_image);
 }
-*/
 
-static inline bool CheckToGrowDownHill(double kernel_centre_val, double kernel_neighbour_val)
-{
-    if(kernel_neighbour_val != 0.0 && kernel_neighbour_val <= kernel_centre_val)
-        return true;
-
-    return false;
-}
-
-// Region growing downhill
-inline void
-FindMaxima::RegionGrow (int x, int y)
-{
-    if (regionGrowCount++ > MAX_REGIONGROW_CALLS)
-        return;
-
-    if(y <= 0 || y >= (this->height - 1))
-        return;
-
-    if (x <= 0 || x >= (this->width - 1))
-        return;
-
-    double *original_ptr_ptr = (double *) FreeImage_GetScanLine(this->original_image_double, y) + x;
-    BYTE *processing_image_ptr = FreeImage_GetScanLine(this->processing_image, y) + x;
-
-    *processing_image_ptr = 3;	// Mark as done
-
-    // Top left of 3x3 kernel
-    double *kernel_original_ptr = original_ptr_ptr + FIA_GetPitchInPixels(this->original_image_double) - 1;
-    BYTE *kernel_processing_ptr = processing_image_ptr + FIA_GetPitchInPixels(this->processing_image) - 1;
-
-    if(kernel_processing_ptr[0] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[0]))
-         RegionGrow (x-1, y+1);
-
-    if(kernel_processing_ptr[1] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[1]))
-         RegionGrow (x, y+1);
-
-    if(kernel_processing_ptr[2] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[2]))
-         RegionGrow (x+1, y+1);
-
-    kernel_original_ptr = original_ptr_ptr - 1;
-    kernel_processing_ptr = processing_image_ptr - 1;
-
-    if(kernel_processing_ptr[0] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[0]))
-         RegionGrow (x-1, y);
-
-    if(kernel_processing_ptr[2] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[2]))
-         RegionGrow (x+1, y);
-
-    kernel_original_ptr = original_ptr_ptr - FIA_GetPitchInPixels(this->original_image_double) - 1;
-    kernel_processing_ptr = processing_image_ptr - FIA_GetPitchInPixels(this->processing_image) - 1;
-
-    if(kernel_processing_ptr[0] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[0]))
-         RegionGrow (x-1, y-1);
-
-    if(kernel_processing_ptr[1] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[1]))
-         RegionGrow (x, y-1);
-
-    if(kernel_processing_ptr[2] != 3 && CheckToGrowDownHill(original_ptr_ptr[0], kernel_original_ptr[2]))
-         RegionGrow (x+1, y-1);
-}
-
+// Set adjoining pixels to 2
 void
-FindMaxima::PerformRegionGrow ()
+FindMaxima::SetNeigbourPixels ()
 {
-    register BYTE *processing_ptr;
+    const int pitch = FreeImage_GetPitch (this->processing_image);
 
-    for(register int y = 1; y < height - 1; y++)
+    for(int y = 1; y < height - 1; y++)
     {
-        processing_ptr = (BYTE *) FreeImage_GetScanLine(this->processing_image, y);
+        BYTE *src_ptr = (BYTE *) FreeImage_GetScanLine (this->processing_image, y);
 
-        for(register int x = 1; x < width - 1; x++)
+        for(int x = 1; x < width - 1; x++)
         {
-            if (processing_ptr[x] == 2)
+            if (src_ptr[x] != MAXIMA_CANDIDATE)
+                continue;
+
+            for(int dy = -1; dy <= 1; dy++)
             {
-                regionGrowCount = 0;
-                RegionGrow (x, y);
+                BYTE *ptr = src_ptr + dy * pitch + x;
+
+                for(int dx = -1; dx <= 1; dx++)
+                {
+                    if (!ptr[dx])
+                        ptr[dx] = MAXIMA_NEIGHBOUR;
+                }
             }
         }
     }
@@ -469,6 +369,26 @@ ComparePeaks (const void *element1, const void *element2)
     return 0;
 }
 
+// Brightest first, ties in scanline order so the choice does not depend on
+// how the candidates happen to be arranged.
+static inline bool
+BrighterPeak (const FIAPeak & peak1, const FIAPeak & peak2)
+{
+    if (peak1.value != peak2.value)
+        return peak1.value > peak2.value;
+
+    if (peak1.centre.y != peak2.centre.y)
+        return peak1.centre.y < peak2.centre.y;
+
+    return peak1.centre.x < peak2.centre.x;
+}
+
+static inline bool
+DimmerPeak (const FIAPeak & peak1, const FIAPeak & peak2)
+{
+    return BrighterPeak (peak2, peak1);
+}
+
 int
 FindMaxima::StoreBrightestPeaks (int number, FIAPeak ** peaks_ref)
 {
@@ -482,14 +402,14 @@ FindMaxima::StoreBrightestPeaks (int number, FIAPeak ** peaks_ref)
 
     int total_blobs = info->number_of_blobs;
 
-    if (number <= 0)
+    if (number <= 0 || number > total_blobs)
     {
         number = total_blobs;
     }
 
     if (*peaks_ref == NULL)
     {
-        *peaks_ref = (FIAPeak *) malloc (number * sizeof (FIAPeak));
+        *peaks_ref = (FIAPeak *) malloc (MAX (number, 1) * sizeof (FIAPeak));
         CheckMemory (*peaks_ref);
     }
     else
@@ -504,56 +424,296 @@ FindMaxima::StoreBrightestPeaks (int number, FIAPeak ** peaks_ref)
         return -1;
     }
 
-    for(int i = 0; i < number; i++)
+    std::vector < FIAPeak > candidates (total_blobs);
+
+    for(int i = 0; i < total_blobs; i++)
     {
         BLOBINFO blobinfo = info->blobs[i];
 
-        peaks[i].centre.x = blobinfo.center_x;
-        peaks[i].centre.y = blobinfo.center_y;
+        candidates[i].centre.x = blobinfo.center_x;
+        candidates[i].centre.y = blobinfo.center_y;
 
-        FIA_GetPixelValue (this->original_image, peaks[i].centre.x, peaks[i].centre.y,
-                           &(peaks[i].value));
+        // The centres are from the top, FIA_GetPixelValue takes scanlines.
+        FIA_GetPixelValue (this->original_image, candidates[i].centre.x,
+                           this->height - 1 - candidates[i].centre.y, &(candidates[i].value));
     }
 
     FIA_FreeParticleInfo (info);
 
+    // Only the brightest number are wanted, they are moved to the front
+    // without sorting the rest.
+    if (number < total_blobs)
+        std::nth_element (candidates.begin (), candidates.begin () + number, candidates.end (),
+                          BrighterPeak);
+
+    if (number > 0)
+        memcpy (peaks, &candidates[0], number * sizeof (FIAPeak));
+
     // Sort the peaks
     qsort (peaks, number, sizeof (FIAPeak), ComparePeaks);      // sort into assending order
 
-    return MIN (number, total_blobs);
+    return number;
 }
 
-FIBITMAP *
-FindMaxima::FindImageMaxima (FIBITMAP * src, FIBITMAP * mask, double threshold,
-                             int min_separation, int oval_draw, FIAPeak ** peaks, int number, int *peaks_found)
+// Turns each group of touching maxima pixels, a plateau, into one peak at
+// the pixel of the plateau nearest its centre. Positions are in scanline
+// order as FIA_GetPixelValue takes them.
+void
+FindMaxima::CollectPeaks (FIBITMAP * mask, std::vector < FIAPeak > &peaks)
 {
-    *peaks_found = 0;
+    const int pitch = FreeImage_GetPitch (this->processing_image);
+    BYTE *bits = FreeImage_GetBits (this->processing_image);
 
-    this->regionGrowCount = 0;
-    this->threshold = threshold;
-    this->min_separation = min_separation;
+    std::vector < int > plateau;
 
-    this->original_image = src;
-    this->peek_image = NULL;
+    for(int y = 1; y < height - 1; y++)
+    {
+        for(int x = 1; x < width - 1; x++)
+        {
+            if (bits[y * pitch + x] != MAXIMA_CANDIDATE)
+                continue;
+
+            long long sum_x = 0, sum_y = 0;
+
+            // The plateau's pixels are found in breadth first order.
+            plateau.clear ();
+            plateau.push_back (y * width + x);
+            bits[y * pitch + x] = MAXIMA_COLLECTED;
+
+            for(size_t i = 0; i < plateau.size (); i++)
+            {
+                const int px = plateau[i] % width;
+                const int py = plateau[i] / width;
+
+                sum_x += px;
+                sum_y += py;
+
+                for(int ny = py - 1; ny <= py + 1; ny++)
+                {
+                    for(int nx = px - 1; nx <= px + 1; nx++)
+                    {
+                        if (bits[ny * pitch + nx] != MAXIMA_CANDIDATE)
+                            continue;
+
+                        bits[ny * pitch + nx] = MAXIMA_COLLECTED;
+                        plateau.push_back (ny * width + nx);
+                    }
+                }
+            }
+
+            const double area = (double) plateau.size ();
+            const double centre_x = sum_x / area;
+            const double centre_y = sum_y / area;
+            double nearest = DBL_MAX;
+
+            FIAPeak peak;
+
+            for(size_t i = 0; i < plateau.size (); i++)
+            {
+                const int px = plateau[i] % width;
+                const int py = plateau[i] / width;
+                const double distance = (px - centre_x) * (px - centre_x) + (py - centre_y) * (py - centre_y);
+
+                if (distance < nearest)
+                {
+                    nearest = distance;
+                    peak.centre.x = px;
+                    peak.centre.y = py;
+                }
+            }
+
+            if (mask != NULL && FreeImage_GetScanLine (mask, peak.centre.y)[peak.centre.x] == 0)
+                continue;
+
+            FIA_GetPixelValue (this->original_image, peak.centre.x, peak.centre.y, &peak.value);
+
+            peaks.push_back (peak);
+        }
+    }
+}
+
+// Takes peaks brightest first from a heap, so only as many are ordered as
+// are looked at, and drops any closer than min_separation to one already
+// taken. The peaks taken are kept in a grid of min_separation sized cells so
+// only the neighbouring cells need to be searched.
+static void
+SelectPeaks (std::vector < FIAPeak > &candidates, int width, int height, int min_separation,
+             int number, std::vector < FIAPeak > &selected)
+{
+    if (number <= 0)
+        number = (int) candidates.size ();
+
+    const bool separate = (min_separation > 1);
+    const int cell_size = MAX (min_separation, 1);
+    const int cells_across = separate ? (width + cell_size - 1) / cell_size : 0;
+    const int cells_down = separate ? (height + cell_size - 1) / cell_size : 0;
+    const long long min_distance_squared = (long long) min_separation * min_separation;
+
+    std::vector < int > cell_first (cells_across * cells_down, -1);
+    std::vector < int > next_in_cell;
+
+    std::make_heap (candidates.begin (), candidates.end (), DimmerPeak);
+
+    std::vector < FIAPeak >::iterator heap_end = candidates.end ();
+
+    while (heap_end != candidates.begin () && (int) selected.size () < number)
+    {
+        std::pop_heap (candidates.begin (), heap_end, DimmerPeak);
+        --heap_end;
+
+        const FIAPeak & peak = *heap_end;
+
+        if (separate)
+        {
+            const int cx = peak.centre.x / cell_size;
+            const int cy = peak.centre.y / cell_size;
+            bool too_close = false;
+
+            for(int y = MAX (cy - 1, 0); y <= MIN (cy + 1, cells_down - 1) && !too_close; y++)
+            {
+                for(int x = MAX (cx - 1, 0); x <= MIN (cx + 1, cells_across - 1) && !too_close; x++)
+                {
+                    for(int i = cell_first[y * cells_across + x]; i >= 0; i = next_in_cell[i])
+                    {
+                        long long dx = selected[i].centre.x - peak.centre.x;
+                        long long dy = selected[i].centre.y - peak.centre.y;
+
+                        if (dx * dx + dy * dy < min_distance_squared)
+                        {
+                            too_close = true;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (too_close)
+                continue;
+
+            next_in_cell.push_back (cell_first[cy * cells_across + cx]);
+            cell_first[cy * cells_across + cx] = (int) selected.size ();
+        }
+
+        selected.push_back (peak);
+    }
+}
+
+int
+FindMaxima::FindImagePeaks (FIBITMAP * src, FIBITMAP * mask, double threshold, int min_separation,
+                            int number, FIAPeak ** peaks, int *peaks_found, FIBITMAP ** peak_image)
+{
+    if (this->FindMaximaPixels (src, threshold) == FIA_ERROR)
+        return FIA_ERROR;
+
+    std::vector < FIAPeak > candidates, selected;
+
+    CollectPeaks (mask, candidates);
+
+    FreeImage_Unload (this->processing_image);
+
+    SelectPeaks (candidates, this->width, this->height, min_separation, number, selected);
+
+    *peaks_found = (int) selected.size ();
+    *peaks = (FIAPeak *) malloc (MAX (*peaks_found, 1) * sizeof (FIAPeak));
+    CheckMemory (*peaks);
+
+    if (*peaks_found > 0)
+        memcpy (*peaks, &selected[0], *peaks_found * sizeof (FIAPeak));
 
-	this->oval_draw = oval_draw;
-    this->width = FreeImage_GetWidth (this->original_image);
-    this->height = FreeImage_GetHeight (this->original_image);
+    if (peak_image != NULL)
+    {
+        *peak_image = FreeImage_Allocate (this->width, this->height, 8, 0, 0, 0);
+        FIA_SetGreyLevelPalette (*peak_image);
+
+        for(int i = 0; i < *peaks_found; i++)
+            FreeImage_GetScanLine (*peak_image, selected[i].centre.y)[selected[i].centre.x] = 255;
+    }
+
+    return FIA_SUCCESS;
+}
+
+// Marks the maxima in the processing image with MAXIMA_CANDIDATE.
+int
+FindMaxima::FindMaximaPixels (FIBITMAP * src, double threshold)
+{
+    this->threshold = threshold;
+    this->original_image = src;
+    this->width = FreeImage_GetWidth (src);
+    this->height = FreeImage_GetHeight (src);
 
     if(this->width == 0 || this->height == 0) {
         FreeImage_OutputMessageProc (FIF_UNKNOWN,
-                                     "Error image size is %d x %d", width, height);	
-        return NULL;
+                                     "Error image size is %d x %d", width, height);
+        return FIA_ERROR;
     }
 
-    this->original_image_double = FIA_ConvertToGreyscaleFloatType(this->original_image, FIT_DOUBLE);
     this->processing_image = FreeImage_Allocate (this->width, this->height, 8, 0, 0, 0);
 
-    this->NonMaxSupression ();
+    // The search runs on the image's own pixel type. Other greyscale
+    // formats are converted to double.
+    FIBITMAP *converted = NULL;
 
-    SetNeigbourPixels ();
+    switch (FreeImage_GetImageType (src))
+    {
+        case FIT_BITMAP:
+            if (FreeImage_GetBPP (src) == 8)
+            {
+                this->FindCandidates < unsigned char > (src);
+                break;
+            }
+
+            converted = FIA_ConvertToGreyscaleFloatType (src, FIT_DOUBLE);
+            this->FindCandidates < double > (converted);
+            break;
+
+        case FIT_UINT16:
+            this->FindCandidates < unsigned short > (src);
+            break;
+
+        case FIT_INT16:
+            this->FindCandidates < short > (src);
+            break;
+
+        case FIT_UINT32:
+            this->FindCandidates < unsigned int > (src);
+            break;
+
+        case FIT_INT32:
+            this->FindCandidates < int > (src);
+            break;
+
+        case FIT_FLOAT:
+            this->FindCandidates < float > (src);
+            break;
 
-    PerformRegionGrow ();
+        case FIT_DOUBLE:
+            this->FindCandidates < double > (src);
+            break;
+
+        default:
+            converted = FIA_ConvertToGreyscaleFloatType (src, FIT_DOUBLE);
+            this->FindCandidates < double > (converted);
+            break;
+    }
+
+    if (converted != NULL)
+        FreeImage_Unload (converted);
+
+    return FIA_SUCCESS;
+}
+
+FIBITMAP *
+FindMaxima::FindImageMaxima (FIBITMAP * src, FIBITMAP * mask, double threshold,
+                             int min_separation, int oval_draw, FIAPeak ** peaks, int number, int *peaks_found)
+{
+    *peaks_found = 0;
+
+    this->min_separation = min_separation;
+    this->peek_image = NULL;
+	this->oval_draw = oval_draw;
+
+    if (this->FindMaximaPixels (src, threshold) == FIA_ERROR)
+        return NULL;
 
     DrawMaxima (min_separation);
 
@@ -566,7 +726,6 @@ FindMaxima::FindImageMaxima (FIBITMAP * src, FIBITMAP * mask, double threshold,
     *peaks_found = StoreBrightestPeaks (number, peaks);
 
     FreeImage_Unload (this->processing_image);
-    FreeImage_Unload (this->original_image_double);
 
     return this->peek_image;
 }
@@ -587,6 +746,33 @@ FIA_FindImageMaxima (FIBITMAP * src, FIBITMAP * mask, double threshold, int min_
                                    peaks_found);
 }
 
+int DLL_CALLCONV
+FIA_FindImagePeaks (FIBITMAP * src, FIBITMAP * mask, double threshold, int min_separation,
+                    int number, FIAPeak ** peaks, int *peaks_found, FIBITMAP ** peak_image)
+{
+    FindMaxima maxima;
+
+    *peaks_found = 0;
+
+    if (!FIA_IsGreyScale (src))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Image must be greyscale");
+        return FIA_ERROR;
+    }
+
+    if (mask != NULL && (FreeImage_GetBPP (mask) != 8
+                         || FreeImage_GetWidth (mask) != FreeImage_GetWidth (src)
+                         || FreeImage_GetHeight (mask) != FreeImage_GetHeight (src)))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Mask must be an 8bit image the same size as the image");
+        return FIA_ERROR;
+    }
+
+    return maxima.FindImagePeaks (src, mask, threshold, min_separation, number, peaks,
+                                  peaks_found, peak_image);
+}
+
 void DLL_CALLCONV
 FIA_FreePeaks (FIAPeak * peaks)
 {
@@ -0,0 +1,454 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "FreeImageAlgorithms.h"
+#include "FreeImageAlgorithms_Utils.h"
+#include "FreeImageAlgorithms_Morphology.h"
+#include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_ThreadPool.h"
+
+#include <string.h>
+#include <limits>
+
+// Greyscale erosion and dilation by a rectangle are a minimum or maximum
+// over a line along the rows followed by one down the columns. Each line
+// uses the van Herk / Gil-Werman algorithm: the line is cut into blocks
+// the length of the window, and running minimums are kept from the start
+// of each block and from its end. Any window covers the end of one block
+// and the start of the next, so its minimum is the lesser of two values.
+// That is three comparisons a pixel whatever the length of the window.
+//
+// Pixels outside the image are ignored, as if they held the largest value
+// for an erosion or the smallest for a dilation.
+
+#define GREY_MORPHOLOGY_ROWS_PER_BAND 32
+
+// Columns are done this many at a time so the block buffers stay small.
+#define GREY_MORPHOLOGY_COLUMN_STRIP 256
+
+template < typename T > struct MinOp
+{
+    static inline T Combine (T a, T b)
+    {
+        return (b < a) ? b : a;
+    }
+
+    static inline T Neutral ()
+    {
+        return std::numeric_limits < T >::max ();
+    }
+};
+
+template < typename T > struct MaxOp
+{
+    static inline T Combine (T a, T b)
+    {
+        return (b > a) ? b : a;
+    }
+
+    // For float and double min() is the smallest positive value.
+    static inline T Neutral ()
+    {
+        return std::numeric_limits < T >::is_integer ? std::numeric_limits < T >::min ()
+            : -std::numeric_limits < T >::max ();
+    }
+};
+
+// Length of the padded line, a whole number of windows covering the line and a radius either side.
+static inline int
+PaddedLength (int length, int radius)
+{
+    const int window = radius * 2 + 1;
+
+    return ((length + radius * 2 + window - 1) / window) * window;
+}
+
+template < typename T > struct GreyMorphologyData
+{
+    FIBITMAP *src;
+    FIBITMAP *dst;
+    int radius;
+};
+
+// Filters each row of src into dst.
+template < typename T, class Op > static void
+GreyMorphologyRowsBand (void *data, int band, int start, int end)
+{
+    GreyMorphologyData < T > *morph = (GreyMorphologyData < T > *) data;
+
+    const int width = FreeImage_GetWidth (morph->src);
+    const int radius = morph->radius;
+    const int window = radius * 2 + 1;
+    const int length = PaddedLength (width, radius);
+
+    T *padded = new T[length];
+    T *forward = new T[length];
+    T *backward = new T[length];
+
+    for(register int i = 0; i < length; i++)
+        padded[i] = Op::Neutral ();
+
+    for(register int y = start; y < end; y++)
+    {
+        T *src_ptr = (T *) FreeImage_GetScanLine (morph->src, y);
+        T *dst_ptr = (T *) FreeImage_GetScanLine (morph->dst, y);
+
+        memcpy (padded + radius, src_ptr, sizeof (T) * width);
+
+        for(register int block = 0; block < length; block += window)
+        {
+            forward[block] = padded[block];
+
+            for(register int i = block + 1; i < block + window; i++)
+                forward[i] = Op::Combine (forward[i - 1], padded[i]);
+
+            backward[block + window - 1] = padded[block + window - 1];
+
+            for(register int i = block + window - 2; i >= block; i--)
+                backward[i] = Op::Combine (backward[i + 1], padded[i]);
+        }
+
+        // Pixel x has the window from x to x + 2 * radius of the padded line.
+        for(register int x = 0; x < width; x++)
+            dst_ptr[x] = Op::Combine (backward[x], forward[x + window - 1]);
+    }
+
+    delete[]padded;
+    delete[]forward;
+    delete[]backward;
+}
+
+// Filters the columns of dst in place, a strip of columns at a time and
+// a row at a time within the strip so memory is read in order.
+template < typename T, class Op > static void
+GreyMorphologyColumnsBand (void *data, int band, int start, int end)
+{
+    GreyMorphologyData < T > *morph = (GreyMorphologyData < T > *) data;
+
+    const int height = FreeImage_GetHeight (morph->dst);
+    const int radius = morph->radius;
+    const int window = radius * 2 + 1;
+    const int length = PaddedLength (height, radius);
+
+    T *forward = new T[(size_t) length * GREY_MORPHOLOGY_COLUMN_STRIP];
+    T *backward = new T[(size_t) length * GREY_MORPHOLOGY_COLUMN_STRIP];
+
+    for(int strip = start; strip < end; strip += GREY_MORPHOLOGY_COLUMN_STRIP)
+    {
+        const int strip_width = MIN (GREY_MORPHOLOGY_COLUMN_STRIP, end - strip);
+
+        // Row i of the buffers is row i - radius of the image.
+        for(register int i = 0; i < length; i++)
+        {
+            T *fwd = forward + (size_t) i * GREY_MORPHOLOGY_COLUMN_STRIP;
+            int y = i - radius;
+
+            if (y >= 0 && y < height)
+            {
+                T *ptr = (T *) FreeImage_GetScanLine (morph->dst, y) + strip;
+
+                if (i % window == 0)
+                    memcpy (fwd, ptr, sizeof (T) * strip_width);
+                else
+                {
+                    for(register int x = 0; x < strip_width; x++)
+                        fwd[x] = Op::Combine (fwd[x - GREY_MORPHOLOGY_COLUMN_STRIP], ptr[x]);
+                }
+            }
+            else
+            {
+                if (i % window == 0)
+                {
+                    for(register int x = 0; x < strip_width; x++)
+                        fwd[x] = Op::Neutral ();
+                }
+                else
+                    memcpy (fwd, fwd - GREY_MORPHOLOGY_COLUMN_STRIP, sizeof (T) * strip_width);
+            }
+        }
+
+        for(register int i = length - 1; i >= 0; i--)
+        {
+            T *bwd = backward + (size_t) i * GREY_MORPHOLOGY_COLUMN_STRIP;
+            int y = i - radius;
+
+            if (y >= 0 && y < height)
+            {
+                T *ptr = (T *) FreeImage_GetScanLine (morph->dst, y) + strip;
+
+                if (i % window == window - 1)
+                    memcpy (bwd, ptr, sizeof (T) * strip_width);
+                else
+                {
+                    for(register int x = 0; x < strip_width; x++)
+                        bwd[x] = Op::Combine (bwd[x + GREY_MORPHOLOGY_COLUMN_STRIP], ptr[x]);
+                }
+            }
+            else
+            {
+                if (i % window == window - 1)
+                {
+                    for(register int x = 0; x < strip_width; x++)
+                        bwd[x] = Op::Neutral ();
+                }
+                else
+                    memcpy (bwd, bwd + GREY_MORPHOLOGY_COLUMN_STRIP, sizeof (T) * strip_width);
+            }
+        }
+
+        // Every row has been read into the buffers, so the results can go back in place.
+        for(register int y = 0; y < height; y++)
+        {
+            T *ptr = (T *) FreeImage_GetScanLine (morph->dst, y) + strip;
+            T *bwd = backward + (size_t) y * GREY_MORPHOLOGY_COLUMN_STRIP;
+            T *fwd = forward + (size_t) (y + window - 1) * GREY_MORPHOLOGY_COLUMN_STRIP;
+
+            for(register int x = 0; x < strip_width; x++)
+                ptr[x] = Op::Combine (bwd[x], fwd[x]);
+        }
+    }
+
+    delete[]forward;
+    delete[]backward;
+}
+
+// Erodes (Op is MinOp) or dilates (MaxOp) src by a rectangle into a new image of the same size.
+template < typename T, class Op > static FIBITMAP *
+MinMaxFilter (FIBITMAP * src, int x_radius, int y_radius)
+{
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+
+    FIBITMAP *dst = NULL;
+
+    GreyMorphologyData < T > morph;
+
+    if (x_radius > 0)
+    {
+        dst = FIA_CloneImageType (src, width, height);
+
+        if (dst == NULL)
+            return NULL;
+
+        morph.src = src;
+        morph.dst = dst;
+        morph.radius = x_radius;
+
+        FIA_RunBands (0, height, FIA_GetNumberOfBands (height, GREY_MORPHOLOGY_ROWS_PER_BAND),
+                      GreyMorphologyRowsBand < T, Op >, &morph);
+    }
+    else
+    {
+        dst = FreeImage_Clone (src);
+
+        if (dst == NULL)
+            return NULL;
+    }
+
+    if (y_radius > 0)
+    {
+        morph.src = dst;
+        morph.dst = dst;
+        morph.radius = y_radius;
+
+        FIA_RunBands (0, width, FIA_GetNumberOfBands (width, GREY_MORPHOLOGY_COLUMN_STRIP),
+                      GreyMorphologyColumnsBand < T, Op >, &morph);
+    }
+
+    return dst;
+}
+
+// a - b, which is never negative for the differences taken here.
+// Signed types may not hold the difference so it is clipped to the largest value.
+template < typename T > static inline T
+NonNegativeDifference (T a, T b)
+{
+    if (std::numeric_limits < T >::is_integer && std::numeric_limits < T >::is_signed)
+    {
+        if (b < 0 && a > std::numeric_limits < T >::max () + b)
+            return std::numeric_limits < T >::max ();
+    }
+
+    return (T) (a - b);
+}
+
+// Copies all but the border of a, or of a - b if b is not NULL, to a new image.
+template < typename T > static FIBITMAP *
+CropDifference (FIBITMAP * a, FIBITMAP * b, int xborder, int yborder)
+{
+    const int dst_width = FreeImage_GetWidth (a) - 2 * xborder;
+    const int dst_height = FreeImage_GetHeight (a) - 2 * yborder;
+
+    FIBITMAP *dst = FIA_CloneImageType (a, dst_width, dst_height);
+
+    if (dst == NULL)
+        return NULL;
+
+    for(register int y = 0; y < dst_height; y++)
+    {
+        T *a_ptr = (T *) FreeImage_GetScanLine (a, y + yborder) + xborder;
+        T *dst_ptr = (T *) FreeImage_GetScanLine (dst, y);
+
+        if (b == NULL)
+        {
+            memcpy (dst_ptr, a_ptr, sizeof (T) * dst_width);
+            continue;
+        }
+
+        T *b_ptr = (T *) FreeImage_GetScanLine (b, y + yborder) + xborder;
+
+        for(register int x = 0; x < dst_width; x++)
+            dst_ptr[x] = NonNegativeDifference (a_ptr[x], b_ptr[x]);
+    }
+
+    return dst;
+}
+
+template < typename T > static FIBITMAP *
+GreyscaleMorphology (FIABITMAP * src, int x_radius, int y_radius,
+                     FIA_GREYSCALE_MORPHOLOGY_OPERATION operation)
+{
+    FIBITMAP *first = NULL, *second = NULL, *dst = NULL;
+
+    switch (operation)
+    {
+        case FIA_GREYSCALE_EROSION:
+            first = MinMaxFilter < T, MinOp < T > > (src->fib, x_radius, y_radius);
+            dst = CropDifference < T > (first, NULL, src->xborder, src->yborder);
+            break;
+
+        case FIA_GREYSCALE_DILATION:
+            first = MinMaxFilter < T, MaxOp < T > > (src->fib, x_radius, y_radius);
+            dst = CropDifference < T > (first, NULL, src->xborder, src->yborder);
+            break;
+
+        case FIA_GREYSCALE_OPENING:
+        case FIA_GREYSCALE_WHITE_TOP_HAT:
+            first = MinMaxFilter < T, MinOp < T > > (src->fib, x_radius, y_radius);
+
+            if (first != NULL)
+                second = MinMaxFilter < T, MaxOp < T > > (first, x_radius, y_radius);
+
+            if (second == NULL)
+                break;
+
+            if (operation == FIA_GREYSCALE_OPENING)
+                dst = CropDifference < T > (second, NULL, src->xborder, src->yborder);
+            else
+                dst = CropDifference < T > (src->fib, second, src->xborder, src->yborder);
+
+            break;
+
+        case FIA_GREYSCALE_CLOSING:
+        case FIA_GREYSCALE_BLACK_TOP_HAT:
+            first = MinMaxFilter < T, MaxOp < T > > (src->fib, x_radius, y_radius);
+
+            if (first != NULL)
+                second = MinMaxFilter < T, MinOp < T > > (first, x_radius, y_radius);
+
+            if (second == NULL)
+                break;
+
+            if (operation == FIA_GREYSCALE_CLOSING)
+                dst = CropDifference < T > (second, NULL, src->xborder, src->yborder);
+            else
+                dst = CropDifference < T > (second, src->fib, src->xborder, src->yborder);
+
+            break;
+
+        case FIA_GREYSCALE_GRADIENT:
+            first = MinMaxFilter < T, MaxOp < T > > (src->fib, x_radius, y_radius);
+            second = MinMaxFilter < T, MinOp < T > > (src->fib, x_radius, y_radius);
+
+            if (first != NULL && second != NULL)
+                dst = CropDifference < T > (first, second, src->xborder, src->yborder);
+
+            break;
+    }
+
+    if (first != NULL)
+        FreeImage_Unload (first);
+
+    if (second != NULL)
+        FreeImage_Unload (second);
+
+    return dst;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleMorphology (FIABITMAP * src, int x_radius, int y_radius,
+                         FIA_GREYSCALE_MORPHOLOGY_OPERATION operation)
+{
+    if (src == NULL || src->fib == NULL)
+        return NULL;
+
+    if (x_radius < 0 || y_radius < 0)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "The structuring element radius can not be negative");
+        return NULL;
+    }
+
+    FREE_IMAGE_TYPE src_type = FreeImage_GetImageType (src->fib);
+
+    switch (src_type)
+    {
+        case FIT_BITMAP:
+            if (FreeImage_GetBPP (src->fib) == 8)
+                return GreyscaleMorphology < unsigned char > (src, x_radius, y_radius, operation);
+            break;
+
+        case FIT_UINT16:
+            return GreyscaleMorphology < unsigned short > (src, x_radius, y_radius, operation);
+
+        case FIT_INT16:
+            return GreyscaleMorphology < short > (src, x_radius, y_radius, operation);
+
+        case FIT_UINT32:
+            return GreyscaleMorphology < unsigned int > (src, x_radius, y_radius, operation);
+
+        case FIT_INT32:
+            return GreyscaleMorphology < int > (src, x_radius, y_radius, operation);
+
+        case FIT_FLOAT:
+            return GreyscaleMorphology < float > (src, x_radius, y_radius, operation);
+
+        case FIT_DOUBLE:
+            return GreyscaleMorphology < double > (src, x_radius, y_radius, operation);
+
+        default:
+            break;
+    }
+
+    FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                 "FREE_IMAGE_TYPE: Unable to perform greyscale morphology on type %d.",
+                                 src_type);
+
+    return NULL;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleErosion (FIABITMAP * src, int x_radius, int y_radius)
+{
+    return FIA_GreyscaleMorphology (src, x_radius, y_radius, FIA_GREYSCALE_EROSION);
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_GreyscaleDilation (FIABITMAP * src, int x_radius, int y_radius)
+{
+    return FIA_GreyscaleMorphology (src, x_radius, y_radius, FIA_GREYSCALE_DILATION);
+}
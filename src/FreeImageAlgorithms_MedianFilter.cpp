@@ -20,7 +20,24 @@
 #include "FreeImageAlgorithms_Filters.h"
 #include "FreeImageAlgorithms_Utilities.h"
 
-#define BLOCKSIZE 8
+#include "FreeImageAlgorithms_ThreadPool.h"
+#include "FreeImageAlgorithms_SIMD.h"
+#include "FreeImageAlgorithms_MedianNetwork.txx"
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+// Each band of rows is filtered with its own histogram or sorted window.
+#define MEDIAN_ROWS_PER_BAND 16
+
+// Integer images whose values span at most this many levels use a histogram.
+#define MEDIAN_MAX_HISTOGRAM_BINS 65536
+
+// The histogram also counts blocks of 16 levels so the median can skip empty ranges.
+#define MEDIAN_COARSE_SHIFT 4
+#define MEDIAN_COARSE_SIZE (1 << MEDIAN_COARSE_SHIFT)
+#define MEDIAN_COARSE_MASK (MEDIAN_COARSE_SIZE - 1)
 
 template < class Tsrc > class FILTER
 {
@@ -30,18 +47,17 @@ template < class Tsrc > class FILTER
 
   private:
 
-    inline Tsrc KernelMedian (Tsrc * src_row_ptr);
-    inline void GetRow (Tsrc * ptr, Tsrc * kernel_data);
-    inline Tsrc quick_select (Tsrc arr[], int n);
-
-    int kernel_width;
-    int kernel_height;
-    int x_reminder;
-    int y_reminder;
-    int x_max_block_size;
-    int y_max_block_size;
-    int src_pitch_in_pixels;
-    Tsrc *kernel_tmp_array;
+    static void HistogramMedianBand (void *data, int band, int start, int end);
+    static void SortedMedianBand (void *data, int band, int start, int end);
+    static void NetworkMedianBand (void *data, int band, int start, int end);
+    static FIBITMAP *RankMedianFilter (FIABITMAP * src, int kernel_x_radius, int kernel_y_radius);
+
+    FIABITMAP *src;
+    FIBITMAP *dst;
+    int kernel_x_radius;
+    int kernel_y_radius;
+    Tsrc min;                   // Value of the first histogram level.
+    int levels;
 };
 
 template < typename Tsrc > inline Tsrc FILTER < Tsrc >::GetMedianFromImage (FIBITMAP * src)
@@ -58,7 +74,7 @@ template < typename Tsrc > inline Tsrc FILTER < Tsrc >::GetMedianFromImage (FIBI
     {
         src_ptr = (Tsrc *) FreeImage_GetScanLine (src, y);
 
-        memcpy (data, src_ptr, sizeof (Tsrc) * width);
+        memcpy (data + y * width, src_ptr, sizeof (Tsrc) * width);
     }
 
     Tsrc ret = quick_select_median (data, total);
@@ -68,158 +84,397 @@ template < typename Tsrc > inline Tsrc FILTER < Tsrc >::GetMedianFromImage (FIBI
     return ret;
 }
 
-template < typename Tsrc > inline void FILTER < Tsrc >::GetRow (Tsrc * ptr, Tsrc * kernel_data)
+// Huang's sliding histogram. As the window moves along a row a column of
+// values leaves and another enters, the median is then found by walking from
+// the last one, keeping count of the values below it.
+class SlidingHistogram
 {
-    int x_max_block_size = this->x_max_block_size;
-    register Tsrc *tmp;
-    register Tsrc *result = kernel_data;
+  public:
 
-    size_t tsrc_size = sizeof (Tsrc);
-    size_t blocksize_in_bytes = tsrc_size * BLOCKSIZE;
+    SlidingHistogram (int levels, int rank)
+    {
+        this->coarse_levels = (levels >> MEDIAN_COARSE_SHIFT) + 1;
+        this->fine = new int[this->coarse_levels * MEDIAN_COARSE_SIZE];
+        this->coarse = new int[this->coarse_levels];
+        this->rank = rank;
+        Clear ();
+    }
 
-    for(register int col = 0; col < x_max_block_size; col += BLOCKSIZE)
+    ~SlidingHistogram ()
     {
-        tmp = ptr + col;
+        delete[]this->fine;
+        delete[]this->coarse;
+    }
 
-        memcpy (result, tmp, blocksize_in_bytes);
+    void Clear (void)
+    {
+        memset (this->fine, 0, sizeof (int) * this->coarse_levels * MEDIAN_COARSE_SIZE);
+        memset (this->coarse, 0, sizeof (int) * this->coarse_levels);
+        this->level = 0;
+        this->below = 0;
     }
 
-    tmp = ptr + x_max_block_size;
-    result += x_max_block_size;
+    inline void Add (int level)
+    {
+        this->fine[level]++;
+        this->coarse[level >> MEDIAN_COARSE_SHIFT]++;
+
+        if (level < this->level)
+            this->below++;
+    }
 
-    switch (this->x_reminder)
+    inline void Remove (int level)
     {
-        case 7:
-        {
-            memcpy (result, tmp, tsrc_size * 7);
-            break;
-        }
+        this->fine[level]--;
+        this->coarse[level >> MEDIAN_COARSE_SHIFT]--;
 
-        case 6:
-        {
-            memcpy (result, tmp, tsrc_size * 6);
-            break;
-        }
+        if (level < this->level)
+            this->below--;
+    }
 
-        case 5:
-        {
-            memcpy (result, tmp, tsrc_size * 5);
-            break;
-        }
+    // Returns the level with rank values below it.
+    inline int Median (void)
+    {
+        register int *fine = this->fine;
+        register int *coarse = this->coarse;
+        register int level = this->level;
+        register int below = this->below;
 
-        case 4:
+        while (below > this->rank && level > 0)
         {
-            memcpy (result, tmp, tsrc_size * 4);
-            break;
+            if (level > 0 && (level & MEDIAN_COARSE_MASK) == 0
+                && below - coarse[(level >> MEDIAN_COARSE_SHIFT) - 1] > this->rank)
+            {
+                level -= MEDIAN_COARSE_SIZE;
+                below -= coarse[level >> MEDIAN_COARSE_SHIFT];
+            }
+            else
+            {
+                level--;
+                below -= fine[level];
+            }
         }
 
-        case 3:
+        while (below + fine[level] <= this->rank)
         {
-            memcpy (result, tmp, tsrc_size * 3);
-            break;
+            below += fine[level];
+            level++;
+
+            while ((level & MEDIAN_COARSE_MASK) == 0
+                   && below + coarse[level >> MEDIAN_COARSE_SHIFT] <= this->rank)
+            {
+                below += coarse[level >> MEDIAN_COARSE_SHIFT];
+                level += MEDIAN_COARSE_SIZE;
+            }
         }
 
-        case 2:
+        this->level = level;
+        this->below = below;
+
+        return level;
+    }
+
+  private:
+
+    int *fine;
+    int *coarse;
+    int coarse_levels;
+    int rank;
+    int level;                  // The last median.
+    int below;                  // Number of values below level.
+};
+
+template < typename Tsrc > void FILTER < Tsrc >::HistogramMedianBand (void *data, int band,
+                                                                      int start, int end)
+{
+    FILTER < Tsrc > *filter = (FILTER < Tsrc > *) data;
+
+    const int kernel_width = (filter->kernel_x_radius * 2) + 1;
+    const int kernel_height = (filter->kernel_y_radius * 2) + 1;
+    const int dst_width = FreeImage_GetWidth (filter->dst);
+    const int x_start = filter->src->xborder - filter->kernel_x_radius;
+    const int y_start = filter->src->yborder - filter->kernel_y_radius;
+    const Tsrc min = filter->min;
+
+    SlidingHistogram histogram (filter->levels, (kernel_width * kernel_height - 1) / 2);
+    Tsrc **rows = new Tsrc *[kernel_height];
+
+    register Tsrc *dst_ptr;
+
+    for(register int y = start; y < end; y++)
+    {
+        for(register int row = 0; row < kernel_height; row++)
+            rows[row] = (Tsrc *) FreeImage_GetScanLine (filter->src->fib, y + y_start + row) + x_start;
+
+        dst_ptr = (Tsrc *) FreeImage_GetScanLine (filter->dst, y);
+
+        histogram.Clear ();
+
+        for(register int row = 0; row < kernel_height; row++)
         {
-            memcpy (result, tmp, tsrc_size * 2);
-            break;
+            for(register int col = 0; col < kernel_width; col++)
+                histogram.Add ((int) (rows[row][col] - min));
         }
 
-        case 1:
+        dst_ptr[0] = (Tsrc) (histogram.Median () + min);
+
+        for(register int x = 1; x < dst_width; x++)
         {
-            memcpy (result, tmp, tsrc_size * 1);
+            for(register int row = 0; row < kernel_height; row++)
+            {
+                histogram.Remove ((int) (rows[row][x - 1] - min));
+                histogram.Add ((int) (rows[row][x + kernel_width - 1] - min));
+            }
+
+            dst_ptr[x] = (Tsrc) (histogram.Median () + min);
         }
     }
+
+    delete[]rows;
 }
 
-template < typename Tsrc > inline Tsrc FILTER < Tsrc >::KernelMedian (Tsrc * src_row_ptr)
+// The vector median row for each pixel type, NULL where there is none.
+template < typename Tsrc > struct MedianRowFunction
 {
-    register Tsrc *array_ptr = this->kernel_tmp_array;
-    register Tsrc *tmp_ptr = src_row_ptr;
+    typedef void (*Function) (const Tsrc * const *rows, int radius, Tsrc * scratch, Tsrc * dst,
+                              int width);
 
-    for(register int row = 0; row < this->y_max_block_size; row += BLOCKSIZE)
+    static Function Get (const FIA_VectorFunctions * functions)
     {
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+        return NULL;
+    }
+};
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+template <> inline MedianRowFunction < unsigned char >::Function
+MedianRowFunction < unsigned char >::Get (const FIA_VectorFunctions * functions)
+{
+    return functions->uchar_median_row;
+}
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+template <> inline MedianRowFunction < short >::Function
+MedianRowFunction < short >::Get (const FIA_VectorFunctions * functions)
+{
+    return functions->short_median_row;
+}
+
+template <> inline MedianRowFunction < unsigned short >::Function
+MedianRowFunction < unsigned short >::Get (const FIA_VectorFunctions * functions)
+{
+    return functions->ushort_median_row;
+}
+
+template <> inline MedianRowFunction < float >::Function
+MedianRowFunction < float >::Get (const FIA_VectorFunctions * functions)
+{
+    return functions->float_median_row;
+}
+
+// 3x3 and 5x5 windows use the min / max networks, a vector of pixels at a time
+// where the processor allows.
+template < typename Tsrc > void FILTER < Tsrc >::NetworkMedianBand (void *data, int band,
+                                                                    int start, int end)
+{
+    FILTER < Tsrc > *filter = (FILTER < Tsrc > *) data;
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    const int radius = filter->kernel_x_radius;
+    const int kernel_height = (radius * 2) + 1;
+    const int dst_width = FreeImage_GetWidth (filter->dst);
+    const int x_start = filter->src->xborder - radius;
+    const int y_start = filter->src->yborder - radius;
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    const FIA_VectorFunctions *functions = FIA_GetVectorFunctions ();
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    typename MedianRowFunction < Tsrc >::Function median_row = NULL;
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    if (functions != NULL)
+        median_row = MedianRowFunction < Tsrc >::Get (functions);
 
-        GetRow (tmp_ptr, array_ptr);
-        tmp_ptr += this->src_pitch_in_pixels;
-        array_ptr += this->kernel_width;
+    const Tsrc **rows = new const Tsrc *[kernel_height];
+    Tsrc *scratch = new Tsrc[kernel_height * (dst_width + 2 * radius)];
+
+    for(register int y = start; y < end; y++)
+    {
+        for(register int row = 0; row < kernel_height; row++)
+            rows[row] = (Tsrc *) FreeImage_GetScanLine (filter->src->fib, y + y_start + row) + x_start;
+
+        Tsrc *dst_ptr = (Tsrc *) FreeImage_GetScanLine (filter->dst, y);
+
+        if (median_row != NULL)
+            median_row (rows, radius, scratch, dst_ptr, dst_width);
+        else
+            MedianNetworkRow < ScalarMedianVector < Tsrc > > (rows, radius, scratch, dst_ptr,
+                                                                dst_width);
     }
 
-    switch (this->y_reminder)
+    delete[]rows;
+    delete[]scratch;
+}
+
+// NaN is ordered after every number so the sorted window stays consistent.
+template < typename Tsrc > static inline bool MedianLess (Tsrc a, Tsrc b)
+{
+    return a < b || (b != b && a == a);
+}
+
+template < typename Tsrc > static inline bool MedianEqual (Tsrc a, Tsrc b)
+{
+    return a == b || (a != a && b != b);
+}
+
+// Keeps the window sorted. As it moves along a row the column leaving and
+// the column entering are sorted and merged into it in one pass.
+template < typename Tsrc > void FILTER < Tsrc >::SortedMedianBand (void *data, int band,
+                                                                   int start, int end)
+{
+    FILTER < Tsrc > *filter = (FILTER < Tsrc > *) data;
+
+    const int kernel_width = (filter->kernel_x_radius * 2) + 1;
+    const int kernel_height = (filter->kernel_y_radius * 2) + 1;
+    const int kernel_length = kernel_width * kernel_height;
+    const int rank = (kernel_length - 1) / 2;
+    const int dst_width = FreeImage_GetWidth (filter->dst);
+    const int x_start = filter->src->xborder - filter->kernel_x_radius;
+    const int y_start = filter->src->yborder - filter->kernel_y_radius;
+
+    Tsrc **rows = new Tsrc *[kernel_height];
+    Tsrc *window = new Tsrc[kernel_length];
+    Tsrc *merged = new Tsrc[kernel_length];
+    Tsrc *leaving = new Tsrc[kernel_height];
+    Tsrc *entering = new Tsrc[kernel_height];
+
+    register Tsrc *dst_ptr;
+
+    for(register int y = start; y < end; y++)
     {
-        case 7:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 6:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 5:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 4:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 3:
-        {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
-        }
-        case 2:
+        for(register int row = 0; row < kernel_height; row++)
+            rows[row] = (Tsrc *) FreeImage_GetScanLine (filter->src->fib, y + y_start + row) + x_start;
+
+        dst_ptr = (Tsrc *) FreeImage_GetScanLine (filter->dst, y);
+
+        for(register int row = 0; row < kernel_height; row++)
+            memcpy (window + row * kernel_width, rows[row], sizeof (Tsrc) * kernel_width);
+
+        std::sort (window, window + kernel_length, MedianLess < Tsrc >);
+
+        dst_ptr[0] = window[rank];
+
+        for(register int x = 1; x < dst_width; x++)
         {
-            GetRow (tmp_ptr, array_ptr);
-            tmp_ptr += this->src_pitch_in_pixels;
-            array_ptr += this->kernel_width;
+            for(register int row = 0; row < kernel_height; row++)
+            {
+                leaving[row] = rows[row][x - 1];
+                entering[row] = rows[row][x + kernel_width - 1];
+            }
+
+            std::sort (leaving, leaving + kernel_height, MedianLess < Tsrc >);
+            std::sort (entering, entering + kernel_height, MedianLess < Tsrc >);
+
+            register int i = 0, l = 0, e = 0, m = 0;
+
+            while (i < kernel_length)
+            {
+                if (l < kernel_height && MedianEqual (window[i], leaving[l]))
+                {
+                    i++;
+                    l++;
+                }
+                else if (e < kernel_height && MedianLess (entering[e], window[i]))
+                    merged[m++] = entering[e++];
+                else
+                    merged[m++] = window[i++];
+            }
+
+            while (e < kernel_height)
+                merged[m++] = entering[e++];
+
+            std::swap (window, merged);
+
+            dst_ptr[x] = window[rank];
         }
-        case 1:
+    }
+
+    delete[]rows;
+    delete[]window;
+    delete[]merged;
+    delete[]leaving;
+    delete[]entering;
+}
+
+// Images of floating point values with few distinct values, such as integer
+// data that has been converted, are filtered as 16 bit ranks of the values so
+// the histogram can be used. Returns NULL if there are too many values.
+template < typename Tsrc > FIBITMAP * FILTER < Tsrc >::RankMedianFilter (FIABITMAP * src,
+                                                                         int kernel_x_radius,
+                                                                         int kernel_y_radius)
+{
+    const int width = FreeImage_GetWidth (src->fib);
+    const int height = FreeImage_GetHeight (src->fib);
+
+    std::vector < Tsrc > values;
+
+    values.reserve (width * height);
+
+    for(register int y = 0; y < height; y++)
+    {
+        Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine (src->fib, y);
+
+        values.insert (values.end (), src_ptr, src_ptr + width);
+    }
+
+    std::sort (values.begin (), values.end (), MedianLess < Tsrc >);
+    values.erase (std::unique (values.begin (), values.end (), MedianEqual < Tsrc >), values.end ());
+
+    if (values.size () > MEDIAN_MAX_HISTOGRAM_BINS)
+        return NULL;
+
+    FIABITMAP ranks;
+
+    ranks.fib = FreeImage_AllocateT (FIT_UINT16, width, height, 16, 0, 0, 0);
+    ranks.xborder = src->xborder;
+    ranks.yborder = src->yborder;
+
+    if (ranks.fib == NULL)
+        return NULL;
+
+    for(register int y = 0; y < height; y++)
+    {
+        Tsrc *src_ptr = (Tsrc *) FreeImage_GetScanLine (src->fib, y);
+        unsigned short *rank_ptr = (unsigned short *) FreeImage_GetScanLine (ranks.fib, y);
+
+        for(register int x = 0; x < width; x++)
+            rank_ptr[x] = (unsigned short) (std::lower_bound (values.begin (), values.end (),
+                                                              src_ptr[x], MedianLess < Tsrc >)
+                                            - values.begin ());
+    }
+
+    FILTER < unsigned short > rank_filter;
+    FIBITMAP *rank_dst = rank_filter.MedianFilter (&ranks, kernel_x_radius, kernel_y_radius);
+
+    FreeImage_Unload (ranks.fib);
+
+    if (rank_dst == NULL)
+        return NULL;
+
+    const int dst_width = FreeImage_GetWidth (rank_dst);
+    const int dst_height = FreeImage_GetHeight (rank_dst);
+
+    FIBITMAP *dst = FIA_CloneImageType (src->fib, dst_width, dst_height);
+
+    if (dst != NULL)
+    {
+        for(register int y = 0; y < dst_height; y++)
         {
-            GetRow (tmp_ptr, array_ptr);
+            unsigned short *rank_ptr = (unsigned short *) FreeImage_GetScanLine (rank_dst, y);
+            Tsrc *dst_ptr = (Tsrc *) FreeImage_GetScanLine (dst, y);
+
+            for(register int x = 0; x < dst_width; x++)
+                dst_ptr[x] = values[rank_ptr[x]];
         }
     }
 
-    int kernel_length = this->kernel_width * this->kernel_height;
+    FreeImage_Unload (rank_dst);
 
-    // We must now find and return the median value.
-    return quick_select_median (this->kernel_tmp_array, kernel_length);
+    return dst;
 }
 
 template < typename Tsrc > FIBITMAP * FILTER < Tsrc >::MedianFilter (FIABITMAP * src,
@@ -227,11 +482,23 @@ template < typename Tsrc > FIBITMAP * FILTER < Tsrc >::MedianFilter (FIABITMAP *
                                                                      int kernel_y_radius)
 {
     // Border must be large enough to account for kernel radius
-    if (src->xborder < kernel_x_radius || src->yborder < kernel_y_radius)
+    if (kernel_x_radius < 0 || kernel_y_radius < 0
+        || src->xborder < kernel_x_radius || src->yborder < kernel_y_radius)
     {
         return NULL;
     }
 
+    const bool use_network = (kernel_x_radius == kernel_y_radius
+                              && (kernel_x_radius == 1 || kernel_x_radius == 2));
+
+    if (!use_network && !std::numeric_limits < Tsrc >::is_integer)
+    {
+        FIBITMAP *dst = RankMedianFilter (src, kernel_x_radius, kernel_y_radius);
+
+        if (dst != NULL)
+            return dst;
+    }
+
     const int src_image_width = FreeImage_GetWidth (src->fib);
     const int src_image_height = FreeImage_GetHeight (src->fib);
 
@@ -240,46 +507,39 @@ template < typename Tsrc > FIBITMAP * FILTER < Tsrc >::MedianFilter (FIABITMAP *
 
     FIBITMAP *dst = FIA_CloneImageType (src->fib, dst_width, dst_height);
 
-    const int dst_pitch_in_pixels = FreeImage_GetPitch (dst) / sizeof (Tsrc);
-
-    this->kernel_width = (kernel_x_radius * 2) + 1;
-    this->kernel_height = (kernel_y_radius * 2) + 1;
-    this->x_reminder = this->kernel_width % BLOCKSIZE;
-    this->y_reminder = this->kernel_height % BLOCKSIZE;
-    this->x_max_block_size = (this->kernel_width / BLOCKSIZE) * BLOCKSIZE;
-    this->y_max_block_size = (this->kernel_height / BLOCKSIZE) * BLOCKSIZE;
-    this->src_pitch_in_pixels = FreeImage_GetPitch (src->fib) / sizeof (Tsrc);
-
-    Tsrc *src_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (src->fib);
-    Tsrc *dst_first_pixel_address_ptr = (Tsrc *) FreeImage_GetBits (dst);
-
-    this->kernel_tmp_array
-        = (Tsrc *) malloc (sizeof (Tsrc) * this->kernel_width * this->kernel_height);
-
-    CheckMemory (this->kernel_tmp_array);
+    if (dst == NULL)
+        return NULL;
 
-    register Tsrc *dst_ptr;
-    register Tsrc *src_row_ptr;
+    // Each call has its own copy so filters can run at the same time.
+    FILTER < Tsrc > filter;
 
-    // Amount we need to move in x to get pass the border and onto the image.
-    int x_amount_to_image = src->xborder - kernel_x_radius;
-    int y_amount_to_image = src->yborder - kernel_y_radius;
+    filter.src = src;
+    filter.dst = dst;
+    filter.kernel_x_radius = kernel_x_radius;
+    filter.kernel_y_radius = kernel_y_radius;
+    filter.levels = 0;
 
-    for(register int y = 0; y < dst_height; y++)
+    if (!use_network && std::numeric_limits < Tsrc >::is_integer)
     {
-        src_row_ptr = src_first_pixel_address_ptr + (y + y_amount_to_image)
-            * this->src_pitch_in_pixels + x_amount_to_image;
+        double min, max;
 
-        dst_ptr = (dst_first_pixel_address_ptr + y * dst_pitch_in_pixels);
+        FIA_FindMinMax (src->fib, &min, &max);
 
-        for(register int x = 0; x < dst_width; x++)
+        if (max - min < MEDIAN_MAX_HISTOGRAM_BINS)
         {
-            *dst_ptr++ = KernelMedian (src_row_ptr);
-            src_row_ptr++;
+            filter.min = (Tsrc) min;
+            filter.levels = (int) (max - min) + 1;
         }
     }
 
-    free (this->kernel_tmp_array);
+    int bands = FIA_GetNumberOfBands (dst_height, MEDIAN_ROWS_PER_BAND);
+
+    if (use_network)
+        FIA_RunBands (0, dst_height, bands, FILTER < Tsrc >::NetworkMedianBand, &filter);
+    else if (filter.levels > 0)
+        FIA_RunBands (0, dst_height, bands, FILTER < Tsrc >::HistogramMedianBand, &filter);
+    else
+        FIA_RunBands (0, dst_height, bands, FILTER < Tsrc >::SortedMedianBand, &filter);
 
     return dst;
 }
@@ -287,8 +547,8 @@ template < typename Tsrc > FIBITMAP * FILTER < Tsrc >::MedianFilter (FIABITMAP *
 FILTER < unsigned char >filterUCharImage;
 FILTER < unsigned short >filterUShortImage;
 FILTER < short >filterShortImage;
-FILTER < unsigned long >filterULongImage;
-FILTER < long >filterLongImage;
+FILTER < unsigned int >filterUIntImage;
+FILTER < int >filterIntImage;
 FILTER < float >filterFloatImage;
 FILTER < double >filterDoubleImage;
 
@@ -327,12 +587,12 @@ FIA_MedianFilter (FIABITMAP * src, int kernel_x_radius, int kernel_y_radius)
         }
         case FIT_UINT32:
         {                       // array of unsigned long: unsigned 32-bit
-            dst = filterULongImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
+            dst = filterUIntImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
             break;
         }
         case FIT_INT32:
         {                       // array of long: signed 32-bit
-            dst = filterLongImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
+            dst = filterIntImage.MedianFilter (src, kernel_x_radius, kernel_y_radius);
             break;
         }
         case FIT_FLOAT:
@@ -394,12 +654,12 @@ FIA_GetMedianFromImage (FIBITMAP * src)
         }
         case FIT_UINT32:
         {                       // array of unsigned long: unsigned 32-bit
-            return filterULongImage.GetMedianFromImage (src);
+            return filterUIntImage.GetMedianFromImage (src);
             break;
         }
         case FIT_INT32:
         {                       // array of long: signed 32-bit
-            return filterLongImage.GetMedianFromImage (src);
+            return filterIntImage.GetMedianFromImage (src);
             break;
         }
         case FIT_FLOAT:
@@ -0,0 +1,236 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef __FREEIMAGE_ALGORITHMS_MEDIAN_NETWORK_PRIVATE__
+#define __FREEIMAGE_ALGORITHMS_MEDIAN_NETWORK_PRIVATE__
+
+// 3x3 and 5x5 medians by min / max networks, so there are no branches and
+// a vector of pixels is done at once. Each instruction set file supplies a
+// class V with:
+//   Type     the pixel type
+//   Vector   the register type holding Width pixels
+//   Load, Store, Min and Max.
+//
+// The window's columns are sorted first, which is shared between the
+// 2r+1 outputs that use each column. Then wire k * (2r+1) + c holds the
+// k'th smallest value in column c of the window. The networks below only
+// keep the compares whose results reach the median. MEDIAN_MIN and
+// MEDIAN_MAX are compares where only one of the results is used.
+
+#define MEDIAN_CE(a, b) \
+    { typename V::Vector t = V::Min (v[a], v[b]); v[b] = V::Max (v[a], v[b]); v[a] = t; }
+#define MEDIAN_MIN(a, b) v[a] = V::Min (v[a], v[b])
+#define MEDIAN_MAX(a, b) v[b] = V::Max (v[a], v[b])
+
+template < typename T > struct ScalarMedianVector
+{
+    typedef T Type;
+    typedef T Vector;
+
+    enum { Width = 1 };
+
+    static inline T Load (const T * ptr)
+    {
+        return *ptr;
+    }
+
+    static inline void Store (T * ptr, T value)
+    {
+        *ptr = value;
+    }
+
+    static inline T Min (T a, T b)
+    {
+        return (b < a) ? b : a;
+    }
+
+    static inline T Max (T a, T b)
+    {
+        return (a < b) ? b : a;
+    }
+};
+
+template < class V, int R > struct MedianNetwork;
+
+template < class V > struct MedianNetwork < V, 1 >
+{
+    typedef typename V::Type T;
+
+    static inline void SortColumns (const T * const *rows, T * const *sorted, int x)
+    {
+        typename V::Vector v[3];
+
+        for(int k = 0; k < 3; k++)
+            v[k] = V::Load (rows[k] + x);
+
+        MEDIAN_CE (0, 1); MEDIAN_CE (1, 2); MEDIAN_CE (0, 1);
+
+        for(int k = 0; k < 3; k++)
+            V::Store (sorted[k] + x, v[k]);
+    }
+
+    static inline typename V::Vector Median (T * const *sorted, int x)
+    {
+        typename V::Vector v[9];
+
+        for(int k = 0; k < 3; k++)
+            for(int c = 0; c < 3; c++)
+                v[k * 3 + c] = V::Load (sorted[k] + x + c);
+
+        MEDIAN_MAX (0, 1); MEDIAN_MAX (1, 2); MEDIAN_CE (3, 4); MEDIAN_MIN (4, 5);
+        MEDIAN_MAX (3, 4); MEDIAN_CE (6, 7); MEDIAN_MIN (7, 8); MEDIAN_MIN (6, 7);
+        MEDIAN_CE (2, 4); MEDIAN_MAX (2, 6); MEDIAN_MIN (4, 6);
+
+        return v[4];
+    }
+};
+
+template < class V > struct MedianNetwork < V, 2 >
+{
+    typedef typename V::Type T;
+
+    static inline void SortColumns (const T * const *rows, T * const *sorted, int x)
+    {
+        typename V::Vector v[5];
+
+        for(int k = 0; k < 5; k++)
+            v[k] = V::Load (rows[k] + x);
+
+        MEDIAN_CE (0, 1); MEDIAN_CE (3, 4); MEDIAN_CE (2, 4); MEDIAN_CE (2, 3);
+        MEDIAN_CE (0, 3); MEDIAN_CE (0, 2); MEDIAN_CE (1, 4); MEDIAN_CE (1, 3);
+        MEDIAN_CE (1, 2);
+
+        for(int k = 0; k < 5; k++)
+            V::Store (sorted[k] + x, v[k]);
+    }
+
+    static inline typename V::Vector Median (T * const *sorted, int x)
+    {
+        typename V::Vector v[25];
+
+        for(int k = 0; k < 5; k++)
+            for(int c = 0; c < 5; c++)
+                v[k * 5 + c] = V::Load (sorted[k] + x + c);
+
+        MEDIAN_CE (0, 1); MEDIAN_CE (3, 4); MEDIAN_CE (2, 4); MEDIAN_MAX (2, 3);
+        MEDIAN_MAX (0, 3); MEDIAN_CE (1, 4); MEDIAN_MAX (1, 3); MEDIAN_CE (5, 6);
+        MEDIAN_CE (8, 9); MEDIAN_CE (7, 9); MEDIAN_CE (7, 8); MEDIAN_CE (5, 8);
+        MEDIAN_MAX (5, 7); MEDIAN_CE (6, 9); MEDIAN_CE (6, 8); MEDIAN_MAX (6, 7);
+        MEDIAN_CE (10, 11); MEDIAN_CE (13, 14); MEDIAN_CE (12, 14); MEDIAN_CE (12, 13);
+        MEDIAN_CE (10, 13); MEDIAN_MAX (10, 12); MEDIAN_MIN (11, 14);
+        MEDIAN_CE (11, 13); MEDIAN_CE (11, 12); MEDIAN_CE (15, 16); MEDIAN_CE (18, 19);
+        MEDIAN_CE (17, 19); MEDIAN_CE (17, 18); MEDIAN_CE (15, 18); MEDIAN_CE (15, 17);
+        MEDIAN_MIN (16, 19); MEDIAN_MIN (16, 18); MEDIAN_CE (16, 17);
+        MEDIAN_CE (20, 21); MEDIAN_CE (23, 24); MEDIAN_CE (22, 24); MEDIAN_CE (22, 23);
+        MEDIAN_CE (20, 23); MEDIAN_CE (20, 22); MEDIAN_MIN (21, 24);
+        MEDIAN_MIN (21, 23); MEDIAN_MIN (21, 22); MEDIAN_CE (3, 7); MEDIAN_CE (11, 15);
+        MEDIAN_CE (4, 8); MEDIAN_CE (12, 16); MEDIAN_CE (20, 9); MEDIAN_CE (13, 17);
+        MEDIAN_MAX (3, 11); MEDIAN_CE (7, 15); MEDIAN_CE (4, 12); MEDIAN_MIN (8, 16);
+        MEDIAN_CE (20, 13); MEDIAN_MIN (9, 17); MEDIAN_MAX (7, 11); MEDIAN_CE (8, 12);
+        MEDIAN_CE (9, 13); MEDIAN_MAX (11, 4); MEDIAN_CE (15, 8); MEDIAN_MIN (13, 21);
+        MEDIAN_CE (15, 4); MEDIAN_CE (8, 12); MEDIAN_CE (9, 13); MEDIAN_MAX (4, 20);
+        MEDIAN_MIN (8, 9); MEDIAN_MIN (12, 13); MEDIAN_MAX (15, 8); MEDIAN_MIN (12, 20);
+        MEDIAN_MAX (8, 12);
+
+        return v[12];
+    }
+};
+
+#undef MEDIAN_CE
+#undef MEDIAN_MIN
+#undef MEDIAN_MAX
+
+// Median filters one row with a (2R+1) x (2R+1) window. rows point at the
+// leftmost pixel under the window for the first output and scratch has room
+// for (2R+1) * (width + 2R) values. Pixels left over after the last whole
+// vector are done one at a time.
+template < class V, int R > static void
+MedianNetworkRow (const typename V::Type * const *rows, typename V::Type * scratch,
+                  typename V::Type * dst, int width)
+{
+    typedef typename V::Type T;
+    typedef ScalarMedianVector < T > S;
+
+    const int span = width + 2 * R;
+
+    T *sorted[2 * R + 1];
+
+    for(int k = 0; k < 2 * R + 1; k++)
+        sorted[k] = scratch + k * span;
+
+    int x = 0;
+
+    for(; x + V::Width <= span; x += V::Width)
+        MedianNetwork < V, R >::SortColumns (rows, sorted, x);
+
+    for(; x < span; x++)
+        MedianNetwork < S, R >::SortColumns (rows, sorted, x);
+
+    x = 0;
+
+    for(; x + V::Width <= width; x += V::Width)
+        V::Store (dst + x, MedianNetwork < V, R >::Median (sorted, x));
+
+    for(; x < width; x++)
+        dst[x] = MedianNetwork < S, R >::Median (sorted, x);
+}
+
+// Calls MedianNetworkRow for a radius of 1 or 2.
+template < class V > static void
+MedianNetworkRow (const typename V::Type * const *rows, int radius, typename V::Type * scratch,
+                  typename V::Type * dst, int width)
+{
+    if (radius == 1)
+        MedianNetworkRow < V, 1 > (rows, scratch, dst, width);
+    else
+        MedianNetworkRow < V, 2 > (rows, scratch, dst, width);
+}
+
+// The largest of each 3x3 window, used by the local maxima search. The
+// columns of the three rows are reduced to their maximum first, in scratch
+// which has room for width + 2 values, then each output takes the maximum
+// of three neighbouring columns.
+template < class V > static void
+MaximumRow (const typename V::Type * const *rows, typename V::Type * scratch,
+            typename V::Type * dst, int width)
+{
+    typedef typename V::Type T;
+    typedef ScalarMedianVector < T > S;
+
+    const int span = width + 2;
+
+    int x = 0;
+
+    for(; x + V::Width <= span; x += V::Width)
+        V::Store (scratch + x, V::Max (V::Max (V::Load (rows[0] + x), V::Load (rows[1] + x)),
+                                       V::Load (rows[2] + x)));
+
+    for(; x < span; x++)
+        scratch[x] = S::Max (S::Max (rows[0][x], rows[1][x]), rows[2][x]);
+
+    x = 0;
+
+    for(; x + V::Width <= width; x += V::Width)
+        V::Store (dst + x, V::Max (V::Max (V::Load (scratch + x), V::Load (scratch + x + 1)),
+                                   V::Load (scratch + x + 2)));
+
+    for(; x < width; x++)
+        dst[x] = S::Max (S::Max (scratch[x], scratch[x + 1]), scratch[x + 2]);
+}
+
+#endif
@@ -19,870 +19,721 @@
 #include "FreeImageAlgorithms.h"
 #include "FreeImageAlgorithms_Arithmetic.h"
 #include "FreeImageAlgorithms_Convolution.h"
-#include "FreeImageAlgorithms_Convolution.txx"
+#include "FreeImageAlgorithms_ThreadPool.h"
 #include "FreeImageAlgorithms_Morphology.h"
 #include "FreeImageAlgorithms_Utilities.h"
 #include "FreeImageAlgorithms_Palettes.h"
 #include "FreeImageAlgorithms_Utils.h"
 
-inline void
-DilateKernelRow (KernelIterator < unsigned char >&iterator, unsigned char *dst_ptr)
-{
-    register unsigned char *row_ptr;
-    register unsigned char *kernel_ptr;
-
-    Kernel < unsigned char >*kernel = iterator.GetKernel ();
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
 
-    int x_max_block_size = kernel->GetNumberOfBlocksOfEightInKernelRows ();
-    int x_reminder = kernel->GetRemainderAfterBlocksInRows ();
+// Binary images are packed 64 pixels to a word, bit x % 64 of word x / 64
+// holding pixel x. Dilation and erosion by a structuring element are then
+// ORs and ANDs of whole shifted rows.
+//
+// The structuring element is split into horizontal runs, one for each run of
+// set values in a kernel row. A run of n pixels is done in log2(n) passes by
+// combining each row with itself shifted by 1, 2, 4, ... pixels. Each kernel
+// row then combines its run's result, shifted up or down, into the output.
+// Rectangles, diamonds and disks are exact this way and kernel rows that are
+// the same share one run. A full rectangle is done as a horizontal run then a
+// vertical one. As before the centre of the kernel always counts as set.
 
-    unsigned char *center_value = dst_ptr;
+typedef unsigned long long BitWord;
 
-    for(register int col = 0; col < x_max_block_size; col += BLOCKSIZE)
-    {
-        row_ptr = iterator.GetImagePtrValue () + col;
-        kernel_ptr = iterator.GetKernelPtrValue () + col;
+#define BITS_PER_WORD 64
 
-        if (kernel_ptr[0] > 0 && row_ptr[0] > 0)
-        {
-            *center_value = 255;
-            return;
-        }
+// Fewest rows given to one thread.
+#define BIT_ROWS_PER_BAND 64
 
-        if (kernel_ptr[1] > 0 && row_ptr[1] > 0)
-        {
-            *center_value = 255;
-            return;
-        }
-
-        if (kernel_ptr[2] > 0 && row_ptr[2] > 0)
-        {
-            *center_value = 255;
-            return;
-        }
+typedef struct
+{
+    int width;
+    int height;
+    int words;                  // Words in each row.
+    BitWord tail_mask;          // Bits of the last word that are in the image.
+    BitWord *bits;
 
-        if (kernel_ptr[3] > 0 && row_ptr[3] > 0)
-        {
-            *center_value = 255;
-            return;
-        }
+} BitPlane;
 
-        if (kernel_ptr[4] > 0 && row_ptr[4] > 0)
-        {
-            *center_value = 255;
-            return;
-        }
+static inline BitWord *
+BitPlaneRow (BitPlane * plane, int y)
+{
+    return plane->bits + (size_t) y * plane->words;
+}
 
-        if (kernel_ptr[5] > 0 && row_ptr[5] > 0)
-        {
-            *center_value = 255;
-            return;
-        }
+static BitPlane *
+NewBitPlane (int width, int height)
+{
+    BitPlane *plane = (BitPlane *) malloc (sizeof (BitPlane));
 
-        if (kernel_ptr[6] > 0 && row_ptr[6] > 0)
-        {
-            *center_value = 255;
-            return;
-        }
+    if (plane == NULL)
+        return NULL;
 
-        if (kernel_ptr[7] > 0 && row_ptr[7] > 0)
-        {
-            *center_value = 255;
-            return;
-        }
-    }
+    plane->width = width;
+    plane->height = height;
+    plane->words = (width + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    plane->tail_mask = (width % BITS_PER_WORD) ? (((BitWord) 1 << (width % BITS_PER_WORD)) - 1)
+        : ~(BitWord) 0;
+    plane->bits = (BitWord *) calloc ((size_t) plane->words * height, sizeof (BitWord));
 
-    if (x_reminder)
+    if (plane->bits == NULL)
     {
-        row_ptr = iterator.GetImagePtrValue () + x_max_block_size;
-        kernel_ptr = iterator.GetKernelPtrValue () + x_max_block_size;
+        free (plane);
+        return NULL;
     }
 
-    switch (x_reminder)
-    {
-        case 7:
-        {
-            if (kernel_ptr[0] > 0 && row_ptr[0] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[1] > 0 && row_ptr[1] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[2] > 0 && row_ptr[2] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[3] > 0 && row_ptr[3] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[4] > 0 && row_ptr[4] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[5] > 0 && row_ptr[5] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[6] > 0 && row_ptr[6] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            break;
-        }
-
-        case 6:
-        {
-            if (kernel_ptr[0] > 0 && row_ptr[0] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[1] > 0 && row_ptr[1] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[2] > 0 && row_ptr[2] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[3] > 0 && row_ptr[3] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[4] > 0 && row_ptr[4] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
+    return plane;
+}
 
-            if (kernel_ptr[5] > 0 && row_ptr[5] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
+static void
+FreeBitPlane (BitPlane * plane)
+{
+    if (plane == NULL)
+        return;
 
-            break;
-        }
+    free (plane->bits);
+    free (plane);
+}
 
-        case 5:
-        {
-            if (kernel_ptr[0] > 0 && row_ptr[0] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
+static inline void
+SwapBitPlanes (BitPlane ** a, BitPlane ** b)
+{
+    BitPlane *tmp = *a;
 
-            if (kernel_ptr[1] > 0 && row_ptr[1] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
+    *a = *b;
+    *b = tmp;
+}
 
-            if (kernel_ptr[2] > 0 && row_ptr[2] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
+// Packs an 8 bit image, non zero pixels are set. A border of zeros is added around it.
+static BitPlane *
+PackBinaryImage (FIBITMAP * src, int xborder, int yborder)
+{
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
 
-            if (kernel_ptr[3] > 0 && row_ptr[3] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
+    BitPlane *plane = NewBitPlane (width + 2 * xborder, height + 2 * yborder);
 
-            if (kernel_ptr[4] > 0 && row_ptr[4] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
+    if (plane == NULL)
+        return NULL;
 
-            break;
-        }
+    for(register int y = 0; y < height; y++)
+    {
+        unsigned char *src_ptr = (unsigned char *) FreeImage_GetScanLine (src, y);
+        BitWord *row = BitPlaneRow (plane, y + yborder);
 
-        case 4:
+        for(register int x = 0; x < width; x++)
         {
-            if (kernel_ptr[0] > 0 && row_ptr[0] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[1] > 0 && row_ptr[1] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[2] > 0 && row_ptr[2] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[3] > 0 && row_ptr[3] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            break;
+            if (src_ptr[x])
+                row[(x + xborder) / BITS_PER_WORD] |= (BitWord) 1 << ((x + xborder) % BITS_PER_WORD);
         }
+    }
 
-        case 3:
-        {
-            if (kernel_ptr[0] > 0 && row_ptr[0] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[1] > 0 && row_ptr[1] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[2] > 0 && row_ptr[2] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
+    return plane;
+}
 
-            break;
-        }
+// Clears the pixels within the border, as FIA_SetBorder with a constant 0 would.
+static void
+ClearBitPlaneBorder (BitPlane * plane, int xborder, int yborder)
+{
+    for(register int y = 0; y < plane->height; y++)
+    {
+        BitWord *row = BitPlaneRow (plane, y);
 
-        case 2:
+        if (y < yborder || y >= plane->height - yborder)
         {
-            if (kernel_ptr[0] > 0 && row_ptr[0] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            if (kernel_ptr[1] > 0 && row_ptr[1] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
-
-            break;
+            memset (row, 0, sizeof (BitWord) * plane->words);
+            continue;
         }
 
-        case 1:
+        for(register int x = 0; x < xborder; x++)
         {
-            if (kernel_ptr[0] > 0 && row_ptr[0] > 0)
-            {
-                *center_value = 255;
-                return;
-            }
+            row[x / BITS_PER_WORD] &= ~((BitWord) 1 << (x % BITS_PER_WORD));
+            row[(plane->width - 1 - x) / BITS_PER_WORD] &=
+                ~((BitWord) 1 << ((plane->width - 1 - x) % BITS_PER_WORD));
         }
     }
 }
 
-inline void
-BinaryDilateKernel (Kernel < unsigned char >*kernel, unsigned char *dst_ptr)
+struct BitOr
 {
-    KernelIterator < unsigned char >iterator = kernel->Begin ();
-
-    for(register int row = 0; row < kernel->GetNumberOfBlocksOfEightInKernelColoumns (); row
-        += BLOCKSIZE)
+    static inline BitWord Identity ()
     {
-        DilateKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+        return 0;
+    }
 
-        DilateKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+    static inline BitWord Combine (BitWord a, BitWord b)
+    {
+        return a | b;
+    }
+};
 
-        DilateKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+struct BitAnd
+{
+    static inline BitWord Identity ()
+    {
+        return ~(BitWord) 0;
+    }
 
-        DilateKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+    static inline BitWord Combine (BitWord a, BitWord b)
+    {
+        return a & b;
+    }
+};
 
-        DilateKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+// Word w of a row shifted so pixel x holds pixel x + shift of src, zero off the row.
+static inline BitWord
+ShiftedWord (const BitWord * src, int words, int word_shift, int bit_shift, int w)
+{
+    const int i = w + word_shift;
 
-        DilateKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+    BitWord lo = (i >= 0 && i < words) ? src[i] : 0;
 
-        DilateKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+    if (bit_shift == 0)
+        return lo;
 
-        DilateKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
-    }
+    BitWord hi = (i + 1 >= 0 && i + 1 < words) ? src[i + 1] : 0;
 
-    switch (kernel->GetRemainderAfterBlocksInColoumns ())
-    {
-        case 7:
-            DilateKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 6:
-            DilateKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 5:
-            DilateKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 4:
-            DilateKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 3:
-            DilateKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 2:
-            DilateKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 1:
-            DilateKernelRow (iterator, dst_ptr);
-    }
+    return (lo >> bit_shift) | (hi << (BITS_PER_WORD - bit_shift));
 }
 
-FIBITMAP *DLL_CALLCONV
-FIA_BinaryDilation (FIABITMAP * src, FilterKernel kernel)
+static inline void
+SplitShift (int shift, int *word_shift, int *bit_shift)
 {
-    const int dst_width = FreeImage_GetWidth (src->fib) - (2 * kernel.x_radius);
-    const int dst_height = FreeImage_GetHeight (src->fib) - (2 * kernel.y_radius);
-
-    FIBITMAP *dst = FIA_CloneImageType (src->fib, dst_width, dst_height);
+    // Round towards minus infinity so the bit shift is 0 to 63.
+    *word_shift = (shift >= 0) ? shift / BITS_PER_WORD : -((-shift + BITS_PER_WORD - 1) / BITS_PER_WORD);
+    *bit_shift = shift - *word_shift * BITS_PER_WORD;
+}
 
-    const int dst_pitch_in_pixels = FreeImage_GetPitch (dst) / sizeof (unsigned char);
+// dst = src shifted by shift pixels, dst and src must differ.
+static void
+ShiftRow (BitWord * dst, const BitWord * src, int words, int shift, BitWord tail_mask)
+{
+    int word_shift, bit_shift;
 
-    register unsigned char *dst_ptr;
+    SplitShift (shift, &word_shift, &bit_shift);
 
-    unsigned char *dst_first_pixel_address_ptr = (unsigned char *) FreeImage_GetBits (dst);
+    for(register int w = 0; w < words; w++)
+        dst[w] = ShiftedWord (src, words, word_shift, bit_shift, w);
 
-    int kernel_size = (kernel.x_radius * 2 + kernel.y_radius * 2) + 1;
-    unsigned char *vals = new unsigned char[kernel_size];
+    dst[words - 1] &= tail_mask;
+}
 
-    for(int i = 0; i < kernel_size; i++)
-        vals[i] = (unsigned char) kernel.values[i];
+// Combines row with itself shifted left by shift >= 0 pixels, in place. Going
+// up the row only words not yet written are read.
+template < class Op > static void
+CombineShiftedRow (BitWord * row, int words, int shift)
+{
+    int word_shift, bit_shift;
 
-    Kernel < unsigned char >*kern = new Kernel < unsigned char >(src, kernel.x_radius,
-                                                                 kernel.y_radius, vals, 1.0);
+    SplitShift (shift, &word_shift, &bit_shift);
 
-    for(register int y = 0; y < dst_height; y++)
-    {
-        kern->Move (0, y);
-        dst_ptr = (dst_first_pixel_address_ptr + y * dst_pitch_in_pixels);
+    for(register int w = 0; w < words; w++)
+        row[w] = Op::Combine (row[w], ShiftedWord (row, words, word_shift, bit_shift, w));
+}
 
-        for(register int x = 0; x < dst_width; x++)
-        {
-            *dst_ptr = kern->KernelCenterValue ();
+// dst(x) = src(x + start) op ... op src(x + start + length - 1).
+// tmp is a row of scratch.
+template < class Op > static void
+RunRow (BitWord * dst, const BitWord * src, BitWord * tmp, int words, int start, int length,
+        BitWord tail_mask)
+{
+    int span = 1;
 
-            // If Black pixel check neigbours
-            if (*dst_ptr == 0)
-                BinaryDilateKernel (kern, dst_ptr);
+    memcpy (tmp, src, sizeof (BitWord) * words);
 
-            dst_ptr++;
-            kern->Increment ();
-        }
+    while (span * 2 <= length)
+    {
+        CombineShiftedRow < Op > (tmp, words, span);
+        span *= 2;
     }
 
-    delete kern;
+    if (span < length)
+        CombineShiftedRow < Op > (tmp, words, length - span);
 
-    return dst;
-};
+    ShiftRow (dst, tmp, words, start, tail_mask);
+}
 
-static inline void
-ErodeKernelRow (KernelIterator < unsigned char >&iterator, unsigned char *dst_ptr)
+typedef struct
 {
-    register unsigned char *row_ptr;
-    register unsigned char *kernel_ptr;
-
-    Kernel < unsigned char >*kernel = iterator.GetKernel ();
-
-    int x_max_block_size = kernel->GetNumberOfBlocksOfEightInKernelRows ();
-    int x_reminder = kernel->GetRemainderAfterBlocksInRows ();
+    BitPlane *src;
+    BitPlane *other;
+    BitPlane *dst;
+    int start;
+    int length;
+    int rows;
+    volatile int failed;
+
+} BitPassData;
+
+template < class Op > static void
+RunRowsBand (void *data, int band, int start, int end)
+{
+    BitPassData *pass = (BitPassData *) data;
 
-    unsigned char *center_value = dst_ptr;
+    BitWord *tmp = (BitWord *) malloc (sizeof (BitWord) * pass->src->words);
 
-    for(register int col = 0; col < x_max_block_size; col += BLOCKSIZE)
+    if (tmp == NULL)
     {
-        row_ptr = iterator.GetImagePtrValue () + col;
-        kernel_ptr = iterator.GetKernelPtrValue () + col;
+        pass->failed = 1;
+        return;
+    }
 
-        if (kernel_ptr[0] > 0 && row_ptr[0] == 0)
-        {
-            *center_value = 0;
-            return;
-        }
+    for(register int y = start; y < end; y++)
+    {
+        RunRow < Op > (BitPlaneRow (pass->dst, y), BitPlaneRow (pass->src, y), tmp,
+                       pass->src->words, pass->start, pass->length, pass->src->tail_mask);
+    }
 
-        if (kernel_ptr[1] > 0 && row_ptr[1] == 0)
-        {
-            *center_value = 0;
-            return;
-        }
+    free (tmp);
+}
 
-        if (kernel_ptr[2] > 0 && row_ptr[2] == 0)
-        {
-            *center_value = 0;
-            return;
-        }
+// dst row y = src row y op other row y + rows, rows off the plane are zero.
+// dst may be src.
+template < class Op > static void
+CombineRowsBand (void *data, int band, int start, int end)
+{
+    BitPassData *pass = (BitPassData *) data;
 
-        if (kernel_ptr[3] > 0 && row_ptr[3] == 0)
-        {
-            *center_value = 0;
-            return;
-        }
+    const int words = pass->src->words;
 
-        if (kernel_ptr[4] > 0 && row_ptr[4] == 0)
-        {
-            *center_value = 0;
-            return;
-        }
+    for(register int y = start; y < end; y++)
+    {
+        BitWord *dst = BitPlaneRow (pass->dst, y);
+        BitWord *src = BitPlaneRow (pass->src, y);
 
-        if (kernel_ptr[5] > 0 && row_ptr[5] == 0)
+        if (y + pass->rows >= 0 && y + pass->rows < pass->other->height)
         {
-            *center_value = 0;
-            return;
-        }
+            BitWord *other = BitPlaneRow (pass->other, y + pass->rows);
 
-        if (kernel_ptr[6] > 0 && row_ptr[6] > 0)
-        {
-            *center_value = 0;
-            return;
+            for(register int w = 0; w < words; w++)
+                dst[w] = Op::Combine (src[w], other[w]);
         }
-
-        if (kernel_ptr[7] > 0 && row_ptr[7] > 0)
+        else
         {
-            *center_value = 0;
-            return;
+            for(register int w = 0; w < words; w++)
+                dst[w] = Op::Combine (src[w], 0);
         }
     }
+}
 
-    if (x_reminder)
-    {
-        row_ptr = iterator.GetImagePtrValue () + x_max_block_size;
-        kernel_ptr = iterator.GetKernelPtrValue () + x_max_block_size;
-    }
-
-    switch (x_reminder)
-    {
-        case 7:
-
-            if (kernel_ptr[0] > 0 && row_ptr[0] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
-
-            if (kernel_ptr[1] > 0 && row_ptr[1] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
-
-            if (kernel_ptr[2] > 0 && row_ptr[2] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
-
-            if (kernel_ptr[3] > 0 && row_ptr[3] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
-
-            if (kernel_ptr[4] > 0 && row_ptr[4] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
-
-            if (kernel_ptr[5] > 0 && row_ptr[5] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+// dst row y = src row y + rows, or zero off the plane.
+static void
+ShiftRowsBand (void *data, int band, int start, int end)
+{
+    BitPassData *pass = (BitPassData *) data;
 
-            if (kernel_ptr[6] > 0 && row_ptr[6] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+    const int words = pass->src->words;
 
-            break;
+    for(register int y = start; y < end; y++)
+    {
+        if (y + pass->rows >= 0 && y + pass->rows < pass->src->height)
+            memcpy (BitPlaneRow (pass->dst, y), BitPlaneRow (pass->src, y + pass->rows),
+                    sizeof (BitWord) * words);
+        else
+            memset (BitPlaneRow (pass->dst, y), 0, sizeof (BitWord) * words);
+    }
+}
 
-        case 6:
+// Returns false if a band failed.
+static bool
+RunPass (BitPlane * src, BitPlane * other, BitPlane * dst, int start, int length, int rows,
+         FIA_BandFunction function)
+{
+    BitPassData pass;
 
-            if (kernel_ptr[0] > 0 && row_ptr[0] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+    pass.src = src;
+    pass.other = other;
+    pass.dst = dst;
+    pass.start = start;
+    pass.length = length;
+    pass.rows = rows;
+    pass.failed = 0;
 
-            if (kernel_ptr[1] > 0 && row_ptr[1] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+    FIA_RunBands (0, dst->height, FIA_GetNumberOfBands (dst->height, BIT_ROWS_PER_BAND),
+                  function, &pass);
 
-            if (kernel_ptr[2] > 0 && row_ptr[2] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+    return !pass.failed;
+}
 
-            if (kernel_ptr[3] > 0 && row_ptr[3] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+// dst row y = src row y + start op ... op src row y + start + length - 1.
+// src and tmp are used as scratch.
+template < class Op > static void
+RunColumns (BitPlane * src, BitPlane * dst, BitPlane * tmp, int start, int length)
+{
+    BitPlane *from = src;
+    BitPlane *to = tmp;
+    int span = 1;
 
-            if (kernel_ptr[4] > 0 && row_ptr[4] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+    // Ping pong between the two planes so no band reads a row another is writing.
+    while (span < length)
+    {
+        int rows = (span * 2 <= length) ? span : length - span;
 
-            if (kernel_ptr[5] > 0 && row_ptr[5] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+        RunPass (from, from, to, 0, 0, rows, CombineRowsBand < Op >);
+        SwapBitPlanes (&from, &to);
+        span += rows;
+    }
 
-            break;
+    RunPass (from, from, dst, 0, 0, start, ShiftRowsBand);
+}
 
-        case 5:
+typedef struct
+{
+    int start;                  // Column offset of the first pixel.
+    int length;
 
-            if (kernel_ptr[0] > 0 && row_ptr[0] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+} KernelRun;
 
-            if (kernel_ptr[1] > 0 && row_ptr[1] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+typedef struct
+{
+    int run;
+    int row;                    // Row offset of the kernel row.
 
-            if (kernel_ptr[2] > 0 && row_ptr[2] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+} KernelRowRun;
 
-            if (kernel_ptr[3] > 0 && row_ptr[3] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+// Pixels set in the kernel, the centre always counts as set.
+static inline bool
+IsKernelValueSet (FilterKernel kernel, int col, int row)
+{
+    if (col == kernel.x_radius && row == kernel.y_radius)
+        return true;
 
-            if (kernel_ptr[4] > 0 && row_ptr[4] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+    return kernel.values[row * (kernel.x_radius * 2 + 1) + col] > 0.0;
+}
 
-            break;
+// Splits the kernel into runs of set values along each row.
+// Rows with the same run share it.
+static void
+GetKernelRuns (FilterKernel kernel, std::vector < KernelRun > &runs,
+               std::vector < KernelRowRun > &row_runs)
+{
+    const int kernel_width = kernel.x_radius * 2 + 1;
+    const int kernel_height = kernel.y_radius * 2 + 1;
 
-        case 4:
+    for(int row = 0; row < kernel_height; row++)
+    {
+        for(int col = 0; col < kernel_width; col++)
+        {
+            if (!IsKernelValueSet (kernel, col, row)
+                || (col > 0 && IsKernelValueSet (kernel, col - 1, row)))
+                continue;
 
-            if (kernel_ptr[0] > 0 && row_ptr[0] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+            KernelRun run;
+            KernelRowRun row_run;
 
-            if (kernel_ptr[1] > 0 && row_ptr[1] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+            run.start = col - kernel.x_radius;
+            run.length = 1;
 
-            if (kernel_ptr[2] > 0 && row_ptr[2] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+            while (col + run.length < kernel_width
+                   && IsKernelValueSet (kernel, col + run.length, row))
+                run.length++;
 
-            if (kernel_ptr[3] > 0 && row_ptr[3] == 0)
+            for(row_run.run = 0; row_run.run < (int) runs.size (); row_run.run++)
             {
-                *center_value = 0;
-                return;
+                if (runs[row_run.run].start == run.start && runs[row_run.run].length == run.length)
+                    break;
             }
 
-            break;
-
-        case 3:
+            if (row_run.run == (int) runs.size ())
+                runs.push_back (run);
 
-            if (kernel_ptr[0] > 0 && row_ptr[0] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+            row_run.row = row - kernel.y_radius;
+            row_runs.push_back (row_run);
+        }
+    }
+}
 
-            if (kernel_ptr[1] > 0 && row_ptr[1] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+static bool
+IsFullRectangle (FilterKernel kernel)
+{
+    for(int row = 0; row < kernel.y_radius * 2 + 1; row++)
+    {
+        for(int col = 0; col < kernel.x_radius * 2 + 1; col++)
+        {
+            if (!IsKernelValueSet (kernel, col, row))
+                return false;
+        }
+    }
 
-            if (kernel_ptr[2] > 0 && row_ptr[2] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+    return true;
+}
 
-            break;
+// Dilates (Op is BitOr) or erodes (BitAnd) src into dst.
+// tmp and tmp2 are scratch planes of the same size. Returns false on failure.
+template < class Op > static bool
+MorphologyPass (BitPlane * src, BitPlane * dst, BitPlane * tmp, BitPlane * tmp2,
+                FilterKernel kernel)
+{
+    if (IsFullRectangle (kernel))
+    {
+        if (!RunPass (src, src, tmp, -kernel.x_radius, kernel.x_radius * 2 + 1, 0,
+                      RunRowsBand < Op >))
+            return false;
 
-        case 2:
+        RunColumns < Op > (tmp, dst, tmp2, -kernel.y_radius, kernel.y_radius * 2 + 1);
+        return true;
+    }
 
-            if (kernel_ptr[0] > 0 && row_ptr[0] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+    std::vector < KernelRun > runs;
+    std::vector < KernelRowRun > row_runs;
 
-            if (kernel_ptr[1] > 0 && row_ptr[1] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+    GetKernelRuns (kernel, runs, row_runs);
 
-            break;
+    memset (dst->bits, Op::Identity () ? 0xFF : 0x00, sizeof (BitWord) * dst->words * dst->height);
 
-        case 1:
+    for(int i = 0; i < (int) runs.size (); i++)
+    {
+        if (!RunPass (src, src, tmp, runs[i].start, runs[i].length, 0, RunRowsBand < Op >))
+            return false;
 
-            if (kernel_ptr[0] > 0 && row_ptr[0] == 0)
-            {
-                *center_value = 0;
-                return;
-            }
+        for(int j = 0; j < (int) row_runs.size (); j++)
+        {
+            if (row_runs[j].run == i)
+                RunPass (dst, tmp, dst, 0, 0, row_runs[j].row, CombineRowsBand < Op >);
+        }
     }
+
+    return true;
 }
 
-static inline void
-BinaryErodeKernel (Kernel < unsigned char >*kernel, unsigned char *dst_ptr)
+// Runs the operations in turn on a packed copy of the image. Between
+// operations the border the kernel needs is cleared, the same as giving
+// the result a constant 0 border. If add_border is set a border of zeros
+// is added to src first, otherwise src is expected to have one.
+static FIBITMAP *
+BinaryMorphology (FIBITMAP * src, bool add_border, FilterKernel kernel,
+                  const FIA_MORPHOLOGY_OPERATION * operations, int count)
 {
-    KernelIterator < unsigned char >iterator = kernel->Begin ();
-
-    for(register int row = 0; row < kernel->GetNumberOfBlocksOfEightInKernelColoumns (); row
-        += BLOCKSIZE)
+    if (src == NULL || FreeImage_GetImageType (src) != FIT_BITMAP || FreeImage_GetBPP (src) != 8)
     {
-        ErodeKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
-
-        ErodeKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
-
-        ErodeKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Binary morphology needs an 8 bit image");
+        return NULL;
+    }
 
-        ErodeKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+    const int xborder = add_border ? kernel.x_radius : 0;
+    const int yborder = add_border ? kernel.y_radius : 0;
 
-        ErodeKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+    BitPlane *planes[4] = { NULL, NULL, NULL, NULL };
 
-        ErodeKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+    planes[0] = PackBinaryImage (src, xborder, yborder);
 
-        ErodeKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+    for(int i = 1; i < 4 && planes[0] != NULL; i++)
+    {
+        planes[i] = NewBitPlane (planes[0]->width, planes[0]->height);
 
-        ErodeKernelRow (iterator, dst_ptr);
-        iterator.IncrementByRow ();
+        if (planes[i] == NULL)
+            break;
     }
 
-    switch (kernel->GetRemainderAfterBlocksInColoumns ())
+    if (planes[3] == NULL)
     {
-        case 7:
-            ErodeKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 6:
-            ErodeKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 5:
-            ErodeKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 4:
-            ErodeKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 3:
-            ErodeKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 2:
-            ErodeKernelRow (iterator, dst_ptr);
-            iterator.IncrementByRow ();
-        case 1:
-            ErodeKernelRow (iterator, dst_ptr);
+        for(int i = 0; i < 4; i++)
+            FreeBitPlane (planes[i]);
+
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Unable to allocate memory for morphology");
+        return NULL;
     }
-}
 
-FIBITMAP *DLL_CALLCONV
-FIA_BinaryErosion (FIABITMAP * src, FilterKernel kernel)
-{
-    const int dst_width = FreeImage_GetWidth (src->fib) - (2 * kernel.x_radius);
-    const int dst_height = FreeImage_GetHeight (src->fib) - (2 * kernel.y_radius);
+    for(int i = 0; i < count; i++)
+    {
+        if (i > 0)
+            ClearBitPlaneBorder (planes[0], kernel.x_radius, kernel.y_radius);
 
-    FIBITMAP *dst = FIA_CloneImageType (src->fib, dst_width, dst_height);
+        bool passed;
 
-    const int dst_pitch_in_pixels = FreeImage_GetPitch (dst) / sizeof (unsigned char);
+        if (operations[i] == FIA_MORPHOLOGY_DILATION)
+            passed = MorphologyPass < BitOr > (planes[0], planes[1], planes[2], planes[3], kernel);
+        else
+            passed = MorphologyPass < BitAnd > (planes[0], planes[1], planes[2], planes[3], kernel);
 
-    register unsigned char *dst_ptr;
+        if (!passed)
+        {
+            for(int j = 0; j < 4; j++)
+                FreeBitPlane (planes[j]);
 
-    unsigned char *dst_first_pixel_address_ptr = (unsigned char *) FreeImage_GetBits (dst);
+            FreeImage_OutputMessageProc (FIF_UNKNOWN, "Unable to allocate memory for morphology");
+            return NULL;
+        }
 
-    int kernel_size = (kernel.x_radius * 2 + kernel.y_radius * 2) + 1;
-    unsigned char *vals = new unsigned char[kernel_size];
+        SwapBitPlanes (&planes[0], &planes[1]);
+    }
 
-    for(int i = 0; i < kernel_size; i++)
-        vals[i] = (unsigned char) kernel.values[i];
+    // Unpack all but the kernel's border. Pixels set in src keep their
+    // values, the pixels the operations newly set become 255.
+    const int dst_width = planes[0]->width - 2 * kernel.x_radius;
+    const int dst_height = planes[0]->height - 2 * kernel.y_radius;
 
-    Kernel < unsigned char >*kern = new Kernel < unsigned char >(src, kernel.x_radius,
-                                                                 kernel.y_radius, vals, 1.0);
+    FIBITMAP *dst = FIA_CloneImageType (src, dst_width, dst_height);
 
-    for(register int y = 0; y < dst_height; y++)
+    if (dst != NULL)
     {
-        kern->Move (0, y);
-        dst_ptr = (dst_first_pixel_address_ptr + y * dst_pitch_in_pixels);
-
-        for(register int x = 0; x < dst_width; x++)
+        for(register int y = 0; y < dst_height; y++)
         {
-            *dst_ptr = kern->KernelCenterValue ();
+            BitWord *row = BitPlaneRow (planes[0], y + kernel.y_radius);
+            unsigned char *src_ptr = (unsigned char *) FreeImage_GetScanLine (src,
+                y + kernel.y_radius - yborder) + kernel.x_radius - xborder;
+            unsigned char *dst_ptr = (unsigned char *) FreeImage_GetScanLine (dst, y);
 
-            // If White pixel check neigbours
-            if (*dst_ptr > 0)
-                BinaryErodeKernel (kern, dst_ptr);
+            for(register int x = 0; x < dst_width; x++)
+            {
+                int bit = x + kernel.x_radius;
 
-            dst_ptr++;
-            kern->Increment ();
+                if ((row[bit / BITS_PER_WORD] >> (bit % BITS_PER_WORD)) & 1)
+                    dst_ptr[x] = src_ptr[x] ? src_ptr[x] : 255;
+                else
+                    dst_ptr[x] = 0;
+            }
         }
     }
 
-    delete kern;
+    for(int i = 0; i < 4; i++)
+        FreeBitPlane (planes[i]);
 
     return dst;
-};
+}
 
 FIBITMAP *DLL_CALLCONV
-FIA_BinaryOpening (FIABITMAP * src, FilterKernel kernel)
+FIA_BinaryMorphology (FIABITMAP * src, FilterKernel kernel,
+                      const FIA_MORPHOLOGY_OPERATION * operations, int count)
 {
-    // Erosion followed by a dilation.
+    if (src == NULL)
+        return NULL;
 
-    FIBITMAP *tmp = FIA_BinaryErosion (src, kernel);
+    if (src->xborder < kernel.x_radius || src->yborder < kernel.y_radius)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "The border must be at least as large as the kernel radius");
+        return NULL;
+    }
+
+    return BinaryMorphology (src->fib, false, kernel, operations, count);
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_BinaryDilation (FIABITMAP * src, FilterKernel kernel)
+{
+    const FIA_MORPHOLOGY_OPERATION operations[] = { FIA_MORPHOLOGY_DILATION };
 
-    FIABITMAP *border_dib = FIA_SetBorder (tmp,
-                                           kernel.x_radius, kernel.y_radius, BorderType_Constant,
-                                           0.0);
+    return FIA_BinaryMorphology (src, kernel, operations, 1);
+}
 
-    FreeImage_Unload (tmp);
+FIBITMAP *DLL_CALLCONV
+FIA_BinaryErosion (FIABITMAP * src, FilterKernel kernel)
+{
+    const FIA_MORPHOLOGY_OPERATION operations[] = { FIA_MORPHOLOGY_EROSION };
 
-    tmp = FIA_BinaryDilation (border_dib, kernel);
+    return FIA_BinaryMorphology (src, kernel, operations, 1);
+}
 
-    FIA_Unload (border_dib);
+FIBITMAP *DLL_CALLCONV
+FIA_BinaryOpening (FIABITMAP * src, FilterKernel kernel)
+{
+    // Erosion followed by a dilation.
+    const FIA_MORPHOLOGY_OPERATION operations[] = { FIA_MORPHOLOGY_EROSION,
+        FIA_MORPHOLOGY_DILATION
+    };
 
-    return tmp;
+    return FIA_BinaryMorphology (src, kernel, operations, 2);
 };
 
 FIBITMAP *DLL_CALLCONV
 FIA_BinaryClosing (FIABITMAP * src, FilterKernel kernel)
 {
     // Dialation followed by a erosion.
+    const FIA_MORPHOLOGY_OPERATION operations[] = { FIA_MORPHOLOGY_DILATION,
+        FIA_MORPHOLOGY_EROSION
+    };
 
-    FIBITMAP *tmp = FIA_BinaryDilation (src, kernel);
+    return FIA_BinaryMorphology (src, kernel, operations, 2);
+};
 
-    FIABITMAP *border_dib = FIA_SetBorder (tmp,
-                                           kernel.x_radius, kernel.y_radius, BorderType_Constant,
-                                           0.0);
+int DLL_CALLCONV
+FIA_MakeStructuringElement (FIA_STRUCTURING_ELEMENT shape, int radius, double *values)
+{
+    const int size = radius * 2 + 1;
 
-    FreeImage_Unload (tmp);
+    if (radius < 0 || values == NULL)
+        return FIA_ERROR;
 
-    tmp = FIA_BinaryErosion (border_dib, kernel);
+    for(int y = 0; y < size; y++)
+    {
+        for(int x = 0; x < size; x++)
+        {
+            int dx = x - radius, dy = y - radius;
+            bool set;
 
-    FIA_Unload (border_dib);
+            switch (shape)
+            {
+                case FIA_STRUCTURING_ELEMENT_DIAMOND:
+                    set = abs (dx) + abs (dy) <= radius;
+                    break;
 
-    return tmp;
-};
+                case FIA_STRUCTURING_ELEMENT_DISK:
+                    set = dx * dx + dy * dy <= radius * radius;
+                    break;
+
+                default:
+                    set = true;
+                    break;
+            }
+
+            values[y * size + x] = set ? 1.0 : 0.0;
+        }
+    }
+
+    return FIA_SUCCESS;
+}
+
+// The 3x3 functions add their zero border while packing.
+static FIBITMAP *
+Binary3x3Morphology (FIBITMAP * src, const FIA_MORPHOLOGY_OPERATION * operations, int count)
+{
+    const double vals[9] = { 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+
+    FilterKernel kernel = FIA_NewKernel (1, 1, vals, 9.0);
+
+    return BinaryMorphology (src, true, kernel, operations, count);
+}
 
 FIBITMAP *DLL_CALLCONV
 FIA_Binary3x3Dilation (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryDilation(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+	const FIA_MORPHOLOGY_OPERATION operations[] = { FIA_MORPHOLOGY_DILATION };
 
-	return dst;
+	return Binary3x3Morphology (src, operations, 1);
 }
 
 FIBITMAP *DLL_CALLCONV
 FIA_Binary3x3Erosion (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryErosion(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+	const FIA_MORPHOLOGY_OPERATION operations[] = { FIA_MORPHOLOGY_EROSION };
 
-	return dst;
+	return Binary3x3Morphology (src, operations, 1);
 }
 
 FIBITMAP *DLL_CALLCONV
 FIA_Binary3x3Opening (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryOpening(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+	const FIA_MORPHOLOGY_OPERATION operations[] = { FIA_MORPHOLOGY_EROSION, FIA_MORPHOLOGY_DILATION };
 
-	return dst;
+	return Binary3x3Morphology (src, operations, 2);
 }
 
 FIBITMAP *DLL_CALLCONV
 FIA_Binary3x3Closing (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryClosing(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+	const FIA_MORPHOLOGY_OPERATION operations[] = { FIA_MORPHOLOGY_DILATION, FIA_MORPHOLOGY_EROSION };
 
-	return dst;
+	return Binary3x3Morphology (src, operations, 2);
 }
 
 FIBITMAP *DLL_CALLCONV
 FIA_BinaryInnerBorder (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryErosion(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+	FIBITMAP *dst = FIA_Binary3x3Erosion(src);
 
 	FIBITMAP *dst2 = FreeImage_Clone(src);
 
@@ -897,12 +748,7 @@ FIA_BinaryInnerBorder (FIBITMAP * src)
 FIBITMAP *DLL_CALLCONV
 FIA_BinaryOuterBorder (FIBITMAP * src)
 {
-	const double vals[9]={1,1,1,1,1,1,1,1,1};
-	
-	FilterKernel kernel = FIA_NewKernel(1, 1, vals, 9.0);			
-	FIABITMAP *dst_FIA = FIA_SetBorder(src, 1, 1, BorderType_Constant, 0);
-	FIBITMAP *dst = FIA_BinaryDilation(dst_FIA, kernel);
-	FIA_Unload (dst_FIA);
+	FIBITMAP *dst = FIA_Binary3x3Dilation(src);
 
 //	FIA_InPlaceConvertToInt32Type (&dst, 0);
 //	FIA_SubtractGreyLevelImages(dst, src);
@@ -21,371 +21,817 @@
 #include "FreeImageAlgorithms_Particle.h"
 #include "FreeImageAlgorithms_Palettes.h"
 #include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_ThreadPool.h"
 
-struct Blob
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+// Particles are labelled from runs of particle pixels along the rows.
+// The image is cut into strips of rows and each strip is done on its own thread:
+// first the runs on each row are counted so one array of exactly the
+// right size can hold them all, then each strip finds its runs and joins
+// those that touch a run on the row above with union-find.
+// The runs either side of the cuts between strips are then joined, and the
+// particles are numbered in the order they are first met from the top left.
+// Memory depends on the number of runs rather than the number of pixels.
+
+#define PARTICLE_ROWS_PER_BAND 64
+
+// A run of particle pixels on one row.
+struct ParticleRun
 {
-    int left;
-    int bottom;
-    int right;
-    int top;
-    int area;
-    int sum_x;
-    int sum_y;
-
-    int rank;
-    Blob *parent;
+    int start;
+    int end;                    // Last pixel of the run.
+    int label;                  // The particle, from 1.
 };
 
-struct Run
+struct ParticleRuns
 {
-    int x;
-    int y;
-    int end_x;
-    int sum_x;
-
-    Blob *blob;
+    int width;
+    int height;
+    int number_of_runs;
+    int number_of_particles;
+    int *row_first_run;         // Index of the first run on each row from the top, height + 1 of them.
+    ParticleRun *runs;
 };
 
-typedef struct
+struct LabelBandData
 {
-    Blob *blobpool_start_ptr;   // Start of memory allocated for blobpool
-    Blob *blobpool_ptr;         // The current pointer into the blobpool
-    int blobpool_blobcount;     // Number of blobs in the pool including merged ones.
-    // We don't want to delete merged blobs until the end for performance.
-    int real_blobcount;         // This is the real blob count that takes account of merging.
+    FIBITMAP *src;
+    unsigned char white_on_black;
+    int reach;                  // How far apart runs on neighbouring rows may be and touch.
+    ParticleRuns *particle_runs;
+    int *parents;
+    int *band_starts;           // First row of each band, to join the bands afterwards.
+    FIBITMAP *dst;
+};
 
-} BLOBPOOL;
+static inline int
+IsParticlePixel (BYTE value, unsigned char white_on_black)
+{
+    return (value != 0) == (white_on_black != 0);
+}
 
-static BLOBPOOL *
-UnionFindInit (int size)
+// Finds the runs on a row, or just counts them if runs is NULL.
+static int
+FindRowRuns (const BYTE * bits, int width, unsigned char white_on_black, ParticleRun * runs)
 {
-    BLOBPOOL *pool = (BLOBPOOL *) malloc (sizeof (BLOBPOOL));
+    int count = 0;
 
-    CheckMemory (pool);
+    for(int x = 0; x < width; x++)
+    {
+        if (!IsParticlePixel (bits[x], white_on_black))
+        {
+            continue;
+        }
 
-    pool->blobpool_start_ptr = (Blob *) malloc (size * sizeof (Blob));
+        int start = x;
 
-    CheckMemory (pool->blobpool_start_ptr);
+        while (x + 1 < width && IsParticlePixel (bits[x + 1], white_on_black))
+        {
+            x++;
+        }
 
-    pool->blobpool_ptr = pool->blobpool_start_ptr;
-    pool->blobpool_blobcount = 0;
-    pool->real_blobcount = 0;
+        if (runs != NULL)
+        {
+            runs[count].start = start;
+            runs[count].end = x;
+            runs[count].label = 0;
+        }
 
-    return pool;
+        count++;
+    }
+
+    return count;
 }
 
-static void
-UnionFindFree (BLOBPOOL * pool)
+// The root of a run is always the first of its particle's runs so the
+// particles can be numbered in one pass in order.
+static inline int
+FindRootRun (int *parents, int run)
 {
-    free (pool->blobpool_start_ptr);
-    pool->blobpool_start_ptr = NULL;
-    pool->blobpool_ptr = NULL;
-    free (pool);
+    while (parents[run] != run)
+    {
+        parents[run] = parents[parents[run]];
+        run = parents[run];
+    }
+
+    return run;
 }
 
-// New blob references itself as parent.
-static inline Blob *
-NewBlob (BLOBPOOL * pool, unsigned int top_row, Run * run)
+static inline void
+JoinRuns (int *parents, int run1, int run2)
 {
-    Blob *b = pool->blobpool_ptr;
-
-    b->parent = b;
-    b->rank = 0;
-    b->left = run->x;
-    b->bottom = run->y;
-    b->right = run->end_x;
-    b->top = b->bottom;
+    run1 = FindRootRun (parents, run1);
+    run2 = FindRootRun (parents, run2);
 
-    b->area = run->end_x - run->x + 1;
-    b->sum_x = run->sum_x;
-    b->sum_y = (top_row - run->y) * b->area;    // Current row times number in run
+    if (run1 < run2)
+    {
+        parents[run2] = run1;
+    }
+    else if (run2 < run1)
+    {
+        parents[run1] = run2;
+    }
+}
 
-    run->blob = b;
+// Joins the runs on a row to those they touch on the row above.
+// Both rows are in order so they are walked together.
+static void
+JoinRowToRowAbove (ParticleRuns * particle_runs, int *parents, int row, int reach)
+{
+    const ParticleRun *runs = particle_runs->runs;
+    int above = particle_runs->row_first_run[row - 1];
+    int above_end = particle_runs->row_first_run[row];
+    int current = above_end;
+    int current_end = particle_runs->row_first_run[row + 1];
 
-    pool->blobpool_ptr++;
-    pool->blobpool_blobcount++;
-    pool->real_blobcount++;
+    while (above < above_end && current < current_end)
+    {
+        if (runs[current].start <= runs[above].end + reach
+            && runs[above].start <= runs[current].end + reach)
+        {
+            JoinRuns (parents, above, current);
+        }
 
-    return b;
+        // The run that finishes first can not touch any more runs on the other row.
+        if (runs[above].end < runs[current].end)
+        {
+            above++;
+        }
+        else
+        {
+            current++;
+        }
+    }
 }
 
-static inline Blob *
-FindBlob (Blob * blob)
+static void
+CountRunsBand (void *data, int band, int start, int end)
 {
-    // Path Compression
-    // Since, anyway, we travel the path to the root during a find operation,
-    // we might as well hung all the nodes on the path directly on the root.
-    if (blob != blob->parent)
+    LabelBandData *band_data = (LabelBandData *) data;
+    ParticleRuns *particle_runs = band_data->particle_runs;
+
+    for(int row = start; row < end; row++)
     {
-        blob->parent = FindBlob (blob->parent);
-    }
+        const BYTE *bits = (const BYTE *) FIA_GetScanLineFromTop (band_data->src, row);
 
-    return blob->parent;
+        particle_runs->row_first_run[row + 1] = FindRowRuns (bits, particle_runs->width,
+                                                             band_data->white_on_black, NULL);
+    }
 }
 
-// Return toplevel blob
-static inline Blob *
-MergeBlobs (BLOBPOOL * pool, Blob * blob1, Blob * blob2)
+static void
+FindRunsBand (void *data, int band, int start, int end)
 {
-    // Union by rank, Always hanges the smaller tree off the larger
-    Blob *b1 = FindBlob (blob1);
-    Blob *b2 = FindBlob (blob2);
+    LabelBandData *band_data = (LabelBandData *) data;
+    ParticleRuns *particle_runs = band_data->particle_runs;
+
+    band_data->band_starts[band] = start;
 
-    if (b1->rank > b2->rank)
+    for(int row = start; row < end; row++)
     {
-        b2->parent = b1;
+        const BYTE *bits = (const BYTE *) FIA_GetScanLineFromTop (band_data->src, row);
+        int first = particle_runs->row_first_run[row];
+
+        FindRowRuns (bits, particle_runs->width, band_data->white_on_black,
+                     particle_runs->runs + first);
+
+        for(int i = first; i < particle_runs->row_first_run[row + 1]; i++)
+        {
+            band_data->parents[i] = i;
+        }
+
+        // The first row of a band is joined to the band above afterwards.
+        if (row > start)
+        {
+            JoinRowToRowAbove (particle_runs, band_data->parents, row, band_data->reach);
+        }
     }
-    else
+}
+
+static void
+DrawLabelsBand (void *data, int band, int start, int end)
+{
+    LabelBandData *band_data = (LabelBandData *) data;
+    ParticleRuns *particle_runs = band_data->particle_runs;
+
+    for(int row = start; row < end; row++)
     {
-        b1->parent = b2;
+        int *bits = (int *) FIA_GetScanLineFromTop (band_data->dst, row);
 
-        if (b1->rank == b2->rank)
-            b2->rank++;
-    }
+        memset (bits, 0, particle_runs->width * sizeof (int));
 
-    // Set new width height etc
-    b1->parent->left = MIN (b1->left, b2->left);
-    b1->parent->bottom = MIN (b1->bottom, b2->bottom);
-    b1->parent->right = MAX (b1->right, b2->right);
-    b1->parent->top = MAX (b1->top, b2->top);
-    b1->parent->area = b1->area + b2->area;
-    b1->parent->sum_x = b1->sum_x + b2->sum_x;
-    b1->parent->sum_y = b1->sum_y + b2->sum_y;
+        for(int i = particle_runs->row_first_run[row]; i < particle_runs->row_first_run[row + 1]; i++)
+        {
+            const ParticleRun *run = &particle_runs->runs[i];
+
+            for(int x = run->start; x <= run->end; x++)
+            {
+                bits[x] = run->label;
+            }
+        }
+    }
+}
 
-    pool->real_blobcount--;
+static void
+FreeParticleRuns (ParticleRuns * particle_runs)
+{
+    if (particle_runs == NULL)
+    {
+        return;
+    }
 
-    return b1->parent;
+    free (particle_runs->row_first_run);
+    free (particle_runs->runs);
+    free (particle_runs);
 }
 
-int DLL_CALLCONV
-FIA_ParticleInfo (FIBITMAP * src, PARTICLEINFO ** info, unsigned char white_on_black)
+// Finds the runs of particle pixels in src and labels each with its particle.
+static ParticleRuns *
+LabelParticleRuns (FIBITMAP * src, unsigned char white_on_black, FIA_CONNECTIVITY connectivity)
 {
     if (src == NULL)
     {
-        return FIA_ERROR;
+        return NULL;
     }
 
-    // Make sure we have the 8bit greyscale image.
-    if (FreeImage_GetBPP (src) != 8 && FreeImage_GetImageType (src) != FIT_BITMAP)
+    if (FreeImage_GetBPP (src) != 8 || FreeImage_GetImageType (src) != FIT_BITMAP)
     {
         FreeImage_OutputMessageProc (FIF_UNKNOWN,
-                                     "Error performing ParticleInfo. Source image must be an 8bit FIT_BITMAP");
-        return FIA_ERROR;
+                                     "Error labelling particles. Source image must be an 8bit FIT_BITMAP");
+        return NULL;
+    }
+
+    if (connectivity != FIA_CONNECTIVITY_4 && connectivity != FIA_CONNECTIVITY_8)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Error labelling particles. Connectivity must be 4 or 8");
+        return NULL;
     }
 
     const int width = FreeImage_GetWidth (src);
     const int height = FreeImage_GetHeight (src);
 
-    if(width == 0 || height == 0) {
-
-        FreeImage_OutputMessageProc (FIF_UNKNOWN,
-                                         "Error image size is %d x %d", width, height);
-        return FIA_ERROR;
+    if (width == 0 || height == 0)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Error image size is %d x %d", width, height);
+        return NULL;
     }
 
-    unsigned int top_row = height - 1;
-    unsigned char *src_ptr;
+    ParticleRuns *particle_runs = (ParticleRuns *) calloc (1, sizeof (ParticleRuns));
 
-    register int i = 0;
-    register int x = 0;
+    if (particle_runs == NULL)
+    {
+        return NULL;
+    }
 
-    unsigned char bg_val = 0;
+    particle_runs->width = width;
+    particle_runs->height = height;
+    particle_runs->row_first_run = (int *) malloc ((height + 1) * sizeof (int));
 
-    if (!white_on_black)
+    if (particle_runs->row_first_run == NULL)
     {
-        bg_val = 1;
+        FreeParticleRuns (particle_runs);
+        return NULL;
     }
 
-    Run *current_runs = (Run *) malloc (sizeof (Run) * width / 2);      // Array of all runs
+    LabelBandData band_data;
 
-    CheckMemory (current_runs);
+    band_data.src = src;
+    band_data.white_on_black = white_on_black;
+    band_data.reach = (connectivity == FIA_CONNECTIVITY_8) ? 1 : 0;
+    band_data.particle_runs = particle_runs;
+    band_data.parents = NULL;
+    band_data.band_starts = NULL;
+    band_data.dst = NULL;
 
-    Run *last_runs = (Run *) malloc (sizeof (Run) * width / 2);
+    const int number_of_bands = FIA_GetNumberOfBands (height, PARTICLE_ROWS_PER_BAND);
 
-    CheckMemory (last_runs);
+    particle_runs->row_first_run[0] = 0;
 
-    Run *last_runs_ptr = last_runs, *current_runs_ptr = current_runs;
+    FIA_RunBands (0, height, number_of_bands, CountRunsBand, &band_data);
 
-    BLOBPOOL *pool = UnionFindInit (width * height / 2);
+    for(int row = 0; row < height; row++)
+    {
+        particle_runs->row_first_run[row + 1] += particle_runs->row_first_run[row];
+    }
+
+    const int number_of_runs = particle_runs->row_first_run[height];
+
+    particle_runs->number_of_runs = number_of_runs;
+    particle_runs->runs = (ParticleRun *) malloc (MAX (number_of_runs, 1) * sizeof (ParticleRun));
+    band_data.parents = (int *) malloc (MAX (number_of_runs, 1) * sizeof (int));
+    band_data.band_starts = (int *) calloc (number_of_bands, sizeof (int));
 
-    int last_row_run_count = 0, current_run_count = 0;
+    if (particle_runs->runs == NULL || band_data.parents == NULL || band_data.band_starts == NULL)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Error labelling particles. Out of memory");
+        free (band_data.parents);
+        free (band_data.band_starts);
+        FreeParticleRuns (particle_runs);
+        return NULL;
+    }
 
-    // Do the first line
-    src_ptr = (unsigned char *) FreeImage_GetScanLine (src, 0);
+    FIA_RunBands (0, height, number_of_bands, FindRunsBand, &band_data);
 
-    // Pass through first row - Skip background pixels
-    // All runs are new so no merging takes place.
-    for(x = 0; x < width; x++)
+    // Join each band to the one above. Bands that were not run start at row 0.
+    for(int band = 0; band < number_of_bands; band++)
     {
-        // If bg pixel
-        if (src_ptr[x] == bg_val)
+        if (band_data.band_starts[band] > 0)
         {
-            continue;
+            JoinRowToRowAbove (particle_runs, band_data.parents, band_data.band_starts[band],
+                               band_data.reach);
         }
+    }
 
-        // new blob
-        last_runs_ptr[last_row_run_count].x = x;
-        last_runs_ptr[last_row_run_count].y = 0;
-        last_runs_ptr[last_row_run_count].sum_x = 0;
+    free (band_data.band_starts);
 
-        // While fg pixel increment.
-        while (src_ptr[x] != bg_val && x < width)
-        {
+    // A run's root comes before it so one pass in order numbers the particles.
+    int *parents = band_data.parents;
+    int number_of_particles = 0;
 
-            last_runs_ptr[last_row_run_count].sum_x += x;
-            x++;
+    for(int i = 0; i < number_of_runs; i++)
+    {
+        int root = FindRootRun (parents, i);
+
+        if (root == i)
+        {
+            particle_runs->runs[i].label = ++number_of_particles;
+        }
+        else
+        {
+            particle_runs->runs[i].label = particle_runs->runs[root].label;
         }
+    }
 
-        last_runs_ptr[last_row_run_count].end_x = x - 1;
+    particle_runs->number_of_particles = number_of_particles;
 
-        // This is the first line so all new runs are new blobs update the blob info
-        NewBlob (pool, top_row, &last_runs_ptr[last_row_run_count]);
+    free (parents);
 
-        last_row_run_count++;
+    return particle_runs;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_LabelParticles (FIBITMAP * src, unsigned char white_on_black, FIA_CONNECTIVITY connectivity,
+                    int *number_of_particles)
+{
+    if (number_of_particles != NULL)
+    {
+        *number_of_particles = 0;
     }
 
-    Blob *last_blob = NULL;
+    ParticleRuns *particle_runs = LabelParticleRuns (src, white_on_black, connectivity);
 
-    // Do the rest of the rows
-    for(register int y = 1; y < height; y++)
+    if (particle_runs == NULL)
     {
-        current_run_count = 0;
+        return NULL;
+    }
+
+    FIBITMAP *dst = FreeImage_AllocateT (FIT_INT32, particle_runs->width, particle_runs->height, 32, 0, 0, 0);
+
+    if (dst == NULL)
+    {
+        FreeParticleRuns (particle_runs);
+        return NULL;
+    }
 
-        src_ptr = (unsigned char *) FreeImage_GetScanLine (src, y);
+    LabelBandData band_data;
 
-        Run tmp_run;
+    band_data.src = src;
+    band_data.white_on_black = white_on_black;
+    band_data.reach = 0;
+    band_data.particle_runs = particle_runs;
+    band_data.parents = NULL;
+    band_data.band_starts = NULL;
+    band_data.dst = dst;
 
-        // Pass through next row - Skip background pixels
-        for(x = 0; x < width; x++)
+    FIA_RunBands (0, particle_runs->height,
+                  FIA_GetNumberOfBands (particle_runs->height, PARTICLE_ROWS_PER_BAND),
+                  DrawLabelsBand, &band_data);
+
+    if (number_of_particles != NULL)
+    {
+        *number_of_particles = particle_runs->number_of_particles;
+    }
+
+    FreeParticleRuns (particle_runs);
+
+    return dst;
+}
+
+int DLL_CALLCONV
+FIA_ParticleInfo (FIBITMAP * src, PARTICLEINFO ** info, unsigned char white_on_black)
+{
+    if (src == NULL)
+    {
+        return FIA_ERROR;
+    }
+
+    ParticleRuns *particle_runs = LabelParticleRuns (src, white_on_black, FIA_CONNECTIVITY_8);
+
+    if (particle_runs == NULL)
+    {
+        return FIA_ERROR;
+    }
+
+    const int number_of_blobs = particle_runs->number_of_particles;
+
+    // Create PARTICLEINFO/BLOBINFO array
+    *info = (PARTICLEINFO *) malloc (sizeof (PARTICLEINFO));
+    CheckMemory (*info);
+
+    (*info)->number_of_blobs = number_of_blobs;
+    (*info)->blobs = (BLOBINFO *) malloc (sizeof (BLOBINFO) * MAX (number_of_blobs, 1));
+    CheckMemory ((*info)->blobs);
+
+    long long *sums = (long long *) calloc (2 * MAX (number_of_blobs, 1), sizeof (long long));
+    CheckMemory (sums);
+
+    for(int i = 0; i < number_of_blobs; i++)
+    {
+        (*info)->blobs[i].area = 0;
+    }
+
+    // Rows are from the top so the rectangles and centres are relative to the top left.
+    for(int row = 0; row < particle_runs->height; row++)
+    {
+        for(int i = particle_runs->row_first_run[row]; i < particle_runs->row_first_run[row + 1]; i++)
         {
-            // Skip bg pixels
-            if (src_ptr[x] == bg_val)
+            const ParticleRun *run = &particle_runs->runs[i];
+            BLOBINFO *blob = &(*info)->blobs[run->label - 1];
+            long long *blob_sums = sums + 2 * (run->label - 1);
+            int length = run->end - run->start + 1;
+
+            if (blob->area == 0)
             {
-                continue;
+                blob->rect.left = run->start;
+                blob->rect.right = run->end;
+                blob->rect.top = row;
             }
 
-            tmp_run.x = x;
-            tmp_run.y = y;
-            tmp_run.sum_x = 0;
-            tmp_run.blob = NULL;
+            blob->rect.left = MIN (blob->rect.left, run->start);
+            blob->rect.right = MAX (blob->rect.right, run->end);
+            blob->rect.bottom = row;
+            blob->area += length;
 
-            // While fg pixel increment.
-            while (src_ptr[x] != bg_val && x < width)
-            {
-                tmp_run.sum_x += x;
-                x++;
-            }
+            blob_sums[0] += (long long) length * (run->start + run->end) / 2;
+            blob_sums[1] += (long long) length * row;
+        }
+    }
+
+    for(int i = 0; i < number_of_blobs; i++)
+    {
+        BLOBINFO *blob = &(*info)->blobs[i];
+
+        blob->center_x = (int) (sums[2 * i] / blob->area);
+        blob->center_y = (int) (sums[2 * i + 1] / blob->area);
+    }
 
-            tmp_run.end_x = x - 1;
+    free (sums);
+    FreeParticleRuns (particle_runs);
 
-            // Check whether run is overlapping with previous runs
-            for(i = 0; i < last_row_run_count; i++)
+    return FIA_SUCCESS;
+};
+
+// Sums for one particle's shape, in 64 bit integers so large particles do not overflow.
+struct ParticleShapeSums
+{
+    long long sum_x;
+    long long sum_y;
+    long long sum_xx;
+    long long sum_yy;
+    long long sum_xy;
+    long long edges;
+};
+
+// Sum of the squares of 0 to n.
+static inline long long
+SumOfSquares (long long n)
+{
+    return n * (n + 1) * (2 * n + 1) / 6;
+}
+
+template < typename T > static void
+AccumulateRunIntensities (FIBITMAP * intensity, const ParticleRuns * particle_runs,
+                          FIA_PARTICLE_MEASUREMENTS * measurements)
+{
+    for(int row = 0; row < particle_runs->height; row++)
+    {
+        const T *bits = (const T *) FIA_GetScanLineFromTop (intensity, row);
+
+        for(int i = particle_runs->row_first_run[row]; i < particle_runs->row_first_run[row + 1]; i++)
+        {
+            const ParticleRun *run = &particle_runs->runs[i];
+            const int index = run->label - 1;
+
+            double sum = 0.0, sum_x = 0.0;
+            double min = measurements->min_intensity[index];
+            double max = measurements->max_intensity[index];
+
+            for(int x = run->start; x <= run->end; x++)
             {
-                Run *last_run = &last_runs_ptr[i];
+                double value = (double) bits[x];
 
-                last_blob = FindBlob (last_run->blob);
+                sum += value;
+                sum_x += value * x;
 
-                // Are runs overlapping ?
-                // The -1 are to allow pixels connected on the diagonal
-                if (tmp_run.end_x >= last_run->x - 1 && tmp_run.x <= last_run->end_x + 1)
-                {
+                if (value < min)
+                    min = value;
 
-                    // Point to same blob as overlapped run if the blobs are the same
-                    // Or if its the first overlapping run in the previous line.
-                    if (tmp_run.blob == NULL)
-                    {
-                        // Set new width height etc
-                        tmp_run.blob = last_blob;
-
-                        if (tmp_run.x < last_blob->left)
-                        {
-                            last_blob->left = tmp_run.x;
-                        }
-
-                        if (tmp_run.end_x > last_blob->right)
-                        {
-                            last_blob->right = tmp_run.end_x;
-                        }
-
-                        tmp_run.blob->top = y;
-
-                        tmp_run.blob->area = tmp_run.end_x - tmp_run.x + 1 + last_blob->area;
-                        tmp_run.blob->sum_x = tmp_run.sum_x + last_blob->sum_x;
-                        tmp_run.blob->sum_y += ((top_row - y) * (tmp_run.end_x - tmp_run.x + 1));
-
-						if(tmp_run.blob->sum_y < 0) {
-							tmp_run.blob->sum_y = tmp_run.blob->sum_y;
-						}
-
-                    }
-                    else if (tmp_run.blob != last_blob)
-                    {
-                        // We have more than one previous overlapping run.
-                        // The blobs are not the same so we merge them.
-                        tmp_run.blob = MergeBlobs (pool, tmp_run.blob, last_blob);
-                    }
-                }
+                if (value > max)
+                    max = value;
             }
 
-            // We have no connected runs create a new blob
-            if (tmp_run.blob == NULL)
+            measurements->integrated_intensity[index] += sum;
+            measurements->intensity_centre_x[index] += sum_x;
+            measurements->intensity_centre_y[index] += sum * row;
+            measurements->min_intensity[index] = min;
+            measurements->max_intensity[index] = max;
+        }
+    }
+}
+
+static int
+AccumulateIntensities (FIBITMAP * intensity, const ParticleRuns * particle_runs,
+                       FIA_PARTICLE_MEASUREMENTS * measurements)
+{
+    FREE_IMAGE_TYPE type = FreeImage_GetImageType (intensity);
+
+    switch (type)
+    {
+        case FIT_BITMAP:
+            if (FreeImage_GetBPP (intensity) != 8)
+                break;
+
+            AccumulateRunIntensities < unsigned char > (intensity, particle_runs, measurements);
+            return FIA_SUCCESS;
+
+        case FIT_UINT16:
+            AccumulateRunIntensities < unsigned short > (intensity, particle_runs, measurements);
+            return FIA_SUCCESS;
+
+        case FIT_INT16:
+            AccumulateRunIntensities < short > (intensity, particle_runs, measurements);
+            return FIA_SUCCESS;
+
+        case FIT_UINT32:
+            AccumulateRunIntensities < unsigned int > (intensity, particle_runs, measurements);
+            return FIA_SUCCESS;
+
+        case FIT_INT32:
+            AccumulateRunIntensities < int > (intensity, particle_runs, measurements);
+            return FIA_SUCCESS;
+
+        case FIT_FLOAT:
+            AccumulateRunIntensities < float > (intensity, particle_runs, measurements);
+            return FIA_SUCCESS;
+
+        case FIT_DOUBLE:
+            AccumulateRunIntensities < double > (intensity, particle_runs, measurements);
+            return FIA_SUCCESS;
+
+        default:
+            break;
+    }
+
+    FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                 "Error measuring particles. Intensity image must be greyscale, not type %d",
+                                 type);
+
+    return FIA_ERROR;
+}
+
+// All the arrays are in one block after the structure, the doubles first.
+#define NUMBER_OF_PARTICLE_MEASUREMENT_ARRAYS 11
+
+static FIA_PARTICLE_MEASUREMENTS *
+AllocateParticleMeasurements (int number_of_particles)
+{
+    const size_t count = MAX (number_of_particles, 1);
+
+    char *block = (char *) calloc (1, sizeof (FIA_PARTICLE_MEASUREMENTS)
+                                   + count * (NUMBER_OF_PARTICLE_MEASUREMENT_ARRAYS * sizeof (double)
+                                              + sizeof (FIARECT) + sizeof (int)));
+
+    if (block == NULL)
+    {
+        return NULL;
+    }
+
+    FIA_PARTICLE_MEASUREMENTS *measurements = (FIA_PARTICLE_MEASUREMENTS *) block;
+    double *values = (double *) (block + sizeof (FIA_PARTICLE_MEASUREMENTS));
+
+    measurements->number_of_particles = number_of_particles;
+    measurements->centre_x = values;
+    measurements->centre_y = values + count;
+    measurements->perimeter = values + 2 * count;
+    measurements->orientation = values + 3 * count;
+    measurements->eccentricity = values + 4 * count;
+    measurements->integrated_intensity = values + 5 * count;
+    measurements->min_intensity = values + 6 * count;
+    measurements->max_intensity = values + 7 * count;
+    measurements->mean_intensity = values + 8 * count;
+    measurements->intensity_centre_x = values + 9 * count;
+    measurements->intensity_centre_y = values + 10 * count;
+    measurements->rect = (FIARECT *) (values + NUMBER_OF_PARTICLE_MEASUREMENT_ARRAYS * count);
+    measurements->area = (int *) (measurements->rect + count);
+
+    return measurements;
+}
+
+int DLL_CALLCONV
+FIA_MeasureParticles (FIBITMAP * src, unsigned char white_on_black, FIA_CONNECTIVITY connectivity,
+                      FIBITMAP * intensity, FIA_PARTICLE_MEASUREMENTS ** measurements)
+{
+    if (src == NULL || measurements == NULL)
+    {
+        return FIA_ERROR;
+    }
+
+    *measurements = NULL;
+
+    if (intensity != NULL && FIA_CheckSizesAreSame (src, intensity) == 0)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "Error measuring particles. The intensity image is not the same size");
+        return FIA_ERROR;
+    }
+
+    ParticleRuns *particle_runs = LabelParticleRuns (src, white_on_black, connectivity);
+
+    if (particle_runs == NULL)
+    {
+        return FIA_ERROR;
+    }
+
+    const int number_of_particles = particle_runs->number_of_particles;
+
+    FIA_PARTICLE_MEASUREMENTS *result = AllocateParticleMeasurements (number_of_particles);
+    ParticleShapeSums *sums = (ParticleShapeSums *) calloc (MAX (number_of_particles, 1),
+                                                            sizeof (ParticleShapeSums));
+
+    if (result == NULL || sums == NULL)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Error measuring particles. Out of memory");
+        free (result);
+        free (sums);
+        FreeParticleRuns (particle_runs);
+        return FIA_ERROR;
+    }
+
+    const ParticleRun *runs = particle_runs->runs;
+
+    for(int row = 0; row < particle_runs->height; row++)
+    {
+        const int first = particle_runs->row_first_run[row];
+        const int end = particle_runs->row_first_run[row + 1];
+
+        for(int i = first; i < end; i++)
+        {
+            const ParticleRun *run = &runs[i];
+            const int index = run->label - 1;
+            const long long length = run->end - run->start + 1;
+            const long long run_sum_x = length * (run->start + run->end) / 2;
+
+            FIARECT *rect = &result->rect[index];
+            ParticleShapeSums *shape = &sums[index];
+
+            if (result->area[index] == 0)
             {
-                NewBlob (pool, top_row, &tmp_run);
+                rect->left = run->start;
+                rect->right = run->end;
+                rect->top = row;
             }
 
-            // Add run to current run array
-            current_runs_ptr[current_run_count].x = tmp_run.x;
-            current_runs_ptr[current_run_count].y = tmp_run.y;
-            current_runs_ptr[current_run_count].end_x = tmp_run.end_x;
-            current_runs_ptr[current_run_count].sum_x = tmp_run.sum_x;
-            current_runs_ptr[current_run_count].blob = tmp_run.blob;
+            rect->left = MIN (rect->left, run->start);
+            rect->right = MAX (rect->right, run->end);
+            rect->bottom = row;
+            result->area[index] += (int) length;
+
+            shape->sum_x += run_sum_x;
+            shape->sum_y += length * row;
+            shape->sum_xx += SumOfSquares (run->end) - SumOfSquares (run->start - 1);
+            shape->sum_yy += length * row * row;
+            shape->sum_xy += run_sum_x * row;
 
-            current_run_count++;
+            // Each pixel has four edges, those inside the run are shared.
+            shape->edges += 2 * length + 2;
         }
 
-        // Switch pointer to current runs to last runs a reloop
-        SWAP (last_runs_ptr, current_runs_ptr);
+        // Pixels above each other are always in the same particle,
+        // each pixel's width of overlap hides two edges.
+        if (row > 0)
+        {
+            int above = particle_runs->row_first_run[row - 1];
+            int current = first;
+
+            while (above < first && current < end)
+            {
+                int overlap = MIN (runs[above].end, runs[current].end)
+                    - MAX (runs[above].start, runs[current].start) + 1;
+
+                if (overlap > 0)
+                {
+                    sums[runs[current].label - 1].edges -= 2 * overlap;
+                }
 
-        last_row_run_count = current_run_count;
+                if (runs[above].end < runs[current].end)
+                {
+                    above++;
+                }
+                else
+                {
+                    current++;
+                }
+            }
+        }
     }
 
-    // Create PARTICLEINFO/BLOBINFO array
-    *info = (PARTICLEINFO *) malloc (sizeof (PARTICLEINFO));
-    CheckMemory (*info);
+    for(int i = 0; i < number_of_particles; i++)
+    {
+        const ParticleShapeSums *shape = &sums[i];
+        const double area = result->area[i];
+        const double centre_x = shape->sum_x / area;
+        const double centre_y = shape->sum_y / area;
+
+        result->centre_x[i] = centre_x;
+        result->centre_y[i] = centre_y;
+        result->perimeter[i] = (double) shape->edges;
+
+        // Central second moments, then the axes of the ellipse with the same moments.
+        double mu20 = shape->sum_xx / area - centre_x * centre_x;
+        double mu02 = shape->sum_yy / area - centre_y * centre_y;
+        double mu11 = shape->sum_xy / area - centre_x * centre_y;
+
+        double half_difference = (mu20 - mu02) / 2.0;
+        double root = sqrt (half_difference * half_difference + mu11 * mu11);
+        double major = (mu20 + mu02) / 2.0 + root;
+        double minor = (mu20 + mu02) / 2.0 - root;
+
+        result->orientation[i] = (root > 0.0) ? 0.5 * atan2 (2.0 * mu11, mu20 - mu02) : 0.0;
+        result->eccentricity[i] = (major > 0.0) ? sqrt (1.0 - MAX (minor, 0.0) / major) : 0.0;
+    }
 
-    (*info)->number_of_blobs = pool->real_blobcount;
-    (*info)->blobs = (BLOBINFO *) malloc (sizeof (BLOBINFO) * pool->real_blobcount);
-    CheckMemory ((*info)->blobs);
+    free (sums);
 
-    // Get blobs
-    for(int i = 0, j = 0; i < pool->blobpool_blobcount; i++)
+    if (intensity == NULL)
     {
-        Blob *ptr = &(pool->blobpool_start_ptr[i]);
+        result->integrated_intensity = NULL;
+        result->min_intensity = NULL;
+        result->max_intensity = NULL;
+        result->mean_intensity = NULL;
+        result->intensity_centre_x = NULL;
+        result->intensity_centre_y = NULL;
+    }
+    else
+    {
+        for(int i = 0; i < number_of_particles; i++)
+        {
+            result->min_intensity[i] = DBL_MAX;
+            result->max_intensity[i] = -DBL_MAX;
+        }
 
-        if (ptr != ptr->parent)
+        if (AccumulateIntensities (intensity, particle_runs, result) == FIA_ERROR)
         {
-            continue;
+            free (result);
+            FreeParticleRuns (particle_runs);
+            return FIA_ERROR;
         }
 
-        (*info)->blobs[j].rect.left = ptr->left;
-        (*info)->blobs[j].rect.top = top_row - ptr->top;
-        (*info)->blobs[j].rect.right = ptr->right;
-        (*info)->blobs[j].rect.bottom = top_row - ptr->bottom;
-        (*info)->blobs[j].area = ptr->area;
-        (*info)->blobs[j].center_x = ptr->sum_x / ptr->area;
-        (*info)->blobs[j].center_y = ptr->sum_y / ptr->area;
+        for(int i = 0; i < number_of_particles; i++)
+        {
+            double sum = result->integrated_intensity[i];
+
+            result->mean_intensity[i] = sum / result->area[i];
 
-        j++;
+            // A particle with no intensity has no weighted centre, its plain centre is used.
+            if (sum != 0.0)
+            {
+                result->intensity_centre_x[i] /= sum;
+                result->intensity_centre_y[i] /= sum;
+            }
+            else
+            {
+                result->intensity_centre_x[i] = result->centre_x[i];
+                result->intensity_centre_y[i] = result->centre_y[i];
+            }
+        }
     }
 
-    UnionFindFree (pool);
-    free (current_runs);
-    current_runs = NULL;
-    free (last_runs);
-    last_runs = NULL;
+    FreeParticleRuns (particle_runs);
+
+    *measurements = result;
 
     return FIA_SUCCESS;
-};
+}
+
+void DLL_CALLCONV
+FIA_FreeParticleMeasurements (FIA_PARTICLE_MEASUREMENTS * measurements)
+{
+    free (measurements);
+}
 
 void DLL_CALLCONV
 FIA_FreeParticleInfo (PARTICLEINFO * info)
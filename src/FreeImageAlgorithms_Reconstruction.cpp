@@ -0,0 +1,402 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "FreeImageAlgorithms.h"
+#include "FreeImageAlgorithms_Utils.h"
+#include "FreeImageAlgorithms_Morphology.h"
+#include "FreeImageAlgorithms_Palettes.h"
+#include "FreeImageAlgorithms_Utilities.h"
+
+#include <math.h>
+#include <float.h>
+#include <limits>
+#include <vector>
+
+// Reconstruction by Vincent's hybrid algorithm. A raster scan and an
+// anti-raster scan carry the marker most of the way, each pixel taking the
+// best of itself and the neighbours already scanned, limited by the mask.
+// The pixels the backward scan leaves that could still improve a neighbour
+// go into a queue which finishes the propagation. Each pixel is visited a
+// small number of times whatever the shape of the image.
+//
+// For a reconstruction by dilation the best value is the largest and the
+// mask is an upper limit, by erosion the reverse.
+
+struct DilationOperation
+{
+    template < typename T > static inline T Best (T a, T b)
+    {
+        return (a < b) ? b : a;
+    }
+
+    template < typename T > static inline T Limit (T a, T b)
+    {
+        return (b < a) ? b : a;
+    }
+
+    // True if a can still be improved towards b.
+    template < typename T > static inline bool Worse (T a, T b)
+    {
+        return a < b;
+    }
+};
+
+struct ErosionOperation
+{
+    template < typename T > static inline T Best (T a, T b)
+    {
+        return (b < a) ? b : a;
+    }
+
+    template < typename T > static inline T Limit (T a, T b)
+    {
+        return (a < b) ? b : a;
+    }
+
+    template < typename T > static inline bool Worse (T a, T b)
+    {
+        return b < a;
+    }
+};
+
+template < typename T, class Op > static void
+Reconstruct (FIBITMAP * marker, FIBITMAP * mask, int connectivity)
+{
+    const int width = FreeImage_GetWidth (marker);
+    const int height = FreeImage_GetHeight (marker);
+    const int marker_pitch = FIA_GetPitchInPixels (marker);
+    const int mask_pitch = FIA_GetPitchInPixels (mask);
+    const bool corners = (connectivity == 8);
+
+    T *j_bits = (T *) FreeImage_GetBits (marker);
+    const T *i_bits = (const T *) FreeImage_GetBits (mask);
+
+    // Forward scan, the neighbours before each pixel.
+    for(int y = 0; y < height; y++)
+    {
+        T *j = j_bits + y * marker_pitch;
+        const T *i = i_bits + y * mask_pitch;
+        const T *previous = (y > 0) ? j - marker_pitch : NULL;
+
+        for(int x = 0; x < width; x++)
+        {
+            T value = j[x];
+
+            if (x > 0)
+                value = Op::Best (value, j[x - 1]);
+
+            if (previous != NULL)
+            {
+                value = Op::Best (value, previous[x]);
+
+                if (corners)
+                {
+                    if (x > 0)
+                        value = Op::Best (value, previous[x - 1]);
+
+                    if (x < width - 1)
+                        value = Op::Best (value, previous[x + 1]);
+                }
+            }
+
+            j[x] = Op::Limit (value, i[x]);
+        }
+    }
+
+    std::vector < int > queue;
+
+    // Backward scan, the neighbours after each pixel. A pixel is queued if
+    // one of those neighbours is worse than it and is not yet at its limit.
+    for(int y = height - 1; y >= 0; y--)
+    {
+        T *j = j_bits + y * marker_pitch;
+        const T *i = i_bits + y * mask_pitch;
+        const T *next = (y < height - 1) ? j + marker_pitch : NULL;
+        const T *next_i = (y < height - 1) ? i + mask_pitch : NULL;
+
+        for(int x = width - 1; x >= 0; x--)
+        {
+            T value = j[x];
+
+            if (x < width - 1)
+                value = Op::Best (value, j[x + 1]);
+
+            if (next != NULL)
+            {
+                value = Op::Best (value, next[x]);
+
+                if (corners)
+                {
+                    if (x > 0)
+                        value = Op::Best (value, next[x - 1]);
+
+                    if (x < width - 1)
+                        value = Op::Best (value, next[x + 1]);
+                }
+            }
+
+            value = Op::Limit (value, i[x]);
+            j[x] = value;
+
+            bool improves = (x < width - 1 && Op::Worse (j[x + 1], value) && Op::Worse (j[x + 1], i[x + 1]));
+
+            if (!improves && next != NULL)
+            {
+                improves = (Op::Worse (next[x], value) && Op::Worse (next[x], next_i[x]));
+
+                if (!improves && corners)
+                {
+                    improves = (x > 0 && Op::Worse (next[x - 1], value) && Op::Worse (next[x - 1], next_i[x - 1]))
+                        || (x < width - 1 && Op::Worse (next[x + 1], value)
+                            && Op::Worse (next[x + 1], next_i[x + 1]));
+                }
+            }
+
+            if (improves)
+                queue.push_back (y * width + x);
+        }
+    }
+
+    static const int offsets[8][2] = {
+        {-1, 0}, {1, 0}, {0, -1}, {0, 1}, {-1, -1}, {1, -1}, {-1, 1}, {1, 1}
+    };
+
+    const int count = corners ? 8 : 4;
+
+    // First in first out, the queue is read from head and only grows at the end.
+    for(size_t head = 0; head < queue.size (); head++)
+    {
+        const int px = queue[head] % width;
+        const int py = queue[head] / width;
+        const T value = j_bits[py * marker_pitch + px];
+        const bool interior = (px > 0 && py > 0 && px < width - 1 && py < height - 1);
+
+        for(int n = 0; n < count; n++)
+        {
+            const int nx = px + offsets[n][0];
+            const int ny = py + offsets[n][1];
+
+            if (!interior && (nx < 0 || ny < 0 || nx >= width || ny >= height))
+                continue;
+
+            T *j = j_bits + ny * marker_pitch + nx;
+            const T i = i_bits[ny * mask_pitch + nx];
+
+            if (Op::Worse (*j, value) && *j != i)
+            {
+                *j = Op::Limit (value, i);
+                queue.push_back (ny * width + nx);
+            }
+        }
+
+        // Drop the part already read once it is most of the queue.
+        if (head > 4096 && head * 2 > queue.size ())
+        {
+            queue.erase (queue.begin (), queue.begin () + head + 1);
+            head = (size_t) -1;
+        }
+    }
+}
+
+template < typename T > static void
+Reconstruct (FIBITMAP * marker, FIBITMAP * mask, FIA_RECONSTRUCTION_OPERATION operation,
+             int connectivity)
+{
+    if (operation == FIA_RECONSTRUCTION_BY_DILATION)
+        Reconstruct < T, DilationOperation > (marker, mask, connectivity);
+    else
+        Reconstruct < T, ErosionOperation > (marker, mask, connectivity);
+}
+
+int DLL_CALLCONV
+FIA_MorphologicalReconstruction (FIBITMAP * marker, FIBITMAP * mask,
+                                 FIA_RECONSTRUCTION_OPERATION operation, FIA_CONNECTIVITY connectivity)
+{
+    if (marker == NULL || mask == NULL)
+        return FIA_ERROR;
+
+    if (FreeImage_GetImageType (marker) != FreeImage_GetImageType (mask)
+        || FreeImage_GetBPP (marker) != FreeImage_GetBPP (mask)
+        || FreeImage_GetWidth (marker) != FreeImage_GetWidth (mask)
+        || FreeImage_GetHeight (marker) != FreeImage_GetHeight (mask))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "The marker and mask must be the same type and size");
+        return FIA_ERROR;
+    }
+
+    if (connectivity != FIA_CONNECTIVITY_4 && connectivity != FIA_CONNECTIVITY_8)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Connectivity must be 4 or 8");
+        return FIA_ERROR;
+    }
+
+    FREE_IMAGE_TYPE type = FreeImage_GetImageType (marker);
+
+    switch (type)
+    {
+        case FIT_BITMAP:
+            if (FreeImage_GetBPP (marker) != 8)
+                break;
+
+            Reconstruct < unsigned char > (marker, mask, operation, connectivity);
+            return FIA_SUCCESS;
+
+        case FIT_UINT16:
+            Reconstruct < unsigned short > (marker, mask, operation, connectivity);
+            return FIA_SUCCESS;
+
+        case FIT_INT16:
+            Reconstruct < short > (marker, mask, operation, connectivity);
+            return FIA_SUCCESS;
+
+        case FIT_UINT32:
+            Reconstruct < unsigned int > (marker, mask, operation, connectivity);
+            return FIA_SUCCESS;
+
+        case FIT_INT32:
+            Reconstruct < int > (marker, mask, operation, connectivity);
+            return FIA_SUCCESS;
+
+        case FIT_FLOAT:
+            Reconstruct < float > (marker, mask, operation, connectivity);
+            return FIA_SUCCESS;
+
+        case FIT_DOUBLE:
+            Reconstruct < double > (marker, mask, operation, connectivity);
+            return FIA_SUCCESS;
+
+        default:
+            break;
+    }
+
+    FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                 "FREE_IMAGE_TYPE: Unable to perform reconstruction on type %d.",
+                                 type);
+
+    return FIA_ERROR;
+}
+
+// The next value below v, or v itself if there is none.
+template < typename T > static inline T
+NextBelow (T v)
+{
+    return (v > std::numeric_limits < T >::min ())? (T) (v - 1) : v;
+}
+
+template <> inline float
+NextBelow < float > (float v)
+{
+    return (v > -FLT_MAX) ? nextafterf (v, -FLT_MAX) : v;
+}
+
+template <> inline double
+NextBelow < double > (double v)
+{
+    return (v > -DBL_MAX) ? nextafter (v, -DBL_MAX) : v;
+}
+
+// A regional maximum is a plateau with no higher neighbour. Reconstructing
+// the image from itself lowered by one step lifts every pixel that can be
+// reached from a higher one back to its value, the maxima stay lower.
+template < typename T > static FIBITMAP *
+RegionalMaxima (FIBITMAP * src, FIA_CONNECTIVITY connectivity)
+{
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+
+    FIBITMAP *marker = FreeImage_Clone (src);
+
+    for(int y = 0; y < height; y++)
+    {
+        T *ptr = (T *) FreeImage_GetScanLine (marker, y);
+
+        for(int x = 0; x < width; x++)
+            ptr[x] = NextBelow (ptr[x]);
+    }
+
+    Reconstruct < T, DilationOperation > (marker, src, connectivity);
+
+    FIBITMAP *dst = FreeImage_Allocate (width, height, 8, 0, 0, 0);
+
+    FIA_SetGreyLevelPalette (dst);
+
+    for(int y = 0; y < height; y++)
+    {
+        const T *src_ptr = (const T *) FreeImage_GetScanLine (src, y);
+        const T *marker_ptr = (const T *) FreeImage_GetScanLine (marker, y);
+        BYTE *dst_ptr = FreeImage_GetScanLine (dst, y);
+
+        for(int x = 0; x < width; x++)
+            dst_ptr[x] = (marker_ptr[x] != src_ptr[x]) ? 255 : 0;
+    }
+
+    FreeImage_Unload (marker);
+
+    return dst;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_RegionalMaxima (FIBITMAP * src, FIA_CONNECTIVITY connectivity)
+{
+    if (src == NULL)
+        return NULL;
+
+    if (connectivity != FIA_CONNECTIVITY_4 && connectivity != FIA_CONNECTIVITY_8)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Connectivity must be 4 or 8");
+        return NULL;
+    }
+
+    FREE_IMAGE_TYPE type = FreeImage_GetImageType (src);
+
+    switch (type)
+    {
+        case FIT_BITMAP:
+            if (FreeImage_GetBPP (src) == 8)
+                return RegionalMaxima < unsigned char > (src, connectivity);
+            break;
+
+        case FIT_UINT16:
+            return RegionalMaxima < unsigned short > (src, connectivity);
+
+        case FIT_INT16:
+            return RegionalMaxima < short > (src, connectivity);
+
+        case FIT_UINT32:
+            return RegionalMaxima < unsigned int > (src, connectivity);
+
+        case FIT_INT32:
+            return RegionalMaxima < int > (src, connectivity);
+
+        case FIT_FLOAT:
+            return RegionalMaxima < float > (src, connectivity);
+
+        case FIT_DOUBLE:
+            return RegionalMaxima < double > (src, connectivity);
+
+        default:
+            break;
+    }
+
+    FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                 "FREE_IMAGE_TYPE: Unable to find regional maxima on type %d.",
+                                 type);
+
+    return NULL;
+}
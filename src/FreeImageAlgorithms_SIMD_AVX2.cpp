@@ -0,0 +1,404 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "FreeImageAlgorithms_SIMD.h"
+#include "FreeImageAlgorithms_MedianNetwork.txx"
+
+// Built with -mavx2 -mfma (or /arch:AVX2), only called when cpuid says so.
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+
+#include <immintrin.h>
+
+static void
+FloatConvolveRowAVX2 (const float *src, int src_pitch, const float *kernel,
+                      int kernel_width, int kernel_height, float *dst, int width)
+{
+    int x = 0;
+
+    for(; x + 32 <= width; x += 32)
+    {
+        __m256 sum0 = _mm256_setzero_ps ();
+        __m256 sum1 = _mm256_setzero_ps ();
+        __m256 sum2 = _mm256_setzero_ps ();
+        __m256 sum3 = _mm256_setzero_ps ();
+
+        const float *src_row = src + x;
+        const float *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+            {
+                __m256 k = _mm256_set1_ps (kernel_row[col]);
+                const float *ptr = src_row + col;
+
+                sum0 = _mm256_fmadd_ps (k, _mm256_loadu_ps (ptr), sum0);
+                sum1 = _mm256_fmadd_ps (k, _mm256_loadu_ps (ptr + 8), sum1);
+                sum2 = _mm256_fmadd_ps (k, _mm256_loadu_ps (ptr + 16), sum2);
+                sum3 = _mm256_fmadd_ps (k, _mm256_loadu_ps (ptr + 24), sum3);
+            }
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm256_storeu_ps (dst + x, sum0);
+        _mm256_storeu_ps (dst + x + 8, sum1);
+        _mm256_storeu_ps (dst + x + 16, sum2);
+        _mm256_storeu_ps (dst + x + 24, sum3);
+    }
+
+    for(; x + 8 <= width; x += 8)
+    {
+        __m256 sum = _mm256_setzero_ps ();
+
+        const float *src_row = src + x;
+        const float *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+                sum = _mm256_fmadd_ps (_mm256_set1_ps (kernel_row[col]),
+                                       _mm256_loadu_ps (src_row + col), sum);
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm256_storeu_ps (dst + x, sum);
+    }
+
+    for(; x < width; x++)
+    {
+        float sum = 0.0f;
+
+        const float *src_row = src + x;
+        const float *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+                sum += kernel_row[col] * src_row[col];
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        dst[x] = sum;
+    }
+}
+
+// Widens 8 pixels to 32 bit integers.
+static inline __m256i
+Widen (const short *ptr)
+{
+    return _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *) ptr));
+}
+
+static inline __m256i
+Widen (const unsigned short *ptr)
+{
+    return _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const __m128i *) ptr));
+}
+
+template < typename Tsrc > static void
+IntegerConvolveRowAVX2 (const Tsrc * src, int src_pitch, const int *kernel,
+                        int kernel_width, int kernel_height, int *dst, int width)
+{
+    int x = 0;
+
+    for(; x + 32 <= width; x += 32)
+    {
+        __m256i sum0 = _mm256_setzero_si256 ();
+        __m256i sum1 = _mm256_setzero_si256 ();
+        __m256i sum2 = _mm256_setzero_si256 ();
+        __m256i sum3 = _mm256_setzero_si256 ();
+
+        const Tsrc *src_row = src + x;
+        const int *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+            {
+                __m256i k = _mm256_set1_epi32 (kernel_row[col]);
+                const Tsrc *ptr = src_row + col;
+
+                sum0 = _mm256_add_epi32 (sum0, _mm256_mullo_epi32 (k, Widen (ptr)));
+                sum1 = _mm256_add_epi32 (sum1, _mm256_mullo_epi32 (k, Widen (ptr + 8)));
+                sum2 = _mm256_add_epi32 (sum2, _mm256_mullo_epi32 (k, Widen (ptr + 16)));
+                sum3 = _mm256_add_epi32 (sum3, _mm256_mullo_epi32 (k, Widen (ptr + 24)));
+            }
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm256_storeu_si256 ((__m256i *) (dst + x), sum0);
+        _mm256_storeu_si256 ((__m256i *) (dst + x + 8), sum1);
+        _mm256_storeu_si256 ((__m256i *) (dst + x + 16), sum2);
+        _mm256_storeu_si256 ((__m256i *) (dst + x + 24), sum3);
+    }
+
+    for(; x + 8 <= width; x += 8)
+    {
+        __m256i sum = _mm256_setzero_si256 ();
+
+        const Tsrc *src_row = src + x;
+        const int *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+                sum = _mm256_add_epi32 (sum, _mm256_mullo_epi32 (_mm256_set1_epi32 (kernel_row[col]),
+                                                                 Widen (src_row + col)));
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm256_storeu_si256 ((__m256i *) (dst + x), sum);
+    }
+
+    for(; x < width; x++)
+    {
+        int sum = 0;
+
+        const Tsrc *src_row = src + x;
+        const int *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+                sum += kernel_row[col] * src_row[col];
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        dst[x] = sum;
+    }
+}
+
+static void
+ShortConvolveRowAVX2 (const short *src, int src_pitch, const int *kernel,
+                      int kernel_width, int kernel_height, int *dst, int width)
+{
+    IntegerConvolveRowAVX2 (src, src_pitch, kernel, kernel_width, kernel_height, dst, width);
+}
+
+static void
+UShortConvolveRowAVX2 (const unsigned short *src, int src_pitch, const int *kernel,
+                       int kernel_width, int kernel_height, int *dst, int width)
+{
+    IntegerConvolveRowAVX2 (src, src_pitch, kernel, kernel_width, kernel_height, dst, width);
+}
+
+struct UCharAVX2
+{
+    typedef unsigned char Type;
+    typedef __m256i Vector;
+
+    enum { Width = 32 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm256_loadu_si256 ((const __m256i *) ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm256_storeu_si256 ((__m256i *) ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm256_min_epu8 (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm256_max_epu8 (a, b);
+    }
+};
+
+struct ShortAVX2
+{
+    typedef short Type;
+    typedef __m256i Vector;
+
+    enum { Width = 16 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm256_loadu_si256 ((const __m256i *) ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm256_storeu_si256 ((__m256i *) ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm256_min_epi16 (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm256_max_epi16 (a, b);
+    }
+};
+
+struct UShortAVX2
+{
+    typedef unsigned short Type;
+    typedef __m256i Vector;
+
+    enum { Width = 16 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm256_loadu_si256 ((const __m256i *) ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm256_storeu_si256 ((__m256i *) ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm256_min_epu16 (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm256_max_epu16 (a, b);
+    }
+};
+
+struct FloatAVX2
+{
+    typedef float Type;
+    typedef __m256 Vector;
+
+    enum { Width = 8 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm256_loadu_ps (ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm256_storeu_ps (ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm256_min_ps (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm256_max_ps (a, b);
+    }
+};
+
+static void
+UCharMedianRowAVX2 (const unsigned char *const *rows, int radius,
+                    unsigned char *scratch, unsigned char *dst, int width)
+{
+    MedianNetworkRow < UCharAVX2 > (rows, radius, scratch, dst, width);
+}
+
+static void
+ShortMedianRowAVX2 (const short *const *rows, int radius, short *scratch, short *dst, int width)
+{
+    MedianNetworkRow < ShortAVX2 > (rows, radius, scratch, dst, width);
+}
+
+static void
+UShortMedianRowAVX2 (const unsigned short *const *rows, int radius,
+                     unsigned short *scratch, unsigned short *dst, int width)
+{
+    MedianNetworkRow < UShortAVX2 > (rows, radius, scratch, dst, width);
+}
+
+static void
+FloatMedianRowAVX2 (const float *const *rows, int radius, float *scratch, float *dst, int width)
+{
+    MedianNetworkRow < FloatAVX2 > (rows, radius, scratch, dst, width);
+}
+
+static void
+UCharMaximumRowAVX2 (const unsigned char *const *rows, unsigned char *scratch,
+                     unsigned char *dst, int width)
+{
+    MaximumRow < UCharAVX2 > (rows, scratch, dst, width);
+}
+
+static void
+ShortMaximumRowAVX2 (const short *const *rows, short *scratch, short *dst, int width)
+{
+    MaximumRow < ShortAVX2 > (rows, scratch, dst, width);
+}
+
+static void
+UShortMaximumRowAVX2 (const unsigned short *const *rows, unsigned short *scratch,
+                      unsigned short *dst, int width)
+{
+    MaximumRow < UShortAVX2 > (rows, scratch, dst, width);
+}
+
+static void
+FloatMaximumRowAVX2 (const float *const *rows, float *scratch, float *dst, int width)
+{
+    MaximumRow < FloatAVX2 > (rows, scratch, dst, width);
+}
+
+static const FIA_VectorFunctions avx2_functions = {
+    FloatConvolveRowAVX2,
+    ShortConvolveRowAVX2,
+    UShortConvolveRowAVX2,
+    UCharMedianRowAVX2,
+    ShortMedianRowAVX2,
+    UShortMedianRowAVX2,
+    FloatMedianRowAVX2,
+    UCharMaximumRowAVX2,
+    ShortMaximumRowAVX2,
+    UShortMaximumRowAVX2,
+    FloatMaximumRowAVX2
+};
+
+const FIA_VectorFunctions *
+FIA_GetAVX2VectorFunctions (void)
+{
+    return &avx2_functions;
+}
+
+#else
+
+const FIA_VectorFunctions *
+FIA_GetAVX2VectorFunctions (void)
+{
+    return NULL;
+}
+
+#endif
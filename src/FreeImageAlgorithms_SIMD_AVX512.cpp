@@ -0,0 +1,364 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "FreeImageAlgorithms_SIMD.h"
+#include "FreeImageAlgorithms_MedianNetwork.txx"
+
+// Built with -mavx512f (or /arch:AVX512), only called when cpuid says so.
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+
+static void
+FloatConvolveRowAVX512 (const float *src, int src_pitch, const float *kernel,
+                        int kernel_width, int kernel_height, float *dst, int width)
+{
+    int x = 0;
+
+    for(; x + 64 <= width; x += 64)
+    {
+        __m512 sum0 = _mm512_setzero_ps ();
+        __m512 sum1 = _mm512_setzero_ps ();
+        __m512 sum2 = _mm512_setzero_ps ();
+        __m512 sum3 = _mm512_setzero_ps ();
+
+        const float *src_row = src + x;
+        const float *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+            {
+                __m512 k = _mm512_set1_ps (kernel_row[col]);
+                const float *ptr = src_row + col;
+
+                sum0 = _mm512_fmadd_ps (k, _mm512_loadu_ps (ptr), sum0);
+                sum1 = _mm512_fmadd_ps (k, _mm512_loadu_ps (ptr + 16), sum1);
+                sum2 = _mm512_fmadd_ps (k, _mm512_loadu_ps (ptr + 32), sum2);
+                sum3 = _mm512_fmadd_ps (k, _mm512_loadu_ps (ptr + 48), sum3);
+            }
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm512_storeu_ps (dst + x, sum0);
+        _mm512_storeu_ps (dst + x + 16, sum1);
+        _mm512_storeu_ps (dst + x + 32, sum2);
+        _mm512_storeu_ps (dst + x + 48, sum3);
+    }
+
+    // The last few pixels use a mask so nothing past the row is read.
+    for(; x < width; x += 16)
+    {
+        int remaining = width - x;
+        __mmask16 mask = (remaining >= 16) ? (__mmask16) 0xFFFF : (__mmask16) ((1 << remaining) - 1);
+        __m512 sum = _mm512_setzero_ps ();
+
+        const float *src_row = src + x;
+        const float *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+                sum = _mm512_fmadd_ps (_mm512_set1_ps (kernel_row[col]),
+                                       _mm512_maskz_loadu_ps (mask, src_row + col), sum);
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm512_mask_storeu_ps (dst + x, mask, sum);
+    }
+}
+
+// Widens 16 pixels to 32 bit integers.
+static inline __m512i
+Widen (const short *ptr)
+{
+    return _mm512_cvtepi16_epi32 (_mm256_loadu_si256 ((const __m256i *) ptr));
+}
+
+static inline __m512i
+Widen (const unsigned short *ptr)
+{
+    return _mm512_cvtepu16_epi32 (_mm256_loadu_si256 ((const __m256i *) ptr));
+}
+
+template < typename Tsrc > static void
+IntegerConvolveRowAVX512 (const Tsrc * src, int src_pitch, const int *kernel,
+                          int kernel_width, int kernel_height, int *dst, int width)
+{
+    int x = 0;
+
+    for(; x + 32 <= width; x += 32)
+    {
+        __m512i sum0 = _mm512_setzero_si512 ();
+        __m512i sum1 = _mm512_setzero_si512 ();
+
+        const Tsrc *src_row = src + x;
+        const int *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+            {
+                __m512i k = _mm512_set1_epi32 (kernel_row[col]);
+                const Tsrc *ptr = src_row + col;
+
+                sum0 = _mm512_add_epi32 (sum0, _mm512_mullo_epi32 (k, Widen (ptr)));
+                sum1 = _mm512_add_epi32 (sum1, _mm512_mullo_epi32 (k, Widen (ptr + 16)));
+            }
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm512_storeu_si512 ((void *) (dst + x), sum0);
+        _mm512_storeu_si512 ((void *) (dst + x + 16), sum1);
+    }
+
+    for(; x < width; x++)
+    {
+        int sum = 0;
+
+        const Tsrc *src_row = src + x;
+        const int *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+                sum += kernel_row[col] * src_row[col];
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        dst[x] = sum;
+    }
+}
+
+static void
+ShortConvolveRowAVX512 (const short *src, int src_pitch, const int *kernel,
+                        int kernel_width, int kernel_height, int *dst, int width)
+{
+    IntegerConvolveRowAVX512 (src, src_pitch, kernel, kernel_width, kernel_height, dst, width);
+}
+
+static void
+UShortConvolveRowAVX512 (const unsigned short *src, int src_pitch, const int *kernel,
+                         int kernel_width, int kernel_height, int *dst, int width)
+{
+    IntegerConvolveRowAVX512 (src, src_pitch, kernel, kernel_width, kernel_height, dst, width);
+}
+
+// AVX-512F has no 8 or 16 bit min and max, those use the AVX2 forms
+// which every AVX-512 processor has.
+struct UCharAVX512
+{
+    typedef unsigned char Type;
+    typedef __m256i Vector;
+
+    enum { Width = 32 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm256_loadu_si256 ((const __m256i *) ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm256_storeu_si256 ((__m256i *) ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm256_min_epu8 (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm256_max_epu8 (a, b);
+    }
+};
+
+struct ShortAVX512
+{
+    typedef short Type;
+    typedef __m256i Vector;
+
+    enum { Width = 16 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm256_loadu_si256 ((const __m256i *) ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm256_storeu_si256 ((__m256i *) ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm256_min_epi16 (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm256_max_epi16 (a, b);
+    }
+};
+
+struct UShortAVX512
+{
+    typedef unsigned short Type;
+    typedef __m256i Vector;
+
+    enum { Width = 16 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm256_loadu_si256 ((const __m256i *) ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm256_storeu_si256 ((__m256i *) ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm256_min_epu16 (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm256_max_epu16 (a, b);
+    }
+};
+
+struct FloatAVX512
+{
+    typedef float Type;
+    typedef __m512 Vector;
+
+    enum { Width = 16 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm512_loadu_ps (ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm512_storeu_ps (ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm512_min_ps (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm512_max_ps (a, b);
+    }
+};
+
+static void
+UCharMedianRowAVX512 (const unsigned char *const *rows, int radius,
+                      unsigned char *scratch, unsigned char *dst, int width)
+{
+    MedianNetworkRow < UCharAVX512 > (rows, radius, scratch, dst, width);
+}
+
+static void
+ShortMedianRowAVX512 (const short *const *rows, int radius, short *scratch, short *dst, int width)
+{
+    MedianNetworkRow < ShortAVX512 > (rows, radius, scratch, dst, width);
+}
+
+static void
+UShortMedianRowAVX512 (const unsigned short *const *rows, int radius,
+                       unsigned short *scratch, unsigned short *dst, int width)
+{
+    MedianNetworkRow < UShortAVX512 > (rows, radius, scratch, dst, width);
+}
+
+static void
+FloatMedianRowAVX512 (const float *const *rows, int radius, float *scratch, float *dst, int width)
+{
+    MedianNetworkRow < FloatAVX512 > (rows, radius, scratch, dst, width);
+}
+
+static void
+UCharMaximumRowAVX512 (const unsigned char *const *rows, unsigned char *scratch,
+                       unsigned char *dst, int width)
+{
+    MaximumRow < UCharAVX512 > (rows, scratch, dst, width);
+}
+
+static void
+ShortMaximumRowAVX512 (const short *const *rows, short *scratch, short *dst, int width)
+{
+    MaximumRow < ShortAVX512 > (rows, scratch, dst, width);
+}
+
+static void
+UShortMaximumRowAVX512 (const unsigned short *const *rows, unsigned short *scratch,
+                        unsigned short *dst, int width)
+{
+    MaximumRow < UShortAVX512 > (rows, scratch, dst, width);
+}
+
+static void
+FloatMaximumRowAVX512 (const float *const *rows, float *scratch, float *dst, int width)
+{
+    MaximumRow < FloatAVX512 > (rows, scratch, dst, width);
+}
+
+static const FIA_VectorFunctions avx512_functions = {
+    FloatConvolveRowAVX512,
+    ShortConvolveRowAVX512,
+    UShortConvolveRowAVX512,
+    UCharMedianRowAVX512,
+    ShortMedianRowAVX512,
+    UShortMedianRowAVX512,
+    FloatMedianRowAVX512,
+    UCharMaximumRowAVX512,
+    ShortMaximumRowAVX512,
+    UShortMaximumRowAVX512,
+    FloatMaximumRowAVX512
+};
+
+const FIA_VectorFunctions *
+FIA_GetAVX512VectorFunctions (void)
+{
+    return &avx512_functions;
+}
+
+#else
+
+const FIA_VectorFunctions *
+FIA_GetAVX512VectorFunctions (void)
+{
+    return NULL;
+}
+
+#endif
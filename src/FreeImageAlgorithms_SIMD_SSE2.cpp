@@ -0,0 +1,407 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "FreeImageAlgorithms_SIMD.h"
+#include "FreeImageAlgorithms_MedianNetwork.txx"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+// Four vectors (16 pixels) are summed at once so each kernel value is loaded
+// once per 16 output pixels.
+static void
+FloatConvolveRowSSE2 (const float *src, int src_pitch, const float *kernel,
+                      int kernel_width, int kernel_height, float *dst, int width)
+{
+    int x = 0;
+
+    for(; x + 16 <= width; x += 16)
+    {
+        __m128 sum0 = _mm_setzero_ps ();
+        __m128 sum1 = _mm_setzero_ps ();
+        __m128 sum2 = _mm_setzero_ps ();
+        __m128 sum3 = _mm_setzero_ps ();
+
+        const float *src_row = src + x;
+        const float *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+            {
+                __m128 k = _mm_set1_ps (kernel_row[col]);
+                const float *ptr = src_row + col;
+
+                sum0 = _mm_add_ps (sum0, _mm_mul_ps (k, _mm_loadu_ps (ptr)));
+                sum1 = _mm_add_ps (sum1, _mm_mul_ps (k, _mm_loadu_ps (ptr + 4)));
+                sum2 = _mm_add_ps (sum2, _mm_mul_ps (k, _mm_loadu_ps (ptr + 8)));
+                sum3 = _mm_add_ps (sum3, _mm_mul_ps (k, _mm_loadu_ps (ptr + 12)));
+            }
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm_storeu_ps (dst + x, sum0);
+        _mm_storeu_ps (dst + x + 4, sum1);
+        _mm_storeu_ps (dst + x + 8, sum2);
+        _mm_storeu_ps (dst + x + 12, sum3);
+    }
+
+    for(; x + 4 <= width; x += 4)
+    {
+        __m128 sum = _mm_setzero_ps ();
+
+        const float *src_row = src + x;
+        const float *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+                sum = _mm_add_ps (sum, _mm_mul_ps (_mm_set1_ps (kernel_row[col]),
+                                                   _mm_loadu_ps (src_row + col)));
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm_storeu_ps (dst + x, sum);
+    }
+
+    for(; x < width; x++)
+    {
+        float sum = 0.0f;
+
+        const float *src_row = src + x;
+        const float *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+                sum += kernel_row[col] * src_row[col];
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        dst[x] = sum;
+    }
+}
+
+// SSE2 has no 32 bit multiply, the low halves of two 32x32->64 bit
+// multiplies give the same bits for signed and unsigned values.
+static inline __m128i
+MultiplyLow32 (__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32 (a, b);
+    __m128i odd = _mm_mul_epu32 (_mm_srli_si128 (a, 4), _mm_srli_si128 (b, 4));
+
+    return _mm_unpacklo_epi32 (_mm_shuffle_epi32 (even, _MM_SHUFFLE (0, 0, 2, 0)),
+                               _mm_shuffle_epi32 (odd, _MM_SHUFFLE (0, 0, 2, 0)));
+}
+
+// Widens 8 pixels to two vectors of 32 bit integers.
+static inline void
+Widen (const short *ptr, __m128i *low, __m128i *high)
+{
+    __m128i v = _mm_loadu_si128 ((const __m128i *) ptr);
+
+    *low = _mm_srai_epi32 (_mm_unpacklo_epi16 (v, v), 16);
+    *high = _mm_srai_epi32 (_mm_unpackhi_epi16 (v, v), 16);
+}
+
+static inline void
+Widen (const unsigned short *ptr, __m128i *low, __m128i *high)
+{
+    __m128i v = _mm_loadu_si128 ((const __m128i *) ptr);
+
+    *low = _mm_unpacklo_epi16 (v, _mm_setzero_si128 ());
+    *high = _mm_unpackhi_epi16 (v, _mm_setzero_si128 ());
+}
+
+template < typename Tsrc > static void
+IntegerConvolveRowSSE2 (const Tsrc * src, int src_pitch, const int *kernel,
+                        int kernel_width, int kernel_height, int *dst, int width)
+{
+    __m128i low, high;
+    int x = 0;
+
+    for(; x + 16 <= width; x += 16)
+    {
+        __m128i sum0 = _mm_setzero_si128 ();
+        __m128i sum1 = _mm_setzero_si128 ();
+        __m128i sum2 = _mm_setzero_si128 ();
+        __m128i sum3 = _mm_setzero_si128 ();
+
+        const Tsrc *src_row = src + x;
+        const int *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+            {
+                __m128i k = _mm_set1_epi32 (kernel_row[col]);
+
+                Widen (src_row + col, &low, &high);
+                sum0 = _mm_add_epi32 (sum0, MultiplyLow32 (k, low));
+                sum1 = _mm_add_epi32 (sum1, MultiplyLow32 (k, high));
+
+                Widen (src_row + col + 8, &low, &high);
+                sum2 = _mm_add_epi32 (sum2, MultiplyLow32 (k, low));
+                sum3 = _mm_add_epi32 (sum3, MultiplyLow32 (k, high));
+            }
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        _mm_storeu_si128 ((__m128i *) (dst + x), sum0);
+        _mm_storeu_si128 ((__m128i *) (dst + x + 4), sum1);
+        _mm_storeu_si128 ((__m128i *) (dst + x + 8), sum2);
+        _mm_storeu_si128 ((__m128i *) (dst + x + 12), sum3);
+    }
+
+    for(; x < width; x++)
+    {
+        int sum = 0;
+
+        const Tsrc *src_row = src + x;
+        const int *kernel_row = kernel;
+
+        for(int row = 0; row < kernel_height; row++)
+        {
+            for(int col = 0; col < kernel_width; col++)
+                sum += kernel_row[col] * src_row[col];
+
+            src_row += src_pitch;
+            kernel_row += kernel_width;
+        }
+
+        dst[x] = sum;
+    }
+}
+
+static void
+ShortConvolveRowSSE2 (const short *src, int src_pitch, const int *kernel,
+                      int kernel_width, int kernel_height, int *dst, int width)
+{
+    IntegerConvolveRowSSE2 (src, src_pitch, kernel, kernel_width, kernel_height, dst, width);
+}
+
+static void
+UShortConvolveRowSSE2 (const unsigned short *src, int src_pitch, const int *kernel,
+                       int kernel_width, int kernel_height, int *dst, int width)
+{
+    IntegerConvolveRowSSE2 (src, src_pitch, kernel, kernel_width, kernel_height, dst, width);
+}
+
+struct UCharSSE2
+{
+    typedef unsigned char Type;
+    typedef __m128i Vector;
+
+    enum { Width = 16 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm_loadu_si128 ((const __m128i *) ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm_storeu_si128 ((__m128i *) ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm_min_epu8 (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm_max_epu8 (a, b);
+    }
+};
+
+struct ShortSSE2
+{
+    typedef short Type;
+    typedef __m128i Vector;
+
+    enum { Width = 8 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm_loadu_si128 ((const __m128i *) ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm_storeu_si128 ((__m128i *) ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm_min_epi16 (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm_max_epi16 (a, b);
+    }
+};
+
+// SSE2 has no unsigned 16 bit min and max, a saturating subtract gives them.
+struct UShortSSE2
+{
+    typedef unsigned short Type;
+    typedef __m128i Vector;
+
+    enum { Width = 8 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm_loadu_si128 ((const __m128i *) ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm_storeu_si128 ((__m128i *) ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm_sub_epi16 (a, _mm_subs_epu16 (a, b));
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm_add_epi16 (b, _mm_subs_epu16 (a, b));
+    }
+};
+
+struct FloatSSE2
+{
+    typedef float Type;
+    typedef __m128 Vector;
+
+    enum { Width = 4 };
+
+    static inline Vector Load (const Type * ptr)
+    {
+        return _mm_loadu_ps (ptr);
+    }
+
+    static inline void Store (Type * ptr, Vector v)
+    {
+        _mm_storeu_ps (ptr, v);
+    }
+
+    static inline Vector Min (Vector a, Vector b)
+    {
+        return _mm_min_ps (a, b);
+    }
+
+    static inline Vector Max (Vector a, Vector b)
+    {
+        return _mm_max_ps (a, b);
+    }
+};
+
+static void
+UCharMedianRowSSE2 (const unsigned char *const *rows, int radius,
+                    unsigned char *scratch, unsigned char *dst, int width)
+{
+    MedianNetworkRow < UCharSSE2 > (rows, radius, scratch, dst, width);
+}
+
+static void
+ShortMedianRowSSE2 (const short *const *rows, int radius, short *scratch, short *dst, int width)
+{
+    MedianNetworkRow < ShortSSE2 > (rows, radius, scratch, dst, width);
+}
+
+static void
+UShortMedianRowSSE2 (const unsigned short *const *rows, int radius,
+                     unsigned short *scratch, unsigned short *dst, int width)
+{
+    MedianNetworkRow < UShortSSE2 > (rows, radius, scratch, dst, width);
+}
+
+static void
+FloatMedianRowSSE2 (const float *const *rows, int radius, float *scratch, float *dst, int width)
+{
+    MedianNetworkRow < FloatSSE2 > (rows, radius, scratch, dst, width);
+}
+
+static void
+UCharMaximumRowSSE2 (const unsigned char *const *rows, unsigned char *scratch,
+                     unsigned char *dst, int width)
+{
+    MaximumRow < UCharSSE2 > (rows, scratch, dst, width);
+}
+
+static void
+ShortMaximumRowSSE2 (const short *const *rows, short *scratch, short *dst, int width)
+{
+    MaximumRow < ShortSSE2 > (rows, scratch, dst, width);
+}
+
+static void
+UShortMaximumRowSSE2 (const unsigned short *const *rows, unsigned short *scratch,
+                      unsigned short *dst, int width)
+{
+    MaximumRow < UShortSSE2 > (rows, scratch, dst, width);
+}
+
+static void
+FloatMaximumRowSSE2 (const float *const *rows, float *scratch, float *dst, int width)
+{
+    MaximumRow < FloatSSE2 > (rows, scratch, dst, width);
+}
+
+static const FIA_VectorFunctions sse2_functions = {
+    FloatConvolveRowSSE2,
+    ShortConvolveRowSSE2,
+    UShortConvolveRowSSE2,
+    UCharMedianRowSSE2,
+    ShortMedianRowSSE2,
+    UShortMedianRowSSE2,
+    FloatMedianRowSSE2,
+    UCharMaximumRowSSE2,
+    ShortMaximumRowSSE2,
+    UShortMaximumRowSSE2,
+    FloatMaximumRowSSE2
+};
+
+const FIA_VectorFunctions *
+FIA_GetSSE2VectorFunctions (void)
+{
+    return &sse2_functions;
+}
+
+#else
+
+const FIA_VectorFunctions *
+FIA_GetSSE2VectorFunctions (void)
+{
+    return NULL;
+}
+
+#endif
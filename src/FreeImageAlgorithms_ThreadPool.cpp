@@ -0,0 +1,262 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "FreeImageAlgorithms.h"
+#include "FreeImageAlgorithms_Utilities.h"
+#include "FreeImageAlgorithms_ThreadPool.h"
+
+#ifdef WIN32
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define FIA_MAX_THREADS 256
+
+// The pool runs one set of bands at a time. The calling thread works on the
+// bands as well so a pool for n threads only starts n - 1 workers.
+// Workers are started the first time they are needed and then wait for work
+// until the process exits.
+typedef struct
+{
+    FIA_MUTEX lock;
+    FIA_CONDITION work_ready;
+    FIA_CONDITION work_done;
+
+    int busy;
+    int number_of_workers;
+
+    FIA_BandFunction function;
+    void *data;
+    int start;
+    int end;
+    int number_of_bands;
+    int next_band;
+    int bands_done;
+
+} FIA_ThreadPool;
+
+static FIA_ThreadPool pool = { FIA_MUTEX_INITIALISER, FIA_CONDITION_INITIALISER,
+    FIA_CONDITION_INITIALISER, 0, 0, NULL, NULL, 0, 0, 0, 0, 0 };
+
+// 0 means use one thread for each processor.
+static int requested_number_of_threads = 0;
+
+static int
+GetNumberOfProcessors(void)
+{
+    int count = 1;
+
+    #ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    count = (int) info.dwNumberOfProcessors;
+    #else
+    count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    #endif
+
+    if (count < 1)
+        count = 1;
+
+    if (count > FIA_MAX_THREADS)
+        count = FIA_MAX_THREADS;
+
+    return count;
+}
+
+void DLL_CALLCONV
+FIA_SetNumberOfThreads(int number_of_threads)
+{
+    if (number_of_threads > FIA_MAX_THREADS)
+        number_of_threads = FIA_MAX_THREADS;
+
+    if (number_of_threads < 0)
+        number_of_threads = 0;
+
+    requested_number_of_threads = number_of_threads;
+}
+
+int DLL_CALLCONV
+FIA_GetNumberOfThreads(void)
+{
+    if (requested_number_of_threads > 0)
+        return requested_number_of_threads;
+
+    return GetNumberOfProcessors();
+}
+
+// Splits the range into number_of_bands pieces that differ in size by at most one.
+static inline void
+GetBandRange(int start, int end, int number_of_bands, int band, int *band_start, int *band_end)
+{
+    int count = end - start;
+    int size = count / number_of_bands;
+    int remainder = count % number_of_bands;
+
+    *band_start = start + band * size + (band < remainder ? band : remainder);
+    *band_end = *band_start + size + (band < remainder ? 1 : 0);
+}
+
+// Takes bands from the current job until there are none left.
+// Must be called with the pool locked and returns with it locked.
+static void
+RunAvailableBands(void)
+{
+    int band, band_start, band_end;
+
+    while (pool.next_band < pool.number_of_bands)
+    {
+        band = pool.next_band++;
+
+        GetBandRange(pool.start, pool.end, pool.number_of_bands, band, &band_start, &band_end);
+
+        FIA_MutexUnlock(&pool.lock);
+
+        pool.function(pool.data, band, band_start, band_end);
+
+        FIA_MutexLock(&pool.lock);
+
+        if (++pool.bands_done == pool.number_of_bands)
+            FIA_ConditionSignal(&pool.work_done);
+    }
+}
+
+#ifdef WIN32
+static unsigned __stdcall
+WorkerThread(void *arg)
+#else
+static void *
+WorkerThread(void *arg)
+#endif
+{
+    FIA_MutexLock(&pool.lock);
+
+    for(;;)
+    {
+        while (pool.next_band >= pool.number_of_bands)
+            FIA_ConditionWait(&pool.work_ready, &pool.lock);
+
+        RunAvailableBands();
+    }
+
+    FIA_MutexUnlock(&pool.lock);
+
+    return 0;
+}
+
+// Starts workers until there are number_of_workers of them.
+// Must be called with the pool locked.
+static void
+StartWorkers(int number_of_workers)
+{
+    while (pool.number_of_workers < number_of_workers)
+    {
+        #ifdef WIN32
+        HANDLE thread = (HANDLE) _beginthreadex(NULL, 0, WorkerThread, NULL, 0, NULL);
+
+        if (thread == 0)
+            return;
+
+        CloseHandle(thread);
+        #else
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL, WorkerThread, NULL) != 0)
+            return;
+
+        pthread_detach(thread);
+        #endif
+
+        pool.number_of_workers++;
+    }
+}
+
+int
+FIA_GetNumberOfBands(int count, int min_band_size)
+{
+    int number_of_bands = FIA_GetNumberOfThreads();
+
+    if (min_band_size < 1)
+        min_band_size = 1;
+
+    if (count / min_band_size < number_of_bands)
+        number_of_bands = count / min_band_size;
+
+    if (number_of_bands < 1)
+        number_of_bands = 1;
+
+    return number_of_bands;
+}
+
+void
+FIA_RunBands(int start, int end, int number_of_bands, FIA_BandFunction function, void *data)
+{
+    int band, band_start, band_end;
+
+    if (end <= start)
+        return;
+
+    if (number_of_bands > end - start)
+        number_of_bands = end - start;
+
+    if (number_of_bands > 1)
+    {
+        FIA_MutexLock(&pool.lock);
+
+        if (!pool.busy)
+        {
+            pool.busy = 1;
+
+            StartWorkers(number_of_bands - 1);
+
+            pool.function = function;
+            pool.data = data;
+            pool.start = start;
+            pool.end = end;
+            pool.bands_done = 0;
+            pool.next_band = 0;
+            pool.number_of_bands = number_of_bands;
+
+            FIA_ConditionBroadcast(&pool.work_ready);
+
+            RunAvailableBands();
+
+            while (pool.bands_done < pool.number_of_bands)
+                FIA_ConditionWait(&pool.work_done, &pool.lock);
+
+            pool.busy = 0;
+
+            FIA_MutexUnlock(&pool.lock);
+
+            return;
+        }
+
+        FIA_MutexUnlock(&pool.lock);
+    }
+
+    // Serial path, also used for nested calls from inside a band.
+    if (number_of_bands < 1)
+        number_of_bands = 1;
+
+    for(band = 0; band < number_of_bands; band++)
+    {
+        GetBandRange(start, end, number_of_bands, band, &band_start, &band_end);
+        function(data, band, band_start, band_end);
+    }
+}
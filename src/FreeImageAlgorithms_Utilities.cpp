@@ -65,62 +65,6 @@ static TemplateImageFunctionClass < double > DoubleImage;
 
 #include <xmmintrin.h>
 
-/***
- * int _os_support(int feature)
- *   - Checks if OS Supports the capablity or not
- *
- * Entry:
- *   feature: the feature we want to check if OS supports it.
- *
- * Exit:
- *   Returns 1 if OS support exist and 0 when OS doesn't support it.
- *
- ****************************************************************/
-
-int DLL_CALLCONV
-_os_support (int feature)
-{
-    __try
-    {
-        switch (feature)
-        {
-            case _CPU_FEATURE_SSE:
-                __asm
-            {
-                xorps xmm0, xmm0        // executing SSE instruction
-            }
-                break;
-            case _CPU_FEATURE_SSE2:
-                __asm
-            {
-                xorpd xmm0, xmm0        // executing SSE2 instruction
-            }
-                break;
-            case _CPU_FEATURE_3DNOW:
-                __asm
-            {
-                pfrcp mm0, mm0  // executing 3DNow! instruction
-              emms}
-                break;
-            case _CPU_FEATURE_MMX:
-                __asm
-            {
-                pxor mm0, mm0   // executing MMX instruction
-              emms}
-                break;
-        }
-    }
-    __except (EXCEPTION_EXECUTE_HANDLER)
-    {
-        if (_exception_code () == STATUS_ILLEGAL_INSTRUCTION)
-        {
-            return 0;
-        }
-        return 0;
-    }
-    return 1;
-}
-
 void DLL_CALLCONV
 FIA_SSEFindFloatMinMax (const float *data, long n, float *min, float *max)
 {
@@ -0,0 +1,390 @@
+/*
+ * Copyright 2007-2010 Glenn Pierce, Paul Barber,
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "FreeImageAlgorithms.h"
+#include "FreeImageAlgorithms_Utils.h"
+#include "FreeImageAlgorithms_Morphology.h"
+#include "FreeImageAlgorithms_Particle.h"
+#include "FreeImageAlgorithms_Utilities.h"
+
+#include <float.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+// Marker controlled watershed by flooding. The markers are put in a
+// hierarchical queue, one first in first out queue for each grey level,
+// and the lowest queue is always emptied first. A pixel taken from the
+// queue passes its label to its unlabelled neighbours, which join the
+// queue at their own level or at the current one if that is higher.
+//
+// The queues are kept as linked lists through one array with an entry per
+// pixel, as each pixel is queued once, so there is no allocation while
+// flooding. Integer images use their values as levels, the time is linear
+// in the number of pixels plus the range of values. Float images use the
+// rank of each value among the distinct values, which costs a sort.
+//
+// With watershed lines a pixel is only labelled when it leaves the queue,
+// a pixel that then has neighbours from two basins becomes a line and
+// does not pass anything on.
+
+#define WATERSHED_QUEUED    -1
+#define WATERSHED_LINE      -2
+#define WATERSHED_MASKED    -3
+
+struct HierarchicalQueue
+{
+    std::vector < int >head;
+    std::vector < int >tail;
+    std::vector < int >next;
+    int level;
+
+    HierarchicalQueue (int levels, int pixels)
+        : head (levels, -1), tail (levels, -1), next (pixels, -1), level (0)
+    {
+    }
+
+    // Levels below the one being emptied go to the end of it.
+    inline void Push (int pixel, int pixel_level)
+    {
+        if (pixel_level < level)
+            pixel_level = level;
+
+        next[pixel] = -1;
+
+        if (tail[pixel_level] < 0)
+            head[pixel_level] = pixel;
+        else
+            next[tail[pixel_level]] = pixel;
+
+        tail[pixel_level] = pixel;
+    }
+
+    // Returns -1 once every queue is empty.
+    inline int Pop ()
+    {
+        const int levels = (int) head.size ();
+
+        while (level < levels && head[level] < 0)
+            level++;
+
+        if (level == levels)
+            return -1;
+
+        int pixel = head[level];
+
+        head[level] = next[pixel];
+
+        if (head[level] < 0)
+            tail[level] = -1;
+
+        return pixel;
+    }
+};
+
+template < typename Tlevel > static void
+Flood (const std::vector < Tlevel > &levels, int number_of_levels, int *labels,
+       int width, int height, int connectivity, int watershed_lines)
+{
+    static const int offsets[8][2] = {
+        {-1, 0}, {1, 0}, {0, -1}, {0, 1}, {-1, -1}, {1, -1}, {-1, 1}, {1, 1}
+    };
+
+    const int count = (connectivity == 8) ? 8 : 4;
+    const int pixels = width * height;
+
+    HierarchicalQueue queue (number_of_levels, pixels);
+
+    for(int p = 0; p < pixels; p++)
+    {
+        if (labels[p] > 0)
+            queue.Push (p, levels[p]);
+    }
+
+    int p;
+
+    while ((p = queue.Pop ()) >= 0)
+    {
+        const int px = p % width;
+        const int py = p / width;
+        const bool interior = (px > 0 && py > 0 && px < width - 1 && py < height - 1);
+
+        if (labels[p] == WATERSHED_QUEUED)
+        {
+            int label = 0;
+
+            for(int n = 0; n < count; n++)
+            {
+                const int nx = px + offsets[n][0];
+                const int ny = py + offsets[n][1];
+
+                if (!interior && (nx < 0 || ny < 0 || nx >= width || ny >= height))
+                    continue;
+
+                const int neighbour = labels[ny * width + nx];
+
+                if (neighbour <= 0)
+                    continue;
+
+                if (label == 0)
+                    label = neighbour;
+                else if (neighbour != label)
+                {
+                    label = WATERSHED_LINE;
+                    break;
+                }
+            }
+
+            labels[p] = label;
+
+            if (label == WATERSHED_LINE)
+                continue;
+        }
+
+        const int spread = watershed_lines ? WATERSHED_QUEUED : labels[p];
+
+        for(int n = 0; n < count; n++)
+        {
+            const int nx = px + offsets[n][0];
+            const int ny = py + offsets[n][1];
+
+            if (!interior && (nx < 0 || ny < 0 || nx >= width || ny >= height))
+                continue;
+
+            const int q = ny * width + nx;
+
+            if (labels[q] == 0)
+            {
+                labels[q] = spread;
+                queue.Push (q, levels[q]);
+            }
+        }
+    }
+}
+
+// Levels of an integer image, its values less the lowest one.
+template < typename T > static int
+IntegerLevels (FIBITMAP * src, std::vector < unsigned short >&levels)
+{
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+
+    double min, max;
+
+    FIA_FindMinMax (src, &min, &max);
+
+    const T lowest = (T) min;
+
+    levels.resize ((size_t) width * height);
+
+    for(int y = 0; y < height; y++)
+    {
+        const T *ptr = (const T *) FreeImage_GetScanLine (src, y);
+        unsigned short *level = &levels[(size_t) y * width];
+
+        for(int x = 0; x < width; x++)
+            level[x] = (unsigned short) (ptr[x] - lowest);
+    }
+
+    return (int) (max - min) + 1;
+}
+
+// Levels of a float image, the rank of each value among the distinct values.
+// The values are sorted as integers which keep their order, with the
+// pixel index in the low half so one sort gives the ranks. NaN is put
+// with the largest float.
+static int
+RankLevels (FIBITMAP * src, std::vector < unsigned int >&levels)
+{
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+
+    std::vector < unsigned long long >keys ((size_t) width * height);
+
+    for(int y = 0; y < height; y++)
+    {
+        const float *ptr = (const float *) FreeImage_GetScanLine (src, y);
+        unsigned long long *key = &keys[(size_t) y * width];
+
+        for(int x = 0; x < width; x++)
+        {
+            float value = (ptr[x] == ptr[x]) ? ptr[x] : FLT_MAX;
+            unsigned int bits;
+
+            if (value == 0.0f)
+                value = 0.0f;           // -0 is the same level as 0.
+
+            memcpy (&bits, &value, sizeof (bits));
+
+            // Negative values reverse, positive ones go above them.
+            bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+
+            key[x] = ((unsigned long long) bits << 32) | (unsigned int) (y * width + x);
+        }
+    }
+
+    std::sort (keys.begin (), keys.end ());
+
+    levels.resize (keys.size ());
+
+    int rank = -1;
+    unsigned int previous = 0;
+
+    for(size_t i = 0; i < keys.size (); i++)
+    {
+        unsigned int bits = (unsigned int) (keys[i] >> 32);
+
+        if (rank < 0 || bits != previous)
+        {
+            rank++;
+            previous = bits;
+        }
+
+        levels[(unsigned int) keys[i]] = rank;
+    }
+
+    return rank + 1;
+}
+
+FIBITMAP *DLL_CALLCONV
+FIA_Watershed (FIBITMAP * src, FIBITMAP * markers, FIBITMAP * mask,
+               FIA_CONNECTIVITY connectivity, int watershed_lines)
+{
+    if (src == NULL || markers == NULL)
+        return NULL;
+
+    const int width = FreeImage_GetWidth (src);
+    const int height = FreeImage_GetHeight (src);
+
+    if ((int) FreeImage_GetWidth (markers) != width
+        || (int) FreeImage_GetHeight (markers) != height)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "The markers must be the same size as the image");
+        return NULL;
+    }
+
+    if (mask != NULL && (FreeImage_GetImageType (mask) != FIT_BITMAP || FreeImage_GetBPP (mask) != 8
+                         || (int) FreeImage_GetWidth (mask) != width
+                         || (int) FreeImage_GetHeight (mask) != height))
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "The mask must be an 8 bit image the same size as the image");
+        return NULL;
+    }
+
+    if (connectivity != FIA_CONNECTIVITY_4 && connectivity != FIA_CONNECTIVITY_8)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN, "Connectivity must be 4 or 8");
+        return NULL;
+    }
+
+    // Markers are labels already or an 8 bit image whose particles are labelled here.
+    FIBITMAP *dst;
+
+    if (FreeImage_GetImageType (markers) == FIT_INT32)
+        dst = FreeImage_Clone (markers);
+    else if (FreeImage_GetImageType (markers) == FIT_BITMAP && FreeImage_GetBPP (markers) == 8)
+        dst = FIA_LabelParticles (markers, 1, connectivity, NULL);
+    else
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "The markers must be a FIT_INT32 label image or an 8 bit image");
+        return NULL;
+    }
+
+    if (dst == NULL)
+        return NULL;
+
+    // The labels are flooded as one array without padding, which
+    // FIT_INT32 scanlines already are.
+    int *labels = (int *) FreeImage_GetBits (dst);
+
+    for(int y = 0; y < height; y++)
+    {
+        int *ptr = labels + y * width;
+        const BYTE *mask_ptr = (mask != NULL) ? FreeImage_GetScanLine (mask, y) : NULL;
+
+        for(int x = 0; x < width; x++)
+        {
+            if (mask_ptr != NULL && mask_ptr[x] == 0)
+                ptr[x] = WATERSHED_MASKED;
+            else if (ptr[x] < 0)
+                ptr[x] = 0;
+        }
+    }
+
+    FREE_IMAGE_TYPE type = FreeImage_GetImageType (src);
+    bool flooded = true;
+
+    if (type == FIT_FLOAT)
+    {
+        std::vector < unsigned int >levels;
+        int number_of_levels = RankLevels (src, levels);
+
+        Flood (levels, number_of_levels, labels, width, height, connectivity, watershed_lines);
+    }
+    else
+    {
+        std::vector < unsigned short >levels;
+        int number_of_levels = 0;
+
+        switch (type)
+        {
+            case FIT_BITMAP:
+                if (FreeImage_GetBPP (src) == 8)
+                    number_of_levels = IntegerLevels < unsigned char > (src, levels);
+                break;
+
+            case FIT_UINT16:
+                number_of_levels = IntegerLevels < unsigned short > (src, levels);
+                break;
+
+            case FIT_INT16:
+                number_of_levels = IntegerLevels < short > (src, levels);
+                break;
+
+            default:
+                break;
+        }
+
+        if (number_of_levels > 0)
+            Flood (levels, number_of_levels, labels, width, height, connectivity, watershed_lines);
+        else
+            flooded = false;
+    }
+
+    if (!flooded)
+    {
+        FreeImage_OutputMessageProc (FIF_UNKNOWN,
+                                     "FREE_IMAGE_TYPE: Unable to perform a watershed on type %d.",
+                                     type);
+        FreeImage_Unload (dst);
+        return NULL;
+    }
+
+    // Lines, masked pixels and anything no marker reached are 0.
+    const int pixels = width * height;
+
+    for(int p = 0; p < pixels; p++)
+    {
+        if (labels[p] < 0)
+            labels[p] = 0;
+    }
+
+    return dst;
+}